@@ -0,0 +1,120 @@
+/**
+ * @file admission_controller.h Definitions for AdmissionController class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef ADMISSION_CONTROLLER_H__
+#define ADMISSION_CONTROLLER_H__
+
+extern "C" {
+#include <pjsip.h>
+}
+
+#include <pthread.h>
+#include <vector>
+
+#include "sas.h"
+#include "load_monitor.h"
+#include "snmp_success_fail_count_table.h"
+
+/// @class AdmissionController
+///
+/// Decides whether to admit requests when the node is overloaded, taking
+/// into account what the request is for.
+///
+/// The LoadMonitor's token bucket controls the overall rate of requests.
+/// When it has no tokens left:
+///
+/// -  emergency and in-dialog requests are still admitted, unless the node
+///    is deeply overloaded (its latency is several times the target), as
+///    rejecting them leaves calls hanging and causes retransmissions;
+/// -  requests refreshing or removing existing registrations are admitted up
+///    to a share of the LoadMonitor's rate;
+/// -  initial registrations and new sessions are rejected.
+///
+/// Even when deeply overloaded, emergency and in-dialog requests are
+/// admitted up to a share of the LoadMonitor's rate.
+class AdmissionController
+{
+public:
+  /// The classes of request, in decreasing order of priority.
+  enum RequestClass
+  {
+    EMERGENCY = 0,
+    IN_DIALOG,
+    RE_REGISTER,
+    INITIAL_REGISTER,
+    NEW_SESSION,
+    NUM_REQUEST_CLASSES
+  };
+
+  /// Constructor.
+  ///
+  /// @param load_monitor       - The load monitor controlling the overall
+  ///                             request rate.
+  /// @param stats_tbls         - Statistics for each request class (indexed
+  ///                             by RequestClass), counting the requests
+  ///                             admitted and rejected.  May be empty.
+  AdmissionController(LoadMonitor* load_monitor,
+                      const std::vector<SNMP::SuccessFailCountTable*>& stats_tbls =
+                                     std::vector<SNMP::SuccessFailCountTable*>());
+
+  virtual ~AdmissionController();
+
+  /// Works out the class of a request.
+  ///
+  /// @param msg                - The request.
+  /// @param trusted            - Whether the request came from a trusted
+  ///                             source.  A To tag on a request from an
+  ///                             untrusted source (such as the P-CSCF's
+  ///                             untrusted port) is easily spoofed, so the
+  ///                             request is only treated as in-dialog if it
+  ///                             is also routed to this node.
+  static RequestClass classify(pjsip_msg* msg, bool trusted = true);
+
+  /// Decides whether to admit a request.
+  ///
+  /// @param request_class      - The class of the request.
+  /// @param trail              - SAS trail.
+  ///
+  /// @returns                  - true if the request should be processed.
+  bool admit_request(RequestClass request_class, SAS::TrailId trail);
+
+  /// The latency (as a multiple of the target latency) above which the node
+  /// is deeply overloaded.
+  static const int DEEP_OVERLOAD_FACTOR = 4;
+
+  /// The share of the LoadMonitor's rate for which each class of request is
+  /// admitted once the token bucket is empty (or for emergency and in-dialog
+  /// requests, once deeply overloaded), in percent.
+  static const int RESERVED_RATE_PERCENT[NUM_REQUEST_CLASSES];
+
+private:
+  /// Token bucket for the requests of one class admitted once the
+  /// LoadMonitor's bucket is empty.  The bucket holds up to a second's worth
+  /// of tokens.
+  struct ReservedBucket
+  {
+    double tokens;
+    unsigned long last_refill_ms;
+  };
+
+  bool deeply_overloaded();
+  bool take_reserved_token(RequestClass request_class);
+
+  static unsigned long now_ms();
+
+  LoadMonitor* _load_monitor;
+  std::vector<SNMP::SuccessFailCountTable*> _stats_tbls;
+
+  pthread_mutex_t _lock;
+  ReservedBucket _reserved[NUM_REQUEST_CLASSES];
+};
+
+#endif
@@ -21,6 +21,7 @@ extern "C" {
 #include <string>
 #include <list>
 #include <map>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include "constants.h"
@@ -51,6 +52,7 @@ static const char* const JSON_TO_URI = "to_uri";
 static const char* const JSON_TO_TAG = "to_tag";
 static const char* const JSON_ROUTES = "routes";
 static const char* const JSON_NOTIFY_CSEQ = "notify_cseq";
+static const char* const JSON_NOTIFY_VERSION = "notify_version";
 static const char* const JSON_SCSCF_URI = "scscf-uri";
 
 /// @class AoR
@@ -134,7 +136,7 @@ public:
   class Subscription
   {
   public:
-    Subscription(): _refreshed(false) {};
+    Subscription(): _refreshed(false), _notify_version(0) {};
 
     /// The Contact URI for the subscription dialog (used as the Request URI
     /// of the NOTIFY)
@@ -166,6 +168,12 @@ public:
     /// should expire.
     int _expires;
 
+    /// The version to put in the next reginfo document sent on this
+    /// subscription.  RFC 3680 requires this to start at 0 and go up by one
+    /// with each NOTIFY, so that the subscriber can tell if it has missed a
+    /// partial state update.
+    int _notify_version;
+
     /// Serialize the subscription as a JSON object.
     ///
     /// @param writer - a rapidjson writer to write to.
@@ -189,6 +197,13 @@ public:
   /// Make sure copy is deep!
   AoR(const AoR& other);
 
+  /// Make a copy-on-write copy of this AoR.  The copy shares this AoR's
+  /// bindings and subscriptions until they are retrieved for modification
+  /// through get_binding or get_subscription, and records which bindings and
+  /// subscriptions it has created, modified or removed.  This AoR must not
+  /// remove any bindings or subscriptions, and must outlive the copy.
+  AoR* copy_on_write() const;
+
   // Make sure assignment is deep!
   AoR& operator= (AoR const& other);
 
@@ -200,6 +215,7 @@ public:
 
   /// Retrieve a binding by Binding ID, creating an empty one if necessary.
   /// The created binding is completely empty, even the Contact URI field.
+  /// This must be used to retrieve any binding that is to be modified.
   Binding* get_binding(const std::string& binding_id);
 
   /// Removes any binding that had the given ID.  If there is no such binding,
@@ -207,6 +223,7 @@ public:
   void remove_binding(const std::string& binding_id);
 
   /// Retrieve a subscription by To tag, creating an empty one if necessary.
+  /// This must be used to retrieve any subscription that is to be modified.
   Subscription* get_subscription(const std::string& to_tag);
 
   /// Remove a subscription for the specified To tag.  If there is no
@@ -223,10 +240,12 @@ public:
   /// To tag -> Subscription.
   typedef std::map<std::string, Subscription*> Subscriptions;
 
-  /// Retrieve all the bindings.
+  /// Retrieve all the bindings.  These may be shared with another AoR, so
+  /// must not be modified - use get_binding instead.
   inline const Bindings& bindings() const { return _bindings; }
 
-  /// Retrieve all the subscriptions.
+  /// Retrieve all the subscriptions.  These may be shared with another AoR,
+  /// so must not be modified - use get_subscription instead.
   inline const Subscriptions& subscriptions() const { return _subscriptions; }
 
   // Return the number of bindings in the AoR.
@@ -280,9 +299,37 @@ public:
   // SIP URI for this AoR
   std::string _uri;
 
+private:
+  /// The AoR this AoR was copied from by copy_on_write, or NULL if this AoR
+  /// owns all its bindings and subscriptions.
+  const AoR* _cow_base;
+
+  /// IDs of the bindings and subscriptions that have been created, retrieved
+  /// for modification or removed since this AoR was copied from _cow_base.
+  /// Only maintained when _cow_base is set.
+  std::set<std::string> _touched_binding_ids;
+  std::set<std::string> _touched_subscription_ids;
+
+  /// Whether the specified binding or subscription is still shared with (and
+  /// so owned by) _cow_base.
+  bool is_shared(const Bindings::const_iterator& i) const;
+  bool is_shared(const Subscriptions::const_iterator& i) const;
+
+  /// Remove a binding or subscription, recording the change and deleting the
+  /// object if it is owned by this AoR.
+  ///
+  /// @returns    An iterator to the next member.
+  Bindings::iterator erase_binding(Bindings::iterator i);
+  Subscriptions::iterator erase_subscription(Subscriptions::iterator i);
+
+  /// Delete all the bindings and subscriptions owned by this AoR and empty
+  /// the maps, without recording any changes.
+  void delete_members();
+
   /// Store code is allowed to manipulate bindings and subscriptions directly.
   friend class AoRStore;
   friend class SubscriberDataManager;
+  friend class AoRPair;
 };
 
 /// @class AoRPair
@@ -300,8 +347,10 @@ public:
 
   ~AoRPair()
   {
-    delete _orig_aor; _orig_aor = NULL;
+    // The current AoR may share bindings and subscriptions with the original
+    // AoR, so must be deleted first.
     delete _current_aor; _current_aor = NULL;
+    delete _orig_aor; _orig_aor = NULL;
   }
 
   /// Get the current AoR
@@ -323,6 +372,8 @@ public:
 
   /// Utility functions to compare Bindings and Subscriptions in the original AoR
   /// and current AoR, and return the set of those created/updated or removed.
+  /// If the current AoR is a copy-on-write copy of the original AoR, only the
+  /// bindings and subscriptions it has touched are compared.
   AoR::Bindings get_updated_bindings();
   AoR::Subscriptions get_updated_subscriptions();
   AoR::Bindings get_removed_bindings();
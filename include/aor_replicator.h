@@ -0,0 +1,150 @@
+/**
+ * @file aor_replicator.h Definitions for AoRReplicator class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef AOR_REPLICATOR_H__
+#define AOR_REPLICATOR_H__
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+
+#include "sas.h"
+#include "subscriber_data_manager.h"
+#include "snmp_event_accumulator_table.h"
+
+/// @class AoRReplicator
+///
+/// Replicates changes made to AoRs in the local store to the remote (geo-
+/// redundant) stores in the background, so that the latency of requests
+/// doesn't depend on the round trip time to the remote sites.
+///
+/// Each remote site has its own queue and pool of threads, so a slow site
+/// doesn't hold up replication to the others.  If an AoR is changed again
+/// before the previous change has been written to a site, the changes are
+/// coalesced into a single write.  As before, failures to write to a remote
+/// site are ignored.
+///
+/// The number of AoRs waiting to be written to each site is limited.  If a
+/// site falls so far behind that the limit is reached, changes to further
+/// AoRs are dropped for that site (and counted), rather than letting the
+/// queue grow without bound.
+class AoRReplicator
+{
+public:
+  /// Constructor.
+  ///
+  /// @param remote_sdms        - The remote stores to replicate to.
+  /// @param threads_per_site   - The number of threads writing to each site.
+  /// @param lag_tbl            - Statistic tracking the time (in
+  ///                             microseconds) from a change being queued to
+  ///                             it being written to a remote site.
+  /// @param max_queue_depth    - The maximum number of AoRs waiting to be
+  ///                             written to each site.
+  AoRReplicator(const std::vector<SubscriberDataManager*>& remote_sdms,
+                int threads_per_site,
+                SNMP::EventAccumulatorTable* lag_tbl = NULL,
+                int max_queue_depth = DEFAULT_MAX_QUEUE_DEPTH);
+
+  /// Destructor.  Any changes that haven't been written are discarded.
+  virtual ~AoRReplicator();
+
+  /// Queues the changes made to an AoR in the local store to be written to
+  /// the remote stores.  This should be called after the changes have been
+  /// successfully written to the local store.
+  ///
+  /// @param aor_id             - The AoR ID.
+  /// @param aor_pair           - The AoR pair written to the local store.
+  /// @param trail              - SAS trail for the change.
+  virtual void replicate(const std::string& aor_id,
+                         AoRPair* aor_pair,
+                         SAS::TrailId trail);
+
+  /// Waits until all queued changes have been written to the remote stores.
+  void flush();
+
+  /// Returns the number of changes that have been dropped because a site's
+  /// queue was full.
+  uint64_t dropped() const { return _dropped.load(); }
+
+  /// The maximum number of AoRs a thread takes off its queue at once.
+  static const int MAX_BATCH_SIZE = 20;
+
+  /// The default maximum number of AoRs waiting to be written to each site.
+  static const int DEFAULT_MAX_QUEUE_DEPTH = 10000;
+
+private:
+  /// A change waiting to be written to a remote site.
+  struct PendingWrite
+  {
+    // The AoR as written to the local store.  This is shared between the
+    // sites, and must not be modified.
+    std::shared_ptr<AoR> aor;
+
+    // The IDs of the bindings and subscriptions removed from the local AoR.
+    std::set<std::string> removed_bindings;
+    std::set<std::string> removed_subscriptions;
+
+    // When the (first) change was queued, from the monotonic clock.
+    unsigned long queued_us;
+
+    SAS::TrailId trail;
+  };
+
+  /// Queue and threads for a single remote site.
+  struct Site
+  {
+    AoRReplicator* replicator;
+    SubscriberDataManager* sdm;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    // AoR IDs in the order they were queued, and the changes waiting for
+    // each.  An AoR only appears once, however many times it changes.
+    std::deque<std::string> queue;
+    std::unordered_map<std::string, PendingWrite> pending;
+
+    // AoR IDs currently being written.  Changes to these aren't picked up
+    // until the write completes, so that writes to an AoR are never
+    // reordered.
+    std::set<std::string> writing;
+
+    bool terminated;
+    std::vector<pthread_t> threads;
+  };
+
+  static void* site_thread(void* p);
+  void process_site(Site* site);
+
+  /// Takes a batch of AoRs to write off the site's queue.  Must be called
+  /// with the site lock held.
+  void get_batch(Site* site,
+                 std::vector<std::pair<std::string, PendingWrite>>& batch);
+
+  /// Writes a change to a remote store.
+  void write_aor(SubscriberDataManager* sdm,
+                 const std::string& aor_id,
+                 const PendingWrite& write);
+
+  static unsigned long now_us();
+
+  std::vector<Site*> _sites;
+  SNMP::EventAccumulatorTable* _lag_tbl;
+  size_t _max_queue_depth;
+  std::atomic<uint64_t> _dropped;
+};
+
+#endif
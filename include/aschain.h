@@ -19,6 +19,7 @@ extern "C" {
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 #include "log.h"
 #include "sessioncase.h"
@@ -398,9 +399,23 @@ private:
   void register_(AsChain* as_chain, std::vector<std::string>& tokens);
   void unregister(std::vector<std::string>& tokens);
 
+  static void create_token(std::string& token);
+
   static const int TOKEN_LENGTH = 10;
 
-  /// Map from ODI token to pair of (AsChain, index).
-  std::map<std::string, AsChainLink> _odi_token_map;
-  pthread_mutex_t _lock;
+  /// The token map is split into stripes, each with its own lock, so that
+  /// lookups of different tokens don't contend.
+  static const int NUM_STRIPES = 64;
+
+  struct Stripe
+  {
+    pthread_mutex_t lock;
+
+    /// Map from ODI token to pair of (AsChain, index).
+    std::unordered_map<std::string, AsChainLink> odi_token_map;
+  };
+
+  Stripe& stripe(const std::string& token);
+
+  Stripe _stripes[NUM_STRIPES];
 };
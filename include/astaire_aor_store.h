@@ -15,6 +15,7 @@
 
 
 #include <string>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -25,8 +26,21 @@
 class AstaireAoRStore: public AoRStore
 {
 public:
+  /// The formats in which AoRs can be written to the store.  AoRs in any of
+  /// these formats can always be read, so the format can be changed (and
+  /// nodes using different formats can share a store) at any time.
+  enum class SerializationFormat
+  {
+    JSON,
+    BINARY
+  };
+
   /// Constructor.
-  AstaireAoRStore(Store* store);
+  ///
+  /// @param store                The underlying data store.
+  /// @param format               The format to write AoRs in.
+  AstaireAoRStore(Store* store,
+                  SerializationFormat format = SerializationFormat::JSON);
 
   /// Destructor.
   virtual ~AstaireAoRStore();
@@ -58,19 +72,19 @@ public:
                                      SAS::TrailId trail) override;
 
 
-  /// Class used by the AstaireAoRStore to serialize AoRs from C++
-  /// objects to the JSON format used in the store, and deserialize them.
-  class JsonSerializerDeserializer
+  /// Interface used by the AstaireAoRStore to serialize AoRs from C++
+  /// objects to the format used in the store, and deserialize them.
+  class SerializerDeserializer
   {
   public:
     /// Destructor.
-    ~JsonSerializerDeserializer() {}
+    virtual ~SerializerDeserializer() {}
 
     /// Serialize an AoR object to the format used in the store.
     ///
     /// @param aor_data - The AoR object to serialize.
     /// @return         - The serialized form.
-    std::string serialize_aor(AoR* aor_data);
+    virtual std::string serialize_aor(AoR* aor_data) = 0;
 
     /// Deserialize some data from the store into an AoR object.
     ///
@@ -79,9 +93,46 @@ public:
     /// @param s      - The data to deserialize.
     ///
     /// @return       - An AoR object, or NULL if the data could not be
-    ///                 deserialized (e.g. because it is corrupt).
-    AoR* deserialize_aor(const std::string& aor_id,
-                         const std::string& s);
+    ///                 deserialized (e.g. because it is corrupt or in a
+    ///                 different format).
+    virtual AoR* deserialize_aor(const std::string& aor_id,
+                                 const std::string& s) = 0;
+
+    /// @return       - The name of this format, for logging.
+    virtual std::string name() = 0;
+  };
+
+  /// (De)serializer for the JSON format.
+  class JsonSerializerDeserializer : public SerializerDeserializer
+  {
+  public:
+    /// Destructor.
+    virtual ~JsonSerializerDeserializer() {}
+
+    virtual std::string serialize_aor(AoR* aor_data) override;
+    virtual AoR* deserialize_aor(const std::string& aor_id,
+                                 const std::string& s) override;
+    virtual std::string name() override { return "JSON"; }
+  };
+
+  /// (De)serializer for the binary format.  This starts with a marker byte
+  /// (which can never start a JSON document) and a schema version, followed
+  /// by the AoR's fields in a fixed order.  Strings and lists are prefixed
+  /// with their lengths, and all integers are encoded as varints.
+  class BinarySerializerDeserializer : public SerializerDeserializer
+  {
+  public:
+    /// Destructor.
+    virtual ~BinarySerializerDeserializer() {}
+
+    virtual std::string serialize_aor(AoR* aor_data) override;
+    virtual AoR* deserialize_aor(const std::string& aor_id,
+                                 const std::string& s) override;
+    virtual std::string name() override { return "binary"; }
+
+    /// The marker byte and the current schema version.
+    static const unsigned char MARKER = 0xA0;
+    static const unsigned char VERSION = 1;
   };
 
   /// Provides the interface to the data store. This is responsible for
@@ -90,8 +141,11 @@ public:
   /// functions in case of failure.
   class Connector
   {
+    /// Constructor.  The connector takes ownership of the
+    /// serializer/deserializers.  The first is used for writing to the store,
+    /// and all are tried in turn when reading from it.
     Connector(Store* data_store,
-              JsonSerializerDeserializer*& serializer_deserializer);
+              std::vector<SerializerDeserializer*>& serializer_deserializers);
 
     ~Connector();
 
@@ -110,7 +164,7 @@ public:
     friend class AstaireAoRStore;
 
   private:
-    JsonSerializerDeserializer* _serializer_deserializer;
+    std::vector<SerializerDeserializer*> _serializer_deserializers;
   };
 
 public:
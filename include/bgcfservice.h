@@ -22,6 +22,7 @@
 
 #include <functional>
 #include "updater.h"
+#include "prefix_trie.h"
 #include "sas.h"
 
 class BgcfService
@@ -40,7 +41,7 @@ public:
 
 private:
   std::map<std::string, std::vector<std::string>> _domain_routes;
-  std::map<std::string, std::vector<std::string>> _number_routes;
+  PrefixTrie<std::vector<std::string>> _number_routes;
   std::string _configuration;
   Updater<void, BgcfService>* _updater;
 
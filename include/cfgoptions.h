@@ -17,6 +17,8 @@
 
 #include "hssconnection.h"
 #include "subscriber_data_manager.h"
+#include "aor_replicator.h"
+#include "astaire_aor_store.h"
 #include "httpconnection.h"
 #include "httpresolver.h"
 #include "acr.h"
@@ -79,6 +81,7 @@ struct options
   std::string                          local_site_name;
   std::vector<std::string>             registration_stores;
   std::vector<std::string>             impi_stores;
+  AstaireAoRStore::SerializationFormat registration_store_format;
   std::string                          ralf_server;
   int                                  ralf_threads;
   std::vector<std::string>             dns_servers;
@@ -99,6 +102,8 @@ struct options
   int                                  memento_threads;
   int                                  call_list_ttl;
   int                                  worker_threads;
+  int                                  worker_queue_shards;
+  int                                  max_worker_queue_depth;
   bool                                 log_to_file;
   std::string                          log_directory;
   int                                  log_level;
@@ -142,6 +147,15 @@ struct options
   std::string                          dummy_app_server;
   bool                                 http_acr_logging;
   int                                  homestead_timeout;
+  int                                  hss_cache_ttl;
+  int                                  hss_cache_size;
+  int                                  enum_cache_max_ttl;
+  int                                  sproutlet_background_threads;
+  int                                  remote_store_replication_threads;
+  int                                  chronos_timer_threads;
+  int                                  sas_log_threads;
+  int                                  third_party_reg_threads;
+  int                                  third_party_reg_rate;
 };
 
 // Objects that must be shared with dynamically linked sproutlets must be
@@ -154,6 +168,7 @@ extern Store* local_impi_data_store;
 extern std::vector<Store*> remote_impi_data_stores;
 extern SubscriberDataManager* local_sdm;
 extern std::vector<SubscriberDataManager*> remote_sdms;
+extern AoRReplicator* aor_replicator;
 extern ImpiStore* local_impi_store;
 extern std::vector<ImpiStore*> remote_impi_stores;
 extern RalfProcessor* ralf_processor;
@@ -0,0 +1,167 @@
+/**
+ * @file chronos_timer_batcher.h Definitions for ChronosTimerBatcher class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CHRONOS_TIMER_BATCHER_H__
+#define CHRONOS_TIMER_BATCHER_H__
+
+extern "C" {
+#include <pjlib.h>
+}
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <functional>
+
+#include "sas.h"
+#include "chronosconnection.h"
+
+/// @class ChronosTimerBatcher
+///
+/// Sends the registration and subscription expiry timers for AoRs to Chronos
+/// from a pool of background threads, rather than from the thread writing
+/// the AoR.
+///
+/// Requests are held for a few milliseconds before being sent, and are then
+/// taken off the queue in batches.  If an AoR's timer changes again while a
+/// request for it is waiting, the two are coalesced, so a burst of writes to
+/// an AoR only results in a single request to Chronos.
+///
+/// When a new timer is created, Chronos allocates its ID, which must be
+/// stored in the AoR.  This is passed to a callback once the timer has been
+/// created.  Until the ID has been stored, any further requests for the AoR's
+/// timer use the allocated ID, so only one timer is ever created for an AoR.
+class ChronosTimerBatcher
+{
+public:
+  /// Callback used to store the ID of a newly created timer in an AoR.
+  typedef std::function<void(const std::string& aor_id,
+                             const std::string& timer_id,
+                             SAS::TrailId trail)> TimerIdCallback;
+
+  /// Constructor.
+  ///
+  /// @param chronos_conn       - The connection to Chronos.
+  /// @param threads            - The number of threads sending requests.
+  /// @param batch_delay_ms     - How long requests are held before being
+  ///                             sent, to give changes a chance to coalesce.
+  ChronosTimerBatcher(ChronosConnection* chronos_conn,
+                      int threads,
+                      int batch_delay_ms = DEFAULT_BATCH_DELAY_MS);
+
+  /// Destructor.  Any requests that haven't been sent are discarded.
+  virtual ~ChronosTimerBatcher();
+
+  /// Sets the callback for storing the IDs of new timers.  This must be
+  /// called before any timers are set.
+  void set_timer_id_callback(TimerIdCallback callback);
+
+  /// Queues a request to create or update the timer for an AoR.
+  ///
+  /// @param aor_id             - The AoR ID.
+  /// @param timer_id           - The AoR's current timer ID, or the empty
+  ///                             string if it doesn't have one yet.
+  /// @param expiry             - Timer length in seconds.
+  /// @param tags               - Any tags to add to the Chronos timer.
+  /// @param trail              - SAS trail.
+  virtual void set_timer(const std::string& aor_id,
+                         const std::string& timer_id,
+                         uint32_t expiry,
+                         const std::map<std::string, uint32_t>& tags,
+                         SAS::TrailId trail);
+
+  /// Queues a request to delete the timer for an AoR.
+  ///
+  /// @param aor_id             - The AoR ID.
+  /// @param timer_id           - The AoR's current timer ID, or the empty
+  ///                             string if it doesn't have one yet.
+  /// @param trail              - SAS trail.
+  virtual void delete_timer(const std::string& aor_id,
+                            const std::string& timer_id,
+                            SAS::TrailId trail);
+
+  /// Waits until all queued requests have been sent.
+  void flush();
+
+  /// The default time for which requests are held before being sent.
+  static const int DEFAULT_BATCH_DELAY_MS = 5;
+
+  /// The maximum number of requests a thread takes off the queue at once.
+  static const int MAX_BATCH_SIZE = 50;
+
+private:
+  /// A request waiting to be sent to Chronos.
+  struct Request
+  {
+    // Whether the timer is to be deleted, rather than created or updated.
+    bool remove;
+
+    // The timer ID, or the empty string if there isn't a timer yet.
+    std::string timer_id;
+
+    uint32_t expiry;
+    std::map<std::string, uint32_t> tags;
+    SAS::TrailId trail;
+
+    // When the (first) request was queued, from the monotonic clock.
+    unsigned long queued_ms;
+  };
+
+  void queue_request(const std::string& aor_id, Request& request);
+
+  static void* thread_fn(void* p);
+  void process_requests();
+
+  /// Takes a batch of requests off the queue, once the oldest has been held
+  /// for long enough.  Must be called with the lock held.
+  void get_batch(std::vector<std::pair<std::string, Request>>& batch);
+
+  /// Sends a request to Chronos.
+  void send_request(const std::string& aor_id, const Request& request);
+
+  static unsigned long now_ms();
+
+  ChronosConnection* _chronos_conn;
+  int _batch_delay_ms;
+  TimerIdCallback _timer_id_callback;
+
+  pthread_mutex_t _lock;
+  pthread_cond_t _cond;
+
+  // AoR IDs in the order they were queued, and the request waiting for each.
+  // An AoR only appears once, however many times its timer changes.
+  std::deque<std::string> _queue;
+  std::unordered_map<std::string, Request> _pending;
+
+  // AoR IDs whose requests are currently being sent.  Requests for these
+  // aren't picked up until the send completes, so that requests for an AoR
+  // are never reordered.
+  std::set<std::string> _sending;
+
+  // IDs of timers that have been created, for AoRs that may not have the ID
+  // stored yet.
+  std::unordered_map<std::string, std::string> _created_timer_ids;
+
+  bool _terminated;
+  std::vector<pthread_t> _threads;
+
+  // Each thread is registered with PJLIB, as the timer ID callback writes to
+  // the AoR stores.
+  pj_thread_desc* _thread_descs;
+  int _registered_threads;
+};
+
+#endif
@@ -24,12 +24,16 @@ extern "C" {
 #include "snmp_counter_table.h"
 #include "snmp_counter_by_scope_table.h"
 #include "health_checker.h"
+#include "sas_log_pool.h"
+#include "admission_controller.h"
 
 pj_status_t
 init_common_sip_processing(LoadMonitor* load_monitor_arg,
                            SNMP::CounterByScopeTable* requests_counter_arg,
                            SNMP::CounterByScopeTable* overload_counter_arg,
-                           HealthChecker* health_checker_arg);
+                           HealthChecker* health_checker_arg,
+                           SasLogPool* sas_log_pool_arg = NULL,
+                           AdmissionController* admission_controller_arg = NULL);
 
 void unregister_common_processing_module(void);
 
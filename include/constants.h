@@ -170,7 +170,6 @@ const pj_str_t STR_XMLNS_VAL = pj_str((char*)"urn:ietf:params:xml:ns:reginfo");
 const pj_str_t STR_XMLNS_GRUU_NAME = pj_str((char*)"xmlns:gr");
 const pj_str_t STR_XMLNS_GRUU_VAL = pj_str((char*)"urn:ietf:params:xml:ns:gruuinfo");
 const pj_str_t STR_VERSION = pj_str((char*)"version");
-const pj_str_t STR_VERSION_VAL = pj_str((char*)"0");
 const pj_str_t STR_XMLNS_XSI_NAME = pj_str((char*)"xmlns:xsi");
 const pj_str_t STR_XMLNS_XSI_VAL = pj_str((char*)"http://www.w3.org/2001/XMLSchema-instance");
 const pj_str_t STR_XMLNS_ERE_NAME  = pj_str((char*)"xmlns:ere");
@@ -40,6 +40,18 @@ public:
   virtual int perform_naptr_query(const std::string& domain, struct ares_naptr_reply*& naptr_reply, SAS::TrailId trail);
   // Free a naptr_reply structure.
   virtual void free_naptr_reply(struct ares_naptr_reply* naptr_reply) const;
+  // The time (in seconds) for which the result of the last query may be
+  // cached, or -1 if this isn't known.  For a successful query this is the
+  // smallest TTL of the answers, and for a name that doesn't exist it is the
+  // negative caching TTL from the SOA record (RFC 2308).
+  inline int last_ttl() const { return _ttl; }
+
+  // Parses the TTL for caching out of a raw DNS response, as above.
+  static int parse_ttl(const unsigned char* abuf, int alen, bool negative);
+
+protected:
+  // The caching TTL of the last query (see last_ttl).
+  int _ttl;
 
 private:
   // Send a query for the specified domain.
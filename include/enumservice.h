@@ -17,6 +17,8 @@
 
 #include <list>
 #include <string>
+#include <memory>
+#include <unordered_map>
 #include <boost/regex.hpp>
 #include <boost/thread.hpp>
 #include <netinet/in.h>
@@ -26,6 +28,7 @@
 #include "dnsresolver.h"
 #include "communicationmonitor.h"
 #include "updater.h"
+#include "prefix_trie.h"
 
 /// @class EnumService
 ///
@@ -41,6 +44,10 @@ public:
   /// Translate a PSTN number to a SIP URI.
   virtual std::string lookup_uri_from_user(const std::string& user, SAS::TrailId trail) const = 0;
 
+  /// Whether lookups may block waiting on the network (and so are worth
+  /// running off the worker threads).
+  virtual bool lookups_may_block() const { return false; }
+
   // Parse a string of the form !<regex>!<replace>! into a regular expression
   // and a replacement string.
   static bool parse_regex_replace(const std::string& regex_replace, boost::regex& regex, std::string& replace);
@@ -96,7 +103,7 @@ private:
   };
 
   std::vector<NumberPrefix> _number_prefixes;
-  std::map<std::string, NumberPrefix> _prefix_regex_map;
+  PrefixTrie<NumberPrefix> _prefix_trie;
   std::string _configuration;
   Updater<void, JSONEnumService>* _updater;
 
@@ -117,11 +124,18 @@ public:
                  const std::string& dns_suffix = ".e164.arpa",
                  const DNSResolverFactory* resolver_factory =
                                                        new DNSResolverFactory(),
-                 CommunicationMonitor* comm_monitor = NULL);
+                 CommunicationMonitor* comm_monitor = NULL,
+                 int max_cache_ttl = 0,
+                 size_t max_cache_entries = MAX_CACHE_ENTRIES);
   ~DNSEnumService();
 
   std::string lookup_uri_from_user(const std::string& user, SAS::TrailId trail) const;
 
+  bool lookups_may_block() const { return true; }
+
+  // Default maximum number of NAPTR answers held in the cache.
+  static const size_t MAX_CACHE_ENTRIES = 10000;
+
   // Characters to strip from a key before turning it into a domain.  This is
   // all non-digit characters.
   static const boost::regex CHARS_TO_STRIP_FROM_DOMAIN;
@@ -160,9 +174,36 @@ private:
 
   };
 
+  /// A NAPTR answer held in the cache.  Only definitive answers are cached -
+  /// either the rules for a domain, or the fact that the domain doesn't exist.
+  struct CachedAnswer
+  {
+    // ARES_SUCCESS or ARES_ENOTFOUND.
+    int status;
+    // The rules parsed from the answer, sorted by order and preference.
+    // NULL unless status is ARES_SUCCESS.
+    std::shared_ptr<const std::vector<Rule>> rules;
+    // When the answer expires, from the monotonic clock.
+    unsigned long expiry_ms;
+    // The position of the domain in the cache's insertion order.
+    std::list<std::string>::iterator order;
+  };
+
   // Maximum number of DNS queries per request.
   static const int MAX_DNS_QUERIES = 5;
 
+  // Gets the rules for a domain, from the cache if possible and otherwise by
+  // querying the ENUM server.  Returns the ares status of the query.
+  int get_rules(const std::string& domain,
+                std::shared_ptr<const std::vector<Rule>>& rules,
+                SAS::TrailId trail) const;
+  // Adds an answer to the cache.
+  void cache_answer(const std::string& domain,
+                    int status,
+                    const std::shared_ptr<const std::vector<Rule>>& rules,
+                    int ttl) const;
+  static unsigned long now_ms();
+
   // Converts a key to an ENUM domain name.
   std::string key_to_domain(const std::string& key) const;
   // Gets a resolver (from thread-local data).
@@ -183,6 +224,25 @@ private:
   // Helper used to track enum communication state, and issue/clear alarms
   // based upon recent activity.
   CommunicationMonitor* _comm_monitor;
+
+  // The longest time (in seconds) for which an answer is cached, whatever
+  // its TTL.  Zero disables the cache.
+  const int _max_cache_ttl;
+
+  // The maximum number of answers held in the cache.
+  const size_t _max_cache_entries;
+
+  // Cache of NAPTR answers, indexed by domain.  This is shared by all
+  // threads, so is protected by a read/write lock.  Marked as mutable as
+  // lookups are 'const'.
+  mutable std::unordered_map<std::string, CachedAnswer> _cache;
+
+  // The domains in the cache, oldest answer first.  When the cache is full,
+  // the oldest answer is evicted.  As every answer is cached for at most
+  // _max_cache_ttl, this is also roughly the answer that expires soonest.
+  // Lookups only take the read lock, so don't reorder this list.
+  mutable std::list<std::string> _cache_order;
+  mutable boost::shared_mutex _cache_lock;
 };
 
 #endif
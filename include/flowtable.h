@@ -83,7 +83,7 @@ private:
   void restart_timer(int id, int timeout);
   void expiry_timer();
 
-  void inc_ref();
+  bool inc_ref();
 
   FlowTable* _flow_table;
   pjsip_transport* _transport;
@@ -118,12 +118,13 @@ private:
   /// The default identity for this flow.
   std::string _default_id;
 
-  /// Counts the references to this Flow.  This can only be updated or tested
-  /// by a thread which currently holds the FlowTable::_flow_map_lock.
-  int _refs;
+  /// Counts the references to this Flow.  Once this drops to zero the flow
+  /// is being removed from the FlowTable, and no new references can be taken.
+  std::atomic<int> _refs;
 
   // Counts the number of active dialogs on this flow. This can be
-  // updated or tested without FlowTable::_flow_map_lock being held.
+  // updated or tested without _flow_lock or any of the FlowTable's shard
+  // locks being held.
   std::atomic_long _dialogs;
 
   /// Timer identifiers - the timer either runs as an expiry timer (when there
@@ -186,38 +187,77 @@ private:
     {
     }
 
-    /// Override operator< so this can be used as a map key.
-    bool operator< (const FlowKey& other) const
+    /// Override operator== so this can be used as an unordered_map key.
+    bool operator== (const FlowKey& other) const
     {
-      // Compare the transport type first.
-      if (_type < other._type)
-      {
-        return true;
-      }
-      else if (_type > other._type)
-      {
-        return false;
-      }
-      else
+      return ((_type == other._type) &&
+              (pj_sockaddr_cmp(&_raddr, &other._raddr) == 0));
+    }
+
+    /// Hashes the key, consistently with pj_sockaddr_cmp (which compares the
+    /// address family, address and port).
+    size_t hash() const
+    {
+      size_t h = std::hash<int>()(_type);
+      h = h * 31 + _raddr.addr.sa_family;
+      h = h * 31 + pj_sockaddr_get_port(&_raddr);
+
+      const unsigned char* addr =
+                      (const unsigned char*)pj_sockaddr_get_addr(&_raddr);
+      unsigned addr_len = pj_sockaddr_get_addr_len(&_raddr);
+      for (unsigned ii = 0; ii < addr_len; ++ii)
       {
-        // The transport is the same, so check the remote addresses.
-        return (pj_sockaddr_cmp(&_raddr, &other._raddr) < 0);
+        h = h * 31 + addr[ii];
       }
+
+      return h;
     }
 
+    struct Hash
+    {
+      size_t operator()(const FlowKey& key) const { return key.hash(); }
+    };
+
   private:
     int _type;
     pj_sockaddr _raddr;
   };
 
-  pthread_mutex_t _flow_map_lock;
-  std::map<FlowKey, Flow*> _tp2flow_map;        // map from transport addresses to flow
-  std::map<std::string, Flow*> _tk2flow_map;    // map from token to flow
+  /// The flows are split across a number of shards, each with its own lock,
+  /// so that lookups for different flows don't contend.  Flows are sharded
+  /// by transport address and, separately, by token.  A thread may hold at
+  /// most one lock of each type, and must take the transport address lock
+  /// first.
+  static const int NUM_SHARDS = 64;
+
+  struct TpShard
+  {
+    pthread_mutex_t lock;
+    std::unordered_map<FlowKey, Flow*, FlowKey::Hash> flows;
+  };
+
+  struct TkShard
+  {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, Flow*> flows;
+  };
+
+  TpShard& tp_shard(const FlowKey& key);
+  TkShard& tk_shard(const std::string& token);
+
+  TpShard _tp_shards[NUM_SHARDS];               // maps from transport addresses to flow
+  TkShard _tk_shards[NUM_SHARDS];               // maps from token to flow
 
   // Statistics
   void report_flow_count();
+  std::atomic<int> _flow_count;
   SNMP::U32Scalar* _conn_count;
-  bool _quiescing;
+  std::atomic<bool> _quiescing;
+
+  // Set when flows_gone has been called on the QuiescingManager, so that it
+  // is only called once per quiesce even when the last flow is removed at the
+  // same time as quiesce() is called.  Cleared by unquiesce().
+  std::atomic<bool> _flows_gone_reported;
   QuiescingManager* _qm;
 
 };
@@ -17,9 +17,11 @@
 #include "chronosconnection.h"
 #include "hssconnection.h"
 #include "subscriber_data_manager.h"
+#include "aor_replicator.h"
 #include "sipresolver.h"
 #include "impistore.h"
 #include "fifcservice.h"
+#include "latency_breakdown.h"
 
 /// Common factory for all handlers that deal with timer pops. This is
 /// a subclass of SpawningHandler that requests HTTP flows to be
@@ -52,14 +54,17 @@ public:
   {
     Config(SubscriberDataManager* sdm,
            std::vector<SubscriberDataManager*> remote_sdms,
-           HSSConnection* hss) :
+           HSSConnection* hss,
+           AoRReplicator* aor_replicator = NULL) :
       _sdm(sdm),
       _remote_sdms(remote_sdms),
-      _hss(hss)
+      _hss(hss),
+      _aor_replicator(aor_replicator)
     {}
     SubscriberDataManager* _sdm;
     std::vector<SubscriberDataManager*> _remote_sdms;
     HSSConnection* _hss;
+    AoRReplicator* _aor_replicator;
   };
 
   AoRTimeoutTask(HttpStack::Request& req,
@@ -217,6 +222,30 @@ protected:
   std::string serialize_data(AoR* aor);
 };
 
+/// Task for reporting the breakdown of SIP message latency.  A GET returns the
+/// latency histograms, and a DELETE resets them.
+class GetLatencyTask : public HttpStackUtils::Task
+{
+public:
+  struct Config
+  {
+    Config(LatencyBreakdown* latency_breakdown) :
+      _latency_breakdown(latency_breakdown)
+    {}
+
+    LatencyBreakdown* _latency_breakdown;
+  };
+
+  GetLatencyTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
+    HttpStackUtils::Task(req, trail), _cfg(cfg)
+  {};
+
+  void run();
+
+private:
+  const Config* _cfg;
+};
+
 /// Task for performing an administrative deregistration at the S-CSCF. This
 ///
 /// -  Deletes subscriber data from the store (including all bindings and
@@ -269,15 +298,18 @@ public:
   {
     Config(SubscriberDataManager* sdm,
            std::vector<SubscriberDataManager*> remote_sdms,
-	   HSSConnection* hss):
+	   HSSConnection* hss,
+           AoRReplicator* aor_replicator = NULL):
       _sdm(sdm),
       _remote_sdms(remote_sdms),
-      _hss(hss)
+      _hss(hss),
+      _aor_replicator(aor_replicator)
     {}
 
     SubscriberDataManager* _sdm;
     std::vector<SubscriberDataManager*> _remote_sdms;
     HSSConnection* _hss;
+    AoRReplicator* _aor_replicator;
   };
 
   PushProfileTask(HttpStack::Request& req,
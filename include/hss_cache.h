@@ -0,0 +1,110 @@
+/**
+ * @file hss_cache.h Definitions for HSSCache class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HSS_CACHE_H__
+#define HSS_CACHE_H__
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <list>
+#include <unordered_map>
+
+#include "ifchandler.h"
+#include "associated_uris.h"
+
+/// @class HSSCache
+///
+/// Process-local cache of the subscriber data returned by Homestead, keyed on
+/// public identity.  The cache is bounded in size (least recently used
+/// entries are evicted first), entries expire after a fixed TTL, and entries
+/// can be invalidated explicitly when Sprout learns that the subscriber data
+/// has changed.
+///
+/// The cache is split into a number of shards, each protected by its own
+/// lock, so that lookups for different subscribers on different worker
+/// threads rarely contend.
+class HSSCache
+{
+public:
+  /// The subscriber data cached for a single public identity.
+  struct Entry
+  {
+    std::string regstate;
+    std::map<std::string, Ifcs> ifcs_map;
+    AssociatedURIs associated_uris;
+    std::vector<std::string> aliases;
+    std::deque<std::string> ccfs;
+    std::deque<std::string> ecfs;
+  };
+
+  /// Constructor.
+  ///
+  /// @param ttl_ms      - The time (in milliseconds) for which an entry is
+  ///                      valid after it is added to the cache.
+  /// @param max_entries - The maximum number of entries held in the cache.
+  /// @param num_shards  - The number of independently locked shards.
+  HSSCache(int ttl_ms, int max_entries, int num_shards = DEFAULT_NUM_SHARDS);
+  ~HSSCache();
+
+  /// Looks up the entry for the specified public identity.
+  ///
+  /// @returns           - true if an unexpired entry was found (in which case
+  ///                      it is copied to the entry parameter), false
+  ///                      otherwise.
+  bool get(const std::string& public_id, Entry& entry);
+
+  /// Adds or replaces the entry for the specified public identity.
+  void put(const std::string& public_id, const Entry& entry);
+
+  /// Removes the entry for the specified public identity (if any).
+  void invalidate(const std::string& public_id);
+
+  /// Removes the entries for each of the specified public identities.
+  void invalidate(const std::vector<std::string>& public_ids);
+
+  /// Returns the total number of entries in the cache, including any that
+  /// have expired but not yet been removed.
+  int size();
+
+  static const int DEFAULT_NUM_SHARDS = 16;
+
+private:
+  struct Node
+  {
+    std::string public_id;
+    Entry entry;
+    unsigned long expiry_ms;
+  };
+
+  typedef std::list<Node> LRUList;
+
+  struct Shard
+  {
+    pthread_mutex_t lock;
+
+    // Most recently used entries are at the front of the list.
+    LRUList lru;
+    std::unordered_map<std::string, LRUList::iterator> index;
+  };
+
+  Shard& shard_for(const std::string& public_id);
+
+  static unsigned long now_ms();
+
+  unsigned long _ttl_ms;
+  size_t _max_entries_per_shard;
+  std::vector<Shard*> _shards;
+};
+
+#endif
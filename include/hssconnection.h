@@ -23,6 +23,7 @@
 #include "load_monitor.h"
 #include "associated_uris.h"
 #include "sifcservice.h"
+#include "hss_cache.h"
 
 /// @class HSSConnection
 ///
@@ -43,7 +44,8 @@ public:
                 SNMP::EventAccumulatorTable* homestead_lir_latency_tbl,
                 CommunicationMonitor* comm_monitor,
                 SIFCService* sifc_service,
-                long homestead_timeout_ms);
+                long homestead_timeout_ms,
+                HSSCache* cache = NULL);
   virtual ~HSSConnection();
 
   HTTPCode get_auth_vector(const std::string& private_user_id,
@@ -124,6 +126,11 @@ public:
                                          SAS::TrailId trail);
   rapidxml::xml_document<>* parse_xml(std::string raw, const std::string& url);
 
+  /// Discards any cached subscriber data for the specified public identities.
+  /// This should be called whenever Sprout is told that the subscriber data
+  /// held by Homestead has changed.
+  void invalidate_cached_data(const std::vector<std::string>& public_ids);
+
   static const std::string REG;
   static const std::string CALL;
   static const std::string DEREG_USER;
@@ -152,6 +159,7 @@ private:
   SNMP::EventAccumulatorTable* _uar_latency_tbl;
   SNMP::EventAccumulatorTable* _lir_latency_tbl;
   SIFCService* _sifc_service;
+  HSSCache* _cache;
 };
 
 #endif
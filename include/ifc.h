@@ -73,7 +73,8 @@ class Ifc
 {
 public:
   Ifc(rapidxml::xml_node<>* ifc) :
-    _ifc(ifc)
+    _ifc(ifc),
+    _compiled(compile(ifc))
   {
   }
 
@@ -91,21 +92,32 @@ public:
   AsInvocation as_invocation() const;
 
 private:
+  /// A service point trigger, pre-compiled from the XML.
+  struct CompiledSpt;
+
+  /// The parts of an iFC needed to evaluate it, pre-compiled from the XML
+  /// so that evaluating the iFC doesn't need to walk the XML or compile any
+  /// regular expressions.
+  struct CompiledIfc;
+
+  /// Compiles the iFC.  Invalid iFCs are still compiled, with the errors
+  /// recorded in the compiled form, so that they are reported against the
+  /// request being processed when the iFC is evaluated.
+  static std::shared_ptr<const CompiledIfc> compile(rapidxml::xml_node<>* ifc);
+
+  static CompiledSpt compile_spt(rapidxml::xml_node<>* spt);
+
   static bool spt_matches(const SessionCase& session_case,
                           bool is_registered,
                           bool is_initial_registration,
                           pjsip_msg *msg,
-                          rapidxml::xml_node<>* spt,
-                          std::string ifc_str,
-                          std::string server_name,
-                          SAS::TrailId trail);
-
-  static void invalid_ifc(std::string error,
-                          std::string server_name,
-                          int sas_event_id,
-                          int instance_id,
+                          const CompiledSpt& spt,
+                          const std::string& server_name,
                           SAS::TrailId trail);
 
   rapidxml::xml_node<>* _ifc;
   std::string _server_name;
+
+  // Shared between copies of this Ifc, and never modified once compiled.
+  std::shared_ptr<const CompiledIfc> _compiled;
 };
@@ -0,0 +1,205 @@
+/**
+ * @file latency_breakdown.h Definitions for the LatencyBreakdown class, which
+ * records where the time spent on SIP messages goes.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LATENCY_BREAKDOWN_H__
+#define LATENCY_BREAKDOWN_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+#include "utils.h"
+#include "snmp_event_accumulator_table.h"
+
+/// @class LatencyHistogram
+///
+/// HDR-style histogram of latencies in microseconds.  Each power of two range
+/// of values is split into SUB_BUCKETS equal buckets, so a percentile read
+/// from the histogram is within 1/SUB_BUCKETS of the true value, however
+/// large the value.  Recording a value is lock-free.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  void record(unsigned long value_us);
+
+  /// Returns the value (in microseconds) that the given percentage of the
+  /// recorded values are no greater than, or 0 if nothing has been recorded.
+  unsigned long percentile(double pct) const;
+
+  uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+  unsigned long max() const { return _max.load(std::memory_order_relaxed); }
+  unsigned long mean() const;
+
+  /// Discards everything recorded so far.  Values recorded while this runs
+  /// may be partly discarded.
+  void reset();
+
+  void to_json(rapidjson::Writer<rapidjson::StringBuffer>& writer) const;
+
+  static const int SUB_BUCKET_BITS = 4;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  /// Maps a value to its bucket, and a bucket to the highest value in it.
+  static int bucket(unsigned long value);
+  static unsigned long bucket_max(int bucket);
+
+private:
+  std::atomic<uint64_t> _buckets[NUM_BUCKETS];
+  std::atomic<uint64_t> _count;
+  std::atomic<uint64_t> _total;
+  std::atomic<unsigned long> _max;
+};
+
+/// @class LatencyBreakdown
+///
+/// Breaks the time Sprout spends on each SIP message down into
+///
+/// -  the time the message waits on the worker thread queue
+/// -  the time spent processing it on a worker thread, and how much of that
+///    was spent blocked on calls to Homestead, Astaire, Chronos, ENUM and XDM
+/// -  the time spent in each Sproutlet (excluding blocked time)
+/// -  the time spent by the SproutletProxy passing messages between
+///    Sproutlets and on to the network (excluding time in the Sproutlets).
+///
+/// The stages are recorded in histograms, which are reported by the
+/// management HTTP interface, and the overall stages are also accumulated in
+/// SNMP tables.
+class LatencyBreakdown
+{
+public:
+  enum Dependency
+  {
+    HOMESTEAD = 0,
+    ASTAIRE,
+    CHRONOS,
+    ENUM,
+    XDM,
+    NUM_DEPENDENCIES
+  };
+
+  /// The time spent in a Sproutlet, split by the type of event it handled.
+  struct SproutletStats
+  {
+    LatencyHistogram request;
+    LatencyHistogram response;
+  };
+
+  /// Constructor.  Any of the SNMP tables may be NULL.
+  ///
+  /// @param queue_tbl          - Accumulates the worker queue wait.
+  /// @param processing_tbl     - Accumulates the worker processing time.
+  /// @param proxy_tbl          - Accumulates the SproutletProxy time.
+  /// @param blocked_tbl        - Accumulates the time each message's
+  ///                             processing was blocked on dependencies.
+  LatencyBreakdown(SNMP::EventAccumulatorTable* queue_tbl,
+                   SNMP::EventAccumulatorTable* processing_tbl,
+                   SNMP::EventAccumulatorTable* proxy_tbl,
+                   SNMP::EventAccumulatorTable* blocked_tbl);
+  virtual ~LatencyBreakdown();
+
+  /// Returns the statistics for the named Sproutlet, creating them if
+  /// necessary.  The returned pointer stays valid for the lifetime of this
+  /// object, so callers should look it up once rather than per message.
+  SproutletStats* sproutlet_stats(const std::string& name);
+
+  /// Records the worker thread stages for one message.
+  void record_message(unsigned long queue_us,
+                      unsigned long processing_us,
+                      unsigned long blocked_us);
+
+  void record_proxy(unsigned long proxy_us);
+  void record_dependency(Dependency dependency, unsigned long latency_us);
+
+  /// Discards everything recorded so far.
+  void reset();
+
+  std::string to_json();
+
+  /// The total time the calling thread has spent blocked on dependencies, and
+  /// in Sproutlets.  Timers take the difference across the code they time to
+  /// exclude the time spent in nested stages.
+  static unsigned long thread_blocked_us();
+  static unsigned long thread_sproutlet_us();
+
+  static const char* dependency_name(Dependency dependency);
+
+  /// Times a call to a dependency, recording it against stack_data's
+  /// LatencyBreakdown (if there is one), and against the calling thread's
+  /// blocked time.
+  class DependencyTimer
+  {
+  public:
+    DependencyTimer(Dependency dependency);
+    ~DependencyTimer();
+
+  private:
+    Dependency _dependency;
+    Utils::StopWatch _stop_watch;
+  };
+
+  /// Times a call into a Sproutlet, excluding any time spent blocked on
+  /// dependencies.  Does nothing if histogram is NULL.
+  class SproutletTimer
+  {
+  public:
+    SproutletTimer(LatencyHistogram* histogram);
+    ~SproutletTimer();
+
+  private:
+    LatencyHistogram* _histogram;
+    unsigned long _blocked_us;
+    Utils::StopWatch _stop_watch;
+  };
+
+  /// Times SproutletProxy processing, excluding any time spent in Sproutlets
+  /// or blocked on dependencies.  Does nothing if breakdown is NULL.
+  class ProxyTimer
+  {
+  public:
+    ProxyTimer(LatencyBreakdown* breakdown);
+    ~ProxyTimer();
+
+  private:
+    LatencyBreakdown* _breakdown;
+    unsigned long _blocked_us;
+    unsigned long _sproutlet_us;
+    Utils::StopWatch _stop_watch;
+  };
+
+private:
+  static void accumulate(SNMP::EventAccumulatorTable* tbl, unsigned long value);
+
+  LatencyHistogram _queue;
+  LatencyHistogram _processing;
+  LatencyHistogram _proxy;
+  LatencyHistogram _blocked;
+  LatencyHistogram _dependencies[NUM_DEPENDENCIES];
+
+  SNMP::EventAccumulatorTable* _queue_tbl;
+  SNMP::EventAccumulatorTable* _processing_tbl;
+  SNMP::EventAccumulatorTable* _proxy_tbl;
+  SNMP::EventAccumulatorTable* _blocked_tbl;
+
+  // Protects the map, not the statistics in it.
+  pthread_mutex_t _sproutlets_lock;
+  std::map<std::string, SproutletStats*> _sproutlets;
+};
+
+#endif
@@ -21,6 +21,8 @@ extern "C" {
 }
 
 #include <string>
+#include <vector>
+#include <map>
 #include "subscriber_data_manager.h"
 #include "ifchandler.h"
 #include "hssconnection.h"
@@ -51,23 +53,83 @@ namespace NotifyUtils
     NotifyUtils::ContactEvent _contact_event;
   };
 
+  /// A reginfo document (RFC 3680) describing a change to an AoR.
+  ///
+  /// The document is built and serialized once, and then shared by all the
+  /// NOTIFYs that report the change.  The only parts of the document that
+  /// differ between subscriptions are the document version and the
+  /// registration IDs, and these are filled in for each NOTIFY.
+  class RegInfoBody
+  {
+  public:
+    /// Constructor.
+    ///
+    /// @param associated_uris  The IMPUs in the IRS.  There is a registration
+    ///                         element for each unbarred IMPU.
+    /// @param bnis             The bindings to report.  A partial document
+    ///                         only includes the bindings that have changed.
+    /// @param reg_state        The registration state.
+    /// @param doc_state        Whether this is a full or partial document.
+    /// @param trail            SAS trail.
+    RegInfoBody(AssociatedURIs* associated_uris,
+                const std::vector<BindingNotifyInformation*>& bnis,
+                RegistrationState reg_state,
+                DocState doc_state,
+                SAS::TrailId trail);
+
+    /// Returns the document to send on a subscription.
+    ///
+    /// @param subscription     The subscription.
+    /// @param version          The document version.
+    std::string for_subscription(const AoR::Subscription* subscription,
+                                 int version) const;
+
+    RegistrationState reg_state() const { return _reg_state; }
+
+  private:
+    RegistrationState _reg_state;
+
+    // The serialized document is split into segments at the fields that are
+    // filled in for each subscription.  There is one more segment than
+    // there are fields.
+    std::vector<std::string> _segments;
+    std::vector<char> _fields;
+  };
+
+  /// The reginfo documents for a change to an AoR.  Each variant of the
+  /// document is built the first time it is needed.
+  class RegInfoBodyCache
+  {
+  public:
+    RegInfoBodyCache(AssociatedURIs* associated_uris,
+                     const std::vector<BindingNotifyInformation*>& bnis,
+                     SAS::TrailId trail);
+    ~RegInfoBodyCache();
+
+    /// Returns the document with the specified state.  This is owned by the
+    /// cache.
+    const RegInfoBody* get(RegistrationState reg_state, DocState doc_state);
+
+  private:
+    AssociatedURIs* _associated_uris;
+    std::vector<BindingNotifyInformation*> _bnis;
+    SAS::TrailId _trail;
+    std::map<std::pair<RegistrationState, DocState>, RegInfoBody*> _bodies;
+  };
+
   pj_status_t create_subscription_notify(pjsip_tx_data** tdata_notify,
                                          AoR::Subscription* s,
-                                         std::string aor,
-                                         AssociatedURIs* associated_uris,
                                          AoR* aor_data,
-                                         std::vector<BindingNotifyInformation*> bnis,
-                                         NotifyUtils::RegistrationState reg_state,
+                                         const RegInfoBody* body,
+                                         int version,
                                          int now,
                                          SAS::TrailId trail);
 
   pj_status_t create_notify(pjsip_tx_data** tdata_notify,
                             AoR::Subscription* subscription,
-                            std::string aor,
-                            AssociatedURIs* associated_uris,
                             int cseq,
-                            std::vector<BindingNotifyInformation*> bnis,
-                            NotifyUtils::RegistrationState reg_state,
+                            const RegInfoBody* body,
+                            int version,
                             NotifyUtils::SubscriptionState subscription_state,
                             int expiry,
                             SAS::TrailId trail);
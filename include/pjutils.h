@@ -180,7 +180,8 @@ public:
 };
 
 // A function that takes a token and a pjsip_event, and returns a Callback
-// object that can safely be run on another thread.
+// object that can safely be run on another thread.  It may instead return
+// NULL if it has arranged for the callback to be run itself.
 typedef Callback* (*send_callback_builder)(void* token, pjsip_event* event);
 
 pj_status_t send_request(pjsip_tx_data* tdata,
@@ -271,12 +272,24 @@ bool get_npdi(pjsip_uri* uri);
 bool get_rn(pjsip_uri* uri, std::string& routing_value);
 pjsip_param* get_userpart_param(pjsip_uri* uri, pj_str_t param);
 
+// Returns true if the Request-URI should be translated using ENUM, and if so
+// the user part to look up.
+bool get_enum_user(pjsip_msg* req, std::string& user);
+
 void translate_request_uri(pjsip_msg* req,
                            pj_pool_t* pool,
                            EnumService* enum_service,
                            bool should_override_npdi,
                            SAS::TrailId trail);
 
+// Updates the Request-URI using the result of an ENUM lookup performed
+// separately (for example, on a background thread).
+void apply_enum_translation(pjsip_msg* req,
+                            pj_pool_t* pool,
+                            const std::string& new_uri_str,
+                            bool should_override_npdi,
+                            SAS::TrailId trail);
+
 void update_request_uri_np_data(pjsip_msg* req,
                                 pj_pool_t* pool,
                                 EnumService* enum_service,
@@ -0,0 +1,118 @@
+/**
+ * @file pool_allocator.h Allocation from PJLIB pools for C++ objects and
+ * STL containers.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef POOL_ALLOCATOR_H__
+#define POOL_ALLOCATOR_H__
+
+extern "C" {
+#include <pjlib.h>
+}
+
+#include <cstddef>
+#include <new>
+
+/// Allocates memory from a pool, aligned for any type.  PJLIB only aligns
+/// pool allocations to PJ_POOL_ALIGNMENT, which may be less than C++ objects
+/// need.
+///
+/// @returns             - The memory.  Throws std::bad_alloc on failure.
+/// @param  pool         - The pool.
+/// @param  size         - The number of bytes needed.
+inline void* pool_alloc_aligned(pj_pool_t* pool, std::size_t size)
+{
+  const std::size_t align = alignof(std::max_align_t);
+  char* p = (char*)pj_pool_alloc(pool, size + align - 1);
+
+  if (p == NULL)
+  {
+    throw std::bad_alloc(); // LCOV_EXCL_LINE
+  }
+
+  return (void*)(((std::size_t)p + align - 1) & ~(align - 1));
+}
+
+/// @class PoolAllocator
+///
+/// STL allocator that allocates from a PJLIB pool.  Deallocating does
+/// nothing - the memory is only reclaimed when the whole pool is released -
+/// so this is for containers that are destroyed before the pool, and that
+/// don't churn through many more entries than they hold at once.
+///
+/// Like the pool itself, the allocator isn't thread-safe.
+template<typename T>
+class PoolAllocator
+{
+public:
+  typedef T value_type;
+
+  PoolAllocator(pj_pool_t* pool) : _pool(pool) {}
+
+  template<typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : _pool(other.pool()) {}
+
+  T* allocate(std::size_t n)
+  {
+    return (T*)pool_alloc_aligned(_pool, n * sizeof(T));
+  }
+
+  void deallocate(T* p, std::size_t n) {}
+
+  pj_pool_t* pool() const { return _pool; }
+
+private:
+  pj_pool_t* _pool;
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+  return (a.pool() == b.pool());
+}
+
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+  return (a.pool() != b.pool());
+}
+
+/// @class ScopedPool
+///
+/// Owns a PJLIB pool, and releases it when destroyed.  An object whose
+/// members allocate from the pool must declare the ScopedPool before them,
+/// so that the pool outlives them.
+class ScopedPool
+{
+public:
+  ScopedPool(pj_pool_factory* factory,
+             const char* name,
+             pj_size_t initial_size,
+             pj_size_t increment_size) :
+    _pool(pj_pool_create(factory, name, initial_size, increment_size, NULL))
+  {
+  }
+
+  ~ScopedPool()
+  {
+    pj_pool_release(_pool);
+  }
+
+  pj_pool_t* get() const { return _pool; }
+
+private:
+  // Not copyable.
+  ScopedPool(const ScopedPool&);
+  ScopedPool& operator=(const ScopedPool&);
+
+  pj_pool_t* _pool;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * @file prefix_trie.h  Trie for matching numbers against configured prefixes.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PREFIX_TRIE_H__
+#define PREFIX_TRIE_H__
+
+#include <string>
+#include <map>
+#include <utility>
+
+/// Trie of number prefixes, used by the ENUM and BGCF services to find the
+/// configured prefix that best matches a number.
+///
+/// A prefix matches a number if one is a prefix of the other.  Where several
+/// prefixes match, the lexicographically greatest is chosen.  This means that
+/// the longest prefix of the number is chosen, unless the number is itself a
+/// prefix of one or more configured prefixes, in which case the greatest of
+/// those is chosen.  (This is the same result as scanning a std::map of the
+/// prefixes in reverse for the first match, but takes time proportional to
+/// the length of the number, not the number of prefixes.)
+///
+/// The trie isn't thread-safe - it is built once, and then swapped in under
+/// the owner's lock.
+template<class T>
+class PrefixTrie
+{
+public:
+  typedef std::pair<std::string, T> Entry;
+
+  PrefixTrie() : _root(new Node()) {}
+
+  ~PrefixTrie()
+  {
+    delete _root;
+  }
+
+  /// Adds a prefix to the trie.  If the prefix is already present, the
+  /// existing value is kept (as for std::map::insert).
+  ///
+  /// @returns          true if the prefix was added, false if it was already
+  ///                   present.
+  bool insert(const std::string& prefix, const T& value)
+  {
+    Node* node = _root;
+
+    for (std::string::const_iterator c = prefix.begin(); c != prefix.end(); ++c)
+    {
+      Node*& child = node->children[(unsigned char)*c];
+      if (child == NULL)
+      {
+        child = new Node();
+      }
+      node = child;
+    }
+
+    if (node->entry != NULL)
+    {
+      return false;
+    }
+
+    node->entry = new Entry(prefix, value);
+    const Entry* entry = node->entry;
+
+    // Update the greatest entry in the subtree of every node along the path.
+    node = _root;
+    for (std::string::const_iterator c = prefix.begin(); ; ++c)
+    {
+      if ((node->greatest == NULL) ||
+          (node->greatest->first < prefix))
+      {
+        node->greatest = entry;
+      }
+
+      if (c == prefix.end())
+      {
+        break;
+      }
+      node = node->children[(unsigned char)*c];
+    }
+
+    return true;
+  }
+
+  /// Finds the prefix that best matches the number.
+  ///
+  /// @returns          The matching entry, or NULL if there is no match.  The
+  ///                   entry is owned by the trie.
+  const Entry* match(const std::string& number) const
+  {
+    const Node* node = _root;
+    const Entry* longest_prefix = _root->entry;
+
+    for (std::string::const_iterator c = number.begin(); c != number.end(); ++c)
+    {
+      typename std::map<unsigned char, Node*>::const_iterator child =
+                                        node->children.find((unsigned char)*c);
+      if (child == node->children.end())
+      {
+        // No configured prefix continues along the number, so the best match
+        // is the longest prefix of the number.
+        return longest_prefix;
+      }
+
+      node = child->second;
+      if (node->entry != NULL)
+      {
+        longest_prefix = node->entry;
+      }
+    }
+
+    // The whole number is a prefix of every entry under this node, and those
+    // entries are all greater than any prefix of the number.
+    return node->greatest;
+  }
+
+  /// Returns true if the trie has no entries.
+  bool empty() const
+  {
+    return (_root->greatest == NULL);
+  }
+
+  /// Swaps the contents of two tries.
+  void swap(PrefixTrie& other)
+  {
+    std::swap(_root, other._root);
+  }
+
+private:
+  struct Node
+  {
+    Node() : entry(NULL), greatest(NULL) {}
+
+    ~Node()
+    {
+      for (typename std::map<unsigned char, Node*>::iterator i = children.begin();
+           i != children.end();
+           ++i)
+      {
+        delete i->second;
+      }
+      delete entry;
+    }
+
+    std::map<unsigned char, Node*> children;
+
+    // The entry for the prefix ending at this node, if any.
+    Entry* entry;
+
+    // The greatest entry in the subtree rooted at this node.
+    const Entry* greatest;
+  };
+
+  // Not copyable.
+  PrefixTrie(const PrefixTrie&);
+  PrefixTrie& operator=(const PrefixTrie&);
+
+  Node* _root;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * @file priority_eventq.h  Multi-level priority event queue.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PRIORITY_EVENTQ_H__
+#define PRIORITY_EVENTQ_H__
+
+#include <pthread.h>
+#include <time.h>
+#include <deque>
+#include <vector>
+
+/// Thread-safe event queue with a fixed number of priority levels.  Items
+/// are always popped from the highest priority (lowest numbered) non-empty
+/// level, and in FIFO order within a level.
+///
+/// The interface mirrors eventq, with the addition of a priority on push,
+/// so the two can be used interchangeably by the thread dispatcher.
+template<class T>
+class priority_eventq
+{
+public:
+  priority_eventq(unsigned int num_levels) :
+    _levels(num_levels),
+    _size(0),
+    _terminated(false),
+    _deadlock_threshold(0),
+    _last_service_time_ms(0)
+  {
+    pthread_mutex_init(&_m, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+  }
+
+  ~priority_eventq()
+  {
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_m);
+  }
+
+  /// Terminates the queue, waking any threads blocked in pop.
+  void terminate()
+  {
+    pthread_mutex_lock(&_m);
+    _terminated = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_m);
+  }
+
+  /// Sets the time (in milliseconds) for which the queue can be non-empty
+  /// without being serviced before it is considered deadlocked.  Zero
+  /// disables deadlock detection.
+  void set_deadlock_threshold(unsigned long threshold_ms)
+  {
+    pthread_mutex_lock(&_m);
+    _deadlock_threshold = threshold_ms;
+    _last_service_time_ms = now_ms();
+    pthread_mutex_unlock(&_m);
+  }
+
+  /// Returns true if the queue has items on it but has not been serviced
+  /// within the deadlock threshold.
+  bool is_deadlocked()
+  {
+    pthread_mutex_lock(&_m);
+    bool deadlocked = ((_deadlock_threshold > 0) &&
+                       (_size > 0) &&
+                       (now_ms() > _last_service_time_ms + _deadlock_threshold));
+    pthread_mutex_unlock(&_m);
+    return deadlocked;
+  }
+
+  /// Returns the total number of items on the queue, across all levels.
+  int size()
+  {
+    pthread_mutex_lock(&_m);
+    int size = _size;
+    pthread_mutex_unlock(&_m);
+    return size;
+  }
+
+  /// Pushes an item on to the queue at the specified priority level.  Levels
+  /// beyond the lowest priority level are treated as the lowest priority.
+  ///
+  /// @returns          false if the queue has been terminated, true otherwise.
+  bool push(const T& item, unsigned int priority)
+  {
+    if (priority >= _levels.size())
+    {
+      priority = _levels.size() - 1;
+    }
+
+    pthread_mutex_lock(&_m);
+    bool pushed = !_terminated;
+    if (pushed)
+    {
+      if (_size == 0)
+      {
+        // The queue has been empty, so start the service clock afresh.
+        _last_service_time_ms = now_ms();
+      }
+      _levels[priority].push_back(item);
+      ++_size;
+      pthread_cond_signal(&_cond);
+    }
+    pthread_mutex_unlock(&_m);
+    return pushed;
+  }
+
+  /// Pops the highest priority item from the queue, waiting if necessary.
+  ///
+  /// @returns          true if an item was popped, false if the queue was
+  ///                   terminated or the timeout expired.
+  /// @param item       The item that was popped off the queue.
+  /// @param timeout_ms Timeout in milliseconds.  Zero means no waiting, -1
+  ///                   means wait forever.
+  bool pop(T& item, int timeout_ms)
+  {
+    pthread_mutex_lock(&_m);
+
+    if ((_size == 0) && (!_terminated) && (timeout_ms != 0))
+    {
+      if (timeout_ms < 0)
+      {
+        while ((_size == 0) && (!_terminated))
+        {
+          pthread_cond_wait(&_cond, &_m);
+        }
+      }
+      else
+      {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+
+        while ((_size == 0) && (!_terminated))
+        {
+          if (pthread_cond_timedwait(&_cond, &_m, &deadline) != 0)
+          {
+            break;
+          }
+        }
+      }
+    }
+
+    bool popped = false;
+    if ((_size > 0) && (!_terminated))
+    {
+      for (typename std::vector<std::deque<T> >::iterator level = _levels.begin();
+           level != _levels.end();
+           ++level)
+      {
+        if (!level->empty())
+        {
+          item = level->front();
+          level->pop_front();
+          --_size;
+          _last_service_time_ms = now_ms();
+          popped = true;
+          break;
+        }
+      }
+    }
+
+    pthread_mutex_unlock(&_m);
+    return popped;
+  }
+
+  /// Pops the highest priority item from the queue, waiting until there is
+  /// one or the queue is terminated.
+  bool pop(T& item)
+  {
+    return pop(item, -1);
+  }
+
+private:
+  static unsigned long now_ms()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+  }
+
+  pthread_mutex_t _m;
+  pthread_cond_t _cond;
+  std::vector<std::deque<T> > _levels;
+  int _size;
+  bool _terminated;
+  unsigned long _deadlock_threshold;
+  unsigned long _last_service_time_ms;
+};
+
+#endif
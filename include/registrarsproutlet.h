@@ -18,6 +18,7 @@
 
 #include "enumservice.h"
 #include "subscriber_data_manager.h"
+#include "aor_replicator.h"
 #include "stack.h"
 #include "ifchandler.h"
 #include "hssconnection.h"
@@ -49,7 +50,8 @@ public:
                      SNMP::RegistrationStatsTables* reg_stats_tbls,
                      SNMP::RegistrationStatsTables* third_party_reg_stats_tbls,
                      FIFCService* fifcservice,
-                     IFCConfiguration ifc_configuration);
+                     IFCConfiguration ifc_configuration,
+                     AoRReplicator* aor_replicator = NULL);
   ~RegistrarSproutlet();
 
   bool init();
@@ -70,6 +72,10 @@ private:
   SubscriberDataManager* _sdm;
   std::vector<SubscriberDataManager*> _remote_sdms;
 
+  // Writes changes to the remote stores in the background.  If this is NULL,
+  // the remote stores are written to before the REGISTER is responded to.
+  AoRReplicator* _aor_replicator;
+
   // Connection to the HSS service for retrieving associated public URIs.
   HSSConnection* _hss;
 
@@ -25,12 +25,17 @@ extern "C" {
 #include "hssconnection.h"
 #include "snmp_success_fail_count_table.h"
 #include "fifcservice.h"
+#include "third_party_reg_engine.h"
 
 namespace RegistrationUtils {
 
 void init(SNMP::RegistrationStatsTables* third_party_reg_stats_tables_arg,
           bool force_third_party_register_body_arg);
 
+// Sets the engine used to send third-party REGISTERs in the background.  If
+// this is NULL (the default), they are sent inline.
+void set_third_party_reg_engine(ThirdPartyRegEngine* third_party_reg_engine_arg);
+
 bool remove_bindings(SubscriberDataManager* sdm,
                      std::vector<SubscriberDataManager*> remote_sdms,
                      HSSConnection* hss,
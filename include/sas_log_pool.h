@@ -0,0 +1,142 @@
+/**
+ * @file sas_log_pool.h Definitions for SasLogPool class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SAS_LOG_POOL_H__
+#define SAS_LOG_POOL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sas.h"
+#include "snmp_counter_table.h"
+
+/// @class SasLogPool
+///
+/// Logs SIP messages to SAS from a pool of background threads.
+///
+/// Compressing the message and reporting the event to SAS is expensive, and
+/// is otherwise done on the transport thread, which limits the throughput of
+/// the whole node.  Instead, the transport thread copies the message into a
+/// fixed size ring, and the pool threads build and report the events.
+///
+/// If the ring is full, the message isn't logged (rather than holding up the
+/// transport thread), and the dropped message is counted.
+class SasLogPool
+{
+public:
+  /// Function used to report a queued message - report_msg, other than in UT.
+  typedef std::function<void(uint32_t event_id,
+                             SAS::TrailId trail,
+                             uint32_t transport_type,
+                             uint32_t port,
+                             const char* addr,
+                             const char* msg,
+                             int msg_len,
+                             SAS::Timestamp timestamp)> ReportFn;
+
+  /// Constructor.
+  ///
+  /// @param num_threads        - The number of logging threads.
+  /// @param max_queue          - The maximum number of messages waiting to be
+  ///                             logged.
+  /// @param dropped_tbl        - Statistic counting the messages that weren't
+  ///                             logged because the queue was full.
+  /// @param report_fn          - Function used to report each message.
+  SasLogPool(int num_threads,
+             int max_queue = DEFAULT_MAX_QUEUE,
+             SNMP::CounterTable* dropped_tbl = NULL,
+             ReportFn report_fn = &SasLogPool::report_msg);
+
+  /// Destructor.  Any messages that haven't been logged are discarded.
+  virtual ~SasLogPool();
+
+  /// Queues a SIP message to be logged.
+  ///
+  /// @param event_id           - The SAS event ID (RX_SIP_MSG or TX_SIP_MSG).
+  /// @param trail              - The SAS trail to log to.
+  /// @param transport_type     - The PJSIP transport type.
+  /// @param port               - The remote port.
+  /// @param addr               - The remote address.
+  /// @param msg                - The message, as sent on the wire.
+  /// @param msg_len            - The length of the message.
+  ///
+  /// @returns                  - false if the message was dropped.
+  bool log_msg(uint32_t event_id,
+               SAS::TrailId trail,
+               uint32_t transport_type,
+               uint32_t port,
+               const char* addr,
+               const char* msg,
+               int msg_len);
+
+  /// Waits until all queued messages have been logged.
+  void flush();
+
+  /// Reports a SIP message event to SAS.  This is used by the pool threads,
+  /// and also directly when there's no pool.
+  ///
+  /// @param timestamp          - The time the message was queued, or 0 to
+  ///                             timestamp the event now.
+  static void report_msg(uint32_t event_id,
+                         SAS::TrailId trail,
+                         uint32_t transport_type,
+                         uint32_t port,
+                         const char* addr,
+                         const char* msg,
+                         int msg_len,
+                         SAS::Timestamp timestamp = 0);
+
+  static const int DEFAULT_MAX_QUEUE = 10000;
+
+private:
+  /// A message waiting to be logged.  The slot is reserved on the ring before
+  /// the message is copied into it, and isn't logged until it's ready.
+  struct Entry
+  {
+    bool ready;
+    SAS::Timestamp timestamp;
+    uint32_t event_id;
+    SAS::TrailId trail;
+    uint32_t transport_type;
+    uint32_t port;
+    std::string addr;
+    std::string msg;
+  };
+
+  static void* thread_fn(void* p);
+  void process_entries();
+
+  // The ring of entries.  _head is the next entry to log, and _count the
+  // number waiting (including those still being copied in).
+  std::vector<Entry> _ring;
+  size_t _head;
+  size_t _count;
+
+  // The number of entries taken off the ring but not yet logged.
+  int _in_progress;
+
+  pthread_mutex_t _lock;
+
+  // Signalled when there are entries to log, and when there are none left
+  // to log.
+  pthread_cond_t _cond;
+  pthread_cond_t _idle_cond;
+  bool _terminated;
+  std::vector<pthread_t> _threads;
+
+  SNMP::CounterTable* _dropped_tbl;
+  ReportFn _report_fn;
+};
+
+#endif
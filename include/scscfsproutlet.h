@@ -298,6 +298,10 @@ private:
   /// Apply originating services for this request.
   void apply_originating_services(pjsip_msg* req);
 
+  /// Route a request at the end of originating services, once its
+  /// Request-URI has been translated using ENUM.
+  void route_translated_request(pjsip_msg* req);
+
   /// Apply terminating services for this request.
   void apply_terminating_services(pjsip_msg* req);
 
@@ -443,6 +447,11 @@ private:
   /// responding.
   TimerID _liveness_timer;
 
+  /// The request parked while an ENUM lookup runs in the background, and
+  /// the result of the lookup.
+  pjsip_msg* _enum_req;
+  std::string _enum_result;
+
   /// Track if this transaction has already record-routed itself to prevent
   /// us accidentally record routing twice.
   bool _record_routed;
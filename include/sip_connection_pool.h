@@ -54,6 +54,8 @@ private:
   void quiesce_connections();
   void transport_state_update(pjsip_transport* tp, pjsip_transport_state state);
   void recycle_connections();
+  int select_slot();
+  int outstanding(int hash_slot);
   void increment_connection_count(pjsip_transport *);
   void decrement_connection_count(pjsip_transport *);
 
@@ -71,6 +73,13 @@ private:
   pjsip_endpoint* _endpt;
   pjsip_tpfactory* _tpfactory;
 
+  // Connections with many more outstanding messages than average are
+  // quiesced early, as their send queue is backing up.  A connection is
+  // backed up if it has at least BACKLOG_MIN outstanding messages, and
+  // BACKLOG_FACTOR times the average of the other connections.
+  static const int BACKLOG_MIN = 50;
+  static const int BACKLOG_FACTOR = 4;
+
   pj_thread_t* _recycler;
   volatile bool _terminated;
 
@@ -12,9 +12,24 @@
 #ifndef SIPRESOLVER_H__
 #define SIPRESOLVER_H__
 
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+
 #include "baseresolver.h"
 #include "sas.h"
 
+/// @class SIPResolver
+///
+/// Resolves SIP targets following RFC 3263.
+///
+/// Where the port isn't specified, the transport and the name to look up SRV
+/// or A/AAAA records for are selected using NAPTR and SRV records.  Most
+/// traffic goes to a handful of next hops, so this selection is remembered
+/// for each name (until the TTL of the records it used expires).  The SRV
+/// and A/AAAA look-ups that select the targets themselves are still done for
+/// every request, so that the targets are load-balanced according to their
+/// weights and blacklisted targets are avoided.
 class SIPResolver : public BaseResolver
 {
 public:
@@ -35,6 +50,53 @@ public:
   static const int DEFAULT_BLACKLIST_DURATION = 30;
 
   std::string get_transport_str(int transport);
+
+  /// The maximum number of selections remembered in each shard.
+  static const size_t MAX_SELECTIONS_PER_SHARD = 256;
+
+private:
+  /// The outcome of selecting the transport for a name - the transport, and
+  /// either the SRV name to look up, or the name to look up A/AAAA records
+  /// for.
+  struct Selection
+  {
+    int transport;
+    std::string srv_name;
+    std::string a_name;
+    unsigned long expiry_ms;
+  };
+
+  /// Selects the transport for a name, using a remembered selection if
+  /// possible.
+  void select_transport(const std::string& name,
+                        int& transport,
+                        std::string& srv_name,
+                        std::string& a_name,
+                        SAS::TrailId trail);
+
+  /// Selects the transport for a name using NAPTR and SRV records.
+  ///
+  /// @returns                  - The TTL of the selection in seconds, or 0
+  ///                             if it mustn't be remembered.
+  int lookup_transport(const std::string& name,
+                       int& transport,
+                       std::string& srv_name,
+                       std::string& a_name,
+                       SAS::TrailId trail);
+
+  static unsigned long now_ms();
+
+  /// The remembered selections are sharded by name, to avoid contention
+  /// between worker threads.
+  static const int NUM_SHARDS = 16;
+
+  struct SelectionShard
+  {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, Selection> selections;
+  };
+
+  SelectionShard _selection_shards[NUM_SHARDS];
 };
 
 #endif
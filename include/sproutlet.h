@@ -20,6 +20,7 @@ extern "C" {
 }
 
 #include <list>
+#include <functional>
 #include "baseresolver.h"
 #include "snmp_success_fail_count_by_request_type_table.h"
 #include "fork_error_state.h"
@@ -172,6 +173,11 @@ public:
   /// Returns a mutable clone of the original request.  This can be modified
   /// and sent by the Sproutlet using the send_request call.
   ///
+  /// ACKs that nothing upstream still holds are passed to the Sproutlet
+  /// without being cloned, so the request passed to the Sproutlet is the
+  /// original.  In that case the clone includes any changes the Sproutlet
+  /// has already made to the request.
+  ///
   /// @returns             - A clone of the original request message.
   ///
   virtual pjsip_msg* original_request() = 0;
@@ -319,6 +325,16 @@ public:
   ///
   virtual pj_pool_t* get_pool(const pjsip_msg* msg) = 0;
 
+  /// Returns a pool that lasts as long as the transaction, which the
+  /// Sproutlet can use for its own state.  Anything allocated from the pool
+  /// is freed when the transaction ends, so needn't be freed individually.
+  /// The pool must only be used within the transaction's context (and not,
+  /// for example, from background work).
+  ///
+  /// @returns             - The pool, or NULL if there isn't one.
+  ///
+  virtual pj_pool_t* get_tsx_pool() = 0;
+
   /// Returns a brief one line summary of the message.
   ///
   /// @returns             - Message information
@@ -353,6 +369,21 @@ public:
   ///
   virtual bool timer_running(TimerID id) = 0;
 
+  /// Runs a piece of blocking work (such as a DNS query) on a background
+  /// thread, so that it doesn't tie up a worker thread.  When the work
+  /// completes, the on_timer_expiry callback is called back with the context
+  /// parameter, exactly as if a timer had popped.  The work runs outside the
+  /// transaction's context, so must not touch the transaction or its messages
+  /// - it should just store its results for the callback to pick up.
+  ///
+  /// @returns             - true if the work has been queued, false if
+  ///                        background work isn't available, in which case
+  ///                        the caller should do the work inline.
+  /// @param  context      - Context parameter returned on the callback.
+  /// @param  work         - The work to run.
+  ///
+  virtual bool run_in_background(void* context, std::function<void()> work) = 0;
+
   /// Returns the SAS trail identifier that should be used for any SAS events
   /// related to this service invocation.
   ///
@@ -489,7 +520,9 @@ public:
 protected:
 
   /// Returns a mutable clone of the original request.  This can be modified
-  /// and sent by the Sproutlet using the send_request call.
+  /// and sent by the Sproutlet using the send_request call.  For ACKs, this
+  /// may include any changes already made to the request passed to the
+  /// Sproutlet - see SproutletTsxHelper::original_request.
   ///
   /// @returns             - A clone of the original request message.
   ///
@@ -658,6 +691,15 @@ protected:
   pj_pool_t* get_pool(const pjsip_msg* msg)
     {return _helper->get_pool(msg);}
 
+  /// Returns a pool that lasts as long as the transaction, which the
+  /// Sproutlet can use for its own state.  Anything allocated from the pool
+  /// is freed when the transaction ends.
+  ///
+  /// @returns             - The pool, or NULL if there isn't one.
+  ///
+  pj_pool_t* get_tsx_pool()
+    {return _helper->get_tsx_pool();}
+
   /// Returns a brief one line summary of the message.
   ///
   /// @returns             - Message information
@@ -696,6 +738,17 @@ protected:
   bool timer_running(TimerID id)
     {return _helper->timer_running(id);}
 
+  /// Runs a piece of blocking work on a background thread, calling back
+  /// on_timer_expiry with the context parameter when it completes.
+  ///
+  /// @returns             - true if the work has been queued, false if the
+  ///                        caller should do the work inline.
+  /// @param  context      - Context parameter returned on the callback.
+  /// @param  work         - The work to run.
+  ///
+  bool run_in_background(void* context, std::function<void()> work)
+    {return _helper->run_in_background(context, work);}
+
   /// Returns the SAS trail identifier that should be used for any SAS events
   /// related to this service invocation.
   ///
@@ -190,6 +190,7 @@ private:
 
   SproutletTsxHelper* _helper;
   pj_pool_t* _pool;
+  bool _own_pool;
   pjsip_route_hdr _route_set;
   bool _record_routed;
   std::string _rr_param_value;
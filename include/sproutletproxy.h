@@ -12,15 +12,26 @@
 #ifndef SPROUTLETPROXY_H__
 #define SPROUTLETPROXY_H__
 
+extern "C" {
+#include <pjlib.h>
+}
+
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
+#include <deque>
+#include <vector>
+#include <functional>
 
 #include "basicproxy.h"
 #include "sproutlet.h"
 #include "snmp_sip_request_types.h"
 #include "sproutlet_options.h"
+#include "priority_eventq.h"
+#include "pool_allocator.h"
+#include "snmp_event_accumulator_table.h"
+#include "latency_breakdown.h"
 
 class SproutletWrapper;
 
@@ -39,13 +50,23 @@ public:
   ///                               stateless proxies.
   /// @param  max_sproutlet_depth - The maximum number of Sproutlets that can be
   ///                               invoked in a row before we break the loop.
+  /// @param  num_background_threads - The number of threads available to
+  ///                               Sproutlets for blocking work.  If zero,
+  ///                               Sproutlets must do such work inline.
+  /// @param  clones_tbl          - Statistic tracking the number of messages
+  ///                               cloned per transaction.  May be NULL.
+  /// @param  latency_breakdown   - Records the time spent in each Sproutlet
+  ///                               and in the proxy itself.  May be NULL.
   SproutletProxy(pjsip_endpoint* endpt,
                  int priority,
                  const std::string& root_uri,
                  const std::unordered_set<std::string>& host_aliases,
                  const std::list<Sproutlet*>& sproutlets,
                  const std::set<std::string>& stateless_proxies,
-                 int max_sproutlet_depth=DEFAULT_MAX_SPROUTLET_DEPTH);
+                 int max_sproutlet_depth=DEFAULT_MAX_SPROUTLET_DEPTH,
+                 int num_background_threads=0,
+                 SNMP::EventAccumulatorTable* clones_tbl=NULL,
+                 LatencyBreakdown* latency_breakdown=NULL);
 
   /// Destructor.
   virtual ~SproutletProxy();
@@ -136,6 +157,61 @@ protected:
   bool cancel_timer(pj_timer_entry* tentry);
   bool timer_running(pj_timer_entry* tentry);
 
+  /// Queues work for the background threads.  Returns false if there are no
+  /// background threads.
+  bool run_in_background(std::function<void()> work);
+
+  /// Entry point for the background threads.
+  static void* background_thread(void* p);
+
+  /// Callback used to report the completion of background work to a
+  /// Sproutlet as a timer pop, on a worker thread.
+  class BackgroundWorkCallback;
+
+  /// Hash and equality functors for indexing by pj_str_t, so that the routing
+  /// tables can be searched directly with strings from parsed URIs without
+  /// building a std::string for each lookup.
+  struct PjStrHash
+  {
+    size_t operator()(const pj_str_t& s) const
+    {
+      return pj_hash_calc(0, s.ptr, s.slen);
+    }
+  };
+
+  struct PjStrEqual
+  {
+    bool operator()(const pj_str_t& s1, const pj_str_t& s2) const
+    {
+      return (pj_strcmp(&s1, &s2) == 0);
+    }
+  };
+
+  struct PjStrCaseHash
+  {
+    size_t operator()(const pj_str_t& s) const
+    {
+      size_t hash = 0;
+      for (pj_ssize_t ii = 0; ii < s.slen; ++ii)
+      {
+        hash = (hash * 31) + pj_tolower(s.ptr[ii]);
+      }
+      return hash;
+    }
+  };
+
+  struct PjStrCaseEqual
+  {
+    bool operator()(const pj_str_t& s1, const pj_str_t& s2) const
+    {
+      return (pj_stricmp(&s1, &s2) == 0);
+    }
+  };
+
+  /// Adds a service name or alias to the service index.  The name must
+  /// remain valid for the lifetime of the proxy.
+  void index_service(const std::string& name, Sproutlet* sproutlet);
+
   class UASTsx : public BasicProxy::UASTsx
   {
   public:
@@ -180,6 +256,10 @@ protected:
     bool schedule_timer(SproutletWrapper* tsx, void* context, TimerID& id, int duration);
     bool cancel_timer(TimerID id);
     bool timer_running(TimerID id);
+    bool run_in_background(SproutletWrapper* tsx,
+                           void* context,
+                           TimerID& id,
+                           std::function<void()> work);
 
     void tx_response(SproutletWrapper* sproutlet,
                      pjsip_tx_data* rsp);
@@ -196,16 +276,87 @@ protected:
                                     int port,
                                     std::string& alias);
 
+    /// Pool holding the SproutletWrappers, timers and bookkeeping for this
+    /// transaction, which is all released in one go when the UASTsx is
+    /// destroyed.  This must be declared before anything allocated from it.
+    ScopedPool _pool;
+
     /// The root Sproutlet for this transaction.
     SproutletWrapper* _root;
 
+    /// Small map held as a flat vector of key/value pairs, allocated from
+    /// the transaction's pool.  A transaction only ever has a handful of hops
+    /// and forks, so a linear search is cheaper than a tree, and doesn't
+    /// allocate a node for every entry.
+    template<typename K, typename V>
+    class FlatMap
+    {
+    public:
+      typedef std::vector<std::pair<K, V>, PoolAllocator<std::pair<K, V> > > Entries;
+      typedef typename Entries::iterator iterator;
+
+      FlatMap(pj_pool_t* pool) :
+        _entries(PoolAllocator<std::pair<K, V> >(pool))
+      {
+      }
+
+      iterator begin() { return _entries.begin(); }
+      iterator end() { return _entries.end(); }
+      bool empty() const { return _entries.empty(); }
+      size_t size() const { return _entries.size(); }
+
+      iterator find(const K& key)
+      {
+        iterator it = _entries.begin();
+        while ((it != _entries.end()) && (!(it->first == key)))
+        {
+          ++it;
+        }
+        return it;
+      }
+
+      V& operator[](const K& key)
+      {
+        iterator it = find(key);
+        if (it == _entries.end())
+        {
+          _entries.push_back(std::make_pair(key, V()));
+          it = _entries.end() - 1;
+        }
+        return it->second;
+      }
+
+      void erase(iterator it)
+      {
+        // The order of the entries doesn't matter, so just move the last
+        // entry into the gap.
+        if (it != _entries.end() - 1)
+        {
+          *it = _entries.back();
+        }
+        _entries.pop_back();
+      }
+
+      void erase(const K& key)
+      {
+        iterator it = find(key);
+        if (it != _entries.end())
+        {
+          erase(it);
+        }
+      }
+
+    private:
+      Entries _entries;
+    };
+
     /// Templated type used to map from upstream Sproutlet/fork to the
     /// downstream Sproutlet or UACTsx.
     template<typename T>
     struct DMap
     {
-      typedef std::map<std::pair<SproutletWrapper*, int>, T> type;
-      typedef typename std::map<std::pair<SproutletWrapper*, int>, T>::iterator iterator;
+      typedef FlatMap<std::pair<SproutletWrapper*, int>, T> type;
+      typedef typename type::iterator iterator;
     };
 
     /// Mapping from upstream Sproutlet/fork to downstream Sproutlet.
@@ -216,7 +367,7 @@ protected:
 
     /// Mapping from downstream Sproutlet or UAC transaction to upstream
     /// Sproutlet/fork.
-    typedef std::map<void*, std::pair<SproutletWrapper*, int> > UMap;
+    typedef FlatMap<void*, std::pair<SproutletWrapper*, int> > UMap;
     UMap _umap;
 
     /// Queue of pending requests to be scheduled.
@@ -228,7 +379,8 @@ protected:
       int sproutlet_depth;
       std::string upstream_network_func;
     } PendingRequest;
-    std::queue<PendingRequest> _pending_req_q;
+    std::queue<PendingRequest,
+               std::deque<PendingRequest, PoolAllocator<PendingRequest> > > _pending_req_q;
 
     /// Parent proxy object
     SproutletProxy* _sproutlet_proxy;
@@ -238,12 +390,19 @@ protected:
     /// (they are not freed when a timer pops or is cancelled for example).
     /// This prevents race conditions (such as a double free caused by one
     /// thread popping a timer and another thread cancelling it).
-    std::set<pj_timer_entry*> _timers;
+    typedef std::set<pj_timer_entry*,
+                     std::less<pj_timer_entry*>,
+                     PoolAllocator<pj_timer_entry*> > TimerSet;
+    TimerSet _timers;
 
     /// This set holds all the timers created by sproutlet tsx that are
     /// children of this UASTsx that have not popped or been cancelled yet.
     /// The UASTsx will persist while there are pending timers.
-    std::set<pj_timer_entry*> _pending_timers;
+    TimerSet _pending_timers;
+
+    /// The number of times the Sproutlets on this transaction have cloned a
+    /// request or response.
+    int _num_clones;
 
     friend class SproutletWrapper;
   };
@@ -255,12 +414,35 @@ protected:
 
   std::map<std::string, Sproutlet*> _services;
 
+  /// Index of the local hostnames (the root URI host and the host aliases),
+  /// matched case-insensitively.  The keys point into _root_uri and
+  /// _host_aliases.
+  typedef std::unordered_set<pj_str_t, PjStrCaseHash, PjStrCaseEqual> HostIndex;
+  HostIndex _local_host_index;
+
+  /// Index of service names and aliases to Sproutlets.  The keys point into
+  /// the keys of _services.
+  typedef std::unordered_map<pj_str_t, Sproutlet*, PjStrHash, PjStrEqual> ServiceIndex;
+  ServiceIndex _service_index;
+
   std::map<int, Sproutlet*> _ports;
 
   std::list<Sproutlet*> _sproutlets;
 
   const int _max_sproutlet_depth;
 
+  /// Queue of work for the background threads, and the threads themselves.
+  priority_eventq<std::function<void()>> _background_q;
+  std::vector<pthread_t> _background_threads;
+
+  /// Statistic tracking the number of clones made per transaction.
+  SNMP::EventAccumulatorTable* _clones_tbl;
+
+  /// Latency statistics for the proxy, and for each Sproutlet.  The map is
+  /// only written by the constructor, so can be read without locking.
+  LatencyBreakdown* _latency_breakdown;
+  std::unordered_map<const Sproutlet*, LatencyBreakdown::SproutletStats*> _sproutlet_latency_stats;
+
   static const pj_str_t STR_SERVICE;
 
   friend class UASTsx;
@@ -286,6 +468,13 @@ public:
   /// Virtual destructor.
   virtual ~SproutletWrapper();
 
+  /// SproutletWrappers are allocated from their transaction's pool, so are
+  /// freed along with it.
+  static void* operator new(size_t size, pj_pool_t* pool)
+    { return pool_alloc_aligned(pool, size); }
+  static void operator delete(void* p, pj_pool_t* pool) {}
+  static void operator delete(void* p) {}
+
   const std::string& service_name() const;
 
   /// This implementation has concrete implementations for all of the virtual
@@ -310,9 +499,11 @@ public:
   const ForkState& fork_state(int fork_id);
   void free_msg(pjsip_msg*& msg);
   pj_pool_t* get_pool(const pjsip_msg* msg);
+  pj_pool_t* get_tsx_pool();
   bool schedule_timer(void* context, TimerID& id, int duration);
   void cancel_timer(TimerID id);
   bool timer_running(TimerID id);
+  bool run_in_background(void* context, std::function<void()> work);
   SAS::TrailId trail() const;
   bool is_uri_reflexive(const pjsip_uri*) const;
   pjsip_sip_uri* get_reflexive_uri(pj_pool_t*) const;
@@ -327,6 +518,7 @@ public:
 
 private:
   void rx_request(pjsip_tx_data* req);
+  pjsip_msg* adopt_request();
   void rx_response(pjsip_tx_data* rsp, int fork_id);
   void rx_cancel(pjsip_tx_data* cancel);
   void rx_error(int status_code);
@@ -344,6 +536,18 @@ private:
   bool is_uri_local(const pjsip_uri*) const;
   void log_inter_sproutlet(pjsip_tx_data* tdata, bool downstream);
 
+  /// The histograms to record the time spent in the Sproutlet handling
+  /// requests and responses, or NULL if it isn't being recorded.
+  LatencyHistogram* request_latency_histogram() const
+  {
+    return (_latency_stats != NULL) ? &_latency_stats->request : NULL;
+  }
+
+  LatencyHistogram* response_latency_histogram() const
+  {
+    return (_latency_stats != NULL) ? &_latency_stats->response : NULL;
+  }
+
   SproutletProxy* _proxy;
 
   SproutletProxy::UASTsx* _proxy_tsx;
@@ -352,6 +556,10 @@ private:
 
   SproutletTsx* _sproutlet_tsx;
 
+  /// Where to record the time spent in the Sproutlet.  NULL if it isn't being
+  /// recorded.
+  LatencyBreakdown::SproutletStats* _latency_stats;
+
   std::string _service_name;
   std::string _service_host;
 
@@ -365,6 +573,19 @@ private:
   pjsip_tx_data* _req;
   SNMP::SIPRequestTypes _req_type;
 
+  /// Set if the Sproutlet was passed _req itself rather than a clone of it,
+  /// because nothing upstream needed it any more.  In this case the top Route
+  /// header removed from the request is saved in _adopted_route_hdr, and any
+  /// later call to original_request() clones the request as the Sproutlet has
+  /// left it.
+  ///
+  /// Only ACKs are adopted.  Every other request is still held by the
+  /// upstream Sproutlet's fork (to build CANCELs and error responses) or by
+  /// the UAS transaction, so must be cloned, and Sproutlets rely on
+  /// original_request() returning the request as received for them.
+  bool _req_adopted;
+  pjsip_route_hdr* _adopted_route_hdr;
+
   // Immutable reference to the transport used by the original request.
   pjsip_transport* _original_transport;
 
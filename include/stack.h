@@ -27,6 +27,7 @@ extern "C" {
 
 /* Pre-declariations */
 class LastValueCache;
+class LatencyBreakdown;
 
 /* Options */
 struct stack_data_struct
@@ -60,6 +61,7 @@ struct stack_data_struct
 
   std::vector<pj_str_t> name;
   LastValueCache *     stats_aggregator;
+  LatencyBreakdown*    latency_breakdown;
 
   bool record_route_on_every_hop;
   bool record_route_on_initiation_of_originating;
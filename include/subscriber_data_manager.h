@@ -21,13 +21,14 @@
 
 #include "astaire_aor_store.h"
 #include "chronosconnection.h"
+#include "chronos_timer_batcher.h"
 #include "sas.h"
 #include "analyticslogger.h"
 #include "associated_uris.h"
 
 // We need to declare the parts of NotifyUtils needed below to avoid a
 // circular dependency between this and notify_utils.h
-namespace NotifyUtils { struct BindingNotifyInformation; };
+namespace NotifyUtils { struct BindingNotifyInformation; enum class DocState; };
 
 typedef NotifyUtils::BindingNotifyInformation ClassifiedBinding;
 typedef std::vector<ClassifiedBinding*> ClassifiedBindings;
@@ -44,7 +45,14 @@ public:
   class ChronosTimerRequestSender
   {
   public:
-    ChronosTimerRequestSender(ChronosConnection* chronos_conn);
+    /// Constructor.
+    ///
+    /// @param chronos_conn   The connection to Chronos
+    /// @param timer_batcher  If set, timer requests are queued on this to be
+    ///                       sent in the background, rather than being sent
+    ///                       before the AoR is written
+    ChronosTimerRequestSender(ChronosConnection* chronos_conn,
+                              ChronosTimerBatcher* timer_batcher = NULL);
 
     virtual ~ChronosTimerRequestSender();
 
@@ -65,6 +73,7 @@ public:
 
   private:
     ChronosConnection* _chronos_conn;
+    ChronosTimerBatcher* _timer_batcher;
 
     /// Build the tag info map from an AoR
     virtual void build_tag_info(AoR* aor,
@@ -91,46 +100,63 @@ public:
   class NotifySender
   {
   public:
+    /// A NOTIFY to send for a change to an AoR.
+    struct PendingNotify
+    {
+      /// The ID of the subscription to send the NOTIFY on.
+      std::string s_id;
+
+      /// Whether the subscription has ended, in which case it is only in the
+      /// original AoR.
+      bool ended;
+
+      /// Whether to report the full state of the AoR, or just the bindings
+      /// that have changed.
+      NotifyUtils::DocState doc_state;
+
+      /// The version of the reginfo document.
+      int version;
+    };
+
+    /// The NOTIFYs to send for a change to an AoR, and the bindings to
+    /// report in them.
+    struct PendingNotifys
+    {
+      ~PendingNotifys();
+
+      ClassifiedBindings bindings;
+      std::vector<PendingNotify> notifys;
+    };
+
     NotifySender();
 
     virtual ~NotifySender();
 
-    /// Create and send any appropriate NOTIFYs
+    /// Work out which NOTIFYs need to be sent for a change to an AoR, and
+    /// move on the reginfo version of each subscription they are sent on.
+    /// This must be called before the AoR is written to the store, so that
+    /// the new versions are written along with the rest of the AoR.
+    ///
+    /// @param aor_pair     The AoR pair to send NOTIFYs for
+    /// @param notifys      Filled in with the NOTIFYs to send
+    void prepare_notifys(AoRPair* aor_pair,
+                         PendingNotifys& notifys);
+
+    /// Create and send the NOTIFYs for a change to an AoR.
     ///
     /// @param aor_id       The AoR ID
-    /// @param associated_uris
-    ///                     The IMPUs associated with this IRS
     /// @param aor_pair     The AoR pair to send NOTIFYs for
+    /// @param notifys      The NOTIFYs, from prepare_notifys
     /// @param now          The current time
     /// @param trail        SAS trail
     void send_notifys(const std::string& aor_id,
                       AoRPair* aor_pair,
+                      PendingNotifys& notifys,
                       int now,
                       SAS::TrailId trail);
 
     /// SubscriberDataManager is the only class that can use NotifySender
     friend class SubscriberDataManager;
-
-  private:
-    // Create and send any appropriate NOTIFYs for any expired subscriptions
-    //
-    // @param aor_id       The AoR ID
-    // @param associated_uris
-    //                     The IMPUs associated with this IRS
-    // @param aor_pair     The AoR pair to send NOTIFYs for
-    // @param binding_info_to_notify
-    //                     The list of bindings to include on the NOTIFY
-    // @param expired_binding_uris
-    //                     A list of URIs of expired bindings
-    // @param now          The current time
-    // @param trail        SAS trail
-    void send_notifys_for_expired_subscriptions(
-                                   const std::string& aor_id,
-                                   AoRPair* aor_pair,
-                                   ClassifiedBindings binding_info_to_notify,
-                                   std::vector<std::string> expired_binding_uris,
-                                   int now,
-                                   SAS::TrailId trail);
   };
 
   /// Tags to use when setting timers for nothing, for registration and for subscription.
@@ -146,10 +172,15 @@ public:
   /// @param analytics_logger   - AnalyticsLogger for reporting registration events.
   /// @param is_primary         - Whether the underlying data store is the local
   ///                             store or remote
+  /// @param chronos_timer_threads
+  ///                           - Number of threads sending Chronos timer
+  ///                             requests in the background.  If 0, timer
+  ///                             requests are sent before each AoR is written.
   SubscriberDataManager(AoRStore* aor_store,
                         ChronosConnection* chronos_connection,
                         AnalyticsLogger* analytics_logger,
-                        bool is_primary);
+                        bool is_primary,
+                        int chronos_timer_threads = 0);
 
   /// Destructor.
   virtual ~SubscriberDataManager();
@@ -182,6 +213,27 @@ public:
                                      SAS::TrailId trail,
                                      bool& all_bindings_expired = unused_bool);
 
+  /// Store the ID of an AoR's Chronos timer.  Only the timer ID is changed,
+  /// and none of the processing done by set_aor_data (expiring bindings,
+  /// sending timer requests or NOTIFYs) is done.  Retries on data contention.
+  ///
+  /// @param aor_id    The AoR ID
+  /// @param timer_id  The timer ID
+  /// @param trail     SAS trail
+  ///
+  /// @returns false if the AoR has no bindings (so doesn't need a timer),
+  ///          true otherwise
+  virtual bool store_timer_id(const std::string& aor_id,
+                              const std::string& timer_id,
+                              SAS::TrailId trail);
+
+  /// Set the remote stores that timer IDs are also written to, once the
+  /// timer has been set in the background.
+  void set_remote_sdms(const std::vector<SubscriberDataManager*>& remote_sdms)
+  {
+    _remote_sdms = remote_sdms;
+  }
+
 private:
   // Expire any out of date bindings in the current AoR
   //
@@ -234,9 +286,21 @@ private:
   void log_new_or_extended_bindings(ClassifiedBindings& classified_bindings,
                                     int now);
 
+  // Store the ID Chronos has given to an AoR's timer, once the timer has
+  // been set in the background, in the local and remote stores.
+  //
+  // @param aor_id    The AoR ID
+  // @param timer_id  The timer ID
+  // @param trail     SAS trail
+  void update_timer_id(const std::string& aor_id,
+                       const std::string& timer_id,
+                       SAS::TrailId trail);
+
   static bool unused_bool;
   AnalyticsLogger* _analytics;
   AoRStore* _aor_store;
+  ChronosTimerBatcher* _chronos_timer_batcher;
+  std::vector<SubscriberDataManager*> _remote_sdms;
   ChronosTimerRequestSender* _chronos_timer_request_sender;
   NotifySender* _notify_sender;
   bool _primary_sdm;
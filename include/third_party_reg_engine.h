@@ -0,0 +1,141 @@
+/**
+ * @file third_party_reg_engine.h Definitions for ThirdPartyRegEngine class.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef THIRD_PARTY_REG_ENGINE_H__
+#define THIRD_PARTY_REG_ENGINE_H__
+
+extern "C" {
+#include <pjlib.h>
+}
+
+#include <pthread.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pjutils.h"
+
+/// @class ThirdPartyRegEngine
+///
+/// Sends third-party REGISTERs to application servers from a pool of
+/// background threads, and runs their completion callbacks on the same
+/// threads, rather than on the worker threads.
+///
+/// -  The requests to each application server are rate limited, so a burst
+///    of registrations (for example, after an AS outage) is spread out
+///    rather than flooding the AS.
+/// -  Re-registrations are held for a short window, and a newer
+///    re-registration for the same user and AS replaces one that hasn't been
+///    sent yet.
+class ThirdPartyRegEngine
+{
+public:
+  /// Function that builds and sends a third-party REGISTER.
+  typedef std::function<void()> SendFn;
+
+  /// Constructor.
+  ///
+  /// @param num_threads        - The number of threads.
+  /// @param max_rate_per_as    - The maximum number of REGISTERs sent to each
+  ///                             application server per second, or 0 for no
+  ///                             limit.
+  /// @param coalesce_ms        - How long re-registrations are held, waiting
+  ///                             for a newer one that replaces them.
+  ThirdPartyRegEngine(int num_threads,
+                      int max_rate_per_as,
+                      int coalesce_ms = DEFAULT_COALESCE_MS);
+
+  /// Destructor.  Any REGISTERs that haven't been sent are discarded.
+  virtual ~ThirdPartyRegEngine();
+
+  /// Queues a third-party REGISTER.
+  ///
+  /// @param as_uri             - The application server's URI.
+  /// @param key                - Identifies the user and application server.
+  /// @param coalesce           - Whether this is a re-registration, which
+  ///                             can be replaced by a newer one with the same
+  ///                             key.
+  /// @param send_fn            - Builds and sends the REGISTER.
+  void send(const std::string& as_uri,
+            const std::string& key,
+            bool coalesce,
+            SendFn send_fn);
+
+  /// Queues the completion callback of a third-party REGISTER.  The engine
+  /// takes ownership of the callback.
+  void complete(PJUtils::Callback* cb);
+
+  /// Waits until all queued REGISTERs have been sent and callbacks run.
+  void flush();
+
+  static const int DEFAULT_COALESCE_MS = 500;
+
+private:
+  /// A REGISTER waiting to be sent.
+  struct Request
+  {
+    std::string key;
+    bool coalesce;
+    unsigned long ready_ms;
+    SendFn send_fn;
+  };
+
+  /// The REGISTERs waiting to be sent to one application server.
+  /// Re-registrations are held in their own queue until their coalescing
+  /// window has passed, so they don't hold up other registrations.
+  struct AsQueue
+  {
+    std::deque<Request*> immediate;
+    std::deque<Request*> delayed;
+    double tokens;
+    unsigned long last_refill_ms;
+  };
+
+  static void* thread_fn(void* p);
+  void process_requests();
+
+  /// Takes the next REGISTER that can be sent now, or works out how long
+  /// to wait for one.  Must be called with the lock held.
+  Request* next_request(unsigned long now, unsigned long& wait_ms);
+
+  bool idle() const;
+
+  static unsigned long now_ms();
+
+  int _max_rate_per_as;
+  int _coalesce_ms;
+
+  std::map<std::string, AsQueue> _as_queues;
+
+  // Re-registrations that haven't been sent yet, by key.
+  std::map<std::string, Request*> _pending;
+
+  std::deque<PJUtils::Callback*> _callbacks;
+
+  // The number of REGISTERs and callbacks being processed.
+  int _in_progress;
+
+  pthread_mutex_t _lock;
+
+  // Signalled when there is work to do, and when there is none left.
+  pthread_cond_t _cond;
+  pthread_cond_t _idle_cond;
+  bool _terminated;
+  std::vector<pthread_t> _threads;
+
+  // Each thread is registered with PJLIB, so it can send SIP messages.
+  pj_thread_desc* _thread_descs;
+  int _registered_threads;
+};
+
+#endif
@@ -20,13 +20,31 @@ extern "C" {
 #include "load_monitor.h"
 #include "snmp_event_accumulator_table.h"
 #include "snmp_event_accumulator_by_scope_table.h"
+#include "snmp_counter_by_scope_table.h"
 #include "exception_handler.h"
-
+#include "latency_breakdown.h"
+
+// Initialize the thread dispatcher.  If num_queue_shards_arg is greater than
+// one, the worker threads are split across that many queues, with SIP
+// messages distributed between the queues by Call-ID and idle worker threads
+// stealing work from other queues.
+//
+// Responses and in-dialog requests are always processed ahead of new initial
+// requests.  If max_queue_depth_arg is non-zero, new initial requests that
+// arrive when a queue holds that many events are rejected immediately with a
+// 503, and counted in overload_counter_arg.
+//
+// If latency_breakdown_arg is non-NULL, the time each SIP message spends
+// queued, being processed, and blocked on dependencies is recorded in it.
 pj_status_t init_thread_dispatcher(int num_worker_threads_arg,
                                    SNMP::EventAccumulatorByScopeTable* latency_tbl_arg,
                                    SNMP::EventAccumulatorByScopeTable* queue_size_tbl_arg,
                                    LoadMonitor* load_monitor_arg,
-                                   ExceptionHandler* exception_handler_arg);
+                                   ExceptionHandler* exception_handler_arg,
+                                   int num_queue_shards_arg = 1,
+                                   int max_queue_depth_arg = 0,
+                                   SNMP::CounterByScopeTable* overload_counter_arg = NULL,
+                                   LatencyBreakdown* latency_breakdown_arg = NULL);
 
 void unregister_thread_dispatcher(void);
 
@@ -34,7 +52,9 @@ pj_status_t start_worker_threads();
 pj_status_t stop_worker_threads();
 
 // Add a Callback object to the queue, to be run on a worker thread.
-// This MUST be called from the main PJSIP transport thread.
+// This is thread-safe, so can be called from any thread - for example, the
+// PJSIP transport thread, or a Sproutlet background thread completing some
+// work.
 void add_callback_to_queue(PJUtils::Callback*);
 
 #endif
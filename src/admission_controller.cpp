@@ -0,0 +1,224 @@
+/**
+ * @file admission_controller.cpp AdmissionController class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <time.h>
+#include <algorithm>
+
+#include "log.h"
+#include "constants.h"
+#include "pjutils.h"
+#include "admission_controller.h"
+
+const int AdmissionController::RESERVED_RATE_PERCENT[NUM_REQUEST_CLASSES] =
+{
+  100, // EMERGENCY
+  50,  // IN_DIALOG
+  20,  // RE_REGISTER
+  0,   // INITIAL_REGISTER
+  0,   // NEW_SESSION
+};
+
+static const pj_str_t STR_URN = pj_str((char*)"urn");
+static const std::string EMERGENCY_SERVICE_URN_PREFIX = "urn:service:sos";
+
+AdmissionController::AdmissionController(LoadMonitor* load_monitor,
+                                         const std::vector<SNMP::SuccessFailCountTable*>& stats_tbls) :
+  _load_monitor(load_monitor),
+  _stats_tbls(stats_tbls)
+{
+  pthread_mutex_init(&_lock, NULL);
+
+  unsigned long now = now_ms();
+  for (int ii = 0; ii < NUM_REQUEST_CLASSES; ++ii)
+  {
+    _reserved[ii].tokens = 0;
+    _reserved[ii].last_refill_ms = now;
+  }
+}
+
+AdmissionController::~AdmissionController()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+AdmissionController::RequestClass AdmissionController::classify(pjsip_msg* msg,
+                                                                 bool trusted)
+{
+  // Emergency requests are either to an emergency service URN, or are
+  // emergency registrations.
+  const pj_str_t* scheme = pjsip_uri_get_scheme(msg->line.req.uri);
+
+  if ((scheme != NULL) &&
+      (pj_stricmp(scheme, &STR_URN) == 0))
+  {
+    std::string uri = PJUtils::uri_to_string(PJSIP_URI_IN_REQ_URI,
+                                             msg->line.req.uri);
+    if (strncasecmp(uri.c_str(),
+                    EMERGENCY_SERVICE_URN_PREFIX.c_str(),
+                    EMERGENCY_SERVICE_URN_PREFIX.size()) == 0)
+    {
+      return EMERGENCY;
+    }
+  }
+
+  if (msg->line.req.method.id == PJSIP_REGISTER_METHOD)
+  {
+    pjsip_contact_hdr* contact =
+                 (pjsip_contact_hdr*)pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, NULL);
+
+    if ((contact != NULL) &&
+        (!contact->star) &&
+        (PJUtils::is_emergency_registration(contact)))
+    {
+      return EMERGENCY;
+    }
+
+    // A REGISTER on a channel that the P-CSCF has already authenticated
+    // refreshes an existing registration.
+    pjsip_authorization_hdr* auth_hdr =
+      (pjsip_authorization_hdr*)pjsip_msg_find_hdr(msg, PJSIP_H_AUTHORIZATION, NULL);
+
+    if (auth_hdr != NULL)
+    {
+      pjsip_param* integrity =
+        pjsip_param_find(&auth_hdr->credential.digest.other_param,
+                         &STR_INTEGRITY_PROTECTED);
+
+      if ((integrity != NULL) &&
+          ((pj_stricmp(&integrity->value, &STR_YES) == 0) ||
+           (pj_stricmp(&integrity->value, &STR_TLS_YES) == 0) ||
+           (pj_stricmp(&integrity->value, &STR_IP_ASSOC_YES) == 0)))
+      {
+        return RE_REGISTER;
+      }
+    }
+
+    // A REGISTER removing bindings relates to an existing registration.
+    pjsip_expires_hdr* expires =
+                 (pjsip_expires_hdr*)pjsip_msg_find_hdr(msg, PJSIP_H_EXPIRES, NULL);
+
+    if (((expires != NULL) && (expires->ivalue == 0)) ||
+        ((contact != NULL) && (contact->expires == 0)))
+    {
+      return RE_REGISTER;
+    }
+
+    return INITIAL_REGISTER;
+  }
+
+  pjsip_to_hdr* to = PJSIP_MSG_TO_HDR(msg);
+
+  if ((to != NULL) && (to->tag.slen > 0))
+  {
+    // An untrusted endpoint can add a To tag to any request to get it
+    // admitted, so only trust the tag if the request also follows a route set
+    // through this node (which it will if this node record-routed the
+    // dialog).
+    pjsip_route_hdr* route_hdr;
+
+    if ((trusted) ||
+        (PJUtils::is_top_route_local(msg, &route_hdr)))
+    {
+      return IN_DIALOG;
+    }
+
+    TRC_DEBUG("Untrusted request with To tag isn't routed to this node - treat as new session");
+  }
+
+  return NEW_SESSION;
+}
+
+bool AdmissionController::admit_request(RequestClass request_class,
+                                        SAS::TrailId trail)
+{
+  // Always consume a token from the LoadMonitor's bucket, so that it sees
+  // the full request rate.
+  bool admit = _load_monitor->admit_request(trail);
+
+  if (!admit)
+  {
+    if ((request_class == EMERGENCY) ||
+        (request_class == IN_DIALOG))
+    {
+      admit = ((!deeply_overloaded()) ||
+               (take_reserved_token(request_class)));
+    }
+    else
+    {
+      admit = take_reserved_token(request_class);
+    }
+
+    TRC_DEBUG("Overloaded - %s request of class %d",
+              admit ? "admit" : "reject", request_class);
+  }
+
+  if ((size_t)request_class < _stats_tbls.size())
+  {
+    SNMP::SuccessFailCountTable* tbl = _stats_tbls[request_class];
+    tbl->increment_attempts();
+
+    if (admit)
+    {
+      tbl->increment_successes();
+    }
+    else
+    {
+      tbl->increment_failures();
+    }
+  }
+
+  return admit;
+}
+
+bool AdmissionController::deeply_overloaded()
+{
+  return (_load_monitor->get_current_latency() >
+          DEEP_OVERLOAD_FACTOR * _load_monitor->get_target_latency());
+}
+
+bool AdmissionController::take_reserved_token(RequestClass request_class)
+{
+  double rate = _load_monitor->get_rate_limit() *
+                RESERVED_RATE_PERCENT[request_class] / 100.0;
+
+  if (rate <= 0)
+  {
+    return false;
+  }
+
+  bool took_token = false;
+  unsigned long now = now_ms();
+
+  pthread_mutex_lock(&_lock);
+
+  // Refill the bucket, allowing up to a second's worth of tokens.
+  ReservedBucket& bucket = _reserved[request_class];
+  bucket.tokens = std::min(rate,
+                           bucket.tokens + rate * (now - bucket.last_refill_ms) / 1000.0);
+  bucket.last_refill_ms = now;
+
+  if (bucket.tokens >= 1.0)
+  {
+    bucket.tokens -= 1.0;
+    took_token = true;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return took_token;
+}
+
+unsigned long AdmissionController::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
@@ -28,7 +28,8 @@ AoR::AoR(std::string sip_uri) :
   _subscriptions(),
   _associated_uris(),
   _cas(0),
-  _uri(sip_uri)
+  _uri(sip_uri),
+  _cow_base(NULL)
 {
 }
 
@@ -36,12 +37,13 @@ AoR::AoR(std::string sip_uri) :
 /// Destructor.
 AoR::~AoR()
 {
-  clear(true);
+  delete_members();
 }
 
 
 /// Copy constructor.
-AoR::AoR(const AoR& other)
+AoR::AoR(const AoR& other) :
+  _cow_base(NULL)
 {
   common_constructor(other);
 }
@@ -51,13 +53,33 @@ AoR& AoR::operator= (AoR const& other)
 {
   if (this != &other)
   {
-    clear(true);
+    delete_members();
+    _associated_uris.clear_uris();
+    _cow_base = NULL;
+    _touched_binding_ids.clear();
+    _touched_subscription_ids.clear();
     common_constructor(other);
   }
 
   return *this;
 }
 
+/// Make a copy-on-write copy of this AoR.  Only the maps are copied - the
+/// bindings and subscriptions themselves are shared until modified.
+AoR* AoR::copy_on_write() const
+{
+  AoR* copy = new AoR(_uri);
+  copy->_bindings = _bindings;
+  copy->_subscriptions = _subscriptions;
+  copy->_associated_uris = _associated_uris;
+  copy->_notify_cseq = _notify_cseq;
+  copy->_timer_id = _timer_id;
+  copy->_cas = _cas;
+  copy->_scscf_uri = _scscf_uri;
+  copy->_cow_base = this;
+  return copy;
+}
+
 void AoR::common_constructor(const AoR& other)
 {
   for (Bindings::const_iterator i = other._bindings.begin();
@@ -93,8 +115,7 @@ void AoR::clear(bool clear_emergency_bindings)
   {
     if ((clear_emergency_bindings) || (!i->second->_emergency_registration))
     {
-      delete i->second;
-      _bindings.erase(i++);
+      i = erase_binding(i);
     }
     else
     {
@@ -102,20 +123,103 @@ void AoR::clear(bool clear_emergency_bindings)
     }
   }
 
-  if (clear_emergency_bindings)
+  for (Subscriptions::iterator i = _subscriptions.begin();
+       i != _subscriptions.end();
+       )
   {
-    _bindings.clear();
+    i = erase_subscription(i);
   }
 
-  for (Subscriptions::iterator i = _subscriptions.begin();
+  _associated_uris.clear_uris();
+}
+
+
+/// Delete all the bindings and subscriptions owned by this AoR.  Those still
+/// shared with the AoR this was copied from are left alone.
+void AoR::delete_members()
+{
+  for (Bindings::const_iterator i = _bindings.begin();
+       i != _bindings.end();
+       ++i)
+  {
+    if (!is_shared(i))
+    {
+      delete i->second;
+    }
+  }
+
+  for (Subscriptions::const_iterator i = _subscriptions.begin();
        i != _subscriptions.end();
        ++i)
   {
-    delete i->second;
+    if (!is_shared(i))
+    {
+      delete i->second;
+    }
   }
 
+  _bindings.clear();
   _subscriptions.clear();
-  _associated_uris.clear_uris();
+}
+
+
+/// A binding is shared if the AoR this was copied from holds the same object
+/// under the same ID.
+bool AoR::is_shared(const Bindings::const_iterator& i) const
+{
+  if (_cow_base == NULL)
+  {
+    return false;
+  }
+
+  Bindings::const_iterator j = _cow_base->_bindings.find(i->first);
+  return ((j != _cow_base->_bindings.end()) && (j->second == i->second));
+}
+
+
+/// A subscription is shared if the AoR this was copied from holds the same
+/// object under the same To tag.
+bool AoR::is_shared(const Subscriptions::const_iterator& i) const
+{
+  if (_cow_base == NULL)
+  {
+    return false;
+  }
+
+  Subscriptions::const_iterator j = _cow_base->_subscriptions.find(i->first);
+  return ((j != _cow_base->_subscriptions.end()) && (j->second == i->second));
+}
+
+
+AoR::Bindings::iterator AoR::erase_binding(Bindings::iterator i)
+{
+  if (_cow_base != NULL)
+  {
+    _touched_binding_ids.insert(i->first);
+  }
+
+  if (!is_shared(i))
+  {
+    delete i->second;
+  }
+
+  return _bindings.erase(i);
+}
+
+
+AoR::Subscriptions::iterator AoR::erase_subscription(Subscriptions::iterator i)
+{
+  if (_cow_base != NULL)
+  {
+    _touched_subscription_ids.insert(i->first);
+  }
+
+  if (!is_shared(i))
+  {
+    delete i->second;
+  }
+
+  return _subscriptions.erase(i);
 }
 
 
@@ -125,10 +229,18 @@ void AoR::clear(bool clear_emergency_bindings)
 AoR::Binding* AoR::get_binding(const std::string& binding_id)
 {
   AoR::Binding* b;
-  AoR::Bindings::const_iterator i = _bindings.find(binding_id);
+  AoR::Bindings::iterator i = _bindings.find(binding_id);
   if (i != _bindings.end())
   {
     b = i->second;
+
+    if (is_shared(i))
+    {
+      // The binding is still shared with the AoR this was copied from, so
+      // take a private copy before the caller modifies it.
+      b = new Binding(*b);
+      i->second = b;
+    }
   }
   else
   {
@@ -137,6 +249,12 @@ AoR::Binding* AoR::get_binding(const std::string& binding_id)
     b->_expires = 0;
     _bindings.insert(std::make_pair(binding_id, b));
   }
+
+  if (_cow_base != NULL)
+  {
+    _touched_binding_ids.insert(binding_id);
+  }
+
   return b;
 }
 
@@ -148,8 +266,7 @@ void AoR::remove_binding(const std::string& binding_id)
   AoR::Bindings::iterator i = _bindings.find(binding_id);
   if (i != _bindings.end())
   {
-    delete i->second;
-    _bindings.erase(i);
+    erase_binding(i);
   }
 }
 
@@ -158,10 +275,18 @@ void AoR::remove_binding(const std::string& binding_id)
 AoR::Subscription* AoR::get_subscription(const std::string& to_tag)
 {
   AoR::Subscription* s;
-  AoR::Subscriptions::const_iterator i = _subscriptions.find(to_tag);
+  AoR::Subscriptions::iterator i = _subscriptions.find(to_tag);
   if (i != _subscriptions.end())
   {
     s = i->second;
+
+    if (is_shared(i))
+    {
+      // The subscription is still shared with the AoR this was copied from,
+      // so take a private copy before the caller modifies it.
+      s = new Subscription(*s);
+      i->second = s;
+    }
   }
   else
   {
@@ -169,6 +294,12 @@ AoR::Subscription* AoR::get_subscription(const std::string& to_tag)
     s = new Subscription;
     _subscriptions.insert(std::make_pair(to_tag, s));
   }
+
+  if (_cow_base != NULL)
+  {
+    _touched_subscription_ids.insert(to_tag);
+  }
+
   return s;
 }
 
@@ -180,23 +311,19 @@ void AoR::remove_subscription(const std::string& to_tag)
   AoR::Subscriptions::iterator i = _subscriptions.find(to_tag);
   if (i != _subscriptions.end())
   {
-    delete i->second;
-    _subscriptions.erase(i);
+    erase_subscription(i);
   }
 }
 
 /// Remove all the bindings from an AOR object
 void AoR::clear_bindings()
 {
-  for (Bindings::const_iterator i = _bindings.begin();
+  for (Bindings::iterator i = _bindings.begin();
        i != _bindings.end();
-       ++i)
+       )
   {
-    delete i->second;
+    i = erase_binding(i);
   }
-
-  // Clear the bindings map.
-  _bindings.clear();
 }
 
 // Generates the public GRUU for this binding from the address of record and
@@ -405,6 +532,7 @@ void AoR::Subscription::
     writer.EndArray();
 
     writer.String(JSON_EXPIRES); writer.Int(_expires);
+    writer.String(JSON_NOTIFY_VERSION); writer.Int(_notify_version);
   }
   writer.EndObject();
 }
@@ -431,6 +559,7 @@ void AoR::Subscription::from_json(const rapidjson::Value& s_obj)
   }
 
   JSON_GET_INT_MEMBER(s_obj, JSON_EXPIRES, _expires);
+  JSON_SAFE_GET_INT_MEMBER(s_obj, JSON_NOTIFY_VERSION, _notify_version);
 }
 
 // Utility function to return the expiry time of the binding or subscription due
@@ -498,42 +627,91 @@ void AoR::copy_aor(AoR* source_aor)
   _scscf_uri = source_aor->_scscf_uri;
 }
 
-AoR::Bindings AoRPair::get_updated_bindings()
+/// Adds a binding or subscription from the current AoR to the updated set if
+/// it is not in the original AoR, or if its expiry time has changed.
+template<class T>
+static void add_if_updated(const std::string& id,
+                           T* current,
+                           const std::map<std::string, T*>& orig_members,
+                           std::map<std::string, T*>& updated_members,
+                           const char* type)
 {
-  AoR::Bindings updated_bindings;
+  typename std::map<std::string, T*>::const_iterator orig_match =
+    orig_members.find(id);
 
-  // Iterate over the bindings in the current AoR. Figure out if the bindings
-  // have been created or updated.
-  for (std::pair<std::string, AoR::Binding*> current_aor_binding :
-         _current_aor->bindings())
+  // If the member is only in the current AoR, it has been created
+  if (orig_match == orig_members.end())
+  {
+    TRC_DEBUG("%s %s has been created", type, id.c_str());
+    updated_members.insert(std::make_pair(id, current));
+  }
+  // The member is in both AoRs. Check if the expiry time has changed at all
+  else if (orig_match->second->_expires != current->_expires)
   {
-    std::string b_id = current_aor_binding.first;
-    AoR::Binding* binding = current_aor_binding.second;
+    TRC_DEBUG("%s %s expiry has been changed", type, id.c_str());
+    updated_members.insert(std::make_pair(id, current));
+  }
+  else
+  {
+    TRC_DEBUG("%s %s is unchanged", type, id.c_str());
+  }
+}
 
-    // Find any binding match in the original AoR
-    AoR::Bindings::const_iterator orig_aor_binding_match =
-      _orig_aor->bindings().find(b_id);
+/// Adds a binding or subscription from the original AoR to the removed set if
+/// it is not in the current AoR.
+template<class T>
+static void add_if_removed(const std::string& id,
+                           T* orig,
+                           const std::map<std::string, T*>& current_members,
+                           std::map<std::string, T*>& removed_members,
+                           const char* type)
+{
+  if (current_members.find(id) == current_members.end())
+  {
+    // The member is gone (which may mean deregistration or expiry)
+    TRC_DEBUG("%s %s has been removed", type, id.c_str());
+    removed_members.insert(std::make_pair(id, orig));
+  }
+}
 
-    // If the binding is only in the current AoR, it has been created
-    if (orig_aor_binding_match == _orig_aor->bindings().end())
-    {
-      TRC_DEBUG("Binding %s has been created", current_aor_binding.first.c_str());
-      updated_bindings.insert(std::make_pair(b_id, binding));
-    }
-    else
+AoR::Bindings AoRPair::get_updated_bindings()
+{
+  AoR::Bindings updated_bindings;
+
+  if (_current_aor->_cow_base == _orig_aor)
+  {
+    // The current AoR is a copy-on-write copy of the original AoR, so only
+    // the bindings it has touched can differ.
+    for (const std::string& b_id : _current_aor->_touched_binding_ids)
     {
-      // The binding is in both AoRs. Check if the expiry time has changed at all
-      if (orig_aor_binding_match->second->_expires != binding->_expires)
-      {
-        TRC_DEBUG("Binding %s expiry has been changed", b_id.c_str());
-        updated_bindings.insert(std::make_pair(b_id, binding));
-      }
-      else
+      AoR::Bindings::const_iterator current_match =
+        _current_aor->bindings().find(b_id);
+
+      if (current_match != _current_aor->bindings().end())
       {
-        TRC_DEBUG("Binding %s is unchanged", b_id.c_str());
+        add_if_updated(b_id,
+                       current_match->second,
+                       _orig_aor->bindings(),
+                       updated_bindings,
+                       "Binding");
       }
     }
   }
+  else
+  {
+    // Iterate over the bindings in the current AoR. Figure out if the bindings
+    // have been created or updated.
+    for (const std::pair<const std::string, AoR::Binding*>& current_aor_binding :
+           _current_aor->bindings())
+    {
+      add_if_updated(current_aor_binding.first,
+                     current_aor_binding.second,
+                     _orig_aor->bindings(),
+                     updated_bindings,
+                     "Binding");
+    }
+  }
+
   return updated_bindings;
 }
 
@@ -541,38 +719,39 @@ AoR::Subscriptions AoRPair::get_updated_subscriptions()
 {
   AoR::Subscriptions updated_subscriptions;
 
-  // Iterate over the subscriptions in the current AoR. Figure out if the
-  // subscriptions have been created or updated.
-  for (std::pair<std::string, AoR::Subscription*> current_aor_subscription :
-         _current_aor->subscriptions())
+  if (_current_aor->_cow_base == _orig_aor)
   {
-    std::string s_id = current_aor_subscription.first;
-    AoR::Subscription* subscription = current_aor_subscription.second;
-
-    // Find any subscriptions match in the original AoR
-    AoR::Subscriptions::const_iterator orig_aor_subscription_match =
-      _orig_aor->subscriptions().find(s_id);
-
-    // If the subscription is only in the current AoR, it has been created
-    if (orig_aor_subscription_match == _orig_aor->subscriptions().end())
+    // The current AoR is a copy-on-write copy of the original AoR, so only
+    // the subscriptions it has touched can differ.
+    for (const std::string& s_id : _current_aor->_touched_subscription_ids)
     {
-      TRC_DEBUG("Subscription %s has been created", current_aor_subscription.first.c_str());
-      updated_subscriptions.insert(std::make_pair(s_id, subscription));
-    }
-    else
-    {
-      // The subscription is in both AoRs. Check if the expiry time has changed at all
-      if (orig_aor_subscription_match->second->_expires != subscription->_expires)
-      {
-        TRC_DEBUG("Subscription %s expiry has been changed", s_id.c_str());
-        updated_subscriptions.insert(std::make_pair(s_id, subscription));
-      }
-      else
+      AoR::Subscriptions::const_iterator current_match =
+        _current_aor->subscriptions().find(s_id);
+
+      if (current_match != _current_aor->subscriptions().end())
       {
-        TRC_DEBUG("Subscription %s is unchanged", s_id.c_str());
+        add_if_updated(s_id,
+                       current_match->second,
+                       _orig_aor->subscriptions(),
+                       updated_subscriptions,
+                       "Subscription");
       }
     }
   }
+  else
+  {
+    // Iterate over the subscriptions in the current AoR. Figure out if the
+    // subscriptions have been created or updated.
+    for (const std::pair<const std::string, AoR::Subscription*>& current_aor_subscription :
+           _current_aor->subscriptions())
+    {
+      add_if_updated(current_aor_subscription.first,
+                     current_aor_subscription.second,
+                     _orig_aor->subscriptions(),
+                     updated_subscriptions,
+                     "Subscription");
+    }
+  }
 
   return updated_subscriptions;
 }
@@ -581,17 +760,35 @@ AoR::Bindings AoRPair::get_removed_bindings()
 {
   AoR::Bindings removed_bindings;
 
-  // Iterate over original bindings and record those not in current AoR
-  for (std::pair<std::string, AoR::Binding*> orig_aor_binding :
-         _orig_aor->bindings())
+  if (_current_aor->_cow_base == _orig_aor)
+  {
+    // Only bindings touched by the copy-on-write copy can have been removed.
+    for (const std::string& b_id : _current_aor->_touched_binding_ids)
+    {
+      AoR::Bindings::const_iterator orig_match =
+        _orig_aor->bindings().find(b_id);
+
+      if (orig_match != _orig_aor->bindings().end())
+      {
+        add_if_removed(b_id,
+                       orig_match->second,
+                       _current_aor->bindings(),
+                       removed_bindings,
+                       "Binding");
+      }
+    }
+  }
+  else
   {
-    if (_current_aor->bindings().find(orig_aor_binding.first) ==
-        _current_aor->bindings().end())
+    // Iterate over original bindings and record those not in current AoR
+    for (const std::pair<const std::string, AoR::Binding*>& orig_aor_binding :
+           _orig_aor->bindings())
     {
-      // Binding is gone (which may mean deregistration or expiry)
-      TRC_DEBUG("Binding %s has been removed", orig_aor_binding.first.c_str());
-      removed_bindings.insert(std::make_pair(orig_aor_binding.first,
-                                             orig_aor_binding.second));
+      add_if_removed(orig_aor_binding.first,
+                     orig_aor_binding.second,
+                     _current_aor->bindings(),
+                     removed_bindings,
+                     "Binding");
     }
   }
 
@@ -602,20 +799,38 @@ AoR::Subscriptions AoRPair::get_removed_subscriptions()
 {
   AoR::Subscriptions removed_subscriptions;
 
-  // Iterate over original subscriptions and record those not in current AoR
-  for (std::pair<std::string, AoR::Subscription*> orig_aor_subscription :
-         _orig_aor->subscriptions())
+  if (_current_aor->_cow_base == _orig_aor)
   {
-    // Is this subscription present in the new AoR?
-    if (_current_aor->subscriptions().find(orig_aor_subscription.first) ==
-        _current_aor->subscriptions().end())
+    // Only subscriptions touched by the copy-on-write copy can have been
+    // removed.
+    for (const std::string& s_id : _current_aor->_touched_subscription_ids)
     {
-      // Subscription is gone
-      TRC_DEBUG("Subscription %s is no longer present",
-                    orig_aor_subscription.first.c_str());
-      removed_subscriptions.insert(std::make_pair(orig_aor_subscription.first,
-                                                  orig_aor_subscription.second));
+      AoR::Subscriptions::const_iterator orig_match =
+        _orig_aor->subscriptions().find(s_id);
+
+      if (orig_match != _orig_aor->subscriptions().end())
+      {
+        add_if_removed(s_id,
+                       orig_match->second,
+                       _current_aor->subscriptions(),
+                       removed_subscriptions,
+                       "Subscription");
+      }
     }
   }
+  else
+  {
+    // Iterate over original subscriptions and record those not in current AoR
+    for (const std::pair<const std::string, AoR::Subscription*>& orig_aor_subscription :
+           _orig_aor->subscriptions())
+    {
+      add_if_removed(orig_aor_subscription.first,
+                     orig_aor_subscription.second,
+                     _current_aor->subscriptions(),
+                     removed_subscriptions,
+                     "Subscription");
+    }
+  }
+
   return removed_subscriptions;
 }
@@ -0,0 +1,342 @@
+/**
+ * @file aor_replicator.cpp AoRReplicator class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <time.h>
+
+#include "log.h"
+#include "aor_replicator.h"
+
+AoRReplicator::AoRReplicator(const std::vector<SubscriberDataManager*>& remote_sdms,
+                             int threads_per_site,
+                             SNMP::EventAccumulatorTable* lag_tbl,
+                             int max_queue_depth) :
+  _sites(),
+  _lag_tbl(lag_tbl),
+  _max_queue_depth((max_queue_depth > 0) ? max_queue_depth : 1),
+  _dropped(0)
+{
+  if (threads_per_site < 1)
+  {
+    threads_per_site = 1;
+  }
+
+  for (std::vector<SubscriberDataManager*>::const_iterator sdm = remote_sdms.begin();
+       sdm != remote_sdms.end();
+       ++sdm)
+  {
+    Site* site = new Site();
+    site->replicator = this;
+    site->sdm = *sdm;
+    site->terminated = false;
+    pthread_mutex_init(&site->lock, NULL);
+    pthread_cond_init(&site->cond, NULL);
+    _sites.push_back(site);
+
+    for (int ii = 0; ii < threads_per_site; ++ii)
+    {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, &AoRReplicator::site_thread, site) == 0)
+      {
+        site->threads.push_back(thread);
+      }
+      else
+      {
+        TRC_ERROR("Failed to create AoR replication thread"); // LCOV_EXCL_LINE
+      }
+    }
+  }
+
+  TRC_STATUS("Replicating AoRs to %d remote sites with %d threads per site",
+             (int)_sites.size(), threads_per_site);
+}
+
+AoRReplicator::~AoRReplicator()
+{
+  for (std::vector<Site*>::iterator i = _sites.begin();
+       i != _sites.end();
+       ++i)
+  {
+    Site* site = *i;
+
+    pthread_mutex_lock(&site->lock);
+    site->terminated = true;
+    pthread_cond_broadcast(&site->cond);
+    pthread_mutex_unlock(&site->lock);
+
+    for (std::vector<pthread_t>::iterator thread = site->threads.begin();
+         thread != site->threads.end();
+         ++thread)
+    {
+      pthread_join(*thread, NULL);
+    }
+
+    pthread_cond_destroy(&site->cond);
+    pthread_mutex_destroy(&site->lock);
+    delete site;
+  }
+  _sites.clear();
+}
+
+void AoRReplicator::replicate(const std::string& aor_id,
+                              AoRPair* aor_pair,
+                              SAS::TrailId trail)
+{
+  if ((_sites.empty()) ||
+      (aor_pair == NULL) ||
+      (aor_pair->get_current() == NULL))
+  {
+    return;
+  }
+
+  // Take a copy of the AoR as written to the local store, which is shared by
+  // all the sites, and work out what has been removed from it.
+  PendingWrite write;
+  write.aor.reset(new AoR(*aor_pair->get_current()));
+
+  AoR::Bindings removed_bindings = aor_pair->get_removed_bindings();
+  for (AoR::Bindings::const_iterator b = removed_bindings.begin();
+       b != removed_bindings.end();
+       ++b)
+  {
+    write.removed_bindings.insert(b->first);
+  }
+
+  AoR::Subscriptions removed_subscriptions = aor_pair->get_removed_subscriptions();
+  for (AoR::Subscriptions::const_iterator s = removed_subscriptions.begin();
+       s != removed_subscriptions.end();
+       ++s)
+  {
+    write.removed_subscriptions.insert(s->first);
+  }
+
+  write.queued_us = now_us();
+  write.trail = trail;
+
+  for (std::vector<Site*>::iterator i = _sites.begin();
+       i != _sites.end();
+       ++i)
+  {
+    Site* site = *i;
+    pthread_mutex_lock(&site->lock);
+
+    std::unordered_map<std::string, PendingWrite>::iterator existing =
+                                                    site->pending.find(aor_id);
+    if (existing == site->pending.end())
+    {
+      if (site->pending.size() >= _max_queue_depth)
+      {
+        // The site has fallen too far behind, so drop this change for it.
+        // Log the first drop, and then every thousandth, so that a site that
+        // is down doesn't flood the logs.
+        uint64_t dropped = ++_dropped;
+        if ((dropped % 1000) == 1)
+        {
+          TRC_WARNING("AoR replication queue full - dropped change to %s "
+                      "(%lu changes dropped in total)",
+                      aor_id.c_str(), (unsigned long)dropped);
+        }
+
+        pthread_mutex_unlock(&site->lock);
+        continue;
+      }
+
+      site->pending[aor_id] = write;
+      site->queue.push_back(aor_id);
+    }
+    else
+    {
+      // There is already a change to this AoR waiting for this site, so
+      // coalesce the two.  The new copy of the AoR supersedes the old one,
+      // but anything removed by either change must be removed from the
+      // remote AoR, unless it has since been added back.
+      TRC_DEBUG("Coalescing changes to %s", aor_id.c_str());
+      PendingWrite& pending = existing->second;
+      pending.aor = write.aor;
+      pending.trail = write.trail;
+      pending.removed_bindings.insert(write.removed_bindings.begin(),
+                                      write.removed_bindings.end());
+      pending.removed_subscriptions.insert(write.removed_subscriptions.begin(),
+                                           write.removed_subscriptions.end());
+
+      for (AoR::Bindings::const_iterator b = write.aor->bindings().begin();
+           b != write.aor->bindings().end();
+           ++b)
+      {
+        pending.removed_bindings.erase(b->first);
+      }
+
+      for (AoR::Subscriptions::const_iterator s = write.aor->subscriptions().begin();
+           s != write.aor->subscriptions().end();
+           ++s)
+      {
+        pending.removed_subscriptions.erase(s->first);
+      }
+    }
+
+    pthread_cond_broadcast(&site->cond);
+    pthread_mutex_unlock(&site->lock);
+  }
+}
+
+void AoRReplicator::flush()
+{
+  for (std::vector<Site*>::iterator i = _sites.begin();
+       i != _sites.end();
+       ++i)
+  {
+    Site* site = *i;
+    pthread_mutex_lock(&site->lock);
+
+    while ((!site->terminated) &&
+           ((!site->pending.empty()) || (!site->writing.empty())))
+    {
+      pthread_cond_wait(&site->cond, &site->lock);
+    }
+
+    pthread_mutex_unlock(&site->lock);
+  }
+}
+
+void* AoRReplicator::site_thread(void* p)
+{
+  Site* site = (Site*)p;
+  site->replicator->process_site(site);
+  return NULL;
+}
+
+void AoRReplicator::process_site(Site* site)
+{
+  pthread_mutex_lock(&site->lock);
+
+  while (!site->terminated)
+  {
+    std::vector<std::pair<std::string, PendingWrite>> batch;
+    get_batch(site, batch);
+
+    if (batch.empty())
+    {
+      pthread_cond_wait(&site->cond, &site->lock);
+      continue;
+    }
+
+    // Write the batch without holding the lock, so that more changes can be
+    // queued (and coalesced) while we wait for the remote store.
+    pthread_mutex_unlock(&site->lock);
+
+    for (std::vector<std::pair<std::string, PendingWrite>>::const_iterator w = batch.begin();
+         w != batch.end();
+         ++w)
+    {
+      write_aor(site->sdm, w->first, w->second);
+
+      if (_lag_tbl != NULL)
+      {
+        _lag_tbl->accumulate(now_us() - w->second.queued_us);
+      }
+    }
+
+    pthread_mutex_lock(&site->lock);
+
+    for (std::vector<std::pair<std::string, PendingWrite>>::const_iterator w = batch.begin();
+         w != batch.end();
+         ++w)
+    {
+      site->writing.erase(w->first);
+    }
+
+    // Wake up any threads waiting for these AoRs, and any flushes.
+    pthread_cond_broadcast(&site->cond);
+  }
+
+  pthread_mutex_unlock(&site->lock);
+}
+
+void AoRReplicator::get_batch(Site* site,
+                              std::vector<std::pair<std::string, PendingWrite>>& batch)
+{
+  std::deque<std::string>::iterator i = site->queue.begin();
+
+  while ((i != site->queue.end()) &&
+         (batch.size() < (size_t)MAX_BATCH_SIZE))
+  {
+    if (site->writing.find(*i) != site->writing.end())
+    {
+      // Another thread is writing an earlier change to this AoR, so leave
+      // this one on the queue for now.
+      ++i;
+      continue;
+    }
+
+    std::unordered_map<std::string, PendingWrite>::iterator pending =
+                                                       site->pending.find(*i);
+    batch.push_back(std::make_pair(*i, pending->second));
+    site->pending.erase(pending);
+    site->writing.insert(*i);
+    i = site->queue.erase(i);
+  }
+}
+
+void AoRReplicator::write_aor(SubscriberDataManager* sdm,
+                              const std::string& aor_id,
+                              const PendingWrite& write)
+{
+  if (!sdm->has_servers())
+  {
+    return;
+  }
+
+  Store::Status rc;
+
+  do
+  {
+    AoRPair* remote_aor_pair = sdm->get_aor_data(aor_id, write.trail);
+
+    if ((remote_aor_pair == NULL) ||
+        (remote_aor_pair->get_current() == NULL))
+    {
+      // We don't worry about failures to write to remote stores.
+      TRC_DEBUG("Failed to get AoR %s from remote store", aor_id.c_str());
+      delete remote_aor_pair;
+      return;
+    }
+
+    // Apply the changes to the remote copy of the AoR.  Anything only
+    // present in the remote copy is left alone.
+    AoR* remote_aor = remote_aor_pair->get_current();
+
+    for (std::set<std::string>::const_iterator b = write.removed_bindings.begin();
+         b != write.removed_bindings.end();
+         ++b)
+    {
+      remote_aor->remove_binding(*b);
+    }
+
+    for (std::set<std::string>::const_iterator s = write.removed_subscriptions.begin();
+         s != write.removed_subscriptions.end();
+         ++s)
+    {
+      remote_aor->remove_subscription(*s);
+    }
+
+    remote_aor->copy_aor(write.aor.get());
+
+    rc = sdm->set_aor_data(aor_id, remote_aor_pair, write.trail);
+    delete remote_aor_pair;
+  }
+  while (rc == Store::DATA_CONTENTION);
+}
+
+unsigned long AoRReplicator::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
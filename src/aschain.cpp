@@ -9,6 +9,7 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <random>
 #include <boost/lexical_cast.hpp>
 
 #include "log.h"
@@ -351,13 +352,48 @@ void AsChainLink::on_response(int status_code)
 
 AsChainTable::AsChainTable()
 {
-  pthread_mutex_init(&_lock, NULL);
+  for (int ii = 0; ii < NUM_STRIPES; ++ii)
+  {
+    pthread_mutex_init(&_stripes[ii].lock, NULL);
+  }
 }
 
 
 AsChainTable::~AsChainTable()
 {
-  pthread_mutex_destroy(&_lock);
+  for (int ii = 0; ii < NUM_STRIPES; ++ii)
+  {
+    pthread_mutex_destroy(&_stripes[ii].lock);
+  }
+}
+
+
+AsChainTable::Stripe& AsChainTable::stripe(const std::string& token)
+{
+  return _stripes[std::hash<std::string>()(token) % NUM_STRIPES];
+}
+
+
+/// Create a random base64 token.  Each thread has its own random number
+/// generator, so this doesn't need to take any locks.
+void AsChainTable::create_token(std::string& token)
+{
+  static const char BASE64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  static thread_local std::mt19937_64 generator(std::random_device{}());
+
+  token.resize(TOKEN_LENGTH);
+  uint64_t bits = 0;
+  for (int ii = 0; ii < TOKEN_LENGTH; ++ii)
+  {
+    // Each 64-bit random number gives ten base64 characters.
+    if (ii % 10 == 0)
+    {
+      bits = generator();
+    }
+    token[ii] = BASE64[bits & 0x3F];
+    bits >>= 6;
+  }
 }
 
 
@@ -366,32 +402,32 @@ AsChainTable::~AsChainTable()
 void AsChainTable::register_(AsChain* as_chain, std::vector<std::string>& tokens)
 {
   size_t len = as_chain->size() + 1;
-  pthread_mutex_lock(&_lock);
 
   for (size_t i = 0; i < len; i++)
   {
     std::string token;
-    Utils::create_random_token(TOKEN_LENGTH, token);
+    create_token(token);
     tokens.push_back(token);
-    _odi_token_map[token] = AsChainLink(as_chain, i);
-  }
 
-  pthread_mutex_unlock(&_lock);
+    Stripe& s = stripe(token);
+    pthread_mutex_lock(&s.lock);
+    s.odi_token_map[token] = AsChainLink(as_chain, i);
+    pthread_mutex_unlock(&s.lock);
+  }
 }
 
 
 void AsChainTable::unregister(std::vector<std::string>& tokens)
 {
-  pthread_mutex_lock(&_lock);
-
   for (std::vector<std::string>::iterator it = tokens.begin();
        it != tokens.end();
        ++it)
   {
-    _odi_token_map.erase(*it);
+    Stripe& s = stripe(*it);
+    pthread_mutex_lock(&s.lock);
+    s.odi_token_map.erase(*it);
+    pthread_mutex_unlock(&s.lock);
   }
-
-  pthread_mutex_unlock(&_lock);
 }
 
 
@@ -431,12 +467,13 @@ void AsChain::reset_chain(bool using_standard_ifcs)
 // is finished with the link.
 AsChainLink AsChainTable::lookup(const std::string& token)
 {
-  pthread_mutex_lock(&_lock);
-  std::map<std::string, AsChainLink>::const_iterator it =
-                                                    _odi_token_map.find(token);
-  if (it == _odi_token_map.end())
+  Stripe& s = stripe(token);
+  pthread_mutex_lock(&s.lock);
+  std::unordered_map<std::string, AsChainLink>::const_iterator it =
+                                                  s.odi_token_map.find(token);
+  if (it == s.odi_token_map.end())
   {
-    pthread_mutex_unlock(&_lock);
+    pthread_mutex_unlock(&s.lock);
     return AsChainLink(NULL, 0);
   }
   else
@@ -448,13 +485,13 @@ AsChainLink AsChainTable::lookup(const std::string& token)
       // Flag that the AS corresponding to the previous link in the chain has
       // effectively responded.
       as_chain_link._as_chain->_responsive[as_chain_link._index - 1] = true;
-      pthread_mutex_unlock(&_lock);
+      pthread_mutex_unlock(&s.lock);
       return as_chain_link;
     } else {
       // Failed to increment the count - AS chain must be in the process of
       // being destroyed.  Pretend we didn't find it.
       // LCOV_EXCL_START - Can't hit this window condition in UT.
-      pthread_mutex_unlock(&_lock);
+      pthread_mutex_unlock(&s.lock);
       return AsChainLink(NULL, 0);
       // LCOV_EXCL_STOP
     }
@@ -15,17 +15,33 @@
 #include "json_parse_utils.h"
 #include "rapidjson/error/en.h"
 #include "sproutsasevent.h"
+#include "latency_breakdown.h"
 
 
-AstaireAoRStore::AstaireAoRStore(Store* store) : AoRStore()
+AstaireAoRStore::AstaireAoRStore(Store* store,
+                                 SerializationFormat format) : AoRStore()
 {
-  JsonSerializerDeserializer* serializer_deserializer = new JsonSerializerDeserializer();
-  _connector = new Connector(store, serializer_deserializer); // Takes ownership of serializer_deserializer
+  // The (de)serializer for the configured format goes first, so it is used
+  // for writing.  Both are used for reading.
+  std::vector<SerializerDeserializer*> serializer_deserializers;
+
+  if (format == SerializationFormat::BINARY)
+  {
+    serializer_deserializers.push_back(new BinarySerializerDeserializer());
+    serializer_deserializers.push_back(new JsonSerializerDeserializer());
+  }
+  else
+  {
+    serializer_deserializers.push_back(new JsonSerializerDeserializer());
+    serializer_deserializers.push_back(new BinarySerializerDeserializer());
+  }
+
+  _connector = new Connector(store, serializer_deserializers); // Takes ownership of serializer_deserializers
 }
 
 AstaireAoRStore::~AstaireAoRStore()
 {
-  // Ownership of serializer_deserializer passed to _connector
+  // Ownership of serializer_deserializers passed to _connector
   delete _connector; _connector = NULL;
 }
 
@@ -53,17 +69,22 @@ Store::Status AstaireAoRStore::set_aor_data(const std::string& aor_id,
 /// AstaireAoRStore::Connector Methods
 
 AstaireAoRStore::Connector::Connector(Store* data_store,
-                            JsonSerializerDeserializer*& serializer_deserializer) :
+                            std::vector<SerializerDeserializer*>& serializer_deserializers) :
   _data_store(data_store),
-  _serializer_deserializer(serializer_deserializer)
+  _serializer_deserializers(serializer_deserializers)
 {
-  // We have taken ownership of the serializer_deserializer.
-  serializer_deserializer = NULL;
+  // We have taken ownership of the serializer_deserializers.
+  serializer_deserializers.clear();
 }
 
 AstaireAoRStore::Connector::~Connector()
 {
-  delete _serializer_deserializer; _serializer_deserializer = NULL;
+  for (SerializerDeserializer* serializer_deserializer : _serializer_deserializers)
+  {
+    delete serializer_deserializer;
+  }
+
+  _serializer_deserializers.clear();
 }
 
 /// Retrieve the registration data for a given SIP Address of Record, creating
@@ -79,13 +100,28 @@ AoR* AstaireAoRStore::Connector::get_aor_data(
 
   std::string data;
   uint64_t cas;
-  Store::Status status = _data_store->get_data("reg", aor_id, data, cas, trail);
+  Store::Status status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ASTAIRE);
+    status = _data_store->get_data("reg", aor_id, data, cas, trail);
+  }
 
   if (status == Store::Status::OK)
   {
     // Retrieved the data, so deserialize it.
     TRC_DEBUG("Data store returned a record, CAS = %ld", cas);
-    aor_data = _serializer_deserializer->deserialize_aor(aor_id, data);
+
+    for (SerializerDeserializer* serializer_deserializer : _serializer_deserializers)
+    {
+      aor_data = serializer_deserializer->deserialize_aor(aor_id, data);
+
+      if (aor_data != NULL)
+      {
+        TRC_DEBUG("Deserialized record with %s deserializer",
+                  serializer_deserializer->name().c_str());
+        break;
+      }
+    }
 
     if (aor_data != NULL)
     {
@@ -133,18 +169,22 @@ Store::Status AstaireAoRStore::Connector::set_aor_data(
                                             int expiry,
                                             SAS::TrailId trail)
 {
-  std::string data = _serializer_deserializer->serialize_aor(aor_data);
+  std::string data = _serializer_deserializers.front()->serialize_aor(aor_data);
 
   SAS::Event event(trail, SASEvent::REGSTORE_SET_START, 0);
   event.add_var_param(aor_id);
   SAS::report_event(event);
 
-  Store::Status status = _data_store->set_data("reg",
-                                               aor_id,
-                                               data,
-                                               aor_data->_cas,
-                                               expiry,
-                                               trail);
+  Store::Status status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ASTAIRE);
+    status = _data_store->set_data("reg",
+                                   aor_id,
+                                   data,
+                                   aor_data->_cas,
+                                   expiry,
+                                   trail);
+  }
 
   TRC_DEBUG("Data store set_data returned %d", status);
 
@@ -304,3 +344,331 @@ std::string AstaireAoRStore::JsonSerializerDeserializer::serialize_aor(AoR* aor_
 
   return sb.GetString();
 }
+
+
+//
+// (De)serializer for the binary SubscriberDataManager format.
+//
+
+const unsigned char AstaireAoRStore::BinarySerializerDeserializer::MARKER;
+const unsigned char AstaireAoRStore::BinarySerializerDeserializer::VERSION;
+
+/// Exception thrown when binary data from the store is malformed.
+struct BinaryFormatError
+{
+  BinaryFormatError(const char* reason) : _reason(reason) {}
+  const char* _reason;
+};
+
+/// Helpers for writing the binary format.
+static void write_varint(std::string& s, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    s.push_back((char)((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+
+  s.push_back((char)value);
+}
+
+static void write_int(std::string& s, int value)
+{
+  // Zig-zag encode so that small negative values stay short.
+  uint32_t u = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  write_varint(s, u);
+}
+
+static void write_bool(std::string& s, bool value)
+{
+  s.push_back(value ? 1 : 0);
+}
+
+static void write_string(std::string& s, const std::string& value)
+{
+  write_varint(s, value.size());
+  s.append(value);
+}
+
+static void write_strings(std::string& s, const std::list<std::string>& values)
+{
+  write_varint(s, values.size());
+
+  for (const std::string& value : values)
+  {
+    write_string(s, value);
+  }
+}
+
+/// Reader for the binary format.  All methods throw BinaryFormatError if the
+/// data runs out.
+class BinaryReader
+{
+public:
+  BinaryReader(const std::string& s, size_t pos) : _s(s), _pos(pos) {}
+
+  uint64_t read_varint()
+  {
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      unsigned char byte = read_byte();
+      value |= ((uint64_t)(byte & 0x7F)) << shift;
+
+      if ((byte & 0x80) == 0)
+      {
+        return value;
+      }
+    }
+
+    throw BinaryFormatError("varint too long");
+  }
+
+  int read_int()
+  {
+    uint32_t u = (uint32_t)read_varint();
+    return (int)((u >> 1) ^ (0u - (u & 1)));
+  }
+
+  bool read_bool()
+  {
+    return (read_byte() != 0);
+  }
+
+  std::string read_string()
+  {
+    uint64_t len = read_varint();
+
+    if (len > remaining())
+    {
+      throw BinaryFormatError("string overruns data");
+    }
+
+    std::string value = _s.substr(_pos, len);
+    _pos += len;
+    return value;
+  }
+
+  /// Reads the number of entries in a list or map.  Each entry takes at
+  /// least one byte, so this is also checked against the data remaining.
+  uint64_t read_count()
+  {
+    uint64_t count = read_varint();
+
+    if (count > remaining())
+    {
+      throw BinaryFormatError("count overruns data");
+    }
+
+    return count;
+  }
+
+  void read_strings(std::list<std::string>& values)
+  {
+    for (uint64_t count = read_count(); count > 0; --count)
+    {
+      values.push_back(read_string());
+    }
+  }
+
+  size_t remaining() const { return _s.size() - _pos; }
+
+private:
+  unsigned char read_byte()
+  {
+    if (_pos >= _s.size())
+    {
+      throw BinaryFormatError("data truncated");
+    }
+
+    return (unsigned char)_s[_pos++];
+  }
+
+  const std::string& _s;
+  size_t _pos;
+};
+
+AoR* AstaireAoRStore::BinarySerializerDeserializer::
+  deserialize_aor(const std::string& aor_id, const std::string& s)
+{
+  if ((s.size() < 2) || ((unsigned char)s[0] != MARKER))
+  {
+    // Not in the binary format.
+    return NULL;
+  }
+
+  if ((unsigned char)s[1] != VERSION)
+  {
+    TRC_INFO("Unsupported binary AoR version %d", (unsigned char)s[1]);
+    return NULL;
+  }
+
+  TRC_DEBUG("Deserialize binary document of %d bytes", (int)s.size());
+
+  BinaryReader reader(s, 2);
+  AoR* aor = new AoR(aor_id);
+
+  try
+  {
+    for (uint64_t count = reader.read_count(); count > 0; --count)
+    {
+      std::string b_id = reader.read_string();
+      TRC_DEBUG("  Binding: %s", b_id.c_str());
+      AoR::Binding* b = aor->get_binding(b_id);
+
+      b->_uri = reader.read_string();
+      b->_cid = reader.read_string();
+      b->_cseq = reader.read_int();
+      b->_expires = reader.read_int();
+      b->_priority = reader.read_int();
+
+      for (uint64_t params = reader.read_count(); params > 0; --params)
+      {
+        std::string pname = reader.read_string();
+        b->_params[pname] = reader.read_string();
+      }
+
+      reader.read_strings(b->_path_headers);
+      reader.read_strings(b->_path_uris);
+      b->_private_id = reader.read_string();
+      b->_emergency_registration = reader.read_bool();
+    }
+
+    for (uint64_t count = reader.read_count(); count > 0; --count)
+    {
+      std::string s_id = reader.read_string();
+      TRC_DEBUG("  Subscription: %s", s_id.c_str());
+      AoR::Subscription* sub = aor->get_subscription(s_id);
+
+      sub->_req_uri = reader.read_string();
+      sub->_from_uri = reader.read_string();
+      sub->_from_tag = reader.read_string();
+      sub->_to_uri = reader.read_string();
+      sub->_to_tag = reader.read_string();
+      sub->_cid = reader.read_string();
+      reader.read_strings(sub->_route_uris);
+      sub->_expires = reader.read_int();
+      sub->_notify_version = reader.read_int();
+    }
+
+    for (uint64_t count = reader.read_count(); count > 0; --count)
+    {
+      std::string uri = reader.read_string();
+      aor->_associated_uris.add_uri(uri, reader.read_bool());
+    }
+
+    for (uint64_t count = reader.read_count(); count > 0; --count)
+    {
+      std::string distinct = reader.read_string();
+      aor->_associated_uris.add_wildcard_mapping(reader.read_string(), distinct);
+    }
+
+    aor->_notify_cseq = reader.read_int();
+    aor->_timer_id = reader.read_string();
+    aor->_scscf_uri = reader.read_string();
+
+    if (reader.remaining() != 0)
+    {
+      throw BinaryFormatError("trailing data");
+    }
+  }
+  catch (const BinaryFormatError& err)
+  {
+    TRC_INFO("Failed to deserialize binary document (%s)", err._reason);
+    delete aor; aor = NULL;
+  }
+
+  return aor;
+}
+
+
+std::string AstaireAoRStore::BinarySerializerDeserializer::serialize_aor(AoR* aor_data)
+{
+  std::string s;
+  s.push_back((char)MARKER);
+  s.push_back((char)VERSION);
+
+  //
+  // Bindings
+  //
+  write_varint(s, aor_data->bindings().size());
+
+  for (AoR::Bindings::const_iterator it = aor_data->bindings().begin();
+       it != aor_data->bindings().end();
+       ++it)
+  {
+    const AoR::Binding* b = it->second;
+    write_string(s, it->first);
+    write_string(s, b->_uri);
+    write_string(s, b->_cid);
+    write_int(s, b->_cseq);
+    write_int(s, b->_expires);
+    write_int(s, b->_priority);
+
+    write_varint(s, b->_params.size());
+
+    for (std::map<std::string, std::string>::const_iterator p = b->_params.begin();
+         p != b->_params.end();
+         ++p)
+    {
+      write_string(s, p->first);
+      write_string(s, p->second);
+    }
+
+    write_strings(s, b->_path_headers);
+    write_strings(s, b->_path_uris);
+    write_string(s, b->_private_id);
+    write_bool(s, b->_emergency_registration);
+  }
+
+  //
+  // Subscriptions.
+  //
+  write_varint(s, aor_data->subscriptions().size());
+
+  for (AoR::Subscriptions::const_iterator it = aor_data->subscriptions().begin();
+       it != aor_data->subscriptions().end();
+       ++it)
+  {
+    const AoR::Subscription* sub = it->second;
+    write_string(s, it->first);
+    write_string(s, sub->_req_uri);
+    write_string(s, sub->_from_uri);
+    write_string(s, sub->_from_tag);
+    write_string(s, sub->_to_uri);
+    write_string(s, sub->_to_tag);
+    write_string(s, sub->_cid);
+    write_strings(s, sub->_route_uris);
+    write_int(s, sub->_expires);
+    write_int(s, sub->_notify_version);
+  }
+
+  // Associated URIs
+  std::vector<std::string> uris = aor_data->_associated_uris.get_all_uris();
+  write_varint(s, uris.size());
+
+  for (const std::string& uri : uris)
+  {
+    write_string(s, uri);
+    write_bool(s, aor_data->_associated_uris.is_impu_barred(uri));
+  }
+
+  std::map<std::string, std::string> wildcards =
+                               aor_data->_associated_uris.get_wildcard_mapping();
+  write_varint(s, wildcards.size());
+
+  for (std::map<std::string, std::string>::const_iterator w = wildcards.begin();
+       w != wildcards.end();
+       ++w)
+  {
+    write_string(s, w->first);
+    write_string(s, w->second);
+  }
+
+  write_int(s, aor_data->_notify_cseq);
+  write_string(s, aor_data->_timer_id);
+  write_string(s, aor_data->_scscf_uri);
+
+  return s;
+}
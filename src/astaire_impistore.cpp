@@ -22,6 +22,7 @@
 #include <rapidjson/stringbuffer.h>
 #include "rapidjson/error/en.h"
 #include "json_parse_utils.h"
+#include "latency_breakdown.h"
 #include <algorithm>
 
 // Constant table names.
@@ -132,12 +133,16 @@ Store::Status AstaireImpiStore::set_impi(ImpiStore::Impi* impi,
   // First serialize the IMPI and set it in the store.
   std::string data = astaire_impi->to_json();
   TRC_DEBUG("Storing IMPI for %s\n%s", impi->impi.c_str(), data.c_str());
-  Store::Status status = _data_store->set_data(TABLE_IMPI,
-                                               astaire_impi->impi,
-                                               data,
-                                               astaire_impi->_cas,
-                                               astaire_impi->get_expires() - now,
-                                               trail);
+  Store::Status status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ASTAIRE);
+    status = _data_store->set_data(TABLE_IMPI,
+                                   astaire_impi->impi,
+                                   data,
+                                   astaire_impi->_cas,
+                                   astaire_impi->get_expires() - now,
+                                   trail);
+  }
   if (status == Store::Status::OK)
   {
     SAS::Event event(trail, SASEvent::IMPISTORE_IMPI_SET_SUCCESS, 0);
@@ -171,7 +176,11 @@ ImpiStore::Impi* AstaireImpiStore::get_impi(const std::string& impi,
   AstaireImpiStore::Impi* impi_obj = NULL;
   std::string data;
   uint64_t cas;
-  Store::Status status = _data_store->get_data(TABLE_IMPI, impi, data, cas, trail);
+  Store::Status status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ASTAIRE);
+    status = _data_store->get_data(TABLE_IMPI, impi, data, cas, trail);
+  }
   if (status == Store::Status::OK)
   {
     TRC_DEBUG("Retrieved IMPI for %s\n%s", impi.c_str(), data.c_str());
@@ -207,9 +216,11 @@ Store::Status AstaireImpiStore::delete_impi(ImpiStore::Impi* impi,
 {
   // First, delete the IMPI data from the store.
   TRC_DEBUG("Deleting IMPI for %s", impi->impi.c_str());
-  Store::Status status = _data_store->delete_data(TABLE_IMPI,
-                                                  impi->impi,
-                                                  trail);
+  Store::Status status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ASTAIRE);
+    status = _data_store->delete_data(TABLE_IMPI, impi->impi, trail);
+  }
   if (status == Store::Status::OK)
   {
     SAS::Event event(trail, SASEvent::IMPISTORE_IMPI_DELETE_SUCCESS, 0);
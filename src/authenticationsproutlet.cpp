@@ -16,6 +16,7 @@
 #include <openssl/hmac.h>
 #include "base64.h"
 #include "scscf_utils.h"
+#include "latency_breakdown.h"
 
 // Configuring PJSIP with a realm of "*" means that all realms are considered.
 const pj_str_t WILDCARD_REALM = pj_str((char*)"*");
@@ -812,11 +813,14 @@ void AuthenticationSproutletTsx::create_challenge(pjsip_digest_credential* crede
                               "\", \"nonce\": \"" + nonce +
                               "\"}";
       TRC_DEBUG("Sending %s to Chronos to set AV timer", chronos_body.c_str());
-      status = _authentication->_chronos->send_post(timer_id,
-                                                    30,
-                                                    "/authentication-timeout",
-                                                    chronos_body,
-                                                    trail());
+      {
+        LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+        status = _authentication->_chronos->send_post(timer_id,
+                                                      30,
+                                                      "/authentication-timeout",
+                                                      chronos_body,
+                                                      trail());
+      }
       if (status == HTTP_OK)
       {
         TRC_DEBUG("Timer %s successfully stored in Chronos for auth challenge %s",
@@ -857,8 +861,11 @@ void AuthenticationSproutletTsx::create_challenge(pjsip_digest_credential* crede
       if ((_authentication->_chronos) && (auth_challenge->get_timer_id() != ""))
       {
         HTTPCode status;
-        status = _authentication->_chronos->send_delete(auth_challenge->get_timer_id(),
-                                                        trail());
+        {
+          LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+          status = _authentication->_chronos->send_delete(auth_challenge->get_timer_id(),
+                                                          trail());
+        }
         if (status == HTTP_OK)
         {
           TRC_DEBUG("Timer deleted for auth_challenge %s", nonce.c_str());
@@ -1050,8 +1057,11 @@ void AuthenticationSproutletTsx::on_rx_initial_request(pjsip_msg* req)
         if ((_authentication->_chronos) && (auth_challenge->get_timer_id() != ""))
         {
           HTTPCode status;
-          status = _authentication->_chronos->send_delete(auth_challenge->get_timer_id(),
-                                                          trail());
+          {
+            LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+            status = _authentication->_chronos->send_delete(auth_challenge->get_timer_id(),
+                                                            trail());
+          }
           if (status == HTTP_OK)
           {
             TRC_DEBUG("Timer deleted for auth_challenge %s", auth_challenge->get_nonce().c_str());
@@ -78,7 +78,7 @@ void BgcfService::update_routes()
   try
   {
     std::map<std::string, std::vector<std::string>> new_domain_routes;
-    std::map<std::string, std::vector<std::string>> new_number_routes;
+    PrefixTrie<std::vector<std::string>> new_number_routes;
 
     JSON_ASSERT_CONTAINS(doc, "routes");
     JSON_ASSERT_ARRAY(doc["routes"]);
@@ -121,9 +121,8 @@ void BgcfService::update_routes()
         else
         {
           routing_value = (*routes_it)["number"].GetString();
-          new_number_routes.insert(
-                    std::make_pair(Utils::remove_visual_separators(routing_value),
-                                   route_vec));
+          new_number_routes.insert(Utils::remove_visual_separators(routing_value),
+                                   route_vec);
         }
 
         route_vec.clear();
@@ -137,10 +136,11 @@ void BgcfService::update_routes()
       }
     }
 
-    // Take a write lock on the mutex in RAII style
+    // Take a write lock on the mutex in RAII style, and swap in the new
+    // routes.  The old routes are freed once the lock is released.
     boost::lock_guard<boost::shared_mutex> write_lock(_routes_rw_lock);
-    _domain_routes = new_domain_routes;
-    _number_routes = new_number_routes;
+    _domain_routes.swap(new_domain_routes);
+    _number_routes.swap(new_number_routes);
   }
   catch (JsonFormatError err)
   {
@@ -222,41 +222,31 @@ std::vector<std::string> BgcfService::get_route_from_number(
   // Take a read lock on the mutex in RAII style
   boost::shared_lock<boost::shared_mutex> read_lock(_routes_rw_lock);
 
-  // The number routes map is ordered by length of key. Start from the end of
-  // the map to get the longest prefixes first.
-  for (std::map<std::string, std::vector<std::string>>::const_reverse_iterator it =
-        _number_routes.rbegin();
-       it != _number_routes.rend();
-       it++)
-  {
-    int len = std::min(number.size(), (*it).first.size());
+  // Find the most specific prefix that matches the number.
+  const PrefixTrie<std::vector<std::string>>::Entry* it =
+                  _number_routes.match(Utils::remove_visual_separators(number));
 
-    if (Utils::remove_visual_separators(number).compare(0,
-                                                        len,
-                                                        (*it).first,
-                                                        0,
-                                                        len) == 0)
-    {
-      // Found a match, so return it
-      TRC_DEBUG("Match found. Number: %s, prefix: %s",
-                number.c_str(), (*it).first.c_str());
+  if (it != NULL)
+  {
+    // Found a match, so return it
+    TRC_DEBUG("Match found. Number: %s, prefix: %s",
+              number.c_str(), (*it).first.c_str());
 
-      SAS::Event event(trail, SASEvent::BGCF_FOUND_ROUTE_NUMBER, 0);
-      event.add_var_param(number);
-      std::string route_string;
+    SAS::Event event(trail, SASEvent::BGCF_FOUND_ROUTE_NUMBER, 0);
+    event.add_var_param(number);
+    std::string route_string;
 
-      for (std::vector<std::string>::const_iterator ii = (*it).second.begin();
-                                                    ii != (*it).second.end();
-                                                    ++ii)
-      {
-        route_string = route_string + *ii + ";";
-      }
+    for (std::vector<std::string>::const_iterator ii = (*it).second.begin();
+                                                  ii != (*it).second.end();
+                                                  ++ii)
+    {
+      route_string = route_string + *ii + ";";
+    }
 
-      event.add_var_param(route_string);
-      SAS::report_event(event);
+    event.add_var_param(route_string);
+    SAS::report_event(event);
 
-      return (*it).second;
-    }
+    return (*it).second;
   }
 
   SAS::Event event(trail, SASEvent::BGCF_NO_ROUTE_NUMBER, 0);
@@ -0,0 +1,374 @@
+/**
+ * @file chronos_timer_batcher.cpp ChronosTimerBatcher class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <time.h>
+#include <algorithm>
+
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+#include "log.h"
+#include "chronos_timer_batcher.h"
+#include "latency_breakdown.h"
+
+ChronosTimerBatcher::ChronosTimerBatcher(ChronosConnection* chronos_conn,
+                                         int threads,
+                                         int batch_delay_ms) :
+  _chronos_conn(chronos_conn),
+  _batch_delay_ms(batch_delay_ms),
+  _timer_id_callback(),
+  _queue(),
+  _pending(),
+  _sending(),
+  _created_timer_ids(),
+  _terminated(false),
+  _threads(),
+  _thread_descs(NULL),
+  _registered_threads(0)
+{
+  if (threads < 1)
+  {
+    threads = 1;
+  }
+
+  _thread_descs = new pj_thread_desc[threads];
+
+  pthread_mutex_init(&_lock, NULL);
+
+  // Use the monotonic clock for timed waits, so they aren't affected by
+  // changes to the system time.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  for (int ii = 0; ii < threads; ++ii)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &ChronosTimerBatcher::thread_fn, this) == 0)
+    {
+      _threads.push_back(thread);
+    }
+    else
+    {
+      TRC_ERROR("Failed to create Chronos timer thread"); // LCOV_EXCL_LINE
+    }
+  }
+
+  TRC_STATUS("Sending Chronos timer requests with %d threads, batched every %dms",
+             threads, _batch_delay_ms);
+}
+
+ChronosTimerBatcher::~ChronosTimerBatcher()
+{
+  pthread_mutex_lock(&_lock);
+  _terminated = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_lock);
+
+  for (std::vector<pthread_t>::iterator thread = _threads.begin();
+       thread != _threads.end();
+       ++thread)
+  {
+    pthread_join(*thread, NULL);
+  }
+  _threads.clear();
+
+  delete[] _thread_descs; _thread_descs = NULL;
+
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+void ChronosTimerBatcher::set_timer_id_callback(TimerIdCallback callback)
+{
+  _timer_id_callback = callback;
+}
+
+void ChronosTimerBatcher::set_timer(const std::string& aor_id,
+                                    const std::string& timer_id,
+                                    uint32_t expiry,
+                                    const std::map<std::string, uint32_t>& tags,
+                                    SAS::TrailId trail)
+{
+  Request request;
+  request.remove = false;
+  request.timer_id = timer_id;
+  request.expiry = expiry;
+  request.tags = tags;
+  request.trail = trail;
+  queue_request(aor_id, request);
+}
+
+void ChronosTimerBatcher::delete_timer(const std::string& aor_id,
+                                       const std::string& timer_id,
+                                       SAS::TrailId trail)
+{
+  Request request;
+  request.remove = true;
+  request.timer_id = timer_id;
+  request.expiry = 0;
+  request.trail = trail;
+  queue_request(aor_id, request);
+}
+
+void ChronosTimerBatcher::queue_request(const std::string& aor_id,
+                                        Request& request)
+{
+  request.queued_ms = now_ms();
+
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, Request>::iterator existing =
+                                                      _pending.find(aor_id);
+  if (existing == _pending.end())
+  {
+    _pending[aor_id] = request;
+    _queue.push_back(aor_id);
+  }
+  else
+  {
+    // There is already a request waiting for this AoR's timer.  The new
+    // request supersedes it, but keeps its place in the queue (so a busy AoR
+    // isn't held back indefinitely).
+    TRC_DEBUG("Coalescing timer requests for %s", aor_id.c_str());
+    Request& pending = existing->second;
+
+    if (request.timer_id.empty())
+    {
+      request.timer_id = pending.timer_id;
+    }
+
+    request.queued_ms = pending.queued_ms;
+    pending = request;
+  }
+
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_lock);
+}
+
+void ChronosTimerBatcher::flush()
+{
+  pthread_mutex_lock(&_lock);
+
+  while ((!_terminated) &&
+         ((!_pending.empty()) || (!_sending.empty())))
+  {
+    pthread_cond_wait(&_cond, &_lock);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void* ChronosTimerBatcher::thread_fn(void* p)
+{
+  ((ChronosTimerBatcher*)p)->process_requests();
+  return NULL;
+}
+
+void ChronosTimerBatcher::process_requests()
+{
+  pthread_mutex_lock(&_lock);
+
+  // Register this thread with PJLIB.
+  pj_thread_desc* desc = &_thread_descs[_registered_threads++];
+  pj_bzero(*desc, sizeof(pj_thread_desc));
+  pj_thread_t* thread = NULL;
+
+  if (pj_thread_register("ChronosTimer", *desc, &thread) != PJ_SUCCESS)
+  {
+    TRC_ERROR("Failed to register Chronos timer thread with PJLIB"); // LCOV_EXCL_LINE
+  }
+
+  while (!_terminated)
+  {
+    std::vector<std::pair<std::string, Request>> batch;
+    get_batch(batch);
+
+    if (batch.empty())
+    {
+      if (_queue.empty())
+      {
+        pthread_cond_wait(&_cond, &_lock);
+      }
+      else
+      {
+        // There are requests that aren't ready to send yet - check again
+        // once the batching delay has passed.
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_nsec += std::max(_batch_delay_ms, 1) * 1000000L;
+        wake.tv_sec += wake.tv_nsec / 1000000000L;
+        wake.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&_cond, &_lock, &wake);
+      }
+      continue;
+    }
+
+    // Send the batch without holding the lock, so that more requests can be
+    // queued (and coalesced) while we wait for Chronos.
+    pthread_mutex_unlock(&_lock);
+
+    for (std::vector<std::pair<std::string, Request>>::const_iterator r = batch.begin();
+         r != batch.end();
+         ++r)
+    {
+      send_request(r->first, r->second);
+    }
+
+    pthread_mutex_lock(&_lock);
+
+    for (std::vector<std::pair<std::string, Request>>::const_iterator r = batch.begin();
+         r != batch.end();
+         ++r)
+    {
+      _sending.erase(r->first);
+    }
+
+    // Wake up any threads waiting for these AoRs, and any flushes.
+    pthread_cond_broadcast(&_cond);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void ChronosTimerBatcher::get_batch(std::vector<std::pair<std::string, Request>>& batch)
+{
+  unsigned long now = now_ms();
+  std::deque<std::string>::iterator i = _queue.begin();
+
+  while ((i != _queue.end()) &&
+         (batch.size() < (size_t)MAX_BATCH_SIZE))
+  {
+    if (_sending.find(*i) != _sending.end())
+    {
+      // Another thread is sending an earlier request for this AoR, so leave
+      // this one on the queue for now.
+      ++i;
+      continue;
+    }
+
+    std::unordered_map<std::string, Request>::iterator pending =
+                                                          _pending.find(*i);
+
+    if (pending->second.queued_ms + _batch_delay_ms > now)
+    {
+      // The queue is in the order the requests were first queued, so the
+      // rest of the requests aren't ready either.
+      break;
+    }
+
+    Request& request = pending->second;
+    std::unordered_map<std::string, std::string>::iterator created =
+                                                   _created_timer_ids.find(*i);
+
+    if (created != _created_timer_ids.end())
+    {
+      if (request.timer_id == created->second)
+      {
+        // The AoR now has its timer ID stored.
+        _created_timer_ids.erase(created);
+      }
+      else
+      {
+        // The AoR was written before the ID from Chronos was stored, so use
+        // that ID.
+        request.timer_id = created->second;
+
+        if (request.remove)
+        {
+          _created_timer_ids.erase(created);
+        }
+      }
+    }
+
+    batch.push_back(std::make_pair(*i, request));
+    _pending.erase(pending);
+    _sending.insert(*i);
+    i = _queue.erase(i);
+  }
+}
+
+void ChronosTimerBatcher::send_request(const std::string& aor_id,
+                                       const Request& request)
+{
+  if (request.remove)
+  {
+    if (!request.timer_id.empty())
+    {
+      LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+      _chronos_conn->send_delete(request.timer_id, request.trail);
+    }
+
+    return;
+  }
+
+  std::string timer_id = request.timer_id;
+  std::string callback_uri = "/timers";
+
+  // Build the opaque data with rapidjson, so the AoR ID is escaped properly.
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  writer.StartObject();
+  {
+    writer.String("aor_id");
+    writer.String(aor_id.c_str());
+  }
+  writer.EndObject();
+  std::string opaque = sb.GetString();
+  HTTPCode status;
+
+  // If a timer has been previously set for this AoR, send a PUT.  Otherwise
+  // send a POST.
+  if (timer_id.empty())
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+    status = _chronos_conn->send_post(timer_id,
+                                      request.expiry,
+                                      callback_uri,
+                                      opaque,
+                                      request.trail,
+                                      request.tags);
+  }
+  else
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
+    status = _chronos_conn->send_put(timer_id,
+                                     request.expiry,
+                                     callback_uri,
+                                     opaque,
+                                     request.trail,
+                                     request.tags);
+  }
+
+  // If Chronos has given the timer a new ID, store it in the AoR.  If the
+  // request failed, that's OK - we'll try again next time the AoR changes.
+  if ((status == HTTP_OK) &&
+      (timer_id != request.timer_id))
+  {
+    pthread_mutex_lock(&_lock);
+    _created_timer_ids[aor_id] = timer_id;
+    pthread_mutex_unlock(&_lock);
+
+    if (_timer_id_callback)
+    {
+      _timer_id_callback(aor_id, timer_id, request.trail);
+    }
+  }
+}
+
+unsigned long ChronosTimerBatcher::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
@@ -38,11 +38,16 @@ extern "C" {
 #include "load_monitor.h"
 #include "health_checker.h"
 #include "uri_classifier.h"
+#include "sas_log_pool.h"
+#include "admission_controller.h"
 
 static SNMP::CounterByScopeTable* requests_counter = NULL;
 static SNMP::CounterByScopeTable* overload_counter = NULL;
 static LoadMonitor* load_monitor = NULL;
 static HealthChecker* health_checker = NULL;
+static SasLogPool* sas_log_pool = NULL;
+static AdmissionController* admission_controller = NULL;
+static bool own_admission_controller = false;
 
 static pj_bool_t process_on_rx_msg(pjsip_rx_data* rdata);
 static pj_status_t process_on_tx_msg(pjsip_tx_data* tdata);
@@ -107,6 +112,27 @@ static void local_log_tx_msg(pjsip_tx_data* tdata)
 }
 
 // LCOV_EXCL_START - can't meaningfully test SAS in UT
+// Log the bytes of a SIP message to SAS.  Compressing the message is
+// expensive, so if there is a pool of SAS logging threads, the message is
+// passed to them rather than being logged on the transport thread.
+static void log_sip_msg_event(uint32_t event_id,
+                              SAS::TrailId trail,
+                              uint32_t transport_type,
+                              uint32_t port,
+                              const char* addr,
+                              const char* msg,
+                              int msg_len)
+{
+  if (sas_log_pool != NULL)
+  {
+    sas_log_pool->log_msg(event_id, trail, transport_type, port, addr, msg, msg_len);
+  }
+  else
+  {
+    SasLogPool::report_msg(event_id, trail, transport_type, port, addr, msg, msg_len);
+  }
+}
+
 static void sas_log_rx_msg(pjsip_rx_data* rdata)
 {
   bool first_message_in_trail = false;
@@ -259,12 +285,13 @@ static void sas_log_rx_msg(pjsip_rx_data* rdata)
   }
 
   // Log the message event.
-  SAS::Event event(trail, SASEvent::RX_SIP_MSG, 0);
-  event.add_static_param(pjsip_transport_get_type_from_flag(rdata->tp_info.transport->flag));
-  event.add_static_param(rdata->pkt_info.src_port);
-  event.add_var_param(rdata->pkt_info.src_name);
-  event.add_compressed_param(rdata->msg_info.len, rdata->msg_info.msg_buf, &SASEvent::PROFILE_SIP);
-  SAS::report_event(event);
+  log_sip_msg_event(SASEvent::RX_SIP_MSG,
+                    trail,
+                    pjsip_transport_get_type_from_flag(rdata->tp_info.transport->flag),
+                    rdata->pkt_info.src_port,
+                    rdata->pkt_info.src_name,
+                    rdata->msg_info.msg_buf,
+                    rdata->msg_info.len);
 }
 
 
@@ -289,14 +316,13 @@ static void sas_log_tx_msg(pjsip_tx_data *tdata)
     }
 
     // Log the message event.
-    SAS::Event event(trail, SASEvent::TX_SIP_MSG, 0);
-    event.add_static_param(pjsip_transport_get_type_from_flag(tdata->tp_info.transport->flag));
-    event.add_static_param(tdata->tp_info.dst_port);
-    event.add_var_param(tdata->tp_info.dst_name);
-    event.add_compressed_param((int)(tdata->buf.cur - tdata->buf.start),
-                               tdata->buf.start,
-                               &SASEvent::PROFILE_SIP);
-    SAS::report_event(event);
+    log_sip_msg_event(SASEvent::TX_SIP_MSG,
+                      trail,
+                      pjsip_transport_get_type_from_flag(tdata->tp_info.transport->flag),
+                      tdata->tp_info.dst_port,
+                      tdata->tp_info.dst_name,
+                      tdata->buf.start,
+                      (int)(tdata->buf.cur - tdata->buf.start));
   }
   else
   {
@@ -316,12 +342,33 @@ static pj_bool_t process_on_rx_msg(pjsip_rx_data* rdata)
 
   requests_counter->increment();
 
-  // Check whether the request should be processed
-  if (!(load_monitor->admit_request(trail)) &&
-      (rdata->msg_info.msg->type == PJSIP_REQUEST_MSG) &&
+  // Check whether the request should be processed.  Responses and ACKs are
+  // always processed, but still consume tokens.
+  bool admitted;
+
+  if ((rdata->msg_info.msg->type == PJSIP_REQUEST_MSG) &&
       (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD))
   {
-    // Discard non-ACK requests if there are no available tokens.
+    // Requests on the P-CSCF's untrusted port are from endpoints, which
+    // can't be trusted to classify their own requests.
+    bool trusted = ((stack_data.pcscf_untrusted_port == 0) ||
+                    (rdata->tp_info.transport->local_name.port !=
+                                            stack_data.pcscf_untrusted_port));
+
+    admitted = admission_controller->admit_request(
+                         AdmissionController::classify(rdata->msg_info.msg,
+                                                       trusted),
+                         trail);
+  }
+  else
+  {
+    load_monitor->admit_request(trail);
+    admitted = true;
+  }
+
+  if (!admitted)
+  {
+    // Discard non-ACK requests if the admission controller won't admit them.
     // Respond statelessly with a 503 Service Unavailable, including a
     // Retry-After header with a zero length timeout.
     TRC_DEBUG("Rejected request due to overload");
@@ -429,7 +476,9 @@ pj_status_t
 init_common_sip_processing(LoadMonitor* load_monitor_arg,
                            SNMP::CounterByScopeTable* requests_counter_arg,
                            SNMP::CounterByScopeTable* overload_counter_arg,
-                           HealthChecker* health_checker_arg)
+                           HealthChecker* health_checker_arg,
+                           SasLogPool* sas_log_pool_arg,
+                           AdmissionController* admission_controller_arg)
 {
   // Register the stack modules.
   pjsip_endpt_register_module(stack_data.endpt, &mod_common_processing);
@@ -442,6 +491,21 @@ init_common_sip_processing(LoadMonitor* load_monitor_arg,
 
   health_checker = health_checker_arg;
 
+  sas_log_pool = sas_log_pool_arg;
+
+  // If we haven't been given an admission controller, use one without
+  // statistics.
+  if (admission_controller_arg != NULL)
+  {
+    admission_controller = admission_controller_arg;
+    own_admission_controller = false;
+  }
+  else
+  {
+    admission_controller = new AdmissionController(load_monitor);
+    own_admission_controller = true;
+  }
+
   return PJ_SUCCESS;
 }
 
@@ -449,4 +513,10 @@ init_common_sip_processing(LoadMonitor* load_monitor_arg,
 void unregister_common_processing_module(void)
 {
   pjsip_endpt_unregister_module(stack_data.endpt, &mod_common_processing);
+
+  if (own_admission_controller)
+  {
+    delete admission_controller;
+  }
+  admission_controller = NULL;
 }
@@ -19,12 +19,14 @@
 #include <arpa/nameser.h>
 #include <boost/algorithm/string/predicate.hpp>
 #include <poll.h>
+#include <algorithm>
 
 #include "dnsresolver.h"
 #include "log.h"
 #include "sproutsasevent.h"
 
 DNSResolver::DNSResolver(const std::vector<struct IP46Address>& servers) :
+                         _ttl(-1),
                          _req_pending(false),
                          _trail(0),
                          _domain(""),
@@ -137,6 +139,7 @@ void DNSResolver::send_naptr_query(const std::string& domain, SAS::TrailId trail
   SAS::report_event(event);
   _trail = trail;
   _domain = domain;
+  _ttl = -1;
 
   // Send the query.
   TRC_DEBUG("Sending DNS NAPTR query for %s", domain.c_str());
@@ -245,9 +248,19 @@ void DNSResolver::ares_callback(int status,
     {
       TRC_WARNING("Unparseable DNS ENUM response from host %s: %s", _domain.c_str(), ares_strerror(status));
     }
+    else
+    {
+      _ttl = parse_ttl(abuf, alen, false);
+    }
   }
   else
   {
+    if ((status == ARES_ENOTFOUND) && (abuf != NULL))
+    {
+      // The name doesn't exist, so find out how long we can remember that.
+      _ttl = parse_ttl(abuf, alen, true);
+    }
+
     // Log that we've failed.
     TRC_WARNING("DNS ENUM query failed for host %s: %s", _domain.c_str(), ares_strerror(status));
     SAS::Event event(_trail, SASEvent::RX_ENUM_ERR, 0);
@@ -259,6 +272,102 @@ void DNSResolver::ares_callback(int status,
 }
 
 
+// Reads a 16 or 32 bit field in network byte order.
+static inline unsigned int read_u16(const unsigned char* p)
+{
+  return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static inline unsigned int read_u32(const unsigned char* p)
+{
+  return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+         ((unsigned int)p[2] << 8) | p[3];
+}
+
+// Skips over a (possibly compressed) domain name, returning the length of the
+// name as encoded in the message, or -1 if it is malformed.
+static int skip_name(const unsigned char* p,
+                     const unsigned char* abuf,
+                     int alen)
+{
+  char* name = NULL;
+  long enclen = 0;
+  if (ares_expand_name(p, abuf, alen, &name, &enclen) != ARES_SUCCESS)
+  {
+    return -1;
+  }
+  ares_free_string(name);
+  return (int)enclen;
+}
+
+int DNSResolver::parse_ttl(const unsigned char* abuf, int alen, bool negative)
+{
+  if (alen < NS_HFIXEDSZ)
+  {
+    return -1;
+  }
+
+  unsigned int qdcount = read_u16(abuf + 4);
+  unsigned int ancount = read_u16(abuf + 6);
+  unsigned int nscount = read_u16(abuf + 8);
+  const unsigned char* p = abuf + NS_HFIXEDSZ;
+  const unsigned char* end = abuf + alen;
+
+  // Skip the question section.
+  for (unsigned int ii = 0; ii < qdcount; ii++)
+  {
+    int len = skip_name(p, abuf, alen);
+    if ((len < 0) || (p + len + NS_QFIXEDSZ > end))
+    {
+      return -1;
+    }
+    p += len + NS_QFIXEDSZ;
+  }
+
+  // Spin through the answer and authority records.  For a positive answer we
+  // want the smallest TTL of the answers, and for a negative answer the
+  // smaller of the SOA record's TTL and its MINIMUM field.
+  int ttl = -1;
+  for (unsigned int ii = 0; ii < ancount + nscount; ii++)
+  {
+    int len = skip_name(p, abuf, alen);
+    if ((len < 0) || (p + len + NS_RRFIXEDSZ > end))
+    {
+      return -1;
+    }
+    p += len;
+    unsigned int type = read_u16(p);
+    int rr_ttl = (int)(read_u32(p + 4) & 0x7fffffff);
+    unsigned int rdlength = read_u16(p + 8);
+    p += NS_RRFIXEDSZ;
+    if (p + rdlength > end)
+    {
+      return -1;
+    }
+
+    if ((!negative) && (ii < ancount))
+    {
+      ttl = (ttl < 0) ? rr_ttl : std::min(ttl, rr_ttl);
+    }
+    else if ((negative) && (ii >= ancount) && (type == ns_t_soa))
+    {
+      // The MINIMUM field is the last of the five 32-bit fields following the
+      // MNAME and RNAME.
+      if (rdlength >= 20)
+      {
+        int minimum = (int)(read_u32(p + rdlength - 4) & 0x7fffffff);
+        ttl = std::min(rr_ttl, minimum);
+      }
+      break;
+    }
+
+    p += rdlength;
+  }
+
+  return ttl;
+}
+
+
 DNSResolver* DNSResolverFactory::new_resolver(const std::vector<struct IP46Address>& servers) const
 {
   return new DNSResolver(servers);
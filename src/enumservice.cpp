@@ -28,6 +28,7 @@
 #include "log.h"
 #include "sproutsasevent.h"
 #include "sprout_pd_definitions.h"
+#include "latency_breakdown.h"
 
 
 const boost::regex EnumService::CHARS_TO_STRIP_FROM_UAS = boost::regex("([^0-9+]|(?<=.)[^0-9])");
@@ -148,7 +149,7 @@ void JSONEnumService::update_enum()
   try
   {
     std::vector<NumberPrefix> new_number_prefixes;
-    std::map<std::string, NumberPrefix> new_prefix_regex_map;
+    PrefixTrie<NumberPrefix> new_prefix_trie;
 
     JSON_ASSERT_CONTAINS(doc, "number_blocks");
     JSON_ASSERT_ARRAY(doc["number_blocks"]);
@@ -173,11 +174,10 @@ void JSONEnumService::update_enum()
 
         if (parse_regex_replace(regex, pfix.match, pfix.replace))
         {
-          // Create an array in order of entries in json file, and a map
-          // (automatically sorted in order of key length) so we can later
-          // match numbers to the most specific prefixes
+          // Create an array in order of entries in json file, and a trie so
+          // we can later match numbers to the most specific prefixes
           new_number_prefixes.push_back(pfix);
-          new_prefix_regex_map.insert(std::make_pair(prefix, pfix));
+          new_prefix_trie.insert(prefix, pfix);
           TRC_STATUS("  Adding number prefix %s, regex=%s",
                      pfix.prefix.c_str(), regex.c_str());
         }
@@ -199,7 +199,7 @@ void JSONEnumService::update_enum()
     // Take a write lock on the mutex in RAII style
     boost::lock_guard<boost::shared_mutex> write_lock(_number_prefixes_rw_lock);
     _number_prefixes = new_number_prefixes;
-    _prefix_regex_map = new_prefix_regex_map;
+    _prefix_trie.swap(new_prefix_trie);
   }
   catch (JsonFormatError err)
   {
@@ -276,25 +276,15 @@ std::string JSONEnumService::lookup_uri_from_user(const std::string &user, SAS::
 // the object.
 const JSONEnumService::NumberPrefix* JSONEnumService::prefix_match(const std::string& number) const
 {
-  // Iterate through map in reverse order (already sorted by key length during
-  // construction) to find the most specific matching prefix
-  for (std::map<std::string, NumberPrefix>::const_reverse_iterator it =
-                                                     _prefix_regex_map.rbegin();
-       it != _prefix_regex_map.rend();
-       it++)
-  {
-    int len = std::min(number.size(), (*it).first.size());
-
-    TRC_DEBUG("Comparing first %d numbers of %s against prefix %s",
-              len, number.c_str(), (*it).first.c_str());
+  // Look up the most specific matching prefix in the trie.
+  const PrefixTrie<NumberPrefix>::Entry* entry =
+                  _prefix_trie.match(Utils::remove_visual_separators(number));
 
-    if (Utils::remove_visual_separators(number).
-                                      compare(0, len, (*it).first, 0, len) == 0)
-    {
-      // Found a match, so return it.
-      TRC_DEBUG("Match found");
-      return &((*it).second);
-    }
+  if (entry != NULL)
+  {
+    TRC_DEBUG("Number %s matches prefix %s",
+              number.c_str(), entry->first.c_str());
+    return &(entry->second);
   }
 
   return NULL;
@@ -303,10 +293,14 @@ const JSONEnumService::NumberPrefix* JSONEnumService::prefix_match(const std::st
 DNSEnumService::DNSEnumService(const std::vector<std::string>& dns_servers,
                                const std::string& dns_suffix,
                                const DNSResolverFactory* resolver_factory,
-                               CommunicationMonitor* comm_monitor) :
+                               CommunicationMonitor* comm_monitor,
+                               int max_cache_ttl,
+                               size_t max_cache_entries) :
                                _dns_suffix(dns_suffix),
                                _resolver_factory(resolver_factory),
-                               _comm_monitor(comm_monitor)
+                               _comm_monitor(comm_monitor),
+                               _max_cache_ttl(max_cache_ttl),
+                               _max_cache_entries(max_cache_entries)
 {
   // Initialize the ares library.  This might have already been done by curl
   // but it's safe to do it twice.
@@ -390,8 +384,6 @@ std::string DNSEnumService::lookup_uri_from_user(const std::string& user, SAS::T
   // expressions.
   std::string aus = user_to_aus(user);
   std::string string = aus;
-  // Get the resolver to use.  This comes from thread-local data.
-  DNSResolver* resolver = get_resolver();
   // Spin round until we've finished (successfully or otherwise) or we've done
   // the maximum number of queries.
   bool complete = false;
@@ -404,17 +396,14 @@ std::string DNSEnumService::lookup_uri_from_user(const std::string& user, SAS::T
   {
     // Translate the key into a domain and issue a query for it.
     std::string domain = key_to_domain(string);
-    struct ares_naptr_reply* naptr_reply = NULL;
-    int status = resolver->perform_naptr_query(domain, naptr_reply, trail);
+    std::shared_ptr<const std::vector<Rule>> rules;
+    int status = get_rules(domain, rules, trail);
     if (status == ARES_SUCCESS)
     {
-      // Parse the reply into a sorted list of rules.
-      std::vector<Rule> rules;
-      parse_naptr_reply(naptr_reply, rules);
-      // Now spin through the rules, looking for the first match.
+      // Spin through the rules, looking for the first match.
       std::vector<DNSEnumService::Rule>::const_iterator rule;
-      for (rule = rules.begin();
-           rule != rules.end();
+      for (rule = rules->begin();
+           rule != rules->end();
            ++rule)
       {
         if (rule->matches(string))
@@ -440,7 +429,7 @@ std::string DNSEnumService::lookup_uri_from_user(const std::string& user, SAS::T
       }
       // If we didn't find a match (and so hit the end of the list), consider
       // this a failure.
-      failed = failed || (rule == rules.end());
+      failed = failed || (rule == rules->end());
     }
     else if (status == ARES_ENOTFOUND)
     {
@@ -455,14 +444,6 @@ std::string DNSEnumService::lookup_uri_from_user(const std::string& user, SAS::T
       server_failed = true;
     }
 
-
-    // Free off the NAPTR reply if we have one.
-    if (naptr_reply != NULL)
-    {
-      resolver->free_naptr_reply(naptr_reply);
-      naptr_reply = NULL;
-    }
-
     dns_queries++;
   }
 
@@ -503,6 +484,115 @@ std::string DNSEnumService::lookup_uri_from_user(const std::string& user, SAS::T
 }
 
 
+int DNSEnumService::get_rules(const std::string& domain,
+                              std::shared_ptr<const std::vector<Rule>>& rules,
+                              SAS::TrailId trail) const
+{
+  if (_max_cache_ttl > 0)
+  {
+    // Take a read lock on the cache in RAII style.
+    boost::shared_lock<boost::shared_mutex> read_lock(_cache_lock);
+    std::unordered_map<std::string, CachedAnswer>::const_iterator it =
+                                                           _cache.find(domain);
+    if ((it != _cache.end()) &&
+        (it->second.expiry_ms > now_ms()))
+    {
+      TRC_DEBUG("Found cached NAPTR answer for %s", domain.c_str());
+      rules = it->second.rules;
+      return it->second.status;
+    }
+  }
+
+  // Get the resolver to use.  This comes from thread-local data.
+  DNSResolver* resolver = get_resolver();
+  struct ares_naptr_reply* naptr_reply = NULL;
+  int status;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::ENUM);
+    status = resolver->perform_naptr_query(domain, naptr_reply, trail);
+  }
+  if (status == ARES_SUCCESS)
+  {
+    // Parse the reply into a sorted list of rules.  The regular expressions
+    // are compiled once here, and shared by every lookup that hits the cache.
+    std::vector<Rule>* new_rules = new std::vector<Rule>();
+    parse_naptr_reply(naptr_reply, *new_rules);
+    rules.reset(new_rules);
+  }
+
+  // Free off the NAPTR reply if we have one.
+  if (naptr_reply != NULL)
+  {
+    resolver->free_naptr_reply(naptr_reply);
+    naptr_reply = NULL;
+  }
+
+  // Cache definitive answers, including negative ones.  Server failures
+  // aren't cached, so that we try again on the next request.
+  if ((_max_cache_ttl > 0) &&
+      ((status == ARES_SUCCESS) || (status == ARES_ENOTFOUND)))
+  {
+    int ttl = std::min(resolver->last_ttl(), _max_cache_ttl);
+    if (ttl > 0)
+    {
+      cache_answer(domain, status, rules, ttl);
+    }
+  }
+
+  return status;
+}
+
+
+void DNSEnumService::cache_answer(const std::string& domain,
+                                  int status,
+                                  const std::shared_ptr<const std::vector<Rule>>& rules,
+                                  int ttl) const
+{
+  unsigned long now = now_ms();
+
+  // Take a write lock on the cache in RAII style.
+  boost::lock_guard<boost::shared_mutex> write_lock(_cache_lock);
+
+  std::unordered_map<std::string, CachedAnswer>::iterator it = _cache.find(domain);
+
+  if (it != _cache.end())
+  {
+    // We're replacing an answer (which has probably expired), so it's now the
+    // newest.
+    _cache_order.erase(it->second.order);
+  }
+  else
+  {
+    // Make room for the new answer by evicting the oldest ones.  This is
+    // usually just one, so is cheap however big the cache is.
+    while ((!_cache_order.empty()) && (_cache.size() >= _max_cache_entries))
+    {
+      TRC_DEBUG("NAPTR cache full - evicting answer for %s",
+                _cache_order.front().c_str());
+      _cache.erase(_cache_order.front());
+      _cache_order.pop_front();
+    }
+
+    it = _cache.insert(std::make_pair(domain, CachedAnswer())).first;
+  }
+
+  TRC_DEBUG("Caching NAPTR answer for %s for %d seconds", domain.c_str(), ttl);
+  CachedAnswer& answer = it->second;
+  answer.order = _cache_order.insert(_cache_order.end(), domain);
+  answer.status = status;
+  answer.rules = rules;
+  answer.expiry_ms = now + (unsigned long)ttl * 1000;
+}
+
+
+unsigned long DNSEnumService::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+
 std::string DNSEnumService::key_to_domain(const std::string& key) const
 {
   // First strip all non-numeric characters from the key.
@@ -17,7 +17,7 @@ extern "C" {
 
 // Common STL includes.
 #include <cassert>
-#include <map>
+#include <unordered_map>
 #include <string>
 
 #include "log.h"
@@ -27,13 +27,17 @@ extern "C" {
 #include "flowtable.h"
 
 FlowTable::FlowTable(QuiescingManager* qm, SNMP::U32Scalar* connection_count) :
-  _tp2flow_map(),
-  _tk2flow_map(),
+  _flow_count(0),
   _conn_count(connection_count),
   _quiescing(false),
+  _flows_gone_reported(false),
   _qm(qm)
 {
-  pthread_mutex_init(&_flow_map_lock, NULL);
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    pthread_mutex_init(&_tp_shards[ii].lock, NULL);
+    pthread_mutex_init(&_tk_shards[ii].lock, NULL);
+  }
   report_flow_count();
 }
 
@@ -41,14 +45,31 @@ FlowTable::FlowTable(QuiescingManager* qm, SNMP::U32Scalar* connection_count) :
 FlowTable::~FlowTable()
 {
   // Delete all the existing flows.
-  for (std::map<FlowKey, Flow*>::iterator i = _tp2flow_map.begin();
-       i != _tp2flow_map.end();
-       ++i)
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
   {
-    delete i->second;
+    for (std::unordered_map<FlowKey, Flow*, FlowKey::Hash>::iterator i =
+                                                 _tp_shards[ii].flows.begin();
+         i != _tp_shards[ii].flows.end();
+         ++i)
+    {
+      delete i->second;
+    }
+
+    pthread_mutex_destroy(&_tp_shards[ii].lock);
+    pthread_mutex_destroy(&_tk_shards[ii].lock);
   }
+}
 
-  pthread_mutex_destroy(&_flow_map_lock);
+
+FlowTable::TpShard& FlowTable::tp_shard(const FlowKey& key)
+{
+  return _tp_shards[key.hash() % NUM_SHARDS];
+}
+
+
+FlowTable::TkShard& FlowTable::tk_shard(const std::string& token)
+{
+  return _tk_shards[std::hash<std::string>()(token) % NUM_SHARDS];
 }
 
 
@@ -64,35 +85,44 @@ Flow* FlowTable::find_create_flow(pjsip_transport* transport, const pj_sockaddr*
             transport->obj_name, transport->key.type,
             pj_sockaddr_print(raddr, buf, sizeof(buf), 3));
 
-  pthread_mutex_lock(&_flow_map_lock);
+  TpShard& shard = tp_shard(key);
+  pthread_mutex_lock(&shard.lock);
 
-  std::map<FlowKey, Flow*>::iterator i = _tp2flow_map.find(key);
+  std::unordered_map<FlowKey, Flow*, FlowKey::Hash>::iterator i =
+                                                        shard.flows.find(key);
 
-  if (i == _tp2flow_map.end())
+  if ((i != shard.flows.end()) &&
+      (i->second->inc_ref()))
   {
-    // No matching flow, so create a new one.
+    // Found a matching flow, so return this one.
+    flow = i->second;
+
+    TRC_DEBUG("Found flow record %p", flow);
+  }
+  else
+  {
+    // No matching flow (or the matching flow is being removed), so create a
+    // new one.
     flow = new Flow(this, transport, raddr);
 
     // Add the new flow to the maps.
-    _tp2flow_map.insert(std::make_pair(key, flow));
-    _tk2flow_map.insert(std::make_pair(flow->token(), flow));
+    shard.flows[key] = flow;
+
+    TkShard& token_shard = tk_shard(flow->token());
+    pthread_mutex_lock(&token_shard.lock);
+    token_shard.flows.insert(std::make_pair(flow->token(), flow));
+    pthread_mutex_unlock(&token_shard.lock);
 
     TRC_DEBUG("Added flow record %p", flow);
 
+    ++_flow_count;
     report_flow_count();
-  }
-  else
-  {
-    // Found a matching flow, so return this one.
-    flow = i->second;
 
-    TRC_DEBUG("Found flow record %p", flow);
+    // Add a reference to the flow.
+    flow->inc_ref();
   }
 
-  // Add a reference to the flow.
-  flow->inc_ref();
-
-  pthread_mutex_unlock(&_flow_map_lock);
+  pthread_mutex_unlock(&shard.lock);
 
   return flow;
 }
@@ -110,22 +140,23 @@ Flow* FlowTable::find_flow(pjsip_transport* transport, const pj_sockaddr* raddr)
             transport->obj_name, transport->key.type,
             pj_sockaddr_print(raddr, buf, sizeof(buf), 3));
 
-  pthread_mutex_lock(&_flow_map_lock);
+  TpShard& shard = tp_shard(key);
+  pthread_mutex_lock(&shard.lock);
 
-  std::map<FlowKey, Flow*>::iterator i = _tp2flow_map.find(key);
+  std::unordered_map<FlowKey, Flow*, FlowKey::Hash>::iterator i =
+                                                        shard.flows.find(key);
 
-  if (i != _tp2flow_map.end())
+  // Increment the reference count on the flow, unless it's being removed.
+  if ((i != shard.flows.end()) &&
+      (i->second->inc_ref()))
   {
     // Found a matching flow, so return this one.
     flow = i->second;
 
-    // Increment the reference count on the flow.
-    flow->inc_ref();
-
     TRC_DEBUG("Found flow record %p", flow);
   }
 
-  pthread_mutex_unlock(&_flow_map_lock);
+  pthread_mutex_unlock(&shard.lock);
 
   return flow;
 }
@@ -138,36 +169,43 @@ Flow* FlowTable::find_flow(const std::string& token)
 
   TRC_DEBUG("Find flow for flow token %s", token.c_str());
 
-  pthread_mutex_lock(&_flow_map_lock);
+  TkShard& shard = tk_shard(token);
+  pthread_mutex_lock(&shard.lock);
+
+  std::unordered_map<std::string, Flow*>::iterator i = shard.flows.find(token);
 
-  std::map<std::string, Flow*>::iterator i = _tk2flow_map.find(token);
-  if (i != _tk2flow_map.end())
+  // Add a reference to the flow, unless it's being removed.
+  if ((i != shard.flows.end()) &&
+      (i->second->inc_ref()))
   {
     // Found a flow matching the token.
     flow = i->second;
 
-    // Add a reference to the flow.
-    flow->inc_ref();
-
     TRC_DEBUG("Found flow record %p", flow);
   }
 
-  pthread_mutex_unlock(&_flow_map_lock);
+  pthread_mutex_unlock(&shard.lock);
 
   return flow;
 }
 
 void FlowTable::check_quiescing_state()
 {
-  if (_tp2flow_map.empty() && is_quiescing() && (_qm != NULL))
+  if ((_flow_count == 0) && is_quiescing() && (_qm != NULL))
   {
-    TRC_DEBUG("Flow map is empty and we are quiescing - start transaction-based quiescing");
-    _qm->flows_gone();
+    // This is called without any lock held, from both quiesce() and
+    // remove_flow(), so both may see the flow map empty.  Only the first to
+    // claim the transition calls flows_gone.
+    if (!_flows_gone_reported.exchange(true))
+    {
+      TRC_DEBUG("Flow map is empty and we are quiescing - start transaction-based quiescing");
+      _qm->flows_gone();
+    }
   }
   else
   {
     TRC_DEBUG("Checked quiescing state: flow_map is %s, is_quiescing() result is %s, _qm (QuiescingManager reference) is %s",
-              _tp2flow_map.empty() ? "empty" : "not empty",
+              (_flow_count == 0) ? "empty" : "not empty",
               is_quiescing()? "true" : "false",
               (_qm == NULL) ? "NULL" : "not NULL");
   }
@@ -175,50 +213,54 @@ void FlowTable::check_quiescing_state()
 
 void FlowTable::remove_flow(Flow* flow)
 {
-  pthread_mutex_lock(&_flow_map_lock);
-
   TRC_DEBUG("Remove flow %p", flow);
 
   FlowKey key(flow->transport()->key.type, flow->remote_addr());
 
-  std::map<FlowKey, Flow*>::iterator i = _tp2flow_map.find(key);
-  if (i != _tp2flow_map.end())
-  {
-    _tp2flow_map.erase(i);
-  }
+  // Remove the flow from the maps.  A new flow may already have replaced it
+  // in the transport address map, in which case that is left alone.
+  TpShard& shard = tp_shard(key);
+  pthread_mutex_lock(&shard.lock);
 
-  std::map<std::string, Flow*>::iterator j = _tk2flow_map.find(flow->token());
-  if (j != _tk2flow_map.end())
+  std::unordered_map<FlowKey, Flow*, FlowKey::Hash>::iterator i =
+                                                        shard.flows.find(key);
+  if ((i != shard.flows.end()) &&
+      (i->second == flow))
   {
-    _tk2flow_map.erase(j);
+    shard.flows.erase(i);
   }
 
+  TkShard& token_shard = tk_shard(flow->token());
+  pthread_mutex_lock(&token_shard.lock);
+  token_shard.flows.erase(flow->token());
+  pthread_mutex_unlock(&token_shard.lock);
+
+  pthread_mutex_unlock(&shard.lock);
+
+  // The flow can no longer be found, so it is safe to delete it.
+  --_flow_count;
   report_flow_count();
 
   delete flow;
 
   check_quiescing_state();
-
-  pthread_mutex_unlock(&_flow_map_lock);
 }
 
 void FlowTable::report_flow_count()
 {
-  TRC_DEBUG("Reporting current flow count: %d", _tp2flow_map.size());
-  _conn_count->value = _tp2flow_map.size();
+  int flow_count = _flow_count;
+  TRC_DEBUG("Reporting current flow count: %d", flow_count);
+  _conn_count->value = flow_count;
 }
 
 void FlowTable::quiesce()
 {
   TRC_DEBUG("FlowTable was kicked to quiesce");
   _quiescing = true;
-  pthread_mutex_lock(&_flow_map_lock);
 
   // If we have no flows, quiesce now - otherwise we do this in
   // remove_flow when the last flow disappears
   check_quiescing_state();
-
-  pthread_mutex_unlock(&_flow_map_lock);
 }
 
 void FlowTable::unquiesce()
@@ -230,6 +272,7 @@ void FlowTable::unquiesce()
   // reject REGISTERs with a 305, and whether we call flows_gone on
   // the QuiescingManager when our flow cont falls to 0.
   _quiescing = false;
+  _flows_gone_reported = false;
 }
 
 bool FlowTable::is_quiescing()
@@ -566,12 +609,24 @@ void Flow::restart_timer(int id, int timeout)
 }
 
 
-/// Increment the reference count on the flow.  This is always called when
-/// the flowtable lock is held, so no need to lock.
-void Flow::inc_ref()
+/// Increment the reference count on the flow if it's non-zero.  This is
+/// always called when the flow's FlowTable shard lock is held, so the flow
+/// can't be deleted underneath us.
+///
+/// @returns                  - false if the flow is being removed.
+bool Flow::inc_ref()
 {
-  ++_refs;
-  TRC_DEBUG("Dialog count now %d for flow %s", _refs, _default_id.c_str());
+  int refs;
+  do
+  {
+    refs = _refs.load();
+  }
+  while ((refs != 0) &&
+         (!_refs.compare_exchange_weak(refs, refs + 1)));
+  TRC_DEBUG("Reference count now %d for flow %p", _refs.load(), this);
+
+  // If the reference count was non-zero, we successfully incremented it.
+  return (refs != 0);
 }
 
 
@@ -579,18 +634,13 @@ void Flow::inc_ref()
 /// to zero.
 void Flow::dec_ref()
 {
-  pthread_mutex_lock(&_flow_table->_flow_map_lock);
+  int refs = --_refs;
+  TRC_DEBUG("Reference count now %d for flow %p", refs, this);
 
-  if ((--_refs) == 0)
+  if (refs == 0)
   {
-    pthread_mutex_unlock(&_flow_table->_flow_map_lock);
     _flow_table->remove_flow(this);
   }
-  else
-  {
-    TRC_DEBUG("Dialog count now %d for flow %s", _refs, _default_id.c_str());
-    pthread_mutex_unlock(&_flow_table->_flow_map_lock);
-  }
 }
 
 // Increments the dialog count atomically.
@@ -161,10 +161,18 @@ static void set_remote_aor_data(std::string aor_id,
                                 AoRPair* previous_aor_pair,
                                 std::vector<SubscriberDataManager*> remote_sdms,
                                 HSSConnection* hss,
+                                AoRReplicator* aor_replicator,
                                 SAS::TrailId trail)
 {
   bool ignored = false;
 
+  if (aor_replicator != NULL)
+  {
+    // Leave the remote writes to the replicator, so we don't wait for them.
+    aor_replicator->replicate(aor_id, previous_aor_pair, trail);
+    return;
+  }
+
   // If we have any remote stores, try to store this in them too.  We don't worry
   // about failures in this case.
   for (SubscriberDataManager* sdm : remote_sdms)
@@ -330,6 +338,7 @@ void AoRTimeoutTask::process_aor_timeout(std::string aor_id)
                         aor_pair,
                         _cfg->_remote_sdms,
                         _cfg->_hss,
+                        _cfg->_aor_replicator,
                         trail());
 
     if (all_bindings_expired)
@@ -416,6 +425,10 @@ HTTPCode DeregistrationTask::handle_request()
        it!=_bindings.end();
        ++it)
   {
+    // The HSS has deregistered this subscriber, so discard any copy of their
+    // data that we have cached.
+    _cfg->_hss->invalidate_cached_data({it->first});
+
     AoRPair* aor_pair = deregister_bindings(_cfg->_sdm,
                                             _cfg->_hss,
                                             _cfg->_fifc_service,
@@ -431,7 +444,9 @@ HTTPCode DeregistrationTask::handle_request()
         (aor_pair->get_current() != NULL))
     {
       // If we have any remote stores, try to store this in them too.  We don't worry
-      // about failures in this case.
+      // about failures in this case.  This isn't left to the AoR replicator, as
+      // we must also remove (and delete the IMPIs of) any bindings that are
+      // only present in the remote stores.
       for (std::vector<SubscriberDataManager*>::const_iterator sdm = _cfg->_remote_sdms.begin();
            sdm != _cfg->_remote_sdms.end();
            ++sdm)
@@ -542,6 +557,9 @@ AoRPair* DeregistrationTask::deregister_bindings(
       break;
     }
 
+    // Work out which bindings to remove.  We only read the bindings here, so
+    // use the const accessor rather than get_binding, which would take a
+    // private copy of each one.
     std::vector<std::string> binding_ids;
 
     for (AoR::Bindings::const_iterator i =
@@ -549,16 +567,7 @@ AoRPair* DeregistrationTask::deregister_bindings(
          i != aor_pair->get_current()->bindings().end();
          ++i)
     {
-      // Get a list of the bindings to iterate over
-      binding_ids.push_back(i->first);
-    }
-
-    for (std::vector<std::string>::const_iterator i = binding_ids.begin();
-         i != binding_ids.end();
-         ++i)
-    {
-      std::string b_id = *i;
-      AoR::Binding* b = aor_pair->get_current()->get_binding(b_id);
+      const AoR::Binding* b = i->second;
 
       if (private_id.empty() || private_id == b->_private_id)
       {
@@ -568,10 +577,17 @@ AoRPair* DeregistrationTask::deregister_bindings(
           // this binding.
           impis_to_delete.insert(b->_private_id);
         }
-        aor_pair->get_current()->remove_binding(b_id);
+        binding_ids.push_back(i->first);
       }
     }
 
+    for (std::vector<std::string>::const_iterator i = binding_ids.begin();
+         i != binding_ids.end();
+         ++i)
+    {
+      aor_pair->get_current()->remove_binding(*i);
+    }
+
     aor_pair->get_current()->_associated_uris = associated_uris;
     set_rc = current_sdm->set_aor_data(aor_id,
                                        aor_pair,
@@ -787,6 +803,31 @@ std::string GetSubscriptionsTask::serialize_data(AoR* aor)
   return sb.GetString();
 }
 
+//
+// API for reporting the breakdown of SIP message latency.
+//
+
+void GetLatencyTask::run()
+{
+  if (_req.method() == htp_method_GET)
+  {
+    _req.add_content(_cfg->_latency_breakdown->to_json());
+    send_http_reply(HTTP_OK);
+  }
+  else if (_req.method() == htp_method_DELETE)
+  {
+    TRC_STATUS("Resetting SIP latency breakdown");
+    _cfg->_latency_breakdown->reset();
+    send_http_reply(HTTP_OK);
+  }
+  else
+  {
+    send_http_reply(HTTP_BADMETHOD);
+  }
+
+  delete this;
+}
+
 void DeleteImpuTask::run()
 {
   TRC_DEBUG("Request to delete an IMPU");
@@ -951,6 +992,13 @@ HTTPCode PushProfileTask::update_associated_uris(SAS::TrailId trail)
 {
   HTTPCode rc = HTTP_OK;
   bool all_bindings_expired = false;
+
+  // The subscriber's profile has changed, so discard any copy of it that we
+  // have cached.
+  std::vector<std::string> public_ids = _associated_uris.get_all_uris();
+  public_ids.push_back(_default_public_id);
+  _cfg->_hss->invalidate_cached_data(public_ids);
+
   AoRPair* aor_pair = get_and_set_local_aor_data(_cfg->_sdm,
                                                  _default_public_id,
                                                  &_associated_uris,
@@ -966,6 +1014,7 @@ HTTPCode PushProfileTask::update_associated_uris(SAS::TrailId trail)
                         aor_pair,
                         _cfg->_remote_sdms,
                         _cfg->_hss,
+                        _cfg->_aor_replicator,
                         trail);
 
     if (all_bindings_expired)
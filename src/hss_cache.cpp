@@ -0,0 +1,185 @@
+/**
+ * @file hss_cache.cpp HSSCache class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <time.h>
+#include <functional>
+
+#include "log.h"
+#include "hss_cache.h"
+
+HSSCache::HSSCache(int ttl_ms, int max_entries, int num_shards) :
+  _ttl_ms(ttl_ms),
+  _max_entries_per_shard(1),
+  _shards()
+{
+  if (num_shards < 1)
+  {
+    num_shards = 1;
+  }
+
+  // Split the size bound evenly across the shards, rounding up so that the
+  // cache can always hold at least one entry per shard.
+  if (max_entries > num_shards)
+  {
+    _max_entries_per_shard = (max_entries + num_shards - 1) / num_shards;
+  }
+
+  for (int ii = 0; ii < num_shards; ++ii)
+  {
+    Shard* shard = new Shard();
+    pthread_mutex_init(&shard->lock, NULL);
+    _shards.push_back(shard);
+  }
+
+  TRC_STATUS("Created HSS cache with TTL %dms and %d entries in %d shards",
+             ttl_ms, (int)(_max_entries_per_shard * num_shards), num_shards);
+}
+
+HSSCache::~HSSCache()
+{
+  for (std::vector<Shard*>::iterator i = _shards.begin();
+       i != _shards.end();
+       ++i)
+  {
+    pthread_mutex_destroy(&(*i)->lock);
+    delete *i;
+  }
+  _shards.clear();
+}
+
+bool HSSCache::get(const std::string& public_id, Entry& entry)
+{
+  bool found = false;
+  Shard& shard = shard_for(public_id);
+
+  pthread_mutex_lock(&shard.lock);
+
+  std::unordered_map<std::string, LRUList::iterator>::iterator i =
+                                                    shard.index.find(public_id);
+  if (i != shard.index.end())
+  {
+    LRUList::iterator node = i->second;
+
+    if (node->expiry_ms > now_ms())
+    {
+      // Move the entry to the front of the LRU list and return a copy of it.
+      shard.lru.splice(shard.lru.begin(), shard.lru, node);
+      entry = node->entry;
+      found = true;
+    }
+    else
+    {
+      TRC_DEBUG("Cached HSS data for %s has expired", public_id.c_str());
+      shard.lru.erase(node);
+      shard.index.erase(i);
+    }
+  }
+
+  pthread_mutex_unlock(&shard.lock);
+
+  return found;
+}
+
+void HSSCache::put(const std::string& public_id, const Entry& entry)
+{
+  Shard& shard = shard_for(public_id);
+  unsigned long expiry_ms = now_ms() + _ttl_ms;
+
+  pthread_mutex_lock(&shard.lock);
+
+  std::unordered_map<std::string, LRUList::iterator>::iterator i =
+                                                    shard.index.find(public_id);
+  if (i != shard.index.end())
+  {
+    // Replace the existing entry.
+    LRUList::iterator node = i->second;
+    node->entry = entry;
+    node->expiry_ms = expiry_ms;
+    shard.lru.splice(shard.lru.begin(), shard.lru, node);
+  }
+  else
+  {
+    Node node;
+    node.public_id = public_id;
+    node.entry = entry;
+    node.expiry_ms = expiry_ms;
+    shard.lru.push_front(node);
+    shard.index[public_id] = shard.lru.begin();
+
+    // Evict the least recently used entries if the shard is now over its
+    // size limit.
+    while (shard.lru.size() > _max_entries_per_shard)
+    {
+      TRC_DEBUG("Evicting cached HSS data for %s",
+                shard.lru.back().public_id.c_str());
+      shard.index.erase(shard.lru.back().public_id);
+      shard.lru.pop_back();
+    }
+  }
+
+  pthread_mutex_unlock(&shard.lock);
+}
+
+void HSSCache::invalidate(const std::string& public_id)
+{
+  Shard& shard = shard_for(public_id);
+
+  pthread_mutex_lock(&shard.lock);
+
+  std::unordered_map<std::string, LRUList::iterator>::iterator i =
+                                                    shard.index.find(public_id);
+  if (i != shard.index.end())
+  {
+    TRC_DEBUG("Invalidating cached HSS data for %s", public_id.c_str());
+    shard.lru.erase(i->second);
+    shard.index.erase(i);
+  }
+
+  pthread_mutex_unlock(&shard.lock);
+}
+
+void HSSCache::invalidate(const std::vector<std::string>& public_ids)
+{
+  for (std::vector<std::string>::const_iterator i = public_ids.begin();
+       i != public_ids.end();
+       ++i)
+  {
+    invalidate(*i);
+  }
+}
+
+int HSSCache::size()
+{
+  int size = 0;
+
+  for (std::vector<Shard*>::iterator i = _shards.begin();
+       i != _shards.end();
+       ++i)
+  {
+    pthread_mutex_lock(&(*i)->lock);
+    size += (*i)->lru.size();
+    pthread_mutex_unlock(&(*i)->lock);
+  }
+
+  return size;
+}
+
+HSSCache::Shard& HSSCache::shard_for(const std::string& public_id)
+{
+  return *_shards[std::hash<std::string>()(public_id) % _shards.size()];
+}
+
+unsigned long HSSCache::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
@@ -26,6 +26,7 @@
 #include "snmp_continuous_accumulator_table.h"
 #include "xml_utils.h"
 #include "sprout_xml_utils.h"
+#include "latency_breakdown.h"
 
 const std::string HSSConnection::REG = "reg";
 const std::string HSSConnection::CALL = "call";
@@ -46,7 +47,8 @@ HSSConnection::HSSConnection(const std::string& server,
                              SNMP::EventAccumulatorTable* homestead_lir_latency_tbl,
                              CommunicationMonitor* comm_monitor,
                              SIFCService* sifc_service,
-                             long homestead_timeout_ms) :
+                             long homestead_timeout_ms,
+                             HSSCache* cache) :
   _http(new HttpConnection(server,
                            false,
                            resolver,
@@ -63,7 +65,8 @@ HSSConnection::HSSConnection(const std::string& server,
   _sar_latency_tbl(homestead_sar_latency_tbl),
   _uar_latency_tbl(homestead_uar_latency_tbl),
   _lir_latency_tbl(homestead_lir_latency_tbl),
-  _sifc_service(sifc_service)
+  _sifc_service(sifc_service),
+  _cache(cache)
 {
 }
 
@@ -147,7 +150,11 @@ HTTPCode HSSConnection::get_json_object(const std::string& path,
                                         SAS::TrailId trail)
 {
   std::string json_data;
-  HTTPCode rc = _http->send_get(path, json_data, "", trail);
+  HTTPCode rc;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::HOMESTEAD);
+    rc = _http->send_get(path, json_data, "", trail);
+  }
 
   if (rc == HTTP_OK)
   {
@@ -207,12 +214,16 @@ HTTPCode HSSConnection::put_for_xml_object(const std::string& path,
     req_headers.push_back("Cache-control: no-cache");
   }
 
-  HTTPCode http_code = _http->send_put(path,
-                                       rsp_headers,
-                                       raw_data,
-                                       body,
-                                       req_headers,
-                                       trail);
+  HTTPCode http_code;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::HOMESTEAD);
+    http_code = _http->send_put(path,
+                                rsp_headers,
+                                raw_data,
+                                body,
+                                req_headers,
+                                trail);
+  }
 
   if (http_code == HTTP_OK)
   {
@@ -230,7 +241,11 @@ HTTPCode HSSConnection::get_xml_object(const std::string& path,
 {
   std::string raw_data;
 
-  HTTPCode http_code = _http->send_get(path, raw_data, "", trail);
+  HTTPCode http_code;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::HOMESTEAD);
+    http_code = _http->send_get(path, raw_data, "", trail);
+  }
 
   if (http_code == HTTP_OK)
   {
@@ -530,6 +545,39 @@ HTTPCode HSSConnection::update_registration_state(const std::string& public_user
                                                   const std::string& wildcard,
                                                   SAS::TrailId trail)
 {
+  // Requests that just look up the subscriber's data for a call can be
+  // served from (and used to populate) the local cache.  Requests with a
+  // private identity or wildcard identity can return different data for the
+  // same public identity, so aren't cached.
+  bool use_cache = ((_cache != NULL) &&
+                    (type == CALL) &&
+                    (cache_allowed) &&
+                    (private_user_identity.empty()) &&
+                    (wildcard.empty()));
+
+  if (use_cache)
+  {
+    HSSCache::Entry entry;
+
+    if (_cache->get(public_user_identity, entry))
+    {
+      TRC_DEBUG("Using cached HSS data for %s", public_user_identity.c_str());
+      regstate = entry.regstate;
+      ifcs_map = entry.ifcs_map;
+      associated_uris = entry.associated_uris;
+      aliases = entry.aliases;
+      ccfs = entry.ccfs;
+      ecfs = entry.ecfs;
+      return HTTP_OK;
+    }
+  }
+  else if ((_cache != NULL) && (type != CALL))
+  {
+    // This request changes the registration state on the HSS, so any data we
+    // have cached for this subscriber is now stale.
+    _cache->invalidate(public_user_identity);
+  }
+
   Utils::StopWatch stopWatch;
   stopWatch.start();
 
@@ -585,17 +633,50 @@ HTTPCode HSSConnection::update_registration_state(const std::string& public_user
     return http_code;
   }
 
-  return decode_homestead_xml(public_user_identity,
-                              root,
-                              regstate,
-                              ifcs_map,
-                              associated_uris,
-                              aliases,
-                              ccfs,
-                              ecfs,
-                              _sifc_service,
-                              false,
-                              trail) ? HTTP_OK : HTTP_SERVER_ERROR;
+  if (!decode_homestead_xml(public_user_identity,
+                            root,
+                            regstate,
+                            ifcs_map,
+                            associated_uris,
+                            aliases,
+                            ccfs,
+                            ecfs,
+                            _sifc_service,
+                            false,
+                            trail))
+  {
+    return HTTP_SERVER_ERROR;
+  }
+
+  if (use_cache)
+  {
+    HSSCache::Entry entry;
+    entry.regstate = regstate;
+    entry.ifcs_map = ifcs_map;
+    entry.associated_uris = associated_uris;
+    entry.aliases = aliases;
+    entry.ccfs = ccfs;
+    entry.ecfs = ecfs;
+    _cache->put(public_user_identity, entry);
+  }
+  else if ((_cache != NULL) && (type != CALL))
+  {
+    // The registration state of the whole implicit registration set has
+    // changed, so invalidate all of its identities.  This also catches any
+    // call lookup that raced with this request and cached the old data.
+    _cache->invalidate(public_user_identity);
+    _cache->invalidate(associated_uris.get_all_uris());
+  }
+
+  return HTTP_OK;
+}
+
+void HSSConnection::invalidate_cached_data(const std::vector<std::string>& public_ids)
+{
+  if (_cache != NULL)
+  {
+    _cache->invalidate(public_ids);
+  }
 }
 
 HTTPCode HSSConnection::get_registration_data(const std::string& public_user_identity,
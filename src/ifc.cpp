@@ -11,6 +11,8 @@
 
 #include <boost/regex.hpp>
 #include <cassert>
+#include <algorithm>
+#include <sstream>
 
 extern "C" {
 #include <pjlib-util.h>
@@ -59,190 +61,527 @@ Ifc::Ifc(std::string ifc_str,
   _ifc = ifc_doc->clone_node(new_document->first_node());
 
   delete new_document;
+
+  _compiled = compile(_ifc);
 }
 
-void Ifc::invalid_ifc(std::string error,
-                      std::string server_name,
-                      int sas_event_id,
-                      int instance_id,
-                      SAS::TrailId trail)
+// An error found when compiling an iFC.  Errors aren't raised when the iFC is
+// compiled, but when evaluating the iFC reaches the invalid part of it, so an
+// invalid iFC is reported on the trail of the request that hits it and
+// matches exactly as much as it always did.
+struct IfcError
 {
-  SAS::Event event(trail, sas_event_id, instance_id);
-  event.add_var_param(server_name);
-  event.add_var_param(error);
-  SAS::report_event(event);
-  throw xml_error(error.c_str());
+  IfcError() : text(), report(false) {}
+
+  IfcError(const std::string& text, bool report) : text(text), report(report) {}
+
+  bool is_set() const { return !text.empty(); }
+
+  // The description of the error.  Empty if there is no error.
+  std::string text;
+
+  // Whether the error has its own SAS event, in addition to the generic
+  // "invalid iFC ignored" event.
+  bool report;
+};
+
+struct Ifc::CompiledSpt
+{
+  enum SptClass
+  {
+    METHOD,
+    SIP_HEADER,
+    SESSION_CASE,
+    REQUEST_URI,
+    SESSION_DESCRIPTION,
+    UNKNOWN
+  };
+
+  SptClass spt_class;
+  std::string class_name;
+  bool negated;
+  std::vector<int32_t> groups;
+
+  // Method.  The registration types are only used for REGISTER.
+  std::string method;
+  bool has_reg_types;
+  std::vector<int> reg_types;
+
+  // SIPHeader (Header and Content), RequestURI (regex only) and
+  // SessionDescription (Line and Content).  If the Header of a SIPHeader SPT
+  // is a plain string, it is held lower-cased in header_literal and matched
+  // without using a regex.
+  std::string header_literal;
+  boost::regex regex;
+  bool has_content;
+  boost::regex content_regex;
+
+  // SessionCase.
+  int session_case;
+
+  // Errors in the SPT.
+  // - error is raised as soon as the SPT is evaluated.
+  // - match_error is raised when the Method of a REGISTER SPT, the Header of
+  //   a SIPHeader SPT or the Line of a SessionDescription SPT matches, as
+  //   that is when its RegistrationType or Content is used.
+  // - group_error is raised once the SPT has been evaluated.
+  IfcError error;
+  IfcError match_error;
+  IfcError group_error;
+};
+
+struct Ifc::CompiledIfc
+{
+  std::string ifc_str;
+  std::string server_name;
+
+  // Raised before the iFC is evaluated.  This is reported as a missing
+  // application server if report is set.
+  IfcError error;
+
+  // -1 if the iFC has no ProfilePartIndicator.
+  int profile_part_indicator;
+
+  bool has_trigger;
+  bool cnf;
+
+  // Raised after the ProfilePartIndicator has been checked, before any of
+  // the SPTs are evaluated.
+  IfcError trigger_error;
+
+  std::vector<CompiledSpt> spts;
+};
+
+// Returns true if the regular expression is just a string of characters that
+// can appear in a header name, so can be matched as a literal substring.
+static bool is_plain_header_name(const std::string& regex)
+{
+  for (std::string::const_iterator c = regex.begin(); c != regex.end(); ++c)
+  {
+    if (!isalnum(*c) && (*c != '-') && (*c != '_'))
+    {
+      return false;
+    }
+  }
+
+  return !regex.empty();
 }
 
-// Test if the SPT matches. Ignores grouping and negation, and just
-// evaluates the service point trigger in the node.
-// @return true if the SPT matches, false if not
-// @throw xml_error if there is a problem evaluating the trigger.
-bool Ifc::spt_matches(const SessionCase& session_case,  //< The session case
-                      bool is_registered,               //< The registration state
-                      bool is_initial_registration,
-                      pjsip_msg* msg,                   //< The message being matched
-                      xml_node<>* spt,                  //< The Service Point Trigger node
-                      std::string ifc_str,
-                      std::string server_name,
-                      SAS::TrailId trail)
+// Compiles a regular expression from an SPT.  If it is invalid, sets the
+// error (unless it is already set) and returns false.
+static bool compile_spt_regex(const std::string& regex,
+                              boost::regex& compiled,
+                              IfcError& error,
+                              const char* error_text,
+                              boost::regex::flag_type flags = boost::regex::normal)
 {
+  compiled = boost::regex(regex, flags | boost::regex_constants::no_except);
+
+  if (compiled.status())
+  {
+    if (!error.is_set())
+    {
+      error = IfcError(error_text, true);
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+// Compiles a single Service Point Trigger, recording any errors in it.
+Ifc::CompiledSpt Ifc::compile_spt(xml_node<>* spt)
+{
+  CompiledSpt compiled;
+  compiled.spt_class = CompiledSpt::UNKNOWN;
+  compiled.negated = false;
+  compiled.has_reg_types = false;
+  compiled.has_content = false;
+  compiled.session_case = -1;
+
+  try
+  {
+    xml_node<>* neg_node = spt->first_node(RegDataXMLUtils::CONDITION_NEGATED);
+    compiled.negated = neg_node && XMLUtils::parse_bool(neg_node, RegDataXMLUtils::CONDITION_NEGATED);
+  }
+  catch (xml_error err)
+  {
+    compiled.error = IfcError(err.what(), false);
+    return compiled;
+  }
+
+  try
+  {
+    for (xml_node<>* group_node = spt->first_node(RegDataXMLUtils::GROUP);
+         group_node;
+         group_node = group_node->next_sibling(RegDataXMLUtils::GROUP))
+    {
+      compiled.groups.push_back(XMLUtils::parse_integer(group_node,
+                                                        "Group ID",
+                                                        0,
+                                                        std::numeric_limits<int32_t>::max()));
+    }
+  }
+  catch (xml_error err)
+  {
+    compiled.group_error = IfcError(err.what(), false);
+  }
+
   // Find the class node.
   xml_node<>* node = spt->first_node();
-  const char* name = NULL;
-
   for (; node; node = node->next_sibling())
   {
-    name = node->name();
-
-    if ((strcmp(name, RegDataXMLUtils::CONDITION_NEGATED) != 0) &&
-        (strcmp(name, RegDataXMLUtils::GROUP) != 0))
+    if ((strcmp(node->name(), RegDataXMLUtils::CONDITION_NEGATED) != 0) &&
+        (strcmp(node->name(), RegDataXMLUtils::GROUP) != 0))
     {
-      if (strcmp(name, RegDataXMLUtils::EXTENSION) == 0)
-      {
-        invalid_ifc("Missing class for service point trigger", server_name, SASEvent::IFC_INVALID, 0, trail);
-      }
-      else
-      {
-        break;
-      }
+      break;
     }
   }
 
-  if (!node)
+  if ((!node) || (strcmp(node->name(), RegDataXMLUtils::EXTENSION) == 0))
   {
-    invalid_ifc("Missing class for service point trigger", server_name, SASEvent::IFC_INVALID, 0, trail);
+    compiled.error = IfcError("Missing class for service point trigger", true);
+    return compiled;
   }
 
-  // Now interpret the node depending on its class.
-  bool ret = false;
+  const char* name = node->name();
+  compiled.class_name = name;
 
   if (strcmp(RegDataXMLUtils::METHOD, name) == 0)
   {
+    compiled.spt_class = CompiledSpt::METHOD;
+    compiled.method = node->value();
+
     // If we have a REGISTER we may need to match on RegistrationType.
-    if ((strcmp("REGISTER", node->value()) == 0) &&
-        (pj_strcmp2(&msg->line.req.method.name, node->value()) == 0))
+    if (compiled.method == "REGISTER")
     {
-      ret = true;
-      node = node->next_sibling();
-      if (node)
+      xml_node<>* ext_node = node->next_sibling();
+      if ((ext_node) &&
+          (strcmp(ext_node->name(), RegDataXMLUtils::EXTENSION) == 0))
       {
-        name = node->name();
-        if (strcmp(name, RegDataXMLUtils::EXTENSION) == 0)
+        try
         {
-          for (xml_node<>* reg_type_node = node->first_node(RegDataXMLUtils::REGISTRATION_TYPE);
+          for (xml_node<>* reg_type_node = ext_node->first_node(RegDataXMLUtils::REGISTRATION_TYPE);
                reg_type_node;
                reg_type_node = reg_type_node->next_sibling(RegDataXMLUtils::REGISTRATION_TYPE))
           {
-            name = reg_type_node->name();
-            int reg_type = XMLUtils::parse_integer(reg_type_node,
-                                                   "registration type",
-                                                   0,
-                                                   2);
-
-            // Find expiry value from SIP message if it is present to determine
-            // whether we have a de-registration.  Set an arbitrary default value of
-            // an hour.
-            pj_bool_t dereg = PJUtils::is_deregistration(msg);
-
-            switch (reg_type)
-            {
-            case INITIAL_REGISTRATION:
-              ret = (is_initial_registration && !dereg);
-              break;
-            case REREGISTRATION:
-              ret = (!is_initial_registration && !dereg);
-              break;
-            case DEREGISTRATION:
-              ret = dereg;
-              break;
-            default:
-              // LCOV_EXCL_START Unreachable
-              TRC_WARNING("Impossible case %d", reg_type);
-              ret = false;
-              break;
-              // LCOV_EXCL_STOP
-            }
-
-            // If we've found a match, break out of the for loop.
-            if (ret)
-            {
-              break;
-            }
+            compiled.has_reg_types = true;
+            compiled.reg_types.push_back(XMLUtils::parse_integer(reg_type_node,
+                                                                 "registration type",
+                                                                 0,
+                                                                 2));
           }
         }
+        catch (xml_error err)
+        {
+          // The registration types before the invalid one are still
+          // checked first.
+          compiled.match_error = IfcError(err.what(), false);
+        }
       }
     }
-    else
-    {
-      ret = (pj_strcmp2(&msg->line.req.method.name, node->value()) == 0);
-    }
   }
   else if (strcmp(RegDataXMLUtils::SIP_HEADER, name) == 0)
   {
+    compiled.spt_class = CompiledSpt::SIP_HEADER;
     xml_node<>* spt_header = node->first_node(RegDataXMLUtils::HEADER);
     xml_node<>* spt_content = node->first_node(RegDataXMLUtils::CONTENT);
-    boost::regex header_regex;
-    boost::regex content_regex;
-    pjsip_hdr* header = NULL;
 
     if (!spt_header)
     {
-      invalid_ifc("Missing Header element for SIPHeader service point trigger",
-                  server_name, SASEvent::IFC_INVALID, 0, trail);
+      compiled.error = IfcError("Missing Header element for SIPHeader service point trigger", true);
+      return compiled;
+    }
+
+    std::string header = XMLUtils::get_text_or_cdata(spt_header);
+    if (!compile_spt_regex(header,
+                           compiled.regex,
+                           compiled.error,
+                           "Invalid regular expression in Header element for SIPHeader service point trigger",
+                           boost::regex_constants::icase))
+    {
+      return compiled;
+    }
+
+    if (is_plain_header_name(header))
+    {
+      std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+      compiled.header_literal = header;
+    }
+
+    if (spt_content)
+    {
+      compiled.has_content = true;
+      compile_spt_regex(XMLUtils::get_text_or_cdata(spt_content),
+                        compiled.content_regex,
+                        compiled.match_error,
+                        "Invalid regular expression in Content element for SIPHeader service point trigger");
+    }
+  }
+  else if (strcmp(RegDataXMLUtils::SESSION_CASE, name) == 0)
+  {
+    compiled.spt_class = CompiledSpt::SESSION_CASE;
+
+    try
+    {
+      compiled.session_case = XMLUtils::parse_integer(node, "session case", 0, 4);
+    }
+    catch (xml_error err)
+    {
+      compiled.error = IfcError(err.what(), false);
+    }
+  }
+  else if (strcmp(RegDataXMLUtils::REQUEST_URI, name) == 0)
+  {
+    compiled.spt_class = CompiledSpt::REQUEST_URI;
+    compile_spt_regex(XMLUtils::get_text_or_cdata(node),
+                      compiled.regex,
+                      compiled.error,
+                      "Invalid regular expression in Request URI service point trigger");
+  }
+  else if (strcmp(RegDataXMLUtils::SESSION_DESCRIPTION, name) == 0)
+  {
+    compiled.spt_class = CompiledSpt::SESSION_DESCRIPTION;
+    xml_node<>* spt_line = node->first_node(RegDataXMLUtils::LINE);
+    xml_node<>* spt_content = node->first_node(RegDataXMLUtils::CONTENT);
+
+    if (!spt_line)
+    {
+      compiled.error = IfcError("Missing Line element for SessionDescription service point trigger", true);
+      return compiled;
+    }
+
+    if (!compile_spt_regex(XMLUtils::get_text_or_cdata(spt_line),
+                           compiled.regex,
+                           compiled.error,
+                           "Invalid regular expression in Line element for Session Description service point trigger"))
+    {
+      return compiled;
+    }
+
+    if (spt_content)
+    {
+      compiled.has_content = true;
+      compile_spt_regex(XMLUtils::get_text_or_cdata(spt_content),
+                        compiled.content_regex,
+                        compiled.match_error,
+                        "Invalid regular expression in Content element for Session Description service point trigger");
+    }
+  }
+
+  return compiled;
+}
+
+std::shared_ptr<const Ifc::CompiledIfc> Ifc::compile(xml_node<>* ifc)
+{
+  std::shared_ptr<CompiledIfc> compiled;
+
+  if (ifc == NULL)
+  {
+    return compiled;
+  }
+
+  compiled = std::make_shared<CompiledIfc>();
+  rapidxml::print(std::back_inserter(compiled->ifc_str), *ifc, 0);
+  compiled->profile_part_indicator = -1;
+  compiled->has_trigger = false;
+  compiled->cnf = false;
+
+  xml_node<>* as = ifc->first_node(RegDataXMLUtils::APPLICATION_SERVER);
+  if (as == NULL)
+  {
+    compiled->error = IfcError("iFC missing ApplicationServer element", true);
+    return compiled;
+  }
+
+  compiled->server_name = XMLUtils::get_first_node_value(as, RegDataXMLUtils::SERVER_NAME);
+  if (compiled->server_name.empty())
+  {
+    compiled->error = IfcError("iFC has no ServerName", true);
+    return compiled;
+  }
+
+  try
+  {
+    xml_node<>* profile_part_indicator = ifc->first_node(RegDataXMLUtils::PROFILE_PART_INDICATOR);
+    if (profile_part_indicator)
+    {
+      compiled->profile_part_indicator = XMLUtils::parse_integer(profile_part_indicator,
+                                                                 "ProfilePartIndicator",
+                                                                 0,
+                                                                 1);
+    }
+  }
+  catch (xml_error err)
+  {
+    compiled->error = IfcError(err.what(), false);
+    return compiled;
+  }
+
+  // @@@ KSW Parse the URI and ensure it is parsable and a SIP URI
+  // here. If it's invalid, ignore it (seems the only sensible
+  // option).
+  //
+  // That means each AsInvocation would have to belong to a pool,
+  // though, and that's not easy in the current architecture.
+
+  xml_node<>* trigger = ifc->first_node(RegDataXMLUtils::TRIGGER_POINT);
+  compiled->has_trigger = (trigger != NULL);
+
+  if (trigger)
+  {
+    try
+    {
+      compiled->cnf = XMLUtils::parse_bool(trigger->first_node(RegDataXMLUtils::CONDITION_TYPE_CNF),
+                                           RegDataXMLUtils::CONDITION_TYPE_CNF);
+    }
+    catch (xml_error err)
+    {
+      compiled->trigger_error = IfcError(err.what(), false);
+      return compiled;
     }
 
-    header_regex = boost::regex(XMLUtils::get_text_or_cdata(spt_header),
-                                boost::regex_constants::icase |
-                                boost::regex_constants::no_except);
-    if (header_regex.status())
+    for (xml_node<>* spt = trigger->first_node(RegDataXMLUtils::SPT);
+         spt;
+         spt = spt->next_sibling(RegDataXMLUtils::SPT))
     {
-      invalid_ifc("Invalid regular expression in Header element for SIPHeader service point trigger",
-                  server_name, SASEvent::IFC_INVALID, 0, trail);
+      compiled->spts.push_back(compile_spt(spt));
     }
+  }
 
-    for (header = msg->hdr.next; header != &msg->hdr; header = header->next)
+  return compiled;
+}
+
+// Raises an error found in an SPT when it was compiled.
+// @throw xml_error always.
+static void raise_spt_error(const IfcError& error,
+                            const std::string& server_name,
+                            SAS::TrailId trail)
+{
+  if (error.report)
+  {
+    SAS::Event event(trail, SASEvent::IFC_INVALID, 0);
+    event.add_var_param(server_name);
+    event.add_var_param(error.text);
+    SAS::report_event(event);
+  }
+
+  throw xml_error(error.text.c_str());
+}
+
+// Test if the SPT matches. Ignores grouping and negation, and just
+// evaluates the service point trigger.
+// @return true if the SPT matches, false if not
+// @throw xml_error if the SPT is invalid.
+bool Ifc::spt_matches(const SessionCase& session_case,  //< The session case
+                      bool is_registered,               //< The registration state
+                      bool is_initial_registration,
+                      pjsip_msg* msg,                   //< The message being matched
+                      const CompiledSpt& spt,           //< The Service Point Trigger
+                      const std::string& server_name,
+                      SAS::TrailId trail)
+{
+  if (spt.error.is_set())
+  {
+    raise_spt_error(spt.error, server_name, trail);
+  }
+
+  bool ret = false;
+
+  switch (spt.spt_class)
+  {
+  case CompiledSpt::METHOD:
+    ret = (pj_strcmp2(&msg->line.req.method.name, spt.method.c_str()) == 0);
+
+    // If we have a REGISTER we may need to match on RegistrationType.
+    if ((ret) && ((spt.has_reg_types) || (spt.match_error.is_set())))
     {
-      if (boost::regex_search(PJUtils::pj_str_to_string(&(header->name)), header_regex))
+      // Find expiry value from SIP message if it is present to determine
+      // whether we have a de-registration.
+      pj_bool_t dereg = PJUtils::is_deregistration(msg);
+      ret = false;
+
+      for (std::vector<int>::const_iterator reg_type = spt.reg_types.begin();
+           (reg_type != spt.reg_types.end()) && (!ret);
+           ++reg_type)
       {
-        if (!spt_content)
+        switch (*reg_type)
+        {
+        case INITIAL_REGISTRATION:
+          ret = (is_initial_registration && !dereg);
+          break;
+        case REREGISTRATION:
+          ret = (!is_initial_registration && !dereg);
+          break;
+        case DEREGISTRATION:
+          ret = dereg;
+          break;
+        default:
+          // LCOV_EXCL_START Unreachable
+          TRC_WARNING("Impossible case %d", *reg_type);
+          ret = false;
+          break;
+          // LCOV_EXCL_STOP
+        }
+      }
+
+      if ((!ret) && (spt.match_error.is_set()))
+      {
+        raise_spt_error(spt.match_error, server_name, trail);
+      }
+    }
+    break;
+
+  case CompiledSpt::SIP_HEADER:
+    for (pjsip_hdr* header = msg->hdr.next;
+         (header != &msg->hdr) && (!ret);
+         header = header->next)
+    {
+      bool name_matches;
+
+      if (!spt.header_literal.empty())
+      {
+        // Case-insensitive substring search, equivalent to searching with the
+        // case-insensitive regex.
+        const char* begin = header->name.ptr;
+        const char* end = header->name.ptr + header->name.slen;
+        name_matches = (std::search(begin,
+                                    end,
+                                    spt.header_literal.begin(),
+                                    spt.header_literal.end(),
+                                    [](char a, char b) { return tolower((unsigned char)a) == b; }) != end);
+      }
+      else
+      {
+        name_matches = boost::regex_search(header->name.ptr,
+                                           header->name.ptr + header->name.slen,
+                                           spt.regex);
+      }
+
+      if (name_matches)
+      {
+        if (!spt.has_content)
         {
           // We've found a matching header, and don't have to match on content
           ret = true;
         }
         else
         {
-          std::string header_value = PJUtils::get_header_value(header);
-          // status() is nonzero for an uninitialised regex, so we check this in order to only compile it once
-          if (content_regex.status())
+          if (spt.match_error.is_set())
           {
-            content_regex = boost::regex(XMLUtils::get_text_or_cdata(spt_content),
-                                         boost::regex_constants::no_except);
-            if (content_regex.status())
-            {
-              invalid_ifc("Invalid regular expression in Content element for SIPHeader service point trigger",
-                          server_name, SASEvent::IFC_INVALID, 0, trail);
-            }
+            raise_spt_error(spt.match_error, server_name, trail);
           }
 
-          if (boost::regex_search(header_value, content_regex))
-          {
-            // We've found a matching header, and have matching content in one field
-            ret = true;
-          }
+          std::string header_value = PJUtils::get_header_value(header);
+          ret = boost::regex_search(header_value, spt.content_regex);
         }
       }
-      if (ret)
-      {
-        // Stop processing other headers once we have a match
-        break;
-      }
     }
-  }
-  else if (strcmp(RegDataXMLUtils::SESSION_CASE, name) == 0)
-  {
-    int direction = XMLUtils::parse_integer(node, "session case", 0, 4);
-    switch (direction)
+    break;
+
+  case CompiledSpt::SESSION_CASE:
+    switch (spt.session_case)
     {
     case ORIGINATING_REGISTERED:
       ret = (session_case == SessionCase::Originating) && is_registered;
@@ -261,144 +600,102 @@ bool Ifc::spt_matches(const SessionCase& session_case,  //< The session case
       break;
     default:
       // LCOV_EXCL_START Unreachable
-      TRC_WARNING("Impossible case %d", direction);
+      TRC_WARNING("Impossible case %d", spt.session_case);
       ret = false;
       break;
-    // LCOV_EXCL_STOP
-    }
-  }
-  else if (strcmp(RegDataXMLUtils::REQUEST_URI, name) == 0)
-  {
-    boost::regex req_uri_regex;
-    std::string test_string;
-
-    if (PJSIP_URI_SCHEME_IS_TEL(msg->line.req.uri))
-    {
-      pjsip_tel_uri* req_uri =  (pjsip_tel_uri*)pjsip_uri_get_uri(msg->line.req.uri);
-
-      // Match against the telephone-subscriber part of the Req URI, as per Table F.1
-      // of 3GPP TS 29.228.
-      test_string = PJUtils::pj_str_to_string(&req_uri->number);
+      // LCOV_EXCL_STOP
     }
-    else if (PJSIP_URI_SCHEME_IS_URN(msg->line.req.uri))
-    {
-      pjsip_other_uri* req_uri = (pjsip_other_uri*)pjsip_uri_get_uri(msg->line.req.uri);
+    break;
 
-      // There is nothing in TS 29.228 about what to match against in the case
-      // of a urn URI. So just pull out the entire content (which is everything
-      // after "urn:").
-      test_string = PJUtils::pj_str_to_string(&req_uri->content);
-    }
-    else
+  case CompiledSpt::REQUEST_URI:
     {
-      pjsip_sip_uri* req_uri = (pjsip_sip_uri*)pjsip_uri_get_uri(msg->line.req.uri);
+      std::string test_string;
 
-      // Compare against the hostport part of the Req URI, as per Table F.1
-      // of 3GPP TS 29.228.
-      std::string hostport = PJUtils::pj_str_to_string(&req_uri->host);
-
-      if (req_uri->port != 0)
+      if (PJSIP_URI_SCHEME_IS_TEL(msg->line.req.uri))
       {
-        hostport += ":" + std::to_string(req_uri->port);
+        // Match against the telephone-subscriber part of the Req URI, as per
+        // Table F.1 of 3GPP TS 29.228.
+        pjsip_tel_uri* req_uri = (pjsip_tel_uri*)pjsip_uri_get_uri(msg->line.req.uri);
+        test_string = PJUtils::pj_str_to_string(&req_uri->number);
       }
+      else if (PJSIP_URI_SCHEME_IS_URN(msg->line.req.uri))
+      {
+        // There is nothing in TS 29.228 about what to match against in the
+        // case of a urn URI. So just pull out the entire content (which is
+        // everything after "urn:").
+        pjsip_other_uri* req_uri = (pjsip_other_uri*)pjsip_uri_get_uri(msg->line.req.uri);
+        test_string = PJUtils::pj_str_to_string(&req_uri->content);
+      }
+      else
+      {
+        // Compare against the hostport part of the Req URI, as per Table F.1
+        // of 3GPP TS 29.228.
+        pjsip_sip_uri* req_uri = (pjsip_sip_uri*)pjsip_uri_get_uri(msg->line.req.uri);
+        test_string = PJUtils::pj_str_to_string(&req_uri->host);
 
-      test_string = hostport;
-    }
-
-    req_uri_regex = boost::regex(XMLUtils::get_text_or_cdata(node),
-                                 boost::regex_constants::no_except);
-    if (req_uri_regex.status())
-    {
-      invalid_ifc("Invalid regular expression in Request URI service point trigger",
-                  server_name, SASEvent::IFC_INVALID, 0, trail);
-    }
-    ret = boost::regex_search(test_string, req_uri_regex);
-  }
-  else if (strcmp(RegDataXMLUtils::SESSION_DESCRIPTION, name) == 0)
-  {
-    xml_node<>* spt_line = node->first_node(RegDataXMLUtils::LINE);
-    xml_node<>* spt_content = node->first_node(RegDataXMLUtils::CONTENT);
-    boost::regex line_regex;
-    boost::regex content_regex;
-    char newline = '\n';
-
-    if (!spt_line)
-    {
-      invalid_ifc("Missing Line element for SessionDescription service point trigger",
-                  server_name, SASEvent::IFC_INVALID, 0, trail);
-    }
+        if (req_uri->port != 0)
+        {
+          test_string += ":" + std::to_string(req_uri->port);
+        }
+      }
 
-    line_regex = boost::regex(XMLUtils::get_text_or_cdata(spt_line),
-                              boost::regex_constants::no_except);
-    if (line_regex.status())
-    {
-      invalid_ifc("Invalid regular expression in Line element for Session Description service point trigger",
-                  server_name, SASEvent::IFC_INVALID, 0, trail);
+      ret = boost::regex_search(test_string, spt.regex);
     }
+    break;
 
+  case CompiledSpt::SESSION_DESCRIPTION:
     // Check if the message body is SDP.
-    if (msg->body &&
+    if ((msg->body) &&
+        (msg->body->data != NULL) &&
         (!pj_stricmp2(&msg->body->content_type.type, "application")) &&
         (!pj_stricmp2(&msg->body->content_type.subtype, "sdp")))
     {
-      if (msg->body->data != NULL)
+      // Split the message body into each SDP line.
+      std::stringstream sdp((char *)msg->body->data);
+      std::string sdp_line;
+      while ((std::getline(sdp, sdp_line, '\n')) && (ret == false))
       {
-        // Split the message body into each SDP line.
-        std::stringstream sdp((char *)msg->body->data);
-        std::string sdp_line;
-        while((std::getline(sdp, sdp_line, newline)) && (ret == false))
+        // Match the line regex on the first character of the SDP line.
+        std::string sdp_identifier(1, sdp_line[0]);
+        if (boost::regex_search(sdp_identifier, spt.regex))
         {
-          // Match the line regex on the first character of the SDP line.
-          std::string sdp_identifier(1, sdp_line[0]);
-          if (boost::regex_search(sdp_identifier, line_regex))
+          if (!spt.has_content)
           {
-            if (!spt_content)
+            // We've found a matching line type, and don't have to match on content.
+            ret = true;
+          }
+          else
+          {
+            if (spt.match_error.is_set())
             {
-              // We've found a matching line type, and don't have to match on content.
-              ret = true;
+              raise_spt_error(spt.match_error, server_name, trail);
+            }
+
+            // Check the second character of the line is an equals sign, and
+            // then consider the content of the SDP line.
+            if (sdp_line.find_first_of("=") == 1)
+            {
+              sdp_line.erase(0, 2);
+              ret = boost::regex_search(sdp_line, spt.content_regex);
             }
             else
             {
-              // status() is nonzero for an uninitialised regex, so we check this in order to only compile it once.
-              if (content_regex.status())
-              {
-                content_regex = boost::regex(XMLUtils::get_text_or_cdata(spt_content),
-                                             boost::regex_constants::no_except);
-                if (content_regex.status())
-                {
-                  invalid_ifc("Invalid regular expression in Content element for Session Description service point trigger",
-                              server_name, SASEvent::IFC_INVALID, 0, trail);
-                }
-              }
-
-              // Check the second character of the line is an equals sign, and then
-              // consider the content of the SDP line.
-              if (sdp_line.find_first_of("=") == 1)
-              {
-                sdp_line.erase(0,2);
-                if (boost::regex_search(sdp_line, content_regex))
-                {
-                  // We've found a matching line.
-                  ret = true;
-                }
-              }
-              else
-              {
-                TRC_WARNING("Found badly formatted SDP line: %s", sdp_line.c_str());
-              }
+              TRC_WARNING("Found badly formatted SDP line: %s", sdp_line.c_str());
             }
           }
         }
       }
     }
-  }
-  else
-  {
-    TRC_WARNING("Unimplemented iFC service point trigger class: %s", name);
+    break;
+
+  default:
+    TRC_WARNING("Unimplemented iFC service point trigger class: %s",
+                spt.class_name.c_str());
     ret = false;
+    break;
   }
 
-  TRC_DEBUG("SPT class %s: result %s", name, ret ? "true" : "false");
+  TRC_DEBUG("SPT class %s: result %s", spt.class_name.c_str(), ret ? "true" : "false");
   return ret;
 }
 
@@ -413,50 +710,30 @@ bool Ifc::filter_matches(const SessionCase& session_case,
                          pjsip_msg* msg,
                          SAS::TrailId trail) const
 {
-  std::string ifc_str;
-  rapidxml::print(std::back_inserter(ifc_str), *_ifc, 0);
-
   SAS::Event event(trail, SASEvent::IFC_TESTING, 0);
-  event.add_compressed_param(ifc_str, &SASEvent::PROFILE_SERVICE_PROFILE);
+  event.add_compressed_param(_compiled->ifc_str, &SASEvent::PROFILE_SERVICE_PROFILE);
   SAS::report_event(event);
-  std::string server_name;
+  const std::string& server_name = _compiled->server_name;
 
   try
   {
-    xml_node<>* as = _ifc->first_node(RegDataXMLUtils::APPLICATION_SERVER);
-    if (as == NULL)
+    if (_compiled->error.is_set())
     {
-      std::string error_msg = "iFC missing ApplicationServer element";
-
-      SAS::Event event(trail, SASEvent::IFC_INVALID_NOAS, 0);
-      SAS::report_event(event);
-
-      throw xml_error(error_msg);
-    }
-
-    server_name = XMLUtils::get_first_node_value(as, RegDataXMLUtils::SERVER_NAME);
-    if (server_name.empty())
-    {
-      std::string error_msg = "iFC has no ServerName";
-
-      SAS::Event event(trail, SASEvent::IFC_INVALID_NOAS, 0);
-      SAS::report_event(event);
+      if (_compiled->error.report)
+      {
+        SAS::Event event(trail, SASEvent::IFC_INVALID_NOAS, 0);
+        SAS::report_event(event);
+      }
 
-      throw xml_error(error_msg);
+      throw xml_error(_compiled->error.text.c_str());
     }
 
-    xml_node<>* profile_part_indicator = _ifc->first_node(RegDataXMLUtils::PROFILE_PART_INDICATOR);
-    if (profile_part_indicator)
+    if (_compiled->profile_part_indicator >= 0)
     {
-      bool reg = XMLUtils::parse_integer(profile_part_indicator,
-                                         "ProfilePartIndicator",
-                                         0,
-                                         1) == 0;
+      bool reg = (_compiled->profile_part_indicator == 0);
       if (reg != is_registered)
       {
-        std::string reg_state = reg ? "reg" : "unreg";
-        std::string reason = "iFC ProfilePartIndicator " + reg_state + " doesn't match";
-        TRC_DEBUG(reason.c_str());
+        TRC_DEBUG("iFC ProfilePartIndicator %s doesn't match", reg ? "reg" : "unreg");
 
         SAS::Event event(trail, SASEvent::IFC_NOT_MATCHED_PPI, 0);
         event.add_var_param(server_name);
@@ -466,15 +743,7 @@ bool Ifc::filter_matches(const SessionCase& session_case,
       }
     }
 
-    // @@@ KSW Parse the URI and ensure it is parsable and a SIP URI
-    // here. If it's invalid, ignore it (seems the only sensible
-    // option).
-    //
-    // That means each AsInvocation would have to belong to a pool,
-    // though, and that's not easy in the current architecture.
-
-    xml_node<>* trigger = _ifc->first_node(RegDataXMLUtils::TRIGGER_POINT);
-    if (!trigger)
+    if (!_compiled->has_trigger)
     {
       TRC_DEBUG("iFC has no trigger point - unconditional match");  // 3GPP TS 29.228 sB.2.2
 
@@ -485,47 +754,50 @@ bool Ifc::filter_matches(const SessionCase& session_case,
       return true;
     }
 
-    bool cnf = XMLUtils::parse_bool(trigger->first_node(RegDataXMLUtils::CONDITION_TYPE_CNF),
-                                    RegDataXMLUtils::CONDITION_TYPE_CNF);
+    if (_compiled->trigger_error.is_set())
+    {
+      throw xml_error(_compiled->trigger_error.text.c_str());
+    }
+
+    bool cnf = _compiled->cnf;
 
     // In CNF (conjunct-of-disjuncts, i.e., big-AND of ORs), as we
     // work through each SPT we OR it into its group(s). At the end,
     // we AND all the groups together. In DNF we do the converse.
     std::map<int32_t, bool> groups;
 
-    for (xml_node<>* spt = trigger->first_node(RegDataXMLUtils::SPT);
-         spt;
-         spt = spt->next_sibling(RegDataXMLUtils::SPT))
+    for (std::vector<CompiledSpt>::const_iterator spt = _compiled->spts.begin();
+         spt != _compiled->spts.end();
+         ++spt)
     {
-      xml_node<>* neg_node = spt->first_node(RegDataXMLUtils::CONDITION_NEGATED);
-      bool neg = neg_node && XMLUtils::parse_bool(neg_node, RegDataXMLUtils::CONDITION_NEGATED);
       bool val = spt_matches(session_case,
                              is_registered,
                              is_initial_registration,
                              msg,
-                             spt,
-                             ifc_str,
+                             *spt,
                              server_name,
-                             trail) != neg;
+                             trail) != spt->negated;
 
-      for (xml_node<>* group_node = spt->first_node(RegDataXMLUtils::GROUP);
-           group_node;
-           group_node = group_node->next_sibling(RegDataXMLUtils::GROUP))
+      for (std::vector<int32_t>::const_iterator group = spt->groups.begin();
+           group != spt->groups.end();
+           ++group)
       {
-        int32_t group = XMLUtils::parse_integer(group_node,
-                                                "Group ID",
-                                                0,
-                                                std::numeric_limits<int32_t>::max());
-        TRC_DEBUG("Add to group %d val %s", (int)group, val ? "true" : "false");
-        if (groups.find(group) == groups.end())
+        TRC_DEBUG("Add to group %d val %s", (int)*group, val ? "true" : "false");
+        std::map<int32_t, bool>::iterator it = groups.find(*group);
+        if (it == groups.end())
         {
-          groups[group] = val;
+          groups[*group] = val;
         }
         else
         {
-          groups[group] = cnf ? (groups[group] || val) : (groups[group] && val);
+          it->second = cnf ? (it->second || val) : (it->second && val);
         }
       }
+
+      if (spt->group_error.is_set())
+      {
+        throw xml_error(spt->group_error.text.c_str());
+      }
     }
 
     bool ret = cnf;
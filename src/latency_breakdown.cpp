@@ -0,0 +1,422 @@
+/**
+ * @file latency_breakdown.cpp LatencyHistogram and LatencyBreakdown class
+ * methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "log.h"
+#include "stack.h"
+#include "latency_breakdown.h"
+
+// Running totals of the time the current thread has spent blocked on
+// dependencies, and in Sproutlets.
+static thread_local unsigned long blocked_us_total = 0;
+static thread_local unsigned long sproutlet_us_total = 0;
+
+// The number of ProxyTimers running on the current thread.  Only the outermost
+// one records anything, so time isn't counted twice if the SproutletProxy is
+// re-entered.
+static thread_local int proxy_timer_depth = 0;
+
+LatencyHistogram::LatencyHistogram() :
+  _count(0),
+  _total(0),
+  _max(0)
+{
+  for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+  {
+    _buckets[ii].store(0, std::memory_order_relaxed);
+  }
+}
+
+int LatencyHistogram::bucket(unsigned long value)
+{
+  if (value < (unsigned long)SUB_BUCKETS)
+  {
+    return (int)value;
+  }
+
+  // Values with their top bit at position msb are split into SUB_BUCKETS
+  // buckets, each 2^(msb - SUB_BUCKET_BITS) wide.
+  int msb = 63 - __builtin_clzl(value);
+  int shift = msb - SUB_BUCKET_BITS;
+  return ((shift + 1) * SUB_BUCKETS) + (int)((value >> shift) - SUB_BUCKETS);
+}
+
+unsigned long LatencyHistogram::bucket_max(int bucket)
+{
+  if (bucket < SUB_BUCKETS)
+  {
+    return (unsigned long)bucket;
+  }
+
+  int shift = (bucket / SUB_BUCKETS) - 1;
+  unsigned long sub_bucket = (bucket % SUB_BUCKETS) + SUB_BUCKETS;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long value_us)
+{
+  _buckets[bucket(value_us)].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _total.fetch_add(value_us, std::memory_order_relaxed);
+
+  unsigned long max = _max.load(std::memory_order_relaxed);
+  while ((value_us > max) &&
+         (!_max.compare_exchange_weak(max, value_us, std::memory_order_relaxed)))
+  {
+  }
+}
+
+unsigned long LatencyHistogram::percentile(double pct) const
+{
+  uint64_t count = _count.load(std::memory_order_relaxed);
+
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  // Find the bucket holding the value at this rank, and report the highest
+  // value it could be (but no more than the highest value recorded).
+  uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(pct * count / 100.0));
+  uint64_t seen = 0;
+
+  for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+  {
+    seen += _buckets[ii].load(std::memory_order_relaxed);
+
+    if (seen >= rank)
+    {
+      return std::min(bucket_max(ii), max());
+    }
+  }
+
+  // The buckets were updated while we read them.
+  return max(); // LCOV_EXCL_LINE
+}
+
+unsigned long LatencyHistogram::mean() const
+{
+  uint64_t count = _count.load(std::memory_order_relaxed);
+  return (count == 0) ? 0 : (_total.load(std::memory_order_relaxed) / count);
+}
+
+void LatencyHistogram::reset()
+{
+  for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+  {
+    _buckets[ii].store(0, std::memory_order_relaxed);
+  }
+  _count.store(0, std::memory_order_relaxed);
+  _total.store(0, std::memory_order_relaxed);
+  _max.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::to_json(rapidjson::Writer<rapidjson::StringBuffer>& writer) const
+{
+  writer.StartObject();
+  {
+    writer.String("count");
+    writer.Uint64(count());
+    writer.String("mean_us");
+    writer.Uint64(mean());
+    writer.String("max_us");
+    writer.Uint64(max());
+
+    writer.String("percentiles_us");
+    writer.StartObject();
+    {
+      writer.String("50");
+      writer.Uint64(percentile(50));
+      writer.String("90");
+      writer.Uint64(percentile(90));
+      writer.String("99");
+      writer.Uint64(percentile(99));
+      writer.String("99.9");
+      writer.Uint64(percentile(99.9));
+    }
+    writer.EndObject();
+
+    // Only the buckets that have values in them, as pairs of the highest
+    // value in the bucket and the number of values.
+    writer.String("buckets");
+    writer.StartArray();
+    {
+      for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+      {
+        uint64_t bucket_count = _buckets[ii].load(std::memory_order_relaxed);
+
+        if (bucket_count > 0)
+        {
+          writer.StartArray();
+          writer.Uint64(bucket_max(ii));
+          writer.Uint64(bucket_count);
+          writer.EndArray();
+        }
+      }
+    }
+    writer.EndArray();
+  }
+  writer.EndObject();
+}
+
+LatencyBreakdown::LatencyBreakdown(SNMP::EventAccumulatorTable* queue_tbl,
+                                   SNMP::EventAccumulatorTable* processing_tbl,
+                                   SNMP::EventAccumulatorTable* proxy_tbl,
+                                   SNMP::EventAccumulatorTable* blocked_tbl) :
+  _queue_tbl(queue_tbl),
+  _processing_tbl(processing_tbl),
+  _proxy_tbl(proxy_tbl),
+  _blocked_tbl(blocked_tbl),
+  _sproutlets()
+{
+  pthread_mutex_init(&_sproutlets_lock, NULL);
+}
+
+LatencyBreakdown::~LatencyBreakdown()
+{
+  for (std::map<std::string, SproutletStats*>::iterator it = _sproutlets.begin();
+       it != _sproutlets.end();
+       ++it)
+  {
+    delete it->second;
+  }
+  _sproutlets.clear();
+
+  pthread_mutex_destroy(&_sproutlets_lock);
+}
+
+LatencyBreakdown::SproutletStats* LatencyBreakdown::sproutlet_stats(const std::string& name)
+{
+  pthread_mutex_lock(&_sproutlets_lock);
+
+  SproutletStats*& stats = _sproutlets[name];
+  if (stats == NULL)
+  {
+    TRC_DEBUG("Recording latency of Sproutlet %s", name.c_str());
+    stats = new SproutletStats();
+  }
+
+  pthread_mutex_unlock(&_sproutlets_lock);
+
+  return stats;
+}
+
+void LatencyBreakdown::record_message(unsigned long queue_us,
+                                      unsigned long processing_us,
+                                      unsigned long blocked_us)
+{
+  _queue.record(queue_us);
+  _processing.record(processing_us);
+  _blocked.record(blocked_us);
+
+  accumulate(_queue_tbl, queue_us);
+  accumulate(_processing_tbl, processing_us);
+  accumulate(_blocked_tbl, blocked_us);
+}
+
+void LatencyBreakdown::record_proxy(unsigned long proxy_us)
+{
+  _proxy.record(proxy_us);
+  accumulate(_proxy_tbl, proxy_us);
+}
+
+void LatencyBreakdown::record_dependency(Dependency dependency,
+                                         unsigned long latency_us)
+{
+  _dependencies[dependency].record(latency_us);
+}
+
+void LatencyBreakdown::reset()
+{
+  _queue.reset();
+  _processing.reset();
+  _proxy.reset();
+  _blocked.reset();
+
+  for (int ii = 0; ii < NUM_DEPENDENCIES; ++ii)
+  {
+    _dependencies[ii].reset();
+  }
+
+  pthread_mutex_lock(&_sproutlets_lock);
+  for (std::map<std::string, SproutletStats*>::iterator it = _sproutlets.begin();
+       it != _sproutlets.end();
+       ++it)
+  {
+    it->second->request.reset();
+    it->second->response.reset();
+  }
+  pthread_mutex_unlock(&_sproutlets_lock);
+}
+
+std::string LatencyBreakdown::to_json()
+{
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+
+  writer.StartObject();
+  {
+    writer.String("queue");
+    _queue.to_json(writer);
+    writer.String("processing");
+    _processing.to_json(writer);
+    writer.String("blocked");
+    _blocked.to_json(writer);
+    writer.String("sproutlet_proxy");
+    _proxy.to_json(writer);
+
+    writer.String("dependencies");
+    writer.StartObject();
+    {
+      for (int ii = 0; ii < NUM_DEPENDENCIES; ++ii)
+      {
+        writer.String(dependency_name((Dependency)ii));
+        _dependencies[ii].to_json(writer);
+      }
+    }
+    writer.EndObject();
+
+    writer.String("sproutlets");
+    writer.StartObject();
+    {
+      pthread_mutex_lock(&_sproutlets_lock);
+      for (std::map<std::string, SproutletStats*>::const_iterator it = _sproutlets.begin();
+           it != _sproutlets.end();
+           ++it)
+      {
+        writer.String(it->first.c_str());
+        writer.StartObject();
+        {
+          writer.String("request");
+          it->second->request.to_json(writer);
+          writer.String("response");
+          it->second->response.to_json(writer);
+        }
+        writer.EndObject();
+      }
+      pthread_mutex_unlock(&_sproutlets_lock);
+    }
+    writer.EndObject();
+  }
+  writer.EndObject();
+
+  return sb.GetString();
+}
+
+unsigned long LatencyBreakdown::thread_blocked_us()
+{
+  return blocked_us_total;
+}
+
+unsigned long LatencyBreakdown::thread_sproutlet_us()
+{
+  return sproutlet_us_total;
+}
+
+const char* LatencyBreakdown::dependency_name(Dependency dependency)
+{
+  switch (dependency)
+  {
+  case HOMESTEAD:
+    return "homestead";
+  case ASTAIRE:
+    return "astaire";
+  case CHRONOS:
+    return "chronos";
+  case ENUM:
+    return "enum";
+  case XDM:
+    return "xdm";
+  default:
+    return "unknown"; // LCOV_EXCL_LINE
+  }
+}
+
+void LatencyBreakdown::accumulate(SNMP::EventAccumulatorTable* tbl,
+                                  unsigned long value)
+{
+  if (tbl != NULL)
+  {
+    tbl->accumulate(value);
+  }
+}
+
+LatencyBreakdown::DependencyTimer::DependencyTimer(Dependency dependency) :
+  _dependency(dependency)
+{
+  _stop_watch.start();
+}
+
+LatencyBreakdown::DependencyTimer::~DependencyTimer()
+{
+  unsigned long latency_us = 0;
+
+  if (_stop_watch.read(latency_us))
+  {
+    blocked_us_total += latency_us;
+
+    if (stack_data.latency_breakdown != NULL)
+    {
+      stack_data.latency_breakdown->record_dependency(_dependency, latency_us);
+    }
+  }
+}
+
+LatencyBreakdown::SproutletTimer::SproutletTimer(LatencyHistogram* histogram) :
+  _histogram(histogram),
+  _blocked_us(blocked_us_total)
+{
+  if (_histogram != NULL)
+  {
+    _stop_watch.start();
+  }
+}
+
+LatencyBreakdown::SproutletTimer::~SproutletTimer()
+{
+  unsigned long latency_us = 0;
+
+  if ((_histogram != NULL) && (_stop_watch.read(latency_us)))
+  {
+    unsigned long blocked_us = blocked_us_total - _blocked_us;
+    unsigned long sproutlet_us = (latency_us > blocked_us) ? (latency_us - blocked_us) : 0;
+
+    sproutlet_us_total += sproutlet_us;
+    _histogram->record(sproutlet_us);
+  }
+}
+
+LatencyBreakdown::ProxyTimer::ProxyTimer(LatencyBreakdown* breakdown) :
+  _breakdown((++proxy_timer_depth == 1) ? breakdown : NULL),
+  _blocked_us(blocked_us_total),
+  _sproutlet_us(sproutlet_us_total)
+{
+  if (_breakdown != NULL)
+  {
+    _stop_watch.start();
+  }
+}
+
+LatencyBreakdown::ProxyTimer::~ProxyTimer()
+{
+  --proxy_timer_depth;
+  unsigned long latency_us = 0;
+
+  if ((_breakdown != NULL) && (_stop_watch.read(latency_us)))
+  {
+    unsigned long excluded_us = (blocked_us_total - _blocked_us) +
+                                (sproutlet_us_total - _sproutlet_us);
+    _breakdown->record_proxy((latency_us > excluded_us) ? (latency_us - excluded_us) : 0);
+  }
+}
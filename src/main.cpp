@@ -65,6 +65,7 @@ extern "C" {
 #include "httpstack.h"
 #include "sproutlet.h"
 #include "sproutletproxy.h"
+#include "latency_breakdown.h"
 #include "pluginloader.h"
 #include "sprout_pd_definitions.h"
 #include "alarm.h"
@@ -87,6 +88,7 @@ extern "C" {
 #include "sprout_alarmdefinition.h"
 #include "sproutlet_options.h"
 #include "astaire_impistore.h"
+#include "registration_utils.h"
 
 enum OptionTypes
 {
@@ -130,6 +132,7 @@ enum OptionTypes
   OPT_LOCAL_SITE_NAME,
   OPT_REGISTRATION_STORES,
   OPT_IMPI_STORES,
+  OPT_REGISTRATION_STORE_FORMAT,
   OPT_SCSCF_NODE_URI,
   OPT_SAS_USE_SIGNALING_IF,
   OPT_DISABLE_TCP_SWITCH,
@@ -141,6 +144,17 @@ enum OptionTypes
   OPT_DUMMY_APP_SERVER,
   OPT_HTTP_ACR_LOGGING,
   OPT_HOMESTEAD_TIMEOUT,
+  OPT_WORKER_QUEUE_SHARDS,
+  OPT_MAX_WORKER_QUEUE_DEPTH,
+  OPT_HSS_CACHE_TTL,
+  OPT_HSS_CACHE_SIZE,
+  OPT_ENUM_CACHE_MAX_TTL,
+  OPT_SPROUTLET_BACKGROUND_THREADS,
+  OPT_REMOTE_STORE_REPLICATION_THREADS,
+  OPT_CHRONOS_TIMER_THREADS,
+  OPT_SAS_LOG_THREADS,
+  OPT_THIRD_PARTY_REG_THREADS,
+  OPT_THIRD_PARTY_REG_RATE,
 };
 
 
@@ -159,6 +173,7 @@ const static struct pj_getopt_option long_opt[] =
   { "local-site-name",              required_argument, 0, OPT_LOCAL_SITE_NAME},
   { "registration-stores",          required_argument, 0, OPT_REGISTRATION_STORES},
   { "impi-store",                   required_argument, 0, OPT_IMPI_STORES},
+  { "registration-store-format",    required_argument, 0, OPT_REGISTRATION_STORE_FORMAT},
   { "sas",                          required_argument, 0, 'S'},
   { "hss",                          required_argument, 0, 'H'},
   { "record-routing-model",         required_argument, 0, 'C'},
@@ -230,6 +245,17 @@ const static struct pj_getopt_option long_opt[] =
   { "dummy-app-server",             required_argument, 0, OPT_DUMMY_APP_SERVER},
   { "http-acr-logging",             no_argument,       0, OPT_HTTP_ACR_LOGGING},
   { "homestead-timeout",            required_argument, 0, OPT_HOMESTEAD_TIMEOUT},
+  { "worker-queue-shards",          required_argument, 0, OPT_WORKER_QUEUE_SHARDS},
+  { "max-worker-queue-depth",       required_argument, 0, OPT_MAX_WORKER_QUEUE_DEPTH},
+  { "hss-cache-ttl",                required_argument, 0, OPT_HSS_CACHE_TTL},
+  { "hss-cache-size",               required_argument, 0, OPT_HSS_CACHE_SIZE},
+  { "enum-cache-max-ttl",           required_argument, 0, OPT_ENUM_CACHE_MAX_TTL},
+  { "sproutlet-background-threads", required_argument, 0, OPT_SPROUTLET_BACKGROUND_THREADS},
+  { "remote-store-replication-threads", required_argument, 0, OPT_REMOTE_STORE_REPLICATION_THREADS},
+  { "chronos-timer-threads",        required_argument, 0, OPT_CHRONOS_TIMER_THREADS},
+  { "sas-log-threads",              required_argument, 0, OPT_SAS_LOG_THREADS},
+  { "third-party-reg-threads",      required_argument, 0, OPT_THIRD_PARTY_REG_THREADS},
+  { "third-party-reg-rate",         required_argument, 0, OPT_THIRD_PARTY_REG_RATE},
   { NULL,                           0,                 0, 0}
 };
 
@@ -246,6 +272,7 @@ const static int UNQUIESCE_SIGNAL = SIGUSR1;
 const static int MIN_SESSION_EXPIRES = 90;
 
 static const std::string SPROUT_HTTP_MGMT_SOCKET_PATH = "/tmp/sprout-http-mgmt-socket";
+static const std::string BONO_HTTP_MGMT_SOCKET_PATH = "/tmp/bono-http-mgmt-socket";
 static const int NUM_HTTP_MGMT_THREADS = 5;
 
 static void usage(void)
@@ -290,6 +317,11 @@ static void usage(void)
        "                            authentication vectors. There is currently no geo-redundant storage\n"
        "                            for authentication vectors. If this option isn't provided, Sprout uses\n"
        "                            the local site registration store.\n"
+       "     --registration-store-format <format>\n"
+       "                            The format in which to write registration state to the\n"
+       "                            registration stores - either 'json' (the default) or 'binary'.\n"
+       "                            Registration state is read in either format, so all nodes must\n"
+       "                            support the binary format before it is enabled on any of them.\n"
        " -S, --sas <ipv4>,<system name>\n"
        "                            Use specified host as Service Assurance Server and specified\n"
        "                            system name to identify this system to SAS.  If this option isn't\n"
@@ -349,6 +381,15 @@ static void usage(void)
        " -P, --pjsip-threads N      Number of PJSIP threads (default: 1)\n"
        " -B, --billing-cdf <server> Billing CDF server\n"
        " -W, --worker-threads N     Number of worker threads (default: 1)\n"
+       "     --worker-queue-shards N\n"
+       "                            Number of queues to split the worker threads across.  Messages\n"
+       "                            are assigned to a queue by Call-ID, and idle worker threads steal\n"
+       "                            work from other queues (default: 1)\n"
+       "     --max-worker-queue-depth N\n"
+       "                            Maximum number of messages queued for each worker queue before\n"
+       "                            new initial requests are rejected with a 503. Responses and\n"
+       "                            in-dialog requests are always queued, ahead of initial requests.\n"
+       "                            If this is 0, then there is no limit (default: 0)\n"
        " -a, --analytics <directory>\n"
        "                            Generate analytics logs in specified directory\n"
        " -A, --authentication       Enable authentication\n"
@@ -446,6 +487,34 @@ static void usage(void)
        "     --http-acr-logging     Whether to include the bodies of ACR HTTP requests when they are logged \n"
        "                            to SAS\n"
        "     --homestead-timeout    The timeout in ms to use on HTTP requests to Homestead\n"
+       "     --hss-cache-ttl <secs> The time for which subscriber data retrieved from Homestead for calls\n"
+       "                            is cached locally (default: 0, which disables the cache)\n"
+       "     --hss-cache-size <entries>\n"
+       "                            The maximum number of subscribers whose data is cached locally\n"
+       "                            (default: 10000)\n"
+       "     --enum-cache-max-ttl <secs>\n"
+       "                            The longest time for which answers from the ENUM server are cached,\n"
+       "                            whatever their TTL (default: 0, which disables the cache)\n"
+       "     --sproutlet-background-threads N\n"
+       "                            Number of threads used to run blocking lookups (such as ENUM queries)\n"
+       "                            off the worker threads (default: 0, which runs them on the worker threads)\n"
+       "     --remote-store-replication-threads N\n"
+       "                            Number of threads per remote site used to write registration data to the\n"
+       "                            remote stores in the background (default: 0, which writes to the remote\n"
+       "                            stores before responding to each request)\n"
+       "     --chronos-timer-threads N\n"
+       "                            Number of threads used to send registration expiry timers to Chronos in\n"
+       "                            the background, coalescing repeated changes to a registration (default: 0,\n"
+       "                            which sends each timer before the registration data is written)\n"
+       "     --sas-log-threads N    Number of threads used to compress and log SIP messages to SAS, off the\n"
+       "                            transport thread (default: 0, which logs them on the transport thread)\n"
+       "     --third-party-reg-threads N\n"
+       "                            Number of threads used to send third-party REGISTERs to application\n"
+       "                            servers in the background, coalescing repeated re-registrations\n"
+       "                            (default: 0, which sends them on the worker threads)\n"
+       "     --third-party-reg-rate N\n"
+       "                            Maximum number of third-party REGISTERs sent to each application server\n"
+       "                            per second, when sending them in the background (default: 0, no limit)\n"
        " -N, --plugin-option <plugin>,<name>,<value>\n"
        "                            Provide an option value to a plugin.\n"
        " -F, --log-file <directory>\n"
@@ -755,6 +824,23 @@ static pj_status_t init_options(int argc, char* argv[], struct options* options)
       }
       break;
 
+    case OPT_REGISTRATION_STORE_FORMAT:
+      if (strcmp(pj_optarg, "json") == 0)
+      {
+        options->registration_store_format = AstaireAoRStore::SerializationFormat::JSON;
+      }
+      else if (strcmp(pj_optarg, "binary") == 0)
+      {
+        options->registration_store_format = AstaireAoRStore::SerializationFormat::BINARY;
+      }
+      else
+      {
+        TRC_ERROR("--registration-store-format must be one of 'json' or 'binary'");
+        return -1;
+      }
+      TRC_INFO("Registration store format is set to %s", pj_optarg);
+      break;
+
     case 'S':
       {
         std::vector<std::string> sas_options;
@@ -1272,6 +1358,94 @@ static pj_status_t init_options(int argc, char* argv[], struct options* options)
       }
       break;
 
+    case OPT_WORKER_QUEUE_SHARDS:
+      {
+        VALIDATE_INT_PARAM_NON_ZERO(options->worker_queue_shards,
+                                    worker_queue_shards,
+                                    Number of worker queue shards);
+      }
+      break;
+
+    case OPT_MAX_WORKER_QUEUE_DEPTH:
+      {
+        VALIDATE_INT_PARAM(options->max_worker_queue_depth,
+                           max_worker_queue_depth,
+                           Maximum worker queue depth);
+      }
+      break;
+
+    case OPT_HSS_CACHE_TTL:
+      {
+        VALIDATE_INT_PARAM(options->hss_cache_ttl,
+                           hss_cache_ttl,
+                           HSS cache TTL);
+      }
+      break;
+
+    case OPT_HSS_CACHE_SIZE:
+      {
+        VALIDATE_INT_PARAM_NON_ZERO(options->hss_cache_size,
+                                    hss_cache_size,
+                                    HSS cache size);
+      }
+      break;
+
+    case OPT_ENUM_CACHE_MAX_TTL:
+      {
+        VALIDATE_INT_PARAM(options->enum_cache_max_ttl,
+                           enum_cache_max_ttl,
+                           Maximum ENUM cache TTL);
+      }
+      break;
+
+    case OPT_SPROUTLET_BACKGROUND_THREADS:
+      {
+        VALIDATE_INT_PARAM(options->sproutlet_background_threads,
+                           sproutlet_background_threads,
+                           Number of Sproutlet background threads);
+      }
+      break;
+
+    case OPT_REMOTE_STORE_REPLICATION_THREADS:
+      {
+        VALIDATE_INT_PARAM(options->remote_store_replication_threads,
+                           remote_store_replication_threads,
+                           Number of remote store replication threads);
+      }
+      break;
+
+    case OPT_CHRONOS_TIMER_THREADS:
+      {
+        VALIDATE_INT_PARAM(options->chronos_timer_threads,
+                           chronos_timer_threads,
+                           Number of Chronos timer threads);
+      }
+      break;
+
+    case OPT_SAS_LOG_THREADS:
+      {
+        VALIDATE_INT_PARAM(options->sas_log_threads,
+                           sas_log_threads,
+                           Number of SAS logging threads);
+      }
+      break;
+
+    case OPT_THIRD_PARTY_REG_THREADS:
+      {
+        VALIDATE_INT_PARAM(options->third_party_reg_threads,
+                           third_party_reg_threads,
+                           Number of third-party registration threads);
+      }
+      break;
+
+    case OPT_THIRD_PARTY_REG_RATE:
+      {
+        VALIDATE_INT_PARAM(options->third_party_reg_rate,
+                           third_party_reg_rate,
+                           Maximum third-party registration rate per AS);
+      }
+      break;
+
     case OPT_LISTEN_PORT:
       {
         int listen_port;
@@ -1394,6 +1568,7 @@ void reg_httpthread_with_pjsip(evhtp_t * htp, evthr_t * httpthread, void * arg)
 // globally scoped.
 LoadMonitor* load_monitor = NULL;
 HSSConnection* hss_connection = NULL;
+HSSCache* hss_cache = NULL;
 Store* local_data_store = NULL;
 std::vector<Store*> remote_data_stores;
 Store* local_impi_data_store = NULL;
@@ -1402,6 +1577,7 @@ AoRStore* local_aor_store = NULL;
 std::vector<AoRStore*> remote_aor_stores;
 SubscriberDataManager* local_sdm = NULL;
 std::vector<SubscriberDataManager*> remote_sdms;
+AoRReplicator* aor_replicator = NULL;
 ImpiStore* local_impi_store = NULL;
 std::vector<ImpiStore*> remote_impi_stores;
 RalfProcessor* ralf_processor = NULL;
@@ -1516,13 +1692,15 @@ int create_astaire_stores(struct options opt,
     return 1;
   }
 
-  local_aor_store = new AstaireAoRStore(local_data_store);
+  local_aor_store = new AstaireAoRStore(local_data_store,
+                                        opt.registration_store_format);
 
   for (std::vector<Store*>::iterator it = remote_data_stores.begin();
        it != remote_data_stores.end();
        ++it)
   {
-    AoRStore* remote_aor_store = new AstaireAoRStore(*it);
+    AoRStore* remote_aor_store = new AstaireAoRStore(*it,
+                                                     opt.registration_store_format);
     remote_aor_stores.push_back(remote_aor_store);
   }
 
@@ -1671,9 +1849,12 @@ int main(int argc, char* argv[])
   opt.sub_max_expires = 0;
   opt.sas_server = "0.0.0.0";
   opt.record_routing_model = 1;
+  opt.registration_store_format = AstaireAoRStore::SerializationFormat::JSON;
   opt.default_session_expires = 10 * 60;
   opt.max_session_expires = 10 * 60;
   opt.worker_threads = 1;
+  opt.worker_queue_shards = 1;
+  opt.max_worker_queue_depth = 0;
   opt.analytics_enabled = PJ_FALSE;
   opt.http_address = "127.0.0.1";
   opt.http_port = 9888;
@@ -1719,6 +1900,15 @@ int main(int argc, char* argv[])
   opt.dummy_app_server = "";
   opt.http_acr_logging = false;
   opt.homestead_timeout = 750;
+  opt.hss_cache_ttl = 0;
+  opt.hss_cache_size = 10000;
+  opt.enum_cache_max_ttl = 0;
+  opt.sproutlet_background_threads = 0;
+  opt.remote_store_replication_threads = 0;
+  opt.chronos_timer_threads = 0;
+  opt.sas_log_threads = 0;
+  opt.third_party_reg_threads = 0;
+  opt.third_party_reg_rate = 0;
 
   status = init_logging_options(argc, argv, &opt);
 
@@ -1904,6 +2094,14 @@ int main(int argc, char* argv[])
   SNMP::EventAccumulatorTable* homestead_uar_latency_table = NULL;
   SNMP::EventAccumulatorTable* homestead_lir_latency_table = NULL;
   SNMP::CounterTable* no_shared_ifcs_set_table = NULL;
+  SNMP::EventAccumulatorTable* aor_replication_lag_table = NULL;
+  SNMP::CounterTable* sas_log_dropped_table = NULL;
+  std::vector<SNMP::SuccessFailCountTable*> admission_tables;
+  SNMP::EventAccumulatorTable* sproutlet_clones_table = NULL;
+  SNMP::EventAccumulatorTable* queue_latency_table = NULL;
+  SNMP::EventAccumulatorTable* processing_latency_table = NULL;
+  SNMP::EventAccumulatorTable* sproutlet_proxy_latency_table = NULL;
+  SNMP::EventAccumulatorTable* dependency_blocked_latency_table = NULL;
 
   SNMP::ContinuousAccumulatorByScopeTable* token_rate_table = NULL;
   SNMP::ScalarByScopeTable* smoothed_latency_scalar = NULL;
@@ -1921,6 +2119,22 @@ int main(int argc, char* argv[])
                                                          ".1.2.826.0.1.1578918.9.2.4");
     overload_counter = SNMP::CounterByScopeTable::create("bono_rejected_overload",
                                                          ".1.2.826.0.1.1578918.9.2.5");
+    sas_log_dropped_table = SNMP::CounterTable::create("bono_sas_log_dropped",
+                                                       ".1.2.826.0.1.1578918.9.2.7");
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("bono_admission_emergency",
+                                                                   ".1.2.826.0.1.1578918.9.2.8.1"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("bono_admission_in_dialog",
+                                                                   ".1.2.826.0.1.1578918.9.2.8.2"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("bono_admission_re_register",
+                                                                   ".1.2.826.0.1.1578918.9.2.8.3"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("bono_admission_initial_register",
+                                                                   ".1.2.826.0.1.1578918.9.2.8.4"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("bono_admission_new_session",
+                                                                   ".1.2.826.0.1.1578918.9.2.8.5"));
+    queue_latency_table = SNMP::EventAccumulatorTable::create("bono_queue_latency",
+                                                              ".1.2.826.0.1.1578918.9.2.9.1");
+    processing_latency_table = SNMP::EventAccumulatorTable::create("bono_processing_latency",
+                                                                   ".1.2.826.0.1.1578918.9.2.9.2");
   }
   else
   {
@@ -1947,6 +2161,30 @@ int main(int argc, char* argv[])
                                                                  ".1.2.826.0.1.1578918.9.3.3.6");
     no_shared_ifcs_set_table = SNMP::CounterTable::create("no_shared_ifcs_set",
                                                           ".1.2.826.0.1.1578918.9.3.40");
+    aor_replication_lag_table = SNMP::EventAccumulatorTable::create("sprout_aor_replication_lag",
+                                                                    ".1.2.826.0.1.1578918.9.3.43");
+    sas_log_dropped_table = SNMP::CounterTable::create("sprout_sas_log_dropped",
+                                                       ".1.2.826.0.1.1578918.9.3.44");
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("sprout_admission_emergency",
+                                                                   ".1.2.826.0.1.1578918.9.3.45.1"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("sprout_admission_in_dialog",
+                                                                   ".1.2.826.0.1.1578918.9.3.45.2"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("sprout_admission_re_register",
+                                                                   ".1.2.826.0.1.1578918.9.3.45.3"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("sprout_admission_initial_register",
+                                                                   ".1.2.826.0.1.1578918.9.3.45.4"));
+    admission_tables.push_back(SNMP::SuccessFailCountTable::create("sprout_admission_new_session",
+                                                                   ".1.2.826.0.1.1578918.9.3.45.5"));
+    sproutlet_clones_table = SNMP::EventAccumulatorTable::create("sprout_sproutlet_clones",
+                                                                 ".1.2.826.0.1.1578918.9.3.46");
+    queue_latency_table = SNMP::EventAccumulatorTable::create("sprout_queue_latency",
+                                                              ".1.2.826.0.1.1578918.9.3.47.1");
+    processing_latency_table = SNMP::EventAccumulatorTable::create("sprout_processing_latency",
+                                                                   ".1.2.826.0.1.1578918.9.3.47.2");
+    sproutlet_proxy_latency_table = SNMP::EventAccumulatorTable::create("sprout_sproutlet_proxy_latency",
+                                                                        ".1.2.826.0.1.1578918.9.3.47.3");
+    dependency_blocked_latency_table = SNMP::EventAccumulatorTable::create("sprout_dependency_blocked_latency",
+                                                                           ".1.2.826.0.1.1578918.9.3.47.4");
     token_rate_table = SNMP::ContinuousAccumulatorByScopeTable::create("sprout_token_rate",
                                                                        ".1.2.826.0.1.1578918.9.3.27");
     smoothed_latency_scalar = SNMP::ScalarByScopeTable::create("sprout_smoothed_latency",
@@ -1959,6 +2197,14 @@ int main(int argc, char* argv[])
                                                          ".1.2.826.0.1.1578918.9.3.31");
   }
 
+  // Record where the time spent on each SIP message goes.  The per-Sproutlet
+  // and per-dependency breakdown is available on the management interface.
+  LatencyBreakdown* latency_breakdown = new LatencyBreakdown(queue_latency_table,
+                                                             processing_latency_table,
+                                                             sproutlet_proxy_latency_table,
+                                                             dependency_blocked_latency_table);
+  stack_data.latency_breakdown = latency_breakdown;
+
   // Create Sprout's alarm objects.
   alarm_manager = new AlarmManager();
 
@@ -1994,6 +2240,11 @@ int main(int argc, char* argv[])
                                  penalties_scalar,        // Statistics scalar for number of penalties.
                                  token_rate_scalar);      // Statistics scalar for current token rate.
 
+  // Admission control for each class of request is built on the load
+  // monitor.
+  AdmissionController* admission_controller =
+                     new AdmissionController(load_monitor, admission_tables);
+
   // Start the health checker
   HealthChecker* hc = new HealthChecker();
   hc->start_thread();
@@ -2096,6 +2347,12 @@ int main(int argc, char* argv[])
                                              AlarmDef::SPROUT_SIFC_STATUS,
                                              AlarmDef::CRITICAL),
                                    no_shared_ifcs_set_table);
+
+    if (opt.hss_cache_ttl > 0)
+    {
+      hss_cache = new HSSCache(opt.hss_cache_ttl * 1000, opt.hss_cache_size);
+    }
+
     hss_connection = new HSSConnection(opt.hss_server,
                                        http_resolver,
                                        load_monitor,
@@ -2107,7 +2364,8 @@ int main(int argc, char* argv[])
                                        homestead_lir_latency_table,
                                        hss_comm_monitor,
                                        sifc_service,
-                                       opt.homestead_timeout);
+                                       opt.homestead_timeout,
+                                       hss_cache);
   }
 
   // Create FIFC service
@@ -2128,7 +2386,8 @@ int main(int argc, char* argv[])
     enum_service = new DNSEnumService(opt.enum_servers,
                                       opt.enum_suffix,
                                       new DNSResolverFactory(),
-                                      enum_comm_monitor);
+                                      enum_comm_monitor,
+                                      opt.enum_cache_max_ttl);
   }
   else if (!opt.enum_file.empty())
   {
@@ -2215,7 +2474,8 @@ int main(int argc, char* argv[])
   local_sdm = new SubscriberDataManager(local_aor_store,
                                         chronos_connection,
                                         analytics_logger,
-                                        true);
+                                        true,
+                                        opt.chronos_timer_threads);
 
   for (std::vector<AoRStore*>::iterator it = remote_aor_stores.begin();
        it != remote_aor_stores.end();
@@ -2228,6 +2488,18 @@ int main(int argc, char* argv[])
     remote_sdms.push_back(remote_sdm);
   }
 
+  // Timer IDs set in the background are written to the remote stores too.
+  local_sdm->set_remote_sdms(remote_sdms);
+
+  if ((opt.remote_store_replication_threads > 0) && (!remote_sdms.empty()))
+  {
+    // Write to the remote stores in the background, rather than holding up
+    // requests while we wait for them.
+    aor_replicator = new AoRReplicator(remote_sdms,
+                                       opt.remote_store_replication_threads,
+                                       aor_replication_lag_table);
+  }
+
   // Start the HTTP stack early as plugins might need to register handlers
   // with it.
   HttpStack* http_stack_sig = new HttpStack(opt.http_threads,
@@ -2301,7 +2573,10 @@ int main(int argc, char* argv[])
                                          host_aliases,
                                          sproutlets,
                                          opt.stateless_proxies,
-                                         opt.max_sproutlet_depth);
+                                         opt.max_sproutlet_depth,
+                                         opt.sproutlet_background_threads,
+                                         sproutlet_clones_table,
+                                         latency_breakdown);
     if (sproutlet_proxy == NULL)
     {
       TRC_ERROR("Failed to create SproutletProxy");
@@ -2309,16 +2584,38 @@ int main(int argc, char* argv[])
     }
   }
 
+  SasLogPool* sas_log_pool = NULL;
+  if (opt.sas_log_threads > 0)
+  {
+    sas_log_pool = new SasLogPool(opt.sas_log_threads,
+                                  SasLogPool::DEFAULT_MAX_QUEUE,
+                                  sas_log_dropped_table);
+  }
+
   init_common_sip_processing(load_monitor,
                              requests_counter,
                              overload_counter,
-                             hc);
+                             hc,
+                             sas_log_pool,
+                             admission_controller);
+
+  ThirdPartyRegEngine* third_party_reg_engine = NULL;
+  if (opt.third_party_reg_threads > 0)
+  {
+    third_party_reg_engine = new ThirdPartyRegEngine(opt.third_party_reg_threads,
+                                                     opt.third_party_reg_rate);
+    RegistrationUtils::set_third_party_reg_engine(third_party_reg_engine);
+  }
 
   init_thread_dispatcher(opt.worker_threads,
                          latency_table,
                          queue_size_table,
                          load_monitor,
-                         exception_handler);
+                         exception_handler,
+                         opt.worker_queue_shards,
+                         opt.max_worker_queue_depth,
+                         overload_counter,
+                         latency_breakdown);
 
   // Create worker threads first as they take work from the PJSIP threads so
   // need to be ready.
@@ -2356,8 +2653,10 @@ int main(int argc, char* argv[])
                                                    remote_impi_stores);
   PushProfileTask::Config push_profile_config(local_sdm,
                                               remote_sdms,
-                                              hss_connection);
+                                              hss_connection,
+                                              aor_replicator);
   GetCachedDataTask::Config get_cached_data_config(local_sdm, remote_sdms);
+  GetLatencyTask::Config get_latency_config(latency_breakdown);
   DeleteImpuTask::Config delete_impu_config(local_sdm,
                                             remote_sdms,
                                             hss_connection,
@@ -2370,7 +2669,8 @@ int main(int argc, char* argv[])
 
   AoRTimeoutTask::Config aor_timeout_config(local_sdm,
                                             remote_sdms,
-                                            hss_connection);
+                                            hss_connection,
+                                            aor_replicator);
   AuthTimeoutTask::Config auth_timeout_config(local_impi_store,
                                               hss_connection);
 
@@ -2382,6 +2682,7 @@ int main(int argc, char* argv[])
   HttpStackUtils::SpawningHandler<GetBindingsTask, GetCachedDataTask::Config> get_bindings_handler(&get_cached_data_config);
   HttpStackUtils::SpawningHandler<GetSubscriptionsTask, GetCachedDataTask::Config> get_subscriptions_handler(&get_cached_data_config);
   HttpStackUtils::SpawningHandler<DeleteImpuTask, DeleteImpuTask::Config> delete_impu_handler(&delete_impu_config);
+  HttpStackUtils::SpawningHandler<GetLatencyTask, GetLatencyTask::Config> get_latency_handler(&get_latency_config);
 
   if (opt.enabled_scscf)
   {
@@ -2406,8 +2707,14 @@ int main(int argc, char* argv[])
       TRC_ERROR("Caught signaling HttpStack::Exception - %s - %d", e._func, e._rc);
       return 1;
     }
+  }
 
-    try
+  // The management interface always runs, as the latency breakdown is
+  // recorded whatever function this node performs.  The subscriber
+  // management URLs are only available on an S-CSCF.
+  try
+  {
+    if (opt.enabled_scscf)
     {
       http_stack_mgmt->register_handler("^/ping$",
                                         &ping_handler);
@@ -2417,15 +2724,22 @@ int main(int argc, char* argv[])
                                         &get_subscriptions_handler);
       http_stack_mgmt->register_handler("^/impu/[^/]+$",
                                         &delete_impu_handler);
-      http_stack_mgmt->bind_unix_socket(SPROUT_HTTP_MGMT_SOCKET_PATH);
-      http_stack_mgmt->start(&reg_httpthread_with_pjsip);
-    }
-    catch (HttpStack::Exception& e)
-    {
-      CL_SPROUT_HTTP_INTERFACE_FAIL.log(e._func, e._rc);
-      TRC_ERROR("Caught management HttpStack::Exception - %s - %d", e._func, e._rc);
-      return 1;
     }
+
+    http_stack_mgmt->register_handler("^/latency$",
+                                      &get_latency_handler);
+    // Bono and Sprout can run on the same machine, so they need different
+    // sockets.
+    http_stack_mgmt->bind_unix_socket(opt.pcscf_enabled ?
+                                        BONO_HTTP_MGMT_SOCKET_PATH :
+                                        SPROUT_HTTP_MGMT_SOCKET_PATH);
+    http_stack_mgmt->start(&reg_httpthread_with_pjsip);
+  }
+  catch (HttpStack::Exception& e)
+  {
+    CL_SPROUT_HTTP_INTERFACE_FAIL.log(e._func, e._rc);
+    TRC_ERROR("Caught management HttpStack::Exception - %s - %d", e._func, e._rc);
+    return 1;
   }
 
   // Wait here until the quit semaphore is signaled.
@@ -2454,17 +2768,17 @@ int main(int argc, char* argv[])
       CL_SPROUT_HTTP_INTERFACE_STOP_FAIL.log(e._func, e._rc);
       TRC_ERROR("Caught signaling HttpStack::Exception - %s - %d", e._func, e._rc);
     }
+  }
 
-    try
-    {
-      http_stack_mgmt->stop();
-      http_stack_mgmt->wait_stopped();
-    }
-    catch (HttpStack::Exception& e)
-    {
-      CL_SPROUT_HTTP_INTERFACE_STOP_FAIL.log(e._func, e._rc);
-      TRC_ERROR("Caught management HttpStack::Exception - %s - %d", e._func, e._rc);
-    }
+  try
+  {
+    http_stack_mgmt->stop();
+    http_stack_mgmt->wait_stopped();
+  }
+  catch (HttpStack::Exception& e)
+  {
+    CL_SPROUT_HTTP_INTERFACE_STOP_FAIL.log(e._func, e._rc);
+    TRC_ERROR("Caught management HttpStack::Exception - %s - %d", e._func, e._rc);
   }
 
   // Terminate the PJSIP thread and the worker threads to exit.  We kill
@@ -2474,6 +2788,11 @@ int main(int argc, char* argv[])
   stop_pjsip_thread();
   stop_worker_threads();
 
+  // Stop sending third-party REGISTERs.  Any that complete from now on run
+  // their callbacks inline.
+  RegistrationUtils::set_third_party_reg_engine(NULL);
+  delete third_party_reg_engine; third_party_reg_engine = NULL;
+
   // We must call stop_stack here because this terminates the
   // transaction layer, which can otherwise generate work for other modules
   // after they have unregistered.
@@ -2481,6 +2800,8 @@ int main(int argc, char* argv[])
 
   unregister_thread_dispatcher();
   unregister_common_processing_module();
+  delete sas_log_pool; sas_log_pool = NULL;
+  delete admission_controller; admission_controller = NULL;
 
   // Destroy the Sproutlet Proxy.
   delete sproutlet_proxy;
@@ -2506,12 +2827,14 @@ int main(int argc, char* argv[])
   delete http_stack_mgmt; http_stack_mgmt = NULL;
   delete chronos_connection;
   delete hss_connection;
+  delete hss_cache;
   delete fifc_service;
   delete mmf_service;
   delete sifc_service;
   delete quiescing_mgr;
   delete exception_handler;
   delete load_monitor;
+  delete aor_replicator;
   delete local_sdm;
   delete local_aor_store;
   delete local_data_store;
@@ -2583,6 +2906,24 @@ int main(int argc, char* argv[])
   delete homestead_uar_latency_table;
   delete homestead_lir_latency_table;
   delete no_shared_ifcs_set_table;
+  delete aor_replication_lag_table;
+  delete sas_log_dropped_table;
+
+  for (std::vector<SNMP::SuccessFailCountTable*>::iterator it = admission_tables.begin();
+       it != admission_tables.end();
+       ++it)
+  {
+    delete *it;
+  }
+
+  delete sproutlet_clones_table;
+
+  stack_data.latency_breakdown = NULL;
+  delete latency_breakdown;
+  delete queue_latency_table;
+  delete processing_latency_table;
+  delete sproutlet_proxy_latency_table;
+  delete dependency_blocked_latency_table;
 
   delete token_rate_table;
   delete smoothed_latency_scalar;
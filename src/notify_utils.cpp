@@ -26,6 +26,13 @@ extern "C" {
 #include "wildcard_utils.h"
 #include "sproutsasevent.h"
 
+// Markers for the fields of a reginfo document that are filled in for each
+// subscription.  Control characters can't appear in the SIP URIs and
+// parameters that make up the rest of the document, so these can't clash
+// with anything else.
+static const char VERSION_MARKER = '\x01';
+static const char REG_ID_MARKER = '\x02';
+
 // Return a XML registration node with the attributes populated
 pj_xml_node* create_reg_node(pj_pool_t *pool,
                              pj_str_t *aor,
@@ -74,14 +81,14 @@ pj_xml_node* create_contact_node(pj_pool_t *pool,
   return contact_node;
 }
 
-// Create complete XML body for a NOTIFY
+// Create complete XML body for a NOTIFY.  The document version and the
+// registration IDs are left as markers.
 pj_xml_node* notify_create_reg_state_xml(
                          pj_pool_t *pool,
-                         std::string& aor,
                          AssociatedURIs* associated_uris,
-                         AoR::Subscription* subscription,
-                         std::vector<NotifyUtils::BindingNotifyInformation*> bnis,
+                         const std::vector<NotifyUtils::BindingNotifyInformation*>& bnis,
                          NotifyUtils::RegistrationState reg_state,
+                         NotifyUtils::DocState doc_state,
                          SAS::TrailId trail)
 {
   TRC_DEBUG("Create the XML body for a SIP NOTIFY");
@@ -101,11 +108,14 @@ pj_xml_node* notify_create_reg_state_xml(
   pj_xml_add_attr(doc, attr);
   attr = pj_xml_attr_new(pool, &STR_XMLNS_ERE_NAME, &STR_XMLNS_ERE_VAL);
   pj_xml_add_attr(doc, attr);
-  attr = pj_xml_attr_new(pool, &STR_VERSION, &STR_VERSION_VAL);
+  pj_str_t version_str;
+  pj_strdup2(pool, &version_str, std::string(1, VERSION_MARKER).c_str());
+  attr = pj_xml_attr_new(pool, &STR_VERSION, &version_str);
   pj_xml_add_attr(doc, attr);
 
-  // Add the state - this will be partial except on an initial subscription
-  const pj_str_t* state_str = &STR_FULL;
+  // Add the state
+  const pj_str_t* state_str = (doc_state == NotifyUtils::DocState::FULL) ?
+                                                    &STR_FULL : &STR_PARTIAL;
   attr = pj_xml_attr_new(pool, &STR_STATE, state_str);
   pj_xml_add_attr(doc, attr);
 
@@ -172,8 +182,7 @@ pj_xml_node* notify_create_reg_state_xml(
     }
 
     pj_strdup2(pool, &reg_aor, Utils::xml_escape(unescaped_aor).c_str());
-    std::string unescaped_reg_id = subscription->_to_tag;
-    pj_strdup2(pool, &reg_id, Utils::xml_escape(unescaped_reg_id).c_str());
+    pj_strdup2(pool, &reg_id, std::string(1, REG_ID_MARKER).c_str());
     reg_state_str = (reg_state == NotifyUtils::RegistrationState::ACTIVE)
                                                     ? STR_ACTIVE : STR_TERMINATED;
     reg_node = create_reg_node(pool, &reg_aor, &reg_id, &reg_state_str);
@@ -305,52 +314,119 @@ pj_xml_node* notify_create_reg_state_xml(
   return doc;
 }
 
-// Print XML message body.
-static int xml_print_body( struct pjsip_msg_body *msg_body,
-                         char *buf, pj_size_t size)
+NotifyUtils::RegInfoBody::RegInfoBody(
+                    AssociatedURIs* associated_uris,
+                    const std::vector<NotifyUtils::BindingNotifyInformation*>& bnis,
+                    NotifyUtils::RegistrationState reg_state,
+                    NotifyUtils::DocState doc_state,
+                    SAS::TrailId trail) :
+  _reg_state(reg_state),
+  _segments(),
+  _fields()
 {
-  return pj_xml_print((const pj_xml_node*)msg_body->data, buf, size,
-                       PJ_TRUE);
+  TRC_DEBUG("Create %s reginfo document",
+            (doc_state == DocState::FULL) ? "full" : "partial");
+
+  // A partial document only reports the bindings that have changed.
+  std::vector<BindingNotifyInformation*> reported;
+
+  for (BindingNotifyInformation* bni : bnis)
+  {
+    if ((doc_state == DocState::FULL) ||
+        (bni->_contact_event != ContactEvent::REGISTERED))
+    {
+      reported.push_back(bni);
+    }
+  }
+
+  pj_pool_t* pool = pj_pool_create(&stack_data.cp.factory, "reginfo", 4096, 4096, NULL);
+  pj_xml_node* doc = notify_create_reg_state_xml(pool,
+                                                 associated_uris,
+                                                 reported,
+                                                 reg_state,
+                                                 doc_state,
+                                                 trail);
+
+  // Serialize the document, growing the buffer until it fits.
+  std::string text;
+  std::vector<char> buf(8192);
+  int len;
+
+  while ((len = pj_xml_print(doc, buf.data(), buf.size(), PJ_TRUE)) < 0)
+  {
+    buf.resize(buf.size() * 2);
+  }
+
+  text.assign(buf.data(), len);
+  pj_pool_release(pool);
+
+  // Split the document at the markers.
+  size_t start = 0;
+  size_t marker;
+
+  while ((marker = text.find_first_of(std::string{VERSION_MARKER, REG_ID_MARKER},
+                                      start)) != std::string::npos)
+  {
+    _segments.push_back(text.substr(start, marker - start));
+    _fields.push_back(text[marker]);
+    start = marker + 1;
+  }
+
+  _segments.push_back(text.substr(start));
 }
 
-// Create the body of a SIP NOTIFY
-pj_status_t notify_create_body(pjsip_msg_body* body,
-                               pj_pool_t *pool,
-                               std::string& aor,
-                               AssociatedURIs* associated_uris,
-                               AoR::Subscription* subscription,
-                               std::vector<NotifyUtils::BindingNotifyInformation*> bnis,
-                               NotifyUtils::RegistrationState reg_state,
-                               SAS::TrailId trail)
+std::string NotifyUtils::RegInfoBody::for_subscription(
+                                      const AoR::Subscription* subscription,
+                                      int version) const
 {
-  TRC_DEBUG("Create body of a SIP NOTIFY");
-
-  pj_xml_node *doc;
-  doc = notify_create_reg_state_xml(pool,
-                                    aor,
-                                    associated_uris,
-                                    subscription,
-                                    bnis,
-                                    reg_state,
-                                    trail);
-
-  if (doc == NULL)
+  std::string version_str = std::to_string(version);
+  std::string reg_id = Utils::xml_escape(subscription->_to_tag);
+  std::string body;
+
+  for (size_t ii = 0; ii < _fields.size(); ++ii)
   {
-    // LCOV_EXCL_START
-    TRC_DEBUG("Failed to create body");
-    return PJ_FALSE;
-    // LCOV_EXCL_STOP
+    body.append(_segments[ii]);
+    body.append((_fields[ii] == VERSION_MARKER) ? version_str : reg_id);
   }
 
-  body->content_type.type = STR_MIME_TYPE;
-  body->content_type.subtype = STR_MIME_SUBTYPE;
+  body.append(_segments.back());
+  return body;
+}
+
+NotifyUtils::RegInfoBodyCache::RegInfoBodyCache(
+                    AssociatedURIs* associated_uris,
+                    const std::vector<NotifyUtils::BindingNotifyInformation*>& bnis,
+                    SAS::TrailId trail) :
+  _associated_uris(associated_uris),
+  _bnis(bnis),
+  _trail(trail),
+  _bodies()
+{
+}
+
+NotifyUtils::RegInfoBodyCache::~RegInfoBodyCache()
+{
+  for (std::map<std::pair<RegistrationState, DocState>, RegInfoBody*>::iterator i =
+         _bodies.begin();
+       i != _bodies.end();
+       ++i)
+  {
+    delete i->second;
+  }
+}
 
-  body->data = doc;
-  body->len = 0;
+const NotifyUtils::RegInfoBody* NotifyUtils::RegInfoBodyCache::get(
+                                                 RegistrationState reg_state,
+                                                 DocState doc_state)
+{
+  RegInfoBody*& body = _bodies[std::make_pair(reg_state, doc_state)];
 
-  body->print_body = &xml_print_body;
+  if (body == NULL)
+  {
+    body = new RegInfoBody(_associated_uris, _bnis, reg_state, doc_state, _trail);
+  }
 
-  return PJ_SUCCESS;
+  return body;
 }
 
 pj_status_t create_request_from_subscription(
@@ -387,11 +463,9 @@ pj_status_t create_request_from_subscription(
 pj_status_t NotifyUtils::create_subscription_notify(
                                     pjsip_tx_data** tdata_notify,
                                     AoR::Subscription* s,
-                                    std::string aor,
-                                    AssociatedURIs* associated_uris,
                                     AoR* aor_data,
-                                    std::vector<NotifyUtils::BindingNotifyInformation*> bnis,
-                                    NotifyUtils::RegistrationState reg_state,
+                                    const NotifyUtils::RegInfoBody* body,
+                                    int version,
                                     int now,
                                     SAS::TrailId trail)
 {
@@ -407,11 +481,9 @@ pj_status_t NotifyUtils::create_subscription_notify(
 
   pj_status_t status = NotifyUtils::create_notify(tdata_notify,
                                                   s,
-                                                  aor,
-                                                  associated_uris,
                                                   aor_data->_notify_cseq,
-                                                  bnis,
-                                                  reg_state,
+                                                  body,
+                                                  version,
                                                   state,
                                                   expiry,
                                                   trail);
@@ -421,11 +493,9 @@ pj_status_t NotifyUtils::create_subscription_notify(
 pj_status_t NotifyUtils::create_notify(
                                     pjsip_tx_data** tdata_notify,
                                     AoR::Subscription* subscription,
-                                    std::string aor,
-                                    AssociatedURIs* associated_uris,
                                     int cseq,
-                                    std::vector<NotifyUtils::BindingNotifyInformation*> bnis,
-                                    NotifyUtils::RegistrationState reg_state,
+                                    const NotifyUtils::RegInfoBody* body,
+                                    int version,
                                     NotifyUtils::SubscriptionState subscription_state,
                                     int expiry,
                                     SAS::TrailId trail)
@@ -481,7 +551,7 @@ pj_status_t NotifyUtils::create_notify(
       // terminated) set the reason to timeout. Otherwise set it to deactivated
       sub_state_hdr->sub_state = STR_TERMINATED;
 
-      if (reg_state == NotifyUtils::RegistrationState::TERMINATED)
+      if (body->reg_state() == NotifyUtils::RegistrationState::TERMINATED)
       {
         sub_state_hdr->reason_param = STR_DEACTIVATED;
       }
@@ -499,18 +569,15 @@ pj_status_t NotifyUtils::create_notify(
 
     pj_list_push_back( &(*tdata_notify)->msg->hdr, sub_state_hdr);
 
-    // complete body
-    pjsip_msg_body *body2;
-    body2 = PJ_POOL_ZALLOC_T((*tdata_notify)->pool, pjsip_msg_body);
-    status = notify_create_body(body2,
-                               (*tdata_notify)->pool,
-                                aor,
-                                associated_uris,
-                                subscription,
-                                bnis,
-                                reg_state,
-                                trail);
-    (*tdata_notify)->msg->body = body2;
+    // Add the body, filling in the version and registration IDs for this
+    // subscription.
+    std::string text = body->for_subscription(subscription, version);
+    pj_str_t body_str;
+    pj_cstr(&body_str, text.c_str());
+    (*tdata_notify)->msg->body = pjsip_msg_body_create((*tdata_notify)->pool,
+                                                       &STR_MIME_TYPE,
+                                                       &STR_MIME_SUBTYPE,
+                                                       &body_str);
   }
   else
   {
@@ -1154,21 +1154,27 @@ static void on_tsx_state(pjsip_transaction* tsx, pjsip_event* event)
     if (sss->cb_builder != NULL)
     {
       PJUtils::Callback* cb = (sss->cb_builder)(sss->user_token, event);
-#ifndef UNIT_TEST
-      if (is_pjsip_transport_thread())
+
+      // The builder returns NULL if it has arranged to run the callback
+      // itself.
+      if (cb != NULL)
       {
-        // On a transport error, this callback will be on the main PJSIP thread,
-        // so we add the callback to the queue to get picked up by a worker
-        // thread.
-        add_callback_to_queue(cb);
-      }
-      else
+#ifndef UNIT_TEST
+        if (is_pjsip_transport_thread())
+        {
+          // On a transport error, this callback will be on the main PJSIP thread,
+          // so we add the callback to the queue to get picked up by a worker
+          // thread.
+          add_callback_to_queue(cb);
+        }
+        else
 #endif
-      {
-        // If we're already on a worker thread (or in the UTs, which have a
-        // different threading model) we just run the Callback directly.
-        cb->run();
-        delete cb; cb = NULL;
+        {
+          // If we're already on a worker thread (or in the UTs, which have a
+          // different threading model) we just run the Callback directly.
+          cb->run();
+          delete cb; cb = NULL;
+        }
       }
     }
 
@@ -2267,11 +2273,7 @@ static std::string query_enum(pjsip_msg* req,
   return new_uri;
 }
 
-void PJUtils::translate_request_uri(pjsip_msg* req,
-                                    pj_pool_t* pool,
-                                    EnumService* enum_service,
-                                    bool should_override_npdi,
-                                    SAS::TrailId trail)
+bool PJUtils::get_enum_user(pjsip_msg* req, std::string& user)
 {
   pjsip_uri* uri = req->line.req.uri;
   URIClass uri_class = URIClassifier::classify_uri(uri, false, true);
@@ -2280,66 +2282,94 @@ void PJUtils::translate_request_uri(pjsip_msg* req,
       (uri_class == NP_DATA) ||
       (uri_class == FINAL_NP_DATA))
   {
+    // Request is either to a URI in this domain, or a Tel URI, so it should
+    // be translated according to 5.4.3.2 section 10.
+    pj_str_t pj_user = PJUtils::user_from_uri(uri);
+    user = PJUtils::pj_str_to_string(&pj_user);
+    return true;
+  }
 
-    // Request is either to a URI in this domain, or a Tel URI, so attempt
-    // to translate it according to 5.4.3.2 section 10.
+  return false;
+}
+
+void PJUtils::translate_request_uri(pjsip_msg* req,
+                                    pj_pool_t* pool,
+                                    EnumService* enum_service,
+                                    bool should_override_npdi,
+                                    SAS::TrailId trail)
+{
+  std::string user;
+
+  if (get_enum_user(req, user))
+  {
     TRC_DEBUG("Translating URI");
     std::string new_uri_str = query_enum(req,
                                          enum_service,
                                          trail);
+    apply_enum_translation(req, pool, new_uri_str, should_override_npdi, trail);
+  }
+}
 
-    if (!new_uri_str.empty())
-    {
-      pjsip_uri* new_uri = (pjsip_uri*)PJUtils::uri_from_string(new_uri_str,
-                                                                pool);
+void PJUtils::apply_enum_translation(pjsip_msg* req,
+                                     pj_pool_t* pool,
+                                     const std::string& new_uri_str,
+                                     bool should_override_npdi,
+                                     SAS::TrailId trail)
+{
+  pjsip_uri* uri = req->line.req.uri;
+  URIClass uri_class = URIClassifier::classify_uri(uri, false, true);
 
-      if (new_uri == NULL)
-      {
-        // The ENUM lookup has returned an invalid URI. Reject the
-        // request.
-        TRC_WARNING("Invalid ENUM response: %s", new_uri_str.c_str());
-        SAS::Event event(trail, SASEvent::ENUM_INVALID, 0);
-        event.add_var_param(new_uri_str);
-        SAS::report_event(event);
-        return;
-      }
+  if (!new_uri_str.empty())
+  {
+    pjsip_uri* new_uri = (pjsip_uri*)PJUtils::uri_from_string(new_uri_str,
+                                                              pool);
 
-      // The URI was successfully translated, so see what it is.
-      URIClass new_uri_class = URIClassifier::classify_uri(new_uri, false, true);
-      std::string rn;
-      get_rn(new_uri, rn);
+    if (new_uri == NULL)
+    {
+      // The ENUM lookup has returned an invalid URI. Reject the
+      // request.
+      TRC_WARNING("Invalid ENUM response: %s", new_uri_str.c_str());
+      SAS::Event event(trail, SASEvent::ENUM_INVALID, 0);
+      event.add_var_param(new_uri_str);
+      SAS::report_event(event);
+      return;
+    }
 
-      if ((new_uri_class == HOME_DOMAIN_SIP_URI) ||
-          (new_uri_class == NODE_LOCAL_SIP_URI) ||
-          (new_uri_class == OFFNET_SIP_URI))
-      {
-        // Translation to a real SIP URI - this always takes priority.
-        TRC_DEBUG("Translated URI %s is a real SIP URI - replacing Request-URI",
-                  new_uri_str.c_str());
-        req->line.req.uri = new_uri;
-        SAS::Event event(trail, SASEvent::SIP_URI_FROM_ENUM, 0);
-        event.add_var_param(new_uri_str);
-        SAS::report_event(event);
-      }
-      else if ((new_uri_class == NP_DATA) || (new_uri_class == FINAL_NP_DATA))
-      {
-        if (should_update_np_data(uri_class, new_uri_class, new_uri_str, rn, should_override_npdi, trail))
-        {
-          req->line.req.uri = new_uri;
-        }
-      }
-      else
+    // The URI was successfully translated, so see what it is.
+    URIClass new_uri_class = URIClassifier::classify_uri(new_uri, false, true);
+    std::string rn;
+    get_rn(new_uri, rn);
+
+    if ((new_uri_class == HOME_DOMAIN_SIP_URI) ||
+        (new_uri_class == NODE_LOCAL_SIP_URI) ||
+        (new_uri_class == OFFNET_SIP_URI))
+    {
+      // Translation to a real SIP URI - this always takes priority.
+      TRC_DEBUG("Translated URI %s is a real SIP URI - replacing Request-URI",
+                new_uri_str.c_str());
+      req->line.req.uri = new_uri;
+      SAS::Event event(trail, SASEvent::SIP_URI_FROM_ENUM, 0);
+      event.add_var_param(new_uri_str);
+      SAS::report_event(event);
+    }
+    else if ((new_uri_class == NP_DATA) || (new_uri_class == FINAL_NP_DATA))
+    {
+      if (should_update_np_data(uri_class, new_uri_class, new_uri_str, rn, should_override_npdi, trail))
       {
-        // We got a TEL URI of some description - update the Request-URI anyway and expect a
-        // downstream MGCF to sort it out.
-        TRC_DEBUG("Translated URI %s is not a SIP URI - replacing Request-URI anyway",
-                  new_uri_str.c_str());
         req->line.req.uri = new_uri;
-        SAS::Event event(trail, SASEvent::NON_SIP_URI_FROM_ENUM, 0);
-        event.add_var_param(new_uri_str);
-        SAS::report_event(event);
       }
     }
+    else
+    {
+      // We got a TEL URI of some description - update the Request-URI anyway and expect a
+      // downstream MGCF to sort it out.
+      TRC_DEBUG("Translated URI %s is not a SIP URI - replacing Request-URI anyway",
+                new_uri_str.c_str());
+      req->line.req.uri = new_uri;
+      SAS::Event event(trail, SASEvent::NON_SIP_URI_FROM_ENUM, 0);
+      event.add_var_param(new_uri_str);
+      SAS::report_event(event);
+    }
   }
 }
 
@@ -60,10 +60,12 @@ RegistrarSproutlet::RegistrarSproutlet(const std::string& name,
                                        SNMP::RegistrationStatsTables* reg_stats_tbls,
                                        SNMP::RegistrationStatsTables* third_party_reg_stats_tbls,
                                        FIFCService* fifc_service,
-                                       IFCConfiguration ifc_configuration) :
+                                       IFCConfiguration ifc_configuration,
+                                       AoRReplicator* aor_replicator) :
   Sproutlet(name, port, uri, "", aliases, NULL, NULL, network_function),
   _sdm(reg_sdm),
   _remote_sdms(reg_remote_sdms),
+  _aor_replicator(aor_replicator),
   _hss(hss_connection),
   _acr_factory(rfacr_factory),
   _max_expires(cfg_max_expires),
@@ -472,28 +474,37 @@ void RegistrarSproutletTsx::process_register_request(pjsip_msg *req)
     // Log the bindings.
     log_bindings(aor, aor_pair->get_current());
 
-    // If we have any remote stores, try to store this in them too.  We don't worry
-    // about failures in this case.
-    for (std::vector<SubscriberDataManager*>::iterator it = _registrar->_remote_sdms.begin();
-         it != _registrar->_remote_sdms.end();
-         ++it)
+    if (_registrar->_aor_replicator != NULL)
     {
-      if ((*it)->has_servers())
+      // Leave the remote writes to the replicator, so the REGISTER isn't held
+      // up waiting for them.
+      _registrar->_aor_replicator->replicate(aor, aor_pair, trail());
+    }
+    else
+    {
+      // If we have any remote stores, try to store this in them too.  We
+      // don't worry about failures in this case.
+      for (std::vector<SubscriberDataManager*>::iterator it = _registrar->_remote_sdms.begin();
+           it != _registrar->_remote_sdms.end();
+           ++it)
       {
-        int tmp_expiry = 0;
-        bool ignored;
-        AoRPair* remote_aor_pair = write_to_store(*it,
-                                                  aor,
-                                                  &associated_uris,
-                                                  req,
-                                                  now,
-                                                  tmp_expiry,
-                                                  ignored,
-                                                  aor_pair,
-                                                  {},
-                                                  private_id_for_binding,
-                                                  ignored);
-        delete remote_aor_pair;
+        if ((*it)->has_servers())
+        {
+          int tmp_expiry = 0;
+          bool ignored;
+          AoRPair* remote_aor_pair = write_to_store(*it,
+                                                    aor,
+                                                    &associated_uris,
+                                                    req,
+                                                    now,
+                                                    tmp_expiry,
+                                                    ignored,
+                                                    aor_pair,
+                                                    {},
+                                                    private_id_for_binding,
+                                                    ignored);
+          delete remote_aor_pair;
+        }
       }
     }
   }
@@ -18,6 +18,7 @@ extern "C" {
 
 
 #include <string>
+#include <memory>
 #include <cassert>
 #include "constants.h"
 #include "ifchandler.h"
@@ -29,16 +30,40 @@ extern "C" {
 #include <boost/lexical_cast.hpp>
 #include "sproutsasevent.h"
 #include "snmp_success_fail_count_table.h"
+#include "third_party_reg_engine.h"
 
 #define MAX_SIP_MSG_SIZE 65535
 
 static SNMP::RegistrationStatsTables* third_party_reg_stats_tables;
 
+// Engine used to send third-party REGISTERs in the background, or NULL to
+// send them inline.
+static ThirdPartyRegEngine* third_party_reg_engine = NULL;
+
 // Should we always send the access-side REGISTER and 200 OK in the body
 // of third-party REGISTER messages to application servers, even if the
 // iFCs don't tell us to?
 static bool force_third_party_register_body;
 
+/// The parts of a third-party REGISTER taken from the REGISTER and 200 OK
+/// that triggered it.  These are worked out once and shared by all the
+/// application servers, and may be used after the original messages have
+/// been freed.
+struct ThirdPartyRegTemplate
+{
+  // Whether the REGISTER and 200 OK were supplied, so headers and bodies
+  // should be copied from them.
+  bool has_msgs;
+
+  // Headers to copy into the third-party REGISTER, as (name, value) pairs.
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  // The REGISTER and 200 OK, if any application server includes them in
+  // the body.
+  std::string register_str;
+  std::string response_str;
+};
+
 /// Temporary data structure maintained while transmitting a third-party
 /// REGISTER to an application server.
 struct ThirdPartyRegData
@@ -144,8 +169,7 @@ static void send_register_to_as(SubscriberDataManager* sdm,
                                 HSSConnection* hss,
                                 FIFCService* fifc_service,
                                 IFCConfiguration ifc_configuration,
-                                pjsip_msg* received_register_msg,
-                                pjsip_msg* ok_response_msg,
+                                const ThirdPartyRegTemplate& reg_template,
                                 AsInvocation& as,
                                 int expires,
                                 bool is_initial_registration,
@@ -159,6 +183,11 @@ void RegistrationUtils::init(SNMP::RegistrationStatsTables* third_party_reg_stat
   force_third_party_register_body = force_third_party_register_body_arg;
 }
 
+void RegistrationUtils::set_third_party_reg_engine(ThirdPartyRegEngine* third_party_reg_engine_arg)
+{
+  third_party_reg_engine = third_party_reg_engine_arg;
+}
+
 void RegistrationUtils::interpret_ifcs(Ifcs& ifcs,
                                        std::vector<Ifc> fallback_ifcs,
                                        IFCConfiguration ifc_configuration,
@@ -324,6 +353,91 @@ void RegistrationUtils::deregister_with_application_servers(Ifcs& ifcs,
   }
 }
 
+static void count_register_attempt(int expires, bool is_initial_registration)
+{
+  if (third_party_reg_stats_tables != NULL)
+  {
+    if (expires == 0)
+    {
+      third_party_reg_stats_tables->de_reg_tbl->increment_attempts();
+    }
+    else if (is_initial_registration)
+    {
+      third_party_reg_stats_tables->init_reg_tbl->increment_attempts();
+    }
+    else
+    {
+      third_party_reg_stats_tables->re_reg_tbl->increment_attempts();
+    }
+  }
+}
+
+/// Builds the parts of the third-party REGISTERs that come from the received
+/// REGISTER and its 200 OK, so that they are only built once however many
+/// application servers there are.
+static std::shared_ptr<ThirdPartyRegTemplate> build_register_template(
+                                       pjsip_msg* received_register_msg,
+                                       pjsip_msg* ok_response_msg,
+                                       const std::vector<AsInvocation>& as_list)
+{
+  std::shared_ptr<ThirdPartyRegTemplate> reg_template(new ThirdPartyRegTemplate);
+  reg_template->has_msgs = ((received_register_msg != NULL) &&
+                            (ok_response_msg != NULL));
+
+  if (!reg_template->has_msgs)
+  {
+    return reg_template;
+  }
+
+  // Copy P-Access-Network-Info, P-Visited-Network-Id and P-Charging-Vector
+  // from original message, and P-Charging-Function-Addresses from the OK
+  // response.
+  std::vector<std::pair<const pj_str_t*, pjsip_msg*>> hdrs_to_copy =
+    {{&STR_P_A_N_I, received_register_msg},
+     {&STR_P_V_N_I, received_register_msg},
+     {&STR_P_C_V, received_register_msg},
+     {&STR_P_C_F_A, ok_response_msg}};
+
+  for (std::pair<const pj_str_t*, pjsip_msg*> hdr_to_copy : hdrs_to_copy)
+  {
+    pjsip_hdr* hdr = (pjsip_hdr*)pjsip_msg_find_hdr_by_name(hdr_to_copy.second,
+                                                            hdr_to_copy.first,
+                                                            NULL);
+    if (hdr != NULL)
+    {
+      reg_template->headers.push_back(
+               std::make_pair(PJUtils::pj_str_to_string(hdr_to_copy.first),
+                              PJUtils::get_header_value(hdr)));
+    }
+  }
+
+  // Print the REGISTER and 200 OK if they're going in any of the bodies.
+  bool include_register_request = force_third_party_register_body;
+  bool include_register_response = force_third_party_register_body;
+
+  for (const AsInvocation& as : as_list)
+  {
+    include_register_request |= as.include_register_request;
+    include_register_response |= as.include_register_response;
+  }
+
+  char buf[MAX_SIP_MSG_SIZE];
+
+  if (include_register_request)
+  {
+    pj_ssize_t size = pjsip_msg_print(received_register_msg, buf, sizeof(buf));
+    reg_template->register_str.assign(buf, std::max(0L, size));
+  }
+
+  if (include_register_response)
+  {
+    pj_ssize_t size = pjsip_msg_print(ok_response_msg, buf, sizeof(buf));
+    reg_template->response_str.assign(buf, std::max(0L, size));
+  }
+
+  return reg_template;
+}
+
 void RegistrationUtils::register_with_application_servers(Ifcs& ifcs,
                                                           FIFCService* fifc_service,
                                                           IFCConfiguration ifc_configuration,
@@ -360,36 +474,53 @@ void RegistrationUtils::register_with_application_servers(Ifcs& ifcs,
                  found_match,
                  trail);
 
+  std::shared_ptr<ThirdPartyRegTemplate> reg_template =
+                     build_register_template(register_msg, response_msg, as_list);
+
   // Loop through the application servers and send the registers.
   for (AsInvocation as : as_list)
   {
-    if (third_party_reg_stats_tables != NULL)
+    if (third_party_reg_engine != NULL)
     {
-      if (expires == 0)
-      {
-        third_party_reg_stats_tables->de_reg_tbl->increment_attempts();
-      }
-      else if (is_initial_registration)
-      {
-        third_party_reg_stats_tables->init_reg_tbl->increment_attempts();
-      }
-      else
-      {
-        third_party_reg_stats_tables->re_reg_tbl->increment_attempts();
-      }
+      // Send the register in the background.  Re-registrations can be
+      // replaced by a newer one for the same user and AS that arrives before
+      // this one is sent.
+      bool is_reregistration = ((expires != 0) && (!is_initial_registration));
+      third_party_reg_engine->send(as.server_name,
+                                   served_user + " " + as.server_name,
+                                   is_reregistration,
+                                   [=]() mutable
+                                   {
+                                     count_register_attempt(expires,
+                                                            is_initial_registration);
+                                     send_register_to_as(sdm,
+                                                         remote_sdms,
+                                                         hss,
+                                                         fifc_service,
+                                                         ifc_configuration,
+                                                         *reg_template,
+                                                         as,
+                                                         expires,
+                                                         is_initial_registration,
+                                                         served_user,
+                                                         trail);
+                                   });
+    }
+    else
+    {
+      count_register_attempt(expires, is_initial_registration);
+      send_register_to_as(sdm,
+                          remote_sdms,
+                          hss,
+                          fifc_service,
+                          ifc_configuration,
+                          *reg_template,
+                          as,
+                          expires,
+                          is_initial_registration,
+                          served_user,
+                          trail);
     }
-    send_register_to_as(sdm,
-                        remote_sdms,
-                        hss,
-                        fifc_service,
-                        ifc_configuration,
-                        register_msg,
-                        response_msg,
-                        as,
-                        expires,
-                        is_initial_registration,
-                        served_user,
-                        trail);
   }
 
   // Check if we found any iFCs at all. We didn't find any if:
@@ -426,6 +557,15 @@ static PJUtils::Callback* build_register_cb(void* token,
                                             pjsip_event* event)
 {
   RegisterCallback* cb = new RegisterCallback(token, event);
+
+  if (third_party_reg_engine != NULL)
+  {
+    // Complete the REGISTER on the engine's threads, rather than the worker
+    // threads.
+    third_party_reg_engine->complete(cb);
+    return NULL;
+  }
+
   return cb;
 }
 
@@ -434,8 +574,7 @@ static void send_register_to_as(SubscriberDataManager* sdm,
                                 HSSConnection* hss,
                                 FIFCService* fifc_service,
                                 IFCConfiguration ifc_configuration,
-                                pjsip_msg *received_register_msg,
-                                pjsip_msg *ok_response_msg,
+                                const ThirdPartyRegTemplate& reg_template,
                                 AsInvocation& as,
                                 int expires,
                                 bool is_initial_registration,
@@ -479,19 +618,22 @@ static void send_register_to_as(SubscriberDataManager* sdm,
 
   // TODO: modify orig-ioi of P-Charging-Vector and remove term-ioi
 
-  if (received_register_msg && ok_response_msg)
+  if (reg_template.has_msgs)
   {
-    // Copy P-Access-Network-Info, P-Visited-Network-Id and P-Charging-Vector
-    // from original message
-    PJUtils::clone_header(&STR_P_A_N_I, received_register_msg, tdata->msg, tdata->pool);
-    PJUtils::clone_header(&STR_P_V_N_I, received_register_msg, tdata->msg, tdata->pool);
-    PJUtils::clone_header(&STR_P_C_V, received_register_msg, tdata->msg, tdata->pool);
-
-    // Copy P-Charging-Function-Addresses from the OK response.
-    PJUtils::clone_header(&STR_P_C_F_A, ok_response_msg, tdata->msg, tdata->pool);
+    // Copy the headers taken from the original REGISTER and 200 OK.
+    for (const std::pair<std::string, std::string>& hdr : reg_template.headers)
+    {
+      pj_str_t name;
+      pj_str_t value;
+      pj_cstr(&name, hdr.first.c_str());
+      pj_cstr(&value, hdr.second.c_str());
+      pjsip_msg_add_hdr(tdata->msg,
+                        (pjsip_hdr*)pjsip_generic_string_hdr_create(tdata->pool,
+                                                                    &name,
+                                                                    &value));
+    }
 
     // Generate a message body based on Filter Criteria values
-    char buf[MAX_SIP_MSG_SIZE];
     pj_str_t sip_type = pj_str("message");
     pj_str_t sip_subtype = pj_str("sip");
     pj_str_t xml_type = pj_str("application");
@@ -521,8 +663,10 @@ static void send_register_to_as(SubscriberDataManager* sdm,
     if (as.include_register_request || force_third_party_register_body)
     {
       pjsip_multipart_part *request_part = pjsip_multipart_create_part(tdata->pool);
-      pjsip_msg_print(received_register_msg, buf, sizeof(buf));
-      pj_str_t request_str = pj_str(buf);
+      pj_str_t request_str;
+      pj_strset(&request_str,
+                (char*)reg_template.register_str.data(),
+                reg_template.register_str.size());
       request_part->body = pjsip_msg_body_create(tdata->pool, &sip_type, &sip_subtype, &request_str),
       possible_final_body = request_part->body;
       multipart_parts++;
@@ -534,8 +678,10 @@ static void send_register_to_as(SubscriberDataManager* sdm,
     if (as.include_register_response || force_third_party_register_body)
     {
       pjsip_multipart_part *response_part = pjsip_multipart_create_part(tdata->pool);
-      pjsip_msg_print(ok_response_msg, buf, sizeof(buf));
-      pj_str_t response_str = pj_str(buf);
+      pj_str_t response_str;
+      pj_strset(&response_str,
+                (char*)reg_template.response_str.data(),
+                reg_template.response_str.size());
       response_part->body = pjsip_msg_body_create(tdata->pool, &sip_type, &sip_subtype, &response_str),
       possible_final_body = response_part->body;
       multipart_parts++;
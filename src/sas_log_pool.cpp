@@ -0,0 +1,224 @@
+/**
+ * @file sas_log_pool.cpp SasLogPool class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+
+#include "log.h"
+#include "sproutsasevent.h"
+#include "sas_log_pool.h"
+
+SasLogPool::SasLogPool(int num_threads,
+                       int max_queue,
+                       SNMP::CounterTable* dropped_tbl,
+                       ReportFn report_fn) :
+  _ring(std::max(max_queue, 1)),
+  _head(0),
+  _count(0),
+  _in_progress(0),
+  _terminated(false),
+  _threads(),
+  _dropped_tbl(dropped_tbl),
+  _report_fn(report_fn)
+{
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_cond, NULL);
+  pthread_cond_init(&_idle_cond, NULL);
+
+  for (int ii = 0; ii < num_threads; ++ii)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &SasLogPool::thread_fn, this) == 0)
+    {
+      _threads.push_back(thread);
+    }
+    else
+    {
+      TRC_ERROR("Failed to create SAS logging thread"); // LCOV_EXCL_LINE
+    }
+  }
+
+  TRC_STATUS("Logging SIP messages to SAS with %d threads", num_threads);
+}
+
+SasLogPool::~SasLogPool()
+{
+  pthread_mutex_lock(&_lock);
+  _terminated = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_cond_broadcast(&_idle_cond);
+  pthread_mutex_unlock(&_lock);
+
+  for (std::vector<pthread_t>::iterator thread = _threads.begin();
+       thread != _threads.end();
+       ++thread)
+  {
+    pthread_join(*thread, NULL);
+  }
+  _threads.clear();
+
+  pthread_cond_destroy(&_idle_cond);
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+bool SasLogPool::log_msg(uint32_t event_id,
+                         SAS::TrailId trail,
+                         uint32_t transport_type,
+                         uint32_t port,
+                         const char* addr,
+                         const char* msg,
+                         int msg_len)
+{
+  // Timestamp the event now, as the pool threads may report events in a
+  // different order from the one they were queued in.
+  SAS::Timestamp timestamp = SAS::get_current_timestamp();
+
+  pthread_mutex_lock(&_lock);
+
+  if (_count == _ring.size())
+  {
+    pthread_mutex_unlock(&_lock);
+
+    TRC_DEBUG("SAS logging queue is full - drop message on trail %llx", trail);
+    if (_dropped_tbl != NULL)
+    {
+      _dropped_tbl->increment();
+    }
+
+    return false;
+  }
+
+  // Reserve the next free slot.  The pool threads won't take it off the ring
+  // until it's marked as ready, so we can copy the message in without holding
+  // the lock.
+  Entry& entry = _ring[(_head + _count) % _ring.size()];
+  entry.ready = false;
+  ++_count;
+
+  pthread_mutex_unlock(&_lock);
+
+  // The slots keep their buffers between uses, so this doesn't normally need
+  // to allocate.
+  entry.timestamp = timestamp;
+  entry.event_id = event_id;
+  entry.trail = trail;
+  entry.transport_type = transport_type;
+  entry.port = port;
+  entry.addr.assign(addr);
+  entry.msg.assign(msg, msg_len);
+
+  pthread_mutex_lock(&_lock);
+  entry.ready = true;
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+
+  return true;
+}
+
+void SasLogPool::flush()
+{
+  pthread_mutex_lock(&_lock);
+
+  while ((!_terminated) &&
+         ((_count > 0) || (_in_progress > 0)))
+  {
+    pthread_cond_wait(&_idle_cond, &_lock);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void SasLogPool::report_msg(uint32_t event_id,
+                            SAS::TrailId trail,
+                            uint32_t transport_type,
+                            uint32_t port,
+                            const char* addr,
+                            const char* msg,
+                            int msg_len,
+                            SAS::Timestamp timestamp)
+{
+  SAS::Event event(trail, event_id, 0);
+
+  if (timestamp != 0)
+  {
+    event.set_timestamp(timestamp);
+  }
+
+  event.add_static_param(transport_type);
+  event.add_static_param(port);
+  event.add_var_param(addr);
+  event.add_compressed_param(msg_len, msg, &SASEvent::PROFILE_SIP);
+  SAS::report_event(event);
+}
+
+void* SasLogPool::thread_fn(void* p)
+{
+  ((SasLogPool*)p)->process_entries();
+  return NULL;
+}
+
+void SasLogPool::process_entries()
+{
+  Entry entry;
+
+  pthread_mutex_lock(&_lock);
+
+  while (!_terminated)
+  {
+    if ((_count == 0) || (!_ring[_head].ready))
+    {
+      // Nothing to log, or the next entry is still being copied in.
+      pthread_cond_wait(&_cond, &_lock);
+      continue;
+    }
+
+    // Take the entry off the ring by swapping it with our (already logged)
+    // entry, so no buffers are freed or allocated.
+    std::swap(entry, _ring[_head]);
+    _head = (_head + 1) % _ring.size();
+    --_count;
+    ++_in_progress;
+
+    if ((_count > 0) && (_ring[_head].ready))
+    {
+      // Entries made ready out of order only signal once, so pass the
+      // signal on to another thread.
+      pthread_cond_signal(&_cond);
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    _report_fn(entry.event_id,
+               entry.trail,
+               entry.transport_type,
+               entry.port,
+               entry.addr.c_str(),
+               entry.msg.data(),
+               entry.msg.size(),
+               entry.timestamp);
+
+    pthread_mutex_lock(&_lock);
+    --_in_progress;
+
+    if ((_count == 0) && (_in_progress == 0))
+    {
+      // Wake up any flushes.
+      pthread_cond_broadcast(&_idle_cond);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
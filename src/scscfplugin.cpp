@@ -235,7 +235,8 @@ bool SCSCFPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                                                                    opt.reject_if_no_matching_ifcs,
                                                                    opt.dummy_app_server,
                                                                    _no_matching_ifcs_tbl,
-                                                                   _no_matching_fallback_ifcs_tbl));
+                                                                   _no_matching_fallback_ifcs_tbl),
+                                                  aor_replicator);
 
 
     ok = ok && _registrar_sproutlet->init();
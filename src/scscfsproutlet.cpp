@@ -484,6 +484,8 @@ SCSCFSproutletTsx::SCSCFSproutletTsx(SCSCFSproutlet* scscf,
   _target_aor(),
   _target_bindings(),
   _liveness_timer(0),
+  _enum_req(NULL),
+  _enum_result(),
   _record_routed(false),
   _req_type(req_type),
   _seen_1xx(false),
@@ -1486,39 +1488,35 @@ void SCSCFSproutletTsx::apply_originating_services(pjsip_msg* req)
 
     if (_scscf->_enum_service)
     {
+      std::string user;
+      if ((_scscf->_enum_service->lookups_may_block()) &&
+          (PJUtils::get_enum_user(req, user)))
+      {
+        // The ENUM lookup may block waiting for the ENUM server, so try to
+        // run it in the background, parking the request until it completes.
+        EnumService* enum_service = _scscf->_enum_service;
+        std::string* enum_result = &_enum_result;
+        SAS::TrailId trail_id = trail();
+        _enum_req = req;
+        if (run_in_background(&_enum_result,
+                              [enum_service, user, enum_result, trail_id]()
+                              {
+                                *enum_result =
+                                  enum_service->lookup_uri_from_user(user,
+                                                                     trail_id);
+                              }))
+        {
+          TRC_DEBUG("Performing ENUM translation for user %s in the background",
+                    user.c_str());
+          return;
+        }
+        _enum_req = NULL;
+      }
+
       // Attempt to translate the RequestURI using ENUM or an alternative
       // database.
       _scscf->translate_request_uri(req, get_pool(req), trail());
-
-      URIClass uri_class = URIClassifier::classify_uri(req->line.req.uri, true, true);
-      std::string new_uri_str = PJUtils::uri_to_string(PJSIP_URI_IN_REQ_URI, req->line.req.uri);
-      TRC_INFO("New URI string is %s", new_uri_str.c_str());
-
-      if ((uri_class == LOCAL_PHONE_NUMBER) ||
-          (uri_class == GLOBAL_PHONE_NUMBER) ||
-          (uri_class == NP_DATA) ||
-          (uri_class == FINAL_NP_DATA))
-      {
-        TRC_DEBUG("Routing to BGCF");
-        SAS::Event event(trail(), SASEvent::PHONE_ROUTING_TO_BGCF, 0);
-        event.add_var_param(new_uri_str);
-        SAS::report_event(event);
-        route_to_bgcf(req);
-      }
-      else if (uri_class == OFFNET_SIP_URI)
-      {
-        // Destination is off-net, so route to the BGCF.
-        TRC_DEBUG("Routing to BGCF");
-        SAS::Event event(trail(), SASEvent::OFFNET_ROUTING_TO_BGCF, 0);
-        event.add_var_param(new_uri_str);
-        SAS::report_event(event);
-        route_to_bgcf(req);
-      }
-      else
-      {
-        // Destination is on-net so route to the I-CSCF.
-        route_to_icscf(req);
-      }
+      route_translated_request(req);
     }
     else
     {
@@ -1532,6 +1530,42 @@ void SCSCFSproutletTsx::apply_originating_services(pjsip_msg* req)
 }
 
 
+/// Route a request at the end of originating processing, once its
+/// Request-URI has been translated using ENUM.
+void SCSCFSproutletTsx::route_translated_request(pjsip_msg* req)
+{
+  URIClass uri_class = URIClassifier::classify_uri(req->line.req.uri, true, true);
+  std::string new_uri_str = PJUtils::uri_to_string(PJSIP_URI_IN_REQ_URI, req->line.req.uri);
+  TRC_INFO("New URI string is %s", new_uri_str.c_str());
+
+  if ((uri_class == LOCAL_PHONE_NUMBER) ||
+      (uri_class == GLOBAL_PHONE_NUMBER) ||
+      (uri_class == NP_DATA) ||
+      (uri_class == FINAL_NP_DATA))
+  {
+    TRC_DEBUG("Routing to BGCF");
+    SAS::Event event(trail(), SASEvent::PHONE_ROUTING_TO_BGCF, 0);
+    event.add_var_param(new_uri_str);
+    SAS::report_event(event);
+    route_to_bgcf(req);
+  }
+  else if (uri_class == OFFNET_SIP_URI)
+  {
+    // Destination is off-net, so route to the BGCF.
+    TRC_DEBUG("Routing to BGCF");
+    SAS::Event event(trail(), SASEvent::OFFNET_ROUTING_TO_BGCF, 0);
+    event.add_var_param(new_uri_str);
+    SAS::report_event(event);
+    route_to_bgcf(req);
+  }
+  else
+  {
+    // Destination is on-net so route to the I-CSCF.
+    route_to_icscf(req);
+  }
+}
+
+
 /// Apply terminating services for this request.
 void SCSCFSproutletTsx::apply_terminating_services(pjsip_msg* req)
 {
@@ -2254,6 +2288,30 @@ bool SCSCFSproutletTsx::get_billing_role(ACR::NodeRole &role)
 /// Handles liveness timer expiry.
 void SCSCFSproutletTsx::on_timer_expiry(void* context)
 {
+  if (context == &_enum_result)
+  {
+    // A background ENUM lookup has completed, so pick up the parked request.
+    pjsip_msg* req = _enum_req;
+    _enum_req = NULL;
+
+    if (_cancelled)
+    {
+      TRC_DEBUG("Transaction cancelled during ENUM lookup");
+      pjsip_msg* rsp = create_response(req, PJSIP_SC_REQUEST_TERMINATED);
+      send_response(rsp);
+      free_msg(req);
+      return;
+    }
+
+    PJUtils::apply_enum_translation(req,
+                                    get_pool(req),
+                                    _enum_result,
+                                    _scscf->should_override_npdi(),
+                                    trail());
+    route_translated_request(req);
+    return;
+  }
+
   _liveness_timer = 0;
 
   if (_as_chain_link.is_set())
@@ -19,6 +19,7 @@ extern "C" {
 // Common STL includes.
 #include <cassert>
 #include <string>
+#include <algorithm>
 
 #include "log.h"
 #include "utils.h"
@@ -101,17 +102,18 @@ pjsip_transport* SIPConnectionPool::get_connection()
 
   if (_active_connections > 0)
   {
-    // Select a transport by starting at a random point in the hash and
-    // stepping through the hash until a connected entry is found.
-    int start_slot = rand() % _num_connections;
-    int ii = start_slot;
-    while (!_tp_hash[ii].connected)
+    // Pick two connections at random, and use the one with fewer outstanding
+    // messages.  This steers traffic away from connections that are backing
+    // up, without the herding that always picking the least loaded
+    // connection would cause.
+    int ii = select_slot();
+    int jj = select_slot();
+
+    if ((_tp_hash[jj].connected) &&
+        ((!_tp_hash[ii].connected) ||
+         (outstanding(jj) < outstanding(ii))))
     {
-      ii = (ii + 1) % _num_connections;
-      if (ii == start_slot)
-      {
-        break;
-      }
+      ii = jj;
     }
 
     tp = _tp_hash[ii].tp;
@@ -131,6 +133,43 @@ pjsip_transport* SIPConnectionPool::get_connection()
 }
 
 
+/// Selects a slot by starting at a random point in the hash and stepping
+/// through the hash until a connected entry is found.  Must be called with
+/// the hash lock held.
+int SIPConnectionPool::select_slot()
+{
+  int start_slot = rand() % _num_connections;
+  int ii = start_slot;
+  while (!_tp_hash[ii].connected)
+  {
+    ii = (ii + 1) % _num_connections;
+    if (ii == start_slot)
+    {
+      break;
+    }
+  }
+
+  return ii;
+}
+
+
+/// Returns the number of messages outstanding on the connection in a slot.
+/// PJSIP transactions and messages waiting to be sent each hold a reference
+/// to the transport, so this is the transport's reference count (less our
+/// own reference).  Must be called with the hash lock held.
+int SIPConnectionPool::outstanding(int hash_slot)
+{
+  pjsip_transport* tp = _tp_hash[hash_slot].tp;
+
+  if (tp == NULL)
+  {
+    return 0;
+  }
+
+  return std::max(pj_atomic_get(tp->ref_cnt) - 1, (pj_atomic_value_t)0);
+}
+
+
 pj_status_t SIPConnectionPool::resolve_host(const pj_str_t* host,
                                             int port,
                                             pj_sockaddr* addr)
@@ -405,6 +444,24 @@ void SIPConnectionPool::recycle_connections()
 
     int now = time(NULL);
 
+    // Work out how many messages are outstanding on each connection, and the
+    // total across the connected ones.
+    std::vector<int> loads(_tp_hash.size());
+    int total_load = 0;
+    int connected = 0;
+
+    pthread_mutex_lock(&_tp_hash_lock);
+    for (size_t ii = 0; ii < _tp_hash.size(); ++ii)
+    {
+      if (_tp_hash[ii].connected)
+      {
+        loads[ii] = outstanding(ii);
+        total_load += loads[ii];
+        ++connected;
+      }
+    }
+    pthread_mutex_unlock(&_tp_hash_lock);
+
     // Walk the vector of connections.  This is safe to do without the lock
     // because the vector is immutable.
     for (size_t ii = 0; ii < _tp_hash.size(); ++ii)
@@ -424,6 +481,19 @@ void SIPConnectionPool::recycle_connections()
         quiesce_connection(ii);
         create_connection(ii);
       }
+      else if ((_tp_hash[ii].connected) &&
+               (connected > 1) &&
+               (loads[ii] >= BACKLOG_MIN) &&
+               (loads[ii] > BACKLOG_FACTOR * (total_load - loads[ii]) / (connected - 1)))
+      {
+        // This connection is backing up compared to the others, so quiesce
+        // it now (letting it drain the messages already queued on it) and
+        // create a new one.
+        TRC_STATUS("Recycle backed up TCP connection slot %d (%d outstanding)",
+                   ii, loads[ii]);
+        quiesce_connection(ii);
+        create_connection(ii);
+      }
     }
   }
 }
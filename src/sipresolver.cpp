@@ -9,6 +9,9 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <time.h>
+#include <algorithm>
+
 #include "log.h"
 #include "sipresolver.h"
 #include "sas.h"
@@ -32,11 +35,21 @@ SIPResolver::SIPResolver(DnsCachedResolver* dns_client,
   // Create the blacklist.
   create_blacklist(blacklist_duration);
 
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    pthread_mutex_init(&_selection_shards[ii].lock, NULL);
+  }
+
   TRC_STATUS("Created SIP resolver");
 }
 
 SIPResolver::~SIPResolver()
 {
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    pthread_mutex_destroy(&_selection_shards[ii].lock);
+  }
+
   destroy_blacklist();
   destroy_srv_cache();
   destroy_naptr_cache();
@@ -136,141 +149,11 @@ void SIPResolver::resolve(const std::string& name,
         SAS::report_event(event);
       }
     }
-    else if (transport == -1)
-    {
-      // Transport protocol isn't specified, so do a NAPTR lookup for the target.
-      TRC_DEBUG("Do NAPTR look-up for %s", name.c_str());
-
-      if (trail != 0)
-      {
-        SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_LOOKUP, 0);
-        event.add_var_param(name);
-        SAS::report_event(event);
-      }
-
-      NAPTRReplacement* naptr = _naptr_cache->get(name, dummy_ttl, trail);
-
-      if (naptr != NULL)
-      {
-        // NAPTR resolved to a supported service
-        TRC_DEBUG("NAPTR resolved to transport %d", naptr->transport);
-        transport = naptr->transport;
-        if (strcasecmp(naptr->flags.c_str(), "S") == 0)
-        {
-          // Do an SRV lookup with the replacement domain from the NAPTR lookup.
-          srv_name = naptr->replacement;
-
-          if (trail != 0)
-          {
-            SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_SUCCESS_SRV, 0);
-            event.add_var_param(name);
-            event.add_var_param(srv_name);
-            std::string transport_str = get_transport_str(naptr->transport);
-            event.add_var_param(transport_str);
-            SAS::report_event(event);
-          }
-        }
-        else
-        {
-          // Move straight to A/AAAA lookup of the domain returned by NAPTR.
-          a_name = naptr->replacement;
-
-          if (trail != 0)
-          {
-            SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_SUCCESS_A, 0);
-            event.add_var_param(name);
-            event.add_var_param(a_name);
-            SAS::report_event(event);
-          }
-        }
-      }
-      else
-      {
-        // NAPTR resolution failed, so do SRV lookups for both UDP and TCP to
-        // see which transports are supported.
-        TRC_DEBUG("NAPTR lookup failed, so do SRV lookups for UDP and TCP");
-
-        if (trail != 0)
-        {
-          SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_FAILURE, 0);
-          event.add_var_param(name);
-          SAS::report_event(event);
-        }
-
-        std::vector<std::string> domains;
-        domains.push_back("_sip._udp." + name);
-        domains.push_back("_sip._tcp." + name);
-        std::vector<DnsResult> results;
-        _dns_client->dns_query(domains, ns_t_srv, results, trail);
-        DnsResult& udp_result = results[0];
-        TRC_DEBUG("UDP SRV record %s returned %d records",
-                  udp_result.domain().c_str(), udp_result.records().size());
-        DnsResult& tcp_result = results[1];
-        TRC_DEBUG("TCP SRV record %s returned %d records",
-                  tcp_result.domain().c_str(), tcp_result.records().size());
-
-        if (!udp_result.records().empty())
-        {
-          // UDP SRV lookup returned some records, so use UDP transport.
-          TRC_DEBUG("UDP SRV lookup successful, select UDP transport");
-          transport = IPPROTO_UDP;
-          srv_name = udp_result.domain();
-        }
-        else if (!tcp_result.records().empty())
-        {
-          // TCP SRV lookup returned some records, so use TCP transport.
-          TRC_DEBUG("TCP SRV lookup successful, select TCP transport");
-          transport = IPPROTO_TCP;
-          srv_name = tcp_result.domain();
-        }
-        else
-        {
-          // Neither UDP nor TCP SRV lookup returned any results, so default to
-          // UDP transport and move straight to A/AAAA record lookups.
-          TRC_DEBUG("UDP and TCP SRV queries unsuccessful, default to UDP");
-          transport = IPPROTO_UDP;
-        }
-      }
-
-      _naptr_cache->dec_ref(name);
-    }
-    else if (transport == IPPROTO_UDP)
-    {
-      // Use specified transport and try an SRV lookup.
-      if (trail != 0)
-      {
-        SAS::Event event(trail, SASEvent::SIPRESOLVE_TRANSPORT_SRV_LOOKUP, 0);
-        event.add_var_param(name);
-        std::string transport_str = get_transport_str(transport);
-        event.add_var_param(transport_str);
-        SAS::report_event(event);
-      }
-
-      DnsResult result = _dns_client->dns_query("_sip._udp." + name, ns_t_srv, trail);
-
-      if (!result.records().empty())
-      {
-        srv_name = result.domain();
-      }
-    }
-    else if (transport == IPPROTO_TCP)
+    else
     {
-      // Use specified transport and try an SRV lookup.
-      if (trail != 0)
-      {
-        SAS::Event event(trail, SASEvent::SIPRESOLVE_TRANSPORT_SRV_LOOKUP, 0);
-        event.add_var_param(name);
-        std::string transport_str = get_transport_str(transport);
-        event.add_var_param(transport_str);
-        SAS::report_event(event);
-      }
-
-      DnsResult result = _dns_client->dns_query("_sip._tcp." + name, ns_t_srv, trail);
-
-      if (!result.records().empty())
-      {
-        srv_name = result.domain();
-      }
+      // Port isn't specified, so select the transport, and the name to do SRV
+      // or A/AAAA look-ups on.
+      select_transport(name, transport, srv_name, a_name, trail);
     }
 
     if (srv_name != "")
@@ -331,6 +214,223 @@ void SIPResolver::resolve(const std::string& name,
   }
 }
 
+void SIPResolver::select_transport(const std::string& name,
+                                   int& transport,
+                                   std::string& srv_name,
+                                   std::string& a_name,
+                                   SAS::TrailId trail)
+{
+  std::string key = name + ";" + std::to_string(transport);
+  SelectionShard& shard =
+                _selection_shards[std::hash<std::string>()(key) % NUM_SHARDS];
+  unsigned long now = now_ms();
+
+  pthread_mutex_lock(&shard.lock);
+  std::unordered_map<std::string, Selection>::const_iterator it =
+                                                    shard.selections.find(key);
+  if ((it != shard.selections.end()) &&
+      (it->second.expiry_ms > now))
+  {
+    TRC_DEBUG("Use remembered transport %d for %s", it->second.transport, name.c_str());
+    transport = it->second.transport;
+    srv_name = it->second.srv_name;
+    a_name = it->second.a_name;
+    pthread_mutex_unlock(&shard.lock);
+    return;
+  }
+  pthread_mutex_unlock(&shard.lock);
+
+  int ttl = lookup_transport(name, transport, srv_name, a_name, trail);
+
+  if (ttl > 0)
+  {
+    Selection selection;
+    selection.transport = transport;
+    selection.srv_name = srv_name;
+    selection.a_name = a_name;
+    selection.expiry_ms = now + ttl * 1000;
+
+    pthread_mutex_lock(&shard.lock);
+
+    if (shard.selections.size() >= MAX_SELECTIONS_PER_SHARD)
+    {
+      // Make room by dropping the expired selections, or all of them if none
+      // have expired.
+      for (std::unordered_map<std::string, Selection>::iterator jj =
+                                                     shard.selections.begin();
+           jj != shard.selections.end();)
+      {
+        if (jj->second.expiry_ms <= now)
+        {
+          jj = shard.selections.erase(jj);
+        }
+        else
+        {
+          ++jj;
+        }
+      }
+
+      if (shard.selections.size() >= MAX_SELECTIONS_PER_SHARD)
+      {
+        shard.selections.clear();
+      }
+    }
+
+    shard.selections[key] = selection;
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+int SIPResolver::lookup_transport(const std::string& name,
+                                  int& transport,
+                                  std::string& srv_name,
+                                  std::string& a_name,
+                                  SAS::TrailId trail)
+{
+  int ttl = 0;
+
+  if (transport == -1)
+  {
+    // Transport protocol isn't specified, so do a NAPTR lookup for the target.
+    TRC_DEBUG("Do NAPTR look-up for %s", name.c_str());
+
+    if (trail != 0)
+    {
+      SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_LOOKUP, 0);
+      event.add_var_param(name);
+      SAS::report_event(event);
+    }
+
+    NAPTRReplacement* naptr = _naptr_cache->get(name, ttl, trail);
+
+    if (naptr != NULL)
+    {
+      // NAPTR resolved to a supported service
+      TRC_DEBUG("NAPTR resolved to transport %d", naptr->transport);
+      transport = naptr->transport;
+      if (strcasecmp(naptr->flags.c_str(), "S") == 0)
+      {
+        // Do an SRV lookup with the replacement domain from the NAPTR lookup.
+        srv_name = naptr->replacement;
+
+        if (trail != 0)
+        {
+          SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_SUCCESS_SRV, 0);
+          event.add_var_param(name);
+          event.add_var_param(srv_name);
+          std::string transport_str = get_transport_str(naptr->transport);
+          event.add_var_param(transport_str);
+          SAS::report_event(event);
+        }
+      }
+      else
+      {
+        // Move straight to A/AAAA lookup of the domain returned by NAPTR.
+        a_name = naptr->replacement;
+
+        if (trail != 0)
+        {
+          SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_SUCCESS_A, 0);
+          event.add_var_param(name);
+          event.add_var_param(a_name);
+          SAS::report_event(event);
+        }
+      }
+    }
+    else
+    {
+      // NAPTR resolution failed, so do SRV lookups for both UDP and TCP to
+      // see which transports are supported.
+      TRC_DEBUG("NAPTR lookup failed, so do SRV lookups for UDP and TCP");
+
+      if (trail != 0)
+      {
+        SAS::Event event(trail, SASEvent::SIPRESOLVE_NAPTR_FAILURE, 0);
+        event.add_var_param(name);
+        SAS::report_event(event);
+      }
+
+      std::vector<std::string> domains;
+      domains.push_back("_sip._udp." + name);
+      domains.push_back("_sip._tcp." + name);
+      std::vector<DnsResult> results;
+      _dns_client->dns_query(domains, ns_t_srv, results, trail);
+      DnsResult& udp_result = results[0];
+      TRC_DEBUG("UDP SRV record %s returned %d records",
+                udp_result.domain().c_str(), udp_result.records().size());
+      DnsResult& tcp_result = results[1];
+      TRC_DEBUG("TCP SRV record %s returned %d records",
+                tcp_result.domain().c_str(), tcp_result.records().size());
+      ttl = std::min(udp_result.ttl(), tcp_result.ttl());
+
+      if (!udp_result.records().empty())
+      {
+        // UDP SRV lookup returned some records, so use UDP transport.
+        TRC_DEBUG("UDP SRV lookup successful, select UDP transport");
+        transport = IPPROTO_UDP;
+        srv_name = udp_result.domain();
+      }
+      else if (!tcp_result.records().empty())
+      {
+        // TCP SRV lookup returned some records, so use TCP transport.
+        TRC_DEBUG("TCP SRV lookup successful, select TCP transport");
+        transport = IPPROTO_TCP;
+        srv_name = tcp_result.domain();
+      }
+      else
+      {
+        // Neither UDP nor TCP SRV lookup returned any results, so default to
+        // UDP transport and move straight to A/AAAA record lookups.
+        TRC_DEBUG("UDP and TCP SRV queries unsuccessful, default to UDP");
+        transport = IPPROTO_UDP;
+      }
+    }
+
+    _naptr_cache->dec_ref(name);
+  }
+  else if (transport == IPPROTO_UDP)
+  {
+    // Use specified transport and try an SRV lookup.
+    if (trail != 0)
+    {
+      SAS::Event event(trail, SASEvent::SIPRESOLVE_TRANSPORT_SRV_LOOKUP, 0);
+      event.add_var_param(name);
+      std::string transport_str = get_transport_str(transport);
+      event.add_var_param(transport_str);
+      SAS::report_event(event);
+    }
+
+    DnsResult result = _dns_client->dns_query("_sip._udp." + name, ns_t_srv, trail);
+    ttl = result.ttl();
+
+    if (!result.records().empty())
+    {
+      srv_name = result.domain();
+    }
+  }
+  else if (transport == IPPROTO_TCP)
+  {
+    // Use specified transport and try an SRV lookup.
+    if (trail != 0)
+    {
+      SAS::Event event(trail, SASEvent::SIPRESOLVE_TRANSPORT_SRV_LOOKUP, 0);
+      event.add_var_param(name);
+      std::string transport_str = get_transport_str(transport);
+      event.add_var_param(transport_str);
+      SAS::report_event(event);
+    }
+
+    DnsResult result = _dns_client->dns_query("_sip._tcp." + name, ns_t_srv, trail);
+    ttl = result.ttl();
+
+    if (!result.records().empty())
+    {
+      srv_name = result.domain();
+    }
+  }
+  return ttl;
+}
+
 std::string SIPResolver::get_transport_str(int transport)
 {
   if (transport == IPPROTO_UDP)
@@ -346,3 +446,10 @@ std::string SIPResolver::get_transport_str(int transport)
     return "UNKNOWN";
   }
 }
+
+unsigned long SIPResolver::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
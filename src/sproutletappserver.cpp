@@ -17,21 +17,33 @@
 SproutletAppServerTsxHelper::SproutletAppServerTsxHelper(SproutletTsxHelper* helper) :
   _helper(helper),
   _pool(NULL),
+  _own_pool(false),
   _record_routed(false),
   _rr_param_value("")
 {
-  // Create a small pool to hold the onward Route for the request.
-  _pool = pj_pool_create(&stack_data.cp.factory,
-                         "app-route",
-                         1000,
-                         1000,
-                         NULL);
+  // Hold the onward Route for the request in the transaction's pool if there
+  // is one, and otherwise create a small pool for it.
+  _pool = helper->get_tsx_pool();
+
+  if (_pool == NULL)
+  {
+    _pool = pj_pool_create(&stack_data.cp.factory,
+                           "app-route",
+                           1000,
+                           1000,
+                           NULL);
+    _own_pool = true;
+  }
+
   pj_list_init(&_route_set);
 }
 
 SproutletAppServerTsxHelper::~SproutletAppServerTsxHelper()
 {
-  pj_pool_release(_pool);
+  if (_own_pool)
+  {
+    pj_pool_release(_pool);
+  }
 }
 
 /// Stores the onward route for this transaction ready to apply to requests
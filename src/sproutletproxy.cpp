@@ -24,6 +24,7 @@ extern "C" {
 #include "sproutsasevent.h"
 #include "sproutletproxy.h"
 #include "snmp_sip_request_types.h"
+#include "thread_dispatcher.h"
 
 const pj_str_t SproutletProxy::STR_SERVICE = {"service", 7};
 
@@ -36,7 +37,10 @@ SproutletProxy::SproutletProxy(pjsip_endpoint* endpt,
                                const std::unordered_set<std::string>& host_aliases,
                                const std::list<Sproutlet*>& sproutlets,
                                const std::set<std::string>& stateless_proxies,
-                               int max_sproutlet_depth) :
+                               int max_sproutlet_depth,
+                               int num_background_threads,
+                               SNMP::EventAccumulatorTable* clones_tbl,
+                               LatencyBreakdown* latency_breakdown) :
   BasicProxy(endpt,
              "mod-sproutlet-controller",
              priority,
@@ -45,7 +49,12 @@ SproutletProxy::SproutletProxy(pjsip_endpoint* endpt,
   _root_uri(NULL),
   _host_aliases(host_aliases),
   _sproutlets(sproutlets),
-  _max_sproutlet_depth(max_sproutlet_depth)
+  _max_sproutlet_depth(max_sproutlet_depth),
+  _background_q(1),
+  _background_threads(),
+  _clones_tbl(clones_tbl),
+  _latency_breakdown(latency_breakdown),
+  _sproutlet_latency_stats()
 {
   /// Store the URI of this SproutletProxy - this is used for Record-Routing.
   TRC_DEBUG("Root Record-Route URI = %s", root_uri.c_str());
@@ -53,6 +62,20 @@ SproutletProxy::SproutletProxy(pjsip_endpoint* endpt,
                                                        stack_data.pool,
                                                        false);
 
+  // Build the index of local hostnames.
+  if (_root_uri != NULL)
+  {
+    _local_host_index.insert(_root_uri->host);
+  }
+
+  for (std::unordered_set<std::string>::const_iterator it = _host_aliases.begin();
+       it != _host_aliases.end();
+       ++it)
+  {
+    pj_str_t alias = {(char*)it->data(), (pj_ssize_t)it->length()};
+    _local_host_index.insert(alias);
+  }
+
   for (std::list<Sproutlet*>::iterator it = _sproutlets.begin();
        it != _sproutlets.end();
        ++it)
@@ -67,6 +90,26 @@ SproutletProxy::SproutletProxy(pjsip_endpoint* endpt,
     }
 
     register_sproutlet(*it);
+
+    if (_latency_breakdown != NULL)
+    {
+      _sproutlet_latency_stats[*it] =
+                    _latency_breakdown->sproutlet_stats((*it)->service_name());
+    }
+  }
+
+  // Start the threads that Sproutlets can use for blocking work.
+  for (int ii = 0; ii < num_background_threads; ++ii)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &SproutletProxy::background_thread, this) == 0)
+    {
+      _background_threads.push_back(thread);
+    }
+    else
+    {
+      TRC_ERROR("Failed to create Sproutlet background thread"); // LCOV_EXCL_LINE
+    }
   }
 }
 
@@ -74,6 +117,58 @@ SproutletProxy::SproutletProxy(pjsip_endpoint* endpt,
 /// Destructor.
 SproutletProxy::~SproutletProxy()
 {
+  // Stop the background threads.  Any work that hasn't started is abandoned.
+  _background_q.terminate();
+  for (std::vector<pthread_t>::iterator it = _background_threads.begin();
+       it != _background_threads.end();
+       ++it)
+  {
+    pthread_join(*it, NULL);
+  }
+  _background_threads.clear();
+}
+
+
+/// Callback used to report the completion of background work to a
+/// Sproutlet.  This runs on a worker thread, and processes the completion
+/// exactly like a timer pop.
+class SproutletProxy::BackgroundWorkCallback : public PJUtils::Callback
+{
+public:
+  BackgroundWorkCallback(pj_timer_entry* tentry) : _tentry(tentry) {}
+
+  void run()
+  {
+    SproutletProxy::UASTsx::on_timer_pop(NULL, _tentry);
+  }
+
+private:
+  pj_timer_entry* _tentry;
+};
+
+
+bool SproutletProxy::run_in_background(std::function<void()> work)
+{
+  if (_background_threads.empty())
+  {
+    return false;
+  }
+
+  return _background_q.push(work, 0);
+}
+
+
+void* SproutletProxy::background_thread(void* p)
+{
+  SproutletProxy* proxy = (SproutletProxy*)p;
+  std::function<void()> work;
+
+  while (proxy->_background_q.pop(work, -1))
+  {
+    work();
+  }
+
+  return NULL;
 }
 
 
@@ -104,7 +199,7 @@ bool SproutletProxy::register_sproutlet(Sproutlet* sproutlet)
   }
   else
   {
-    _services.insert(std::make_pair(sproutlet->service_name(), sproutlet));
+    index_service(service_name, sproutlet);
   }
 
   std::list<std::string> aliases = sproutlet->aliases();
@@ -126,7 +221,7 @@ bool SproutletProxy::register_sproutlet(Sproutlet* sproutlet)
     }
     else
     {
-      _services.insert(std::make_pair(*j, sproutlet));
+      index_service(*j, sproutlet);
     }
   }
 
@@ -156,6 +251,15 @@ bool SproutletProxy::register_sproutlet(Sproutlet* sproutlet)
 }
 
 
+void SproutletProxy::index_service(const std::string& name, Sproutlet* sproutlet)
+{
+  std::map<std::string, Sproutlet*>::const_iterator it =
+                        _services.insert(std::make_pair(name, sproutlet)).first;
+  pj_str_t key = {(char*)it->first.data(), (pj_ssize_t)it->first.length()};
+  _service_index[key] = sproutlet;
+}
+
+
 /// Utility method to find the appropriate Sproutlet to handle a request.
 Sproutlet* SproutletProxy::target_sproutlet(pjsip_msg* req,
                                             int port,
@@ -288,8 +392,7 @@ Sproutlet* SproutletProxy::match_sproutlet_from_uri(const pjsip_uri* uri,
   // Now we know we have a SIP URI, cast to one.
   pjsip_sip_uri* sip_uri = (pjsip_sip_uri*)uri;
 
-  std::string service_name;
-  std::map<std::string, Sproutlet*>::const_iterator it;
+  ServiceIndex::const_iterator it;
 
   // First check if there is a services parameter, and if it matches a
   // sproutlet.
@@ -304,12 +407,11 @@ Sproutlet* SproutletProxy::match_sproutlet_from_uri(const pjsip_uri* uri,
     if (is_host_local(&sip_uri->host))
     {
       // Check if this service matches a sproutlet.
-      service_name = PJUtils::pj_str_to_string(&services_param->value);
-      it = _services.find(service_name);
-      if (it != _services.end())
+      it = _service_index.find(services_param->value);
+      if (it != _service_index.end())
       {
         sproutlet = it->second;
-        alias = service_name;
+        alias = PJUtils::pj_str_to_string(&services_param->value);
         local_hostname = PJUtils::pj_str_to_string(&sip_uri->host);
         selection_type = SERVICE_NAME;
       }
@@ -330,14 +432,15 @@ Sproutlet* SproutletProxy::match_sproutlet_from_uri(const pjsip_uri* uri,
     if (sep != NULL)
     {
       // Extract the possible service name
-      service_name = std::string(hostname.ptr, sep - hostname.ptr);
+      pj_str_t service_name = {hostname.ptr, sep - hostname.ptr};
 
       // Remove the service name part and the period from the hostname.
       hostname.slen -= (sep - hostname.ptr + 1);
       hostname.ptr = sep + 1;
 
-      TRC_DEBUG("Possible service name %s will be used if %.*s is a local hostname",
-                service_name.c_str(),
+      TRC_DEBUG("Possible service name %.*s will be used if %.*s is a local hostname",
+                service_name.slen,
+                service_name.ptr,
                 hostname.slen,
                 hostname.ptr);
 
@@ -345,11 +448,11 @@ Sproutlet* SproutletProxy::match_sproutlet_from_uri(const pjsip_uri* uri,
       {
         // Check if the part of the hostname before the first '.' matches
         // a sproutlet.
-        it = _services.find(service_name);
-        if (it != _services.end())
+        it = _service_index.find(service_name);
+        if (it != _service_index.end())
         {
           sproutlet = it->second;
-          alias = service_name;
+          alias = PJUtils::pj_str_to_string(&service_name);
           local_hostname = PJUtils::pj_str_to_string(&hostname);
           selection_type = DOMAIN_PART;
         }
@@ -367,12 +470,11 @@ Sproutlet* SproutletProxy::match_sproutlet_from_uri(const pjsip_uri* uri,
     if (is_host_local(&sip_uri->host))
     {
       // Check if the user part matches a sproutlet.
-      service_name = PJUtils::pj_str_to_string(&sip_uri->user);
-      it = _services.find(service_name);
-      if (it != _services.end())
+      it = _service_index.find(sip_uri->user);
+      if (it != _service_index.end())
       {
         sproutlet = it->second;
-        alias = service_name;
+        alias = PJUtils::pj_str_to_string(&sip_uri->user);
         local_hostname = PJUtils::pj_str_to_string(&sip_uri->host);
         selection_type = USER_PART;
       }
@@ -521,24 +623,7 @@ std::string SproutletProxy::get_local_hostname(const pjsip_sip_uri* uri) const
 
 bool SproutletProxy::is_host_local(const pj_str_t* host) const
 {
-  bool rc = false;
-
-  if (!pj_stricmp(host, &_root_uri->host))
-  {
-    rc = true;
-  }
-
-  for (std::unordered_set<std::string>::const_iterator it = _host_aliases.begin();
-       (rc != true) && (it != _host_aliases.end());
-       ++it)
-  {
-    if (!pj_stricmp2(host, it->c_str()))
-    {
-      rc = true;
-    }
-  }
-
-  return rc;
+  return (_local_host_index.find(*host) != _local_host_index.end());
 }
 
 bool SproutletProxy::is_uri_reflexive(const pjsip_uri* uri,
@@ -595,14 +680,16 @@ bool SproutletProxy::timer_running(pj_timer_entry* tentry)
 
 SproutletProxy::UASTsx::UASTsx(SproutletProxy* proxy) :
   BasicProxy::UASTsx(proxy),
+  _pool(&stack_data.cp.factory, "sproutlet-tsx", 4000, 4000),
   _root(NULL),
-  _dmap_sproutlet(),
-  _dmap_uac(),
-  _umap(),
-  _pending_req_q(),
+  _dmap_sproutlet(_pool.get()),
+  _dmap_uac(_pool.get()),
+  _umap(_pool.get()),
+  _pending_req_q(PoolAllocator<PendingRequest>(_pool.get())),
   _sproutlet_proxy(proxy),
-  _timers(),
-  _pending_timers()
+  _timers(std::less<pj_timer_entry*>(), PoolAllocator<pj_timer_entry*>(_pool.get())),
+  _pending_timers(std::less<pj_timer_entry*>(), PoolAllocator<pj_timer_entry*>(_pool.get())),
+  _num_clones(0)
 {
   TRC_VERBOSE("Sproutlet Proxy transaction (%p) created", this);
 }
@@ -610,15 +697,15 @@ SproutletProxy::UASTsx::UASTsx(SproutletProxy* proxy) :
 
 SproutletProxy::UASTsx::~UASTsx()
 {
-  for (std::set<pj_timer_entry*>::const_iterator timer = _timers.begin();
-       timer != _timers.end();
-       ++timer)
+  // The timers themselves are freed along with the pool.
+  _timers.clear();
+
+  TRC_DEBUG("Sproutlets cloned %d messages on transaction (%p)",
+            _num_clones, this);
+  if (_sproutlet_proxy->_clones_tbl != NULL)
   {
-    SproutletTimerCallbackData* tdata = (SproutletTimerCallbackData*)(*timer)->user_data;
-    delete tdata;
-    delete *timer;
+    _sproutlet_proxy->_clones_tbl->accumulate(_num_clones);
   }
-  _timers.clear();
 
   if (_trail != 0)
   {
@@ -678,16 +765,16 @@ pj_status_t SproutletProxy::UASTsx::init(pjsip_rx_data* rdata)
 
     if (status == PJ_SUCCESS)
     {
-      _root = new SproutletWrapper(_sproutlet_proxy,
-                                   this,
-                                   sproutlet,
-                                   sproutlet_tsx,
-                                   alias,
-                                   _req,
-                                   _original_transport,
-                                   "EXTERNAL",
-                                   _sproutlet_proxy->_max_sproutlet_depth,
-                                   trail());
+      _root = new (_pool.get()) SproutletWrapper(_sproutlet_proxy,
+                                                 this,
+                                                 sproutlet,
+                                                 sproutlet_tsx,
+                                                 alias,
+                                                 _req,
+                                                 _original_transport,
+                                                 "EXTERNAL",
+                                                 _sproutlet_proxy->_max_sproutlet_depth,
+                                                 trail());
     }
   }
 
@@ -698,6 +785,8 @@ pj_status_t SproutletProxy::UASTsx::init(pjsip_rx_data* rdata)
 /// Handle the incoming half of a transaction request.
 void SproutletProxy::UASTsx::process_tsx_request(pjsip_rx_data* rdata)
 {
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
+
   // Pass the request to the Sproutlet at the root of the tree.
   pjsip_tx_data_add_ref(_req);
   _root->rx_request(_req);
@@ -710,6 +799,8 @@ void SproutletProxy::UASTsx::process_tsx_request(pjsip_rx_data* rdata)
 /// Handle a received CANCEL request.
 void SproutletProxy::UASTsx::process_cancel_request(pjsip_rx_data* rdata)
 {
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
+
   // We may receive a CANCEL after sending a final response, so check that
   // the root Sproutlet is still connected.
   if (_root != NULL)
@@ -731,6 +822,7 @@ void SproutletProxy::UASTsx::process_cancel_request(pjsip_rx_data* rdata)
 void SproutletProxy::UASTsx::on_new_client_response(UACTsx* uac_tsx,
                                                     pjsip_tx_data *rsp)
 {
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
   enter_context();
 
   if (rsp->msg->line.status.code >= PJSIP_SC_OK)
@@ -776,6 +868,7 @@ void SproutletProxy::UASTsx::on_new_client_response(UACTsx* uac_tsx,
 void SproutletProxy::UASTsx::on_client_not_responding(UACTsx* uac_tsx,
                                                       ForkErrorState fork_error)
 {
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
   enter_context();
 
   // This is equivalent to a final response, so dissociate the UAC transaction.
@@ -815,6 +908,9 @@ void SproutletProxy::UASTsx::on_client_not_responding(UACTsx* uac_tsx,
 /// destroy the UASTsx.
 void SproutletProxy::UASTsx::on_tsx_state(pjsip_event* event)
 {
+  // The timer doesn't refer back to this UASTsx, so it is safe to use even
+  // if the UASTsx is destroyed.
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
   enter_context();
 
   if (_tsx->state == PJSIP_TSX_STATE_TERMINATED)
@@ -927,16 +1023,16 @@ void SproutletProxy::UASTsx::schedule_requests()
         // Found a local Sproutlet and SproutletTsx to handle the request, so
         // create a SproutletWrapper. Since the Tsx is non-NULL, there is
         // guaranteed to be a sproutlet to handle the request.
-        SproutletWrapper* downstream = new SproutletWrapper(_sproutlet_proxy,
-                                                            this,
-                                                            sproutlet_tsx->_sproutlet,
-                                                            sproutlet_tsx,
-                                                            alias,
-                                                            req.req,
-                                                            _original_transport,
-                                                            req.upstream_network_func,
-                                                            req.sproutlet_depth,
-                                                            trail());
+        SproutletWrapper* downstream = new (_pool.get()) SproutletWrapper(_sproutlet_proxy,
+                                                                          this,
+                                                                          sproutlet_tsx->_sproutlet,
+                                                                          sproutlet_tsx,
+                                                                          alias,
+                                                                          req.req,
+                                                                          _original_transport,
+                                                                          req.upstream_network_func,
+                                                                          req.sproutlet_depth,
+                                                                          trail());
 
         // Set up the mappings.
         if (req.req->msg->line.req.method.id != PJSIP_ACK_METHOD)
@@ -1003,12 +1099,13 @@ bool SproutletProxy::UASTsx::schedule_timer(SproutletWrapper* tsx,
                                             TimerID& id,
                                             int duration)
 {
-  SproutletTimerCallbackData* tdata = new SproutletTimerCallbackData;
+  SproutletTimerCallbackData* tdata =
+                         PJ_POOL_ZALLOC_T(_pool.get(), SproutletTimerCallbackData);
   tdata->uas_tsx = this;
   tdata->sproutlet_wrapper = tsx;
   tdata->context = context;
 
-  pj_timer_entry* tentry = new pj_timer_entry();
+  pj_timer_entry* tentry = PJ_POOL_ZALLOC_T(_pool.get(), pj_timer_entry);
   pj_timer_entry_init(tentry, 0, tdata, &SproutletProxy::UASTsx::on_timer_pop);
 
   _timers.insert(tentry);
@@ -1023,6 +1120,42 @@ bool SproutletProxy::UASTsx::schedule_timer(SproutletWrapper* tsx,
   return scheduled;
 }
 
+bool SproutletProxy::UASTsx::run_in_background(SproutletWrapper* tsx,
+                                               void* context,
+                                               TimerID& id,
+                                               std::function<void()> work)
+{
+  // The work is tracked as a timer that hasn't popped yet, which keeps this
+  // UASTsx (and the Sproutlet) alive until the work has completed.
+  SproutletTimerCallbackData* tdata =
+                         PJ_POOL_ZALLOC_T(_pool.get(), SproutletTimerCallbackData);
+  tdata->uas_tsx = this;
+  tdata->sproutlet_wrapper = tsx;
+  tdata->context = context;
+
+  pj_timer_entry* tentry = PJ_POOL_ZALLOC_T(_pool.get(), pj_timer_entry);
+  pj_timer_entry_init(tentry, 0, tdata, &SproutletProxy::UASTsx::on_timer_pop);
+
+  _timers.insert(tentry);
+  _pending_timers.insert(tentry);
+
+  id = (TimerID)tentry;
+
+  bool queued = _sproutlet_proxy->run_in_background([work, tentry]() {
+    work();
+    add_callback_to_queue(new BackgroundWorkCallback(tentry));
+  });
+  if (!queued)
+  {
+    _pending_timers.erase(tentry);
+  }
+  else
+  {
+    TRC_DEBUG("Queued Sproutlet background work, id = %ld", id);
+  }
+  return queued;
+}
+
 bool SproutletProxy::UASTsx::cancel_timer(TimerID id)
 {
   pj_timer_entry* tentry = (pj_timer_entry*)id;
@@ -1052,6 +1185,7 @@ void SproutletProxy::UASTsx::on_timer_pop(pj_timer_heap_t* th,
 
 void SproutletProxy::UASTsx::process_timer_pop(pj_timer_entry* tentry)
 {
+  LatencyBreakdown::ProxyTimer timer(_sproutlet_proxy->_latency_breakdown);
   enter_context();
 
   _pending_timers.erase(tentry);
@@ -1259,10 +1393,13 @@ SproutletWrapper::SproutletWrapper(SproutletProxy* proxy,
   _proxy_tsx(proxy_tsx),
   _sproutlet(sproutlet),
   _sproutlet_tsx(sproutlet_tsx),
+  _latency_stats(NULL),
   _service_name(""),
   _id(""),
   _req(req),
   _req_type(),
+  _req_adopted(false),
+  _adopted_route_hdr(NULL),
   _original_transport(original_transport),
   _this_network_func(""),
   _upstream_network_func(upstream_network_func),
@@ -1290,6 +1427,13 @@ SproutletWrapper::SproutletWrapper(SproutletProxy* proxy,
   {
     // Set the service name from the sproutlet
     _service_name = sproutlet->service_name();
+
+    std::unordered_map<const Sproutlet*, LatencyBreakdown::SproutletStats*>::const_iterator it =
+                                     _proxy->_sproutlet_latency_stats.find(sproutlet);
+    if (it != _proxy->_sproutlet_latency_stats.end())
+    {
+      _latency_stats = it->second;
+    }
   }
   else
   {
@@ -1386,6 +1530,8 @@ pjsip_msg* SproutletWrapper::original_request()
     //LCOV_EXCL_STOP
   }
 
+  ++_proxy_tsx->_num_clones;
+
   // Remove the top Route header from the request if it refers to this node or
   // this Sproutlet.  The Sproutlet can inspect the route_hdr API if required
   // using the route_hdr() API, but cannot manipulate it.
@@ -1403,6 +1549,33 @@ pjsip_msg* SproutletWrapper::original_request()
   return clone->msg;
 }
 
+/// Passes the original request itself to the Sproutlet, rather than a clone
+/// of it.  This is only safe if nothing else holds a reference to the
+/// request.
+pjsip_msg* SproutletWrapper::adopt_request()
+{
+  // Remove the top Route header as original_request() does, but keep hold of
+  // it for route_hdr().  It is allocated from the request's pool, so remains
+  // valid while we hold the request.
+  pjsip_route_hdr* hr = (pjsip_route_hdr*)
+                            pjsip_msg_find_hdr(_req->msg, PJSIP_H_ROUTE, NULL);
+  if ((hr != NULL) &&
+      (is_uri_local(hr->name_addr.uri)))
+  {
+    TRC_DEBUG("Remove top Route header %s", PJUtils::hdr_to_string(hr).c_str());
+    pj_list_erase(hr);
+    _adopted_route_hdr = hr;
+  }
+
+  _req_adopted = true;
+
+  // The Sproutlet now owns the request as well as us.
+  pjsip_tx_data_add_ref(_req);
+  register_tdata(_req);
+
+  return _req->msg;
+}
+
 // Sets the transport on this request to be the same as on the original.
 void SproutletWrapper::copy_original_transport(pjsip_msg* req)
 {
@@ -1448,7 +1621,11 @@ const char* SproutletWrapper::msg_info(pjsip_msg* msg)
 /// Returns the top Route header from the original request.
 const pjsip_route_hdr* SproutletWrapper::route_hdr() const
 {
-  if (_req != NULL)
+  if (_req_adopted)
+  {
+    return _adopted_route_hdr;
+  }
+  else if (_req != NULL)
   {
     pjsip_route_hdr* hr = (pjsip_route_hdr*)
                             pjsip_msg_find_hdr(_req->msg, PJSIP_H_ROUTE, NULL);
@@ -1498,6 +1675,11 @@ pjsip_msg* SproutletWrapper::create_request()
   return new_tdata->msg;
 }
 
+pj_pool_t* SproutletWrapper::get_tsx_pool()
+{
+  return _proxy_tsx->_pool.get();
+}
+
 pjsip_msg* SproutletWrapper::clone_request(pjsip_msg* req)
 {
   return clone_msg(req);
@@ -1524,6 +1706,7 @@ pjsip_msg* SproutletWrapper::clone_msg(pjsip_msg* msg)
     //LCOV_EXCL_STOP
   }
 
+  ++_proxy_tsx->_num_clones;
   register_tdata(new_tdata);
 
   return new_tdata->msg;
@@ -1740,6 +1923,18 @@ bool SproutletWrapper::schedule_timer(void* context, TimerID& id, int duration)
   return scheduled;
 }
 
+bool SproutletWrapper::run_in_background(void* context,
+                                         std::function<void()> work)
+{
+  TimerID id;
+  bool queued = _proxy_tsx->run_in_background(this, context, id, work);
+  if (queued)
+  {
+    _pending_timers.insert(id);
+  }
+  return queued;
+}
+
 void SproutletWrapper::cancel_timer(TimerID id)
 {
   if (_proxy_tsx->cancel_timer(id))
@@ -1829,8 +2024,21 @@ void SproutletWrapper::rx_request(pjsip_tx_data* req)
     }
   }
 
-  // Clone the request to get a mutable copy to pass to the Sproutlet.
-  pjsip_msg* clone = original_request();
+  pjsip_msg* clone;
+
+  if ((req->msg->line.req.method.id == PJSIP_ACK_METHOD) &&
+      (pj_atomic_get(req->ref_cnt) == 1))
+  {
+    // Nothing upstream keeps hold of an ACK once it has been forwarded, so
+    // if we hold the only reference we can pass the request straight to the
+    // Sproutlet without cloning it.
+    clone = adopt_request();
+  }
+  else
+  {
+    // Clone the request to get a mutable copy to pass to the Sproutlet.
+    clone = original_request();
+  }
   if (clone == NULL)
   {
     // @TODO
@@ -1840,12 +2048,14 @@ void SproutletWrapper::rx_request(pjsip_tx_data* req)
   {
     TRC_VERBOSE("%s pass initial request %s to Sproutlet",
                 _id.c_str(), msg_info(clone));
+    LatencyBreakdown::SproutletTimer timer(request_latency_histogram());
     _sproutlet_tsx->on_rx_initial_request(clone);
   }
   else
   {
     TRC_VERBOSE("%s pass in dialog request %s to Sproutlet",
                 _id.c_str(), msg_info(clone));
+    LatencyBreakdown::SproutletTimer timer(request_latency_histogram());
     _sproutlet_tsx->on_rx_in_dialog_request(clone);
   }
 
@@ -1910,7 +2120,11 @@ void SproutletWrapper::rx_response(pjsip_tx_data* rsp, int fork_id)
       }
     }
   }
-  _sproutlet_tsx->on_rx_response(rsp->msg, fork_id);
+
+  {
+    LatencyBreakdown::SproutletTimer timer(response_latency_histogram());
+    _sproutlet_tsx->on_rx_response(rsp->msg, fork_id);
+  }
 
   process_actions(false);
 }
@@ -1978,7 +2192,10 @@ void SproutletWrapper::rx_fork_error(ForkErrorState fork_error, int fork_id)
 
       // Pass the response to the application.
       register_tdata(rsp);
-      _sproutlet_tsx->on_rx_response(rsp->msg, fork_id);
+      {
+        LatencyBreakdown::SproutletTimer timer(response_latency_histogram());
+        _sproutlet_tsx->on_rx_response(rsp->msg, fork_id);
+      }
       process_actions(false);
     }
   }
@@ -1988,7 +2205,10 @@ void SproutletWrapper::on_timer_pop(TimerID id, void* context)
 {
   TRC_DEBUG("Timer has popped");
   _pending_timers.erase(id);
-  _sproutlet_tsx->on_timer_expiry(context);
+  {
+    LatencyBreakdown::SproutletTimer timer(request_latency_histogram());
+    _sproutlet_tsx->on_timer_expiry(context);
+  }
   process_actions(false);
 }
 
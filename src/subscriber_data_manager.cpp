@@ -34,6 +34,7 @@
 #include "chronosconnection.h"
 #include "sproutsasevent.h"
 #include "constants.h"
+#include "latency_breakdown.h"
 
 
 /// Helper to delete vectors of bindings safely
@@ -51,11 +52,31 @@ void delete_bindings(ClassifiedBindings& cbs)
 SubscriberDataManager::SubscriberDataManager(AoRStore* aor_store,
                                              ChronosConnection* chronos_connection,
                                              AnalyticsLogger* analytics_logger,
-                                             bool is_primary) :
+                                             bool is_primary,
+                                             int chronos_timer_threads) :
+  _chronos_timer_batcher(NULL),
   _primary_sdm(is_primary)
 {
   _aor_store = aor_store;
-  _chronos_timer_request_sender = new ChronosTimerRequestSender(chronos_connection);
+
+  // Only the primary SDM sets timers, so there's no need for the others to
+  // batch them.
+  if ((is_primary) &&
+      (chronos_connection != NULL) &&
+      (chronos_timer_threads > 0))
+  {
+    _chronos_timer_batcher = new ChronosTimerBatcher(chronos_connection,
+                                                     chronos_timer_threads);
+    _chronos_timer_batcher->set_timer_id_callback(
+      std::bind(&SubscriberDataManager::update_timer_id,
+                this,
+                std::placeholders::_1,
+                std::placeholders::_2,
+                std::placeholders::_3));
+  }
+
+  _chronos_timer_request_sender = new ChronosTimerRequestSender(chronos_connection,
+                                                                _chronos_timer_batcher);
   _notify_sender = new NotifySender();
   _analytics = analytics_logger;
 }
@@ -63,6 +84,8 @@ SubscriberDataManager::SubscriberDataManager(AoRStore* aor_store,
 
 SubscriberDataManager::~SubscriberDataManager()
 {
+  // Stop the timer threads first, as they call back into this object.
+  delete _chronos_timer_batcher;
   delete _notify_sender;
   delete _chronos_timer_request_sender;
 }
@@ -78,8 +101,9 @@ AoRPair* SubscriberDataManager::get_aor_data(const std::string& aor_id,
   if (aor_data != NULL)
   {
     // We got some data from the store. Copy the AoR, expire the copy,
-    // and return both AoRs as an AoR pair.
-    AoR* aor_copy = new AoR(*aor_data);
+    // and return both AoRs as an AoR pair.  The copy is copy-on-write, so
+    // only the bindings and subscriptions that are modified get copied.
+    AoR* aor_copy = aor_data->copy_on_write();
     int now = time(NULL);
     AoRPair* aor_pair = new AoRPair(aor_data, aor_copy);
     expire_aor_members(aor_pair, now, trail);
@@ -159,6 +183,7 @@ Store::Status SubscriberDataManager::set_aor_data(
             aor_id.c_str(), aor_pair->get_current()->_cas, max_expires);
 
   ClassifiedBindings classified_bindings;
+  NotifySender::PendingNotifys notifys;
 
   if (_primary_sdm)
   {
@@ -175,9 +200,13 @@ Store::Status SubscriberDataManager::set_aor_data(
     {
       _chronos_timer_request_sender->send_timers(aor_id, aor_pair, now, trail);
     }
+
+    // 4. Work out which NOTIFYs to send.  This updates the reginfo versions
+    // of the subscriptions, so must be done before writing the AoR.
+    _notify_sender->prepare_notifys(aor_pair, notifys);
   }
 
-  // 4. Write the data to memcached. If this fails, bail out here
+  // 5. Write the data to memcached. If this fails, bail out here
 
   // Update the Notify CSeq, and write to store. We always update the cseq
   // as it's safe to increment it unnecessarily, and if we wait to find out
@@ -199,14 +228,14 @@ Store::Status SubscriberDataManager::set_aor_data(
 
   if (_primary_sdm)
   {
-    // 5. Log new / extended bindings
+    // 6. Log new / extended bindings
     if (_analytics != NULL)
     {
       log_new_or_extended_bindings(classified_bindings, now);
     }
 
-    // 6. Send any NOTIFYs
-    _notify_sender->send_notifys(aor_id, aor_pair, now, trail);
+    // 7. Send any NOTIFYs
+    _notify_sender->send_notifys(aor_id, aor_pair, notifys, now, trail);
   }
 
   delete_bindings(classified_bindings);
@@ -318,6 +347,85 @@ void SubscriberDataManager::log_new_or_extended_bindings(ClassifiedBindings& cla
   }
 }
 
+void SubscriberDataManager::update_timer_id(const std::string& aor_id,
+                                            const std::string& timer_id,
+                                            SAS::TrailId trail)
+{
+  if (!store_timer_id(aor_id, timer_id, trail))
+  {
+    // The AoR has gone since the timer was set, so the timer isn't needed.
+    TRC_DEBUG("AoR %s has no bindings - delete timer %s",
+              aor_id.c_str(), timer_id.c_str());
+    _chronos_timer_batcher->delete_timer(aor_id, timer_id, trail);
+    return;
+  }
+
+  // The timer ID would have been written to the remote stores along with
+  // the rest of the AoR if it had been known in time, so write it to them
+  // too.  We don't worry about failures in this case.
+  for (SubscriberDataManager* sdm : _remote_sdms)
+  {
+    if (sdm->has_servers())
+    {
+      sdm->store_timer_id(aor_id, timer_id, trail);
+    }
+  }
+}
+
+bool SubscriberDataManager::store_timer_id(const std::string& aor_id,
+                                           const std::string& timer_id,
+                                           SAS::TrailId trail)
+{
+  Store::Status rc;
+
+  do
+  {
+    // Read the AoR straight from the store - we don't want to expire
+    // anything from it.
+    AoR* aor = _aor_store->get_aor_data(aor_id, trail);
+
+    if (aor == NULL)
+    {
+      // LCOV_EXCL_START
+      TRC_DEBUG("Failed to get AoR %s to store timer ID", aor_id.c_str());
+      return true;
+      // LCOV_EXCL_STOP
+    }
+
+    if (aor->get_bindings_count() == 0)
+    {
+      delete aor;
+      return false;
+    }
+
+    if (aor->_timer_id == timer_id)
+    {
+      delete aor;
+      return true;
+    }
+
+    // Keep the AoR in the store for as long as set_aor_data would.
+    int now = time(NULL);
+    int max_expires = now;
+
+    for (AoR::Bindings::const_iterator b = aor->bindings().begin();
+         b != aor->bindings().end();
+         ++b)
+    {
+      max_expires = std::max(max_expires, b->second->_expires);
+    }
+
+    TRC_DEBUG("Store timer ID %s for AoR %s", timer_id.c_str(), aor_id.c_str());
+    aor->_timer_id = timer_id;
+
+    AoRPair aor_pair(aor, aor->copy_on_write());
+    rc = _aor_store->set_aor_data(aor_id, &aor_pair, max_expires + 10 - now, trail);
+  }
+  while (rc == Store::DATA_CONTENTION);
+
+  return true;
+}
+
 int SubscriberDataManager::expire_aor_members(AoRPair* aor_pair,
                                               int now,
                                               SAS::TrailId trail)
@@ -373,8 +481,7 @@ void SubscriberDataManager::expire_subscriptions(AoRPair* aor_pair,
         *s_copy = *i->second;
       }
 
-      delete i->second;
-      aor_pair->get_current()->_subscriptions.erase(i++);
+      i = aor_pair->get_current()->erase_subscription(i);
     }
     else
     {
@@ -415,8 +522,7 @@ int SubscriberDataManager::expire_bindings(AoR* aor_data,
         SAS::report_event(event);
       }
 
-      delete i->second;
-      aor_data->_bindings.erase(i++);
+      i = aor_data->erase_binding(i);
     }
     else
     {
@@ -436,8 +542,10 @@ int SubscriberDataManager::expire_bindings(AoR* aor_data,
 /// ChronosTimerRequestSender Methods
 
 SubscriberDataManager::ChronosTimerRequestSender::
-     ChronosTimerRequestSender(ChronosConnection* chronos_conn) :
-  _chronos_conn(chronos_conn)
+     ChronosTimerRequestSender(ChronosConnection* chronos_conn,
+                               ChronosTimerBatcher* timer_batcher) :
+  _chronos_conn(chronos_conn),
+  _timer_batcher(timer_batcher)
 {
 }
 
@@ -472,8 +580,15 @@ void SubscriberDataManager::ChronosTimerRequestSender::send_timers(
   // We do this before getting next_expires to save on processing.
   if (current_aor->get_bindings_count() == 0)
   {
-    if (timer_id != "")
+    if (_timer_batcher != NULL)
+    {
+      // The batcher may know of a timer that hasn't been stored in the AoR
+      // yet, so always tell it.
+      _timer_batcher->delete_timer(aor_id, timer_id, trail);
+    }
+    else if (timer_id != "")
     {
+      LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
       _chronos_conn->send_delete(timer_id, trail);
     }
   return;
@@ -497,11 +612,20 @@ void SubscriberDataManager::ChronosTimerRequestSender::send_timers(
     // Set the expiry time to be relative to now.
     int expiry = (new_next_expires > now) ? (new_next_expires - now) : (now);
 
-    set_timer(aor_id,
-              timer_id,
-              expiry,
-              new_tags,
-              trail);
+    if (_timer_batcher != NULL)
+    {
+      // The timer is set in the background.  If it's a new timer, its ID is
+      // stored in the AoR once Chronos has allocated it.
+      _timer_batcher->set_timer(aor_id, timer_id, expiry, new_tags, trail);
+    }
+    else
+    {
+      set_timer(aor_id,
+                timer_id,
+                expiry,
+                new_tags,
+                trail);
+    }
   }
 }
 
@@ -521,6 +645,7 @@ void SubscriberDataManager::ChronosTimerRequestSender::set_timer(
   // Otherwise sent a POST.
   if (timer_id == "")
   {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
     status = _chronos_conn->send_post(temp_timer_id,
                                       expiry,
                                       callback_uri,
@@ -531,6 +656,7 @@ void SubscriberDataManager::ChronosTimerRequestSender::set_timer(
   else
   {
     temp_timer_id = timer_id;
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::CHRONOS);
     status = _chronos_conn->send_put(temp_timer_id,
                                      expiry,
                                      callback_uri,
@@ -557,14 +683,17 @@ SubscriberDataManager::NotifySender::~NotifySender()
 {
 }
 
-void SubscriberDataManager::NotifySender::send_notifys(
-                               const std::string& aor_id,
+SubscriberDataManager::NotifySender::PendingNotifys::~PendingNotifys()
+{
+  delete_bindings(bindings);
+}
+
+void SubscriberDataManager::NotifySender::prepare_notifys(
                                AoRPair* aor_pair,
-                               int now,
-                               SAS::TrailId trail)
+                               PendingNotifys& notifys)
 {
   std::vector<std::string> expired_binding_uris;
-  ClassifiedBindings binding_info_to_notify;
+  ClassifiedBindings& binding_info_to_notify = notifys.bindings;
   bool bindings_changed = false;
   bool associated_uris_changed = false;
 
@@ -652,19 +781,53 @@ void SubscriberDataManager::NotifySender::send_notifys(
   associated_uris_changed = (aor_pair->get_current()->_associated_uris !=
                              aor_pair->get_orig()->_associated_uris);
 
-  // Iterate over the subscriptions in the original AoR, and send NOTIFYs for
-  // any subscriptions that aren't in the current AoR.
-  send_notifys_for_expired_subscriptions(aor_id,
-                                         aor_pair,
-                                         binding_info_to_notify,
-                                         expired_binding_uris,
-                                         now,
-                                         trail);
-
-  // Iterate over the subscriptions in the current AoR and send NOTIFYs.
-  // If the bindings have changed, or the Associated URIs has changed,
-  // then send NOTIFYs to all subscribers; otherwise, only send them
-  // when the subscription has been created or updated.
+  // Iterate over the subscriptions in the original AoR, and send final
+  // NOTIFYs for any subscriptions that aren't in the current AoR.
+  //
+  // expired_binding_uris lists bindings which have expired - we no longer have a valid connection to
+  // these endpoints, so shouldn't send a NOTIFY to them (even to say that their subscription is
+  // terminated).
+  //
+  // Note that we can't just check whether a binding exists before sending a NOTIFY - a SUBSCRIBE
+  // may have come from a P-CSCF or AS, which wouldn't match a binding.
+  for (AoR::Subscriptions::const_iterator aor_orig_s =
+         aor_pair->get_orig()->subscriptions().begin();
+       aor_orig_s != aor_pair->get_orig()->subscriptions().end();
+       ++aor_orig_s)
+  {
+    AoR::Subscription* s = aor_orig_s->second;
+    std::string s_id = aor_orig_s->first;
+
+    if (std::find(expired_binding_uris.begin(), expired_binding_uris.end(), s->_req_uri) !=
+      expired_binding_uris.end())
+    {
+      // This NOTIFY would go to a binding which no longer exists - skip it.
+      continue;
+    }
+
+    if (aor_pair->get_current()->subscriptions().find(s_id) ==
+        aor_pair->get_current()->subscriptions().end())
+    {
+      TRC_DEBUG("The subscription (%s) has been terminated", s_id.c_str());
+
+      // The subscription has gone, so there's no need to update its
+      // version.
+      PendingNotify notify = {s_id, true, NotifyUtils::DocState::FULL, s->_notify_version};
+      notifys.notifys.push_back(notify);
+    }
+  }
+
+  // Iterate over the subscriptions in the current AoR.  If the bindings have
+  // changed, or the Associated URIs has changed, then send NOTIFYs to all
+  // subscribers; otherwise, only send them when the subscription has been
+  // created or updated.
+  //
+  // A NOTIFY only needs to report the bindings that have changed, unless the
+  // subscriber doesn't yet have the full state of the AoR (because the
+  // subscription is new or has been refreshed), or the set of registration
+  // elements has changed.
+  std::vector<std::string> notified_s_ids;
+
   for (AoR::Subscriptions::const_iterator current_sub =
         aor_pair->get_current()->subscriptions().begin();
       current_sub != aor_pair->get_current()->subscriptions().end();
@@ -707,130 +870,100 @@ void SubscriberDataManager::NotifySender::send_notifys(
         reasons += "changed_associated_uris ";
       }
 
-      TRC_DEBUG("Sending NOTIFY for subscription %s: reason(s) %s",
+      bool full_state = (sub_created ||
+                         sub_refreshed ||
+                         associated_uris_changed ||
+                         (subscription->_notify_version == 0));
+
+      TRC_DEBUG("Sending %s NOTIFY for subscription %s: reason(s) %s",
+                full_state ? "full" : "partial",
                 s_id.c_str(),
                 reasons.c_str());
 
-      pjsip_tx_data* tdata_notify = NULL;
-      pj_status_t status = NotifyUtils::create_subscription_notify(
-                                            &tdata_notify,
-                                            subscription,
-                                            aor_id,
-                                            &aor_pair->get_current()->_associated_uris,
-                                            aor_pair->get_orig(),
-                                            binding_info_to_notify,
-                                            NotifyUtils::RegistrationState::ACTIVE,
-                                            now,
-                                            trail);
-
-      if (status == PJ_SUCCESS)
-      {
-        set_trail(tdata_notify, trail);
-        status = PJUtils::send_request(tdata_notify, 0, NULL, NULL, true);
-
-        if (status == PJ_SUCCESS)
-        {
-          subscription->_refreshed = false;
-        }
-        else
-        {
-          // LCOV_EXCL_START
-          SAS::Event event(trail, SASEvent::NOTIFICATION_FAILED, 0);
-          std::string error_msg = "Failed to send NOTIFY - error: " +
-                                        PJUtils::pj_status_to_string(status);
-          event.add_var_param(error_msg);
-          SAS::report_event(event);
-          // LCOV_EXCL_STOP
-        }
-      }
+      PendingNotify notify = {s_id,
+                              false,
+                              full_state ? NotifyUtils::DocState::FULL :
+                                           NotifyUtils::DocState::PARTIAL,
+                              subscription->_notify_version};
+      notifys.notifys.push_back(notify);
+      notified_s_ids.push_back(s_id);
     }
   }
 
-  delete_bindings(binding_info_to_notify);
+  // Move on the versions of the subscriptions we're going to NOTIFY.  This
+  // is done through get_subscription so that the original AoR isn't changed.
+  for (const std::string& s_id : notified_s_ids)
+  {
+    aor_pair->get_current()->get_subscription(s_id)->_notify_version++;
+  }
 }
 
-void SubscriberDataManager::NotifySender::send_notifys_for_expired_subscriptions(
+void SubscriberDataManager::NotifySender::send_notifys(
                                const std::string& aor_id,
                                AoRPair* aor_pair,
-                               ClassifiedBindings binding_info_to_notify,
-                               std::vector<std::string> expired_binding_uris,
+                               PendingNotifys& notifys,
                                int now,
                                SAS::TrailId trail)
 {
-  // The registration state to send is ACTIVE if we have at least one active binding,
-  // otherwise TERMINATED.
-  NotifyUtils::RegistrationState reg_state = (!aor_pair->get_current()->bindings().empty()) ?
+  // The registration state to send on the final NOTIFY for a subscription is
+  // ACTIVE if we have at least one active binding, otherwise TERMINATED.
+  NotifyUtils::RegistrationState final_reg_state =
+    (!aor_pair->get_current()->bindings().empty()) ?
     NotifyUtils::RegistrationState::ACTIVE :
     NotifyUtils::RegistrationState::TERMINATED;
 
-  // expired_binding_uris lists bindings which have expired - we no longer have a valid connection to
-  // these endpoints, so shouldn't send a NOTIFY to them (even to say that their subscription is
-  // terminated).
-  //
-  // Note that we can't just check whether a binding exists before sending a NOTIFY - a SUBSCRIBE
-  // may have come from a P-CSCF or AS, which wouldn't match a binding.
+  // Each variant of the reginfo document is only built once, however many
+  // subscriptions it is sent to.
+  NotifyUtils::RegInfoBodyCache bodies(&aor_pair->get_current()->_associated_uris,
+                                       notifys.bindings,
+                                       trail);
 
-  // Iterate over the subscriptions in the original AoR, and send NOTIFYs for
-  // any subscriptions that aren't in the current AoR.
-  for (AoR::Subscriptions::const_iterator aor_orig_s =
-         aor_pair->get_orig()->subscriptions().begin();
-       aor_orig_s != aor_pair->get_orig()->subscriptions().end();
-       ++aor_orig_s)
+  for (const PendingNotify& notify : notifys.notifys)
   {
-    AoR::Subscription* s = aor_orig_s->second;
-    std::string s_id = aor_orig_s->first;
+    AoR::Subscription* subscription;
+    NotifyUtils::RegistrationState reg_state;
 
-    if (std::find(expired_binding_uris.begin(), expired_binding_uris.end(), s->_req_uri) !=
-      expired_binding_uris.end())
+    if (notify.ended)
     {
-      // This NOTIFY would go to a binding which no longer exists - skip it.
-      continue;
+      // This is a terminated subscription - set the expiry time to now
+      subscription = aor_pair->get_orig()->subscriptions().find(notify.s_id)->second;
+      subscription->_expires = now;
+      reg_state = final_reg_state;
     }
-
-    // Is this subscription present in the new AoR?
-    AoR::Subscriptions::const_iterator aor_current =
-      aor_pair->get_current()->subscriptions().find(s_id);
-
-    // The subscription has been deleted. We should send a final NOTIFY
-    // about the state of the bindings in the original AoR
-    if (aor_current == aor_pair->get_current()->subscriptions().end())
+    else
     {
-      TRC_DEBUG("The subscription (%s) has been terminated", s_id.c_str());
-
-      pjsip_tx_data* tdata_notify = NULL;
+      subscription = aor_pair->get_current()->subscriptions().find(notify.s_id)->second;
+      reg_state = NotifyUtils::RegistrationState::ACTIVE;
+    }
 
-      // This is a terminated subscription - set the expiry time to now
-      s->_expires = now;
-      pj_status_t status = NotifyUtils::create_subscription_notify(
+    pjsip_tx_data* tdata_notify = NULL;
+    pj_status_t status = NotifyUtils::create_subscription_notify(
                                           &tdata_notify,
-                                          s,
-                                          aor_id,
-                                          &aor_pair->get_current()->_associated_uris,
+                                          subscription,
                                           aor_pair->get_orig(),
-                                          binding_info_to_notify,
-                                          reg_state,
+                                          bodies.get(reg_state, notify.doc_state),
+                                          notify.version,
                                           now,
                                           trail);
 
+    if (status == PJ_SUCCESS)
+    {
+      set_trail(tdata_notify, trail);
+      status = PJUtils::send_request(tdata_notify, 0, NULL, NULL, true);
+
       if (status == PJ_SUCCESS)
       {
-        set_trail(tdata_notify, trail);
-        status = PJUtils::send_request(tdata_notify, 0, NULL, NULL, true);
-
-        if (status == PJ_SUCCESS)
-        {
-          s->_refreshed = false;
-        }
-        else
-        {
-          // LCOV_EXCL_START
-          SAS::Event event(trail, SASEvent::NOTIFICATION_FAILED, 0);
-          std::string error_msg = "Failed to send NOTIFY - error: " +
-                                       PJUtils::pj_status_to_string(status);
-          event.add_var_param(error_msg);
-          SAS::report_event(event);
-          // LCOV_EXCL_STOP
-        }
+        subscription->_refreshed = false;
+      }
+      else
+      {
+        // LCOV_EXCL_START
+        SAS::Event event(trail, SASEvent::NOTIFICATION_FAILED, 0);
+        std::string error_msg = "Failed to send NOTIFY - error: " +
+                                      PJUtils::pj_status_to_string(status);
+        event.add_var_param(error_msg);
+        SAS::report_event(event);
+        // LCOV_EXCL_STOP
       }
     }
   }
@@ -0,0 +1,376 @@
+/**
+ * @file third_party_reg_engine.cpp ThirdPartyRegEngine class methods.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <time.h>
+#include <algorithm>
+
+#include "log.h"
+#include "third_party_reg_engine.h"
+
+ThirdPartyRegEngine::ThirdPartyRegEngine(int num_threads,
+                                         int max_rate_per_as,
+                                         int coalesce_ms) :
+  _max_rate_per_as(max_rate_per_as),
+  _coalesce_ms(coalesce_ms),
+  _as_queues(),
+  _pending(),
+  _callbacks(),
+  _in_progress(0),
+  _terminated(false),
+  _threads(),
+  _thread_descs(NULL),
+  _registered_threads(0)
+{
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_cond, NULL);
+  pthread_cond_init(&_idle_cond, NULL);
+
+  _thread_descs = new pj_thread_desc[num_threads];
+
+  for (int ii = 0; ii < num_threads; ++ii)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &ThirdPartyRegEngine::thread_fn, this) == 0)
+    {
+      _threads.push_back(thread);
+    }
+    else
+    {
+      TRC_ERROR("Failed to create third-party registration thread"); // LCOV_EXCL_LINE
+    }
+  }
+
+  TRC_STATUS("Sending third-party REGISTERs with %d threads, %d per second per AS",
+             num_threads, max_rate_per_as);
+}
+
+ThirdPartyRegEngine::~ThirdPartyRegEngine()
+{
+  pthread_mutex_lock(&_lock);
+  _terminated = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_cond_broadcast(&_idle_cond);
+  pthread_mutex_unlock(&_lock);
+
+  for (std::vector<pthread_t>::iterator thread = _threads.begin();
+       thread != _threads.end();
+       ++thread)
+  {
+    pthread_join(*thread, NULL);
+  }
+  _threads.clear();
+
+  // Discard anything still queued.
+  for (std::map<std::string, AsQueue>::iterator it = _as_queues.begin();
+       it != _as_queues.end();
+       ++it)
+  {
+    for (Request* request : it->second.immediate)
+    {
+      delete request;
+    }
+
+    for (Request* request : it->second.delayed)
+    {
+      delete request;
+    }
+  }
+  _as_queues.clear();
+  _pending.clear();
+
+  for (PJUtils::Callback* cb : _callbacks)
+  {
+    delete cb;
+  }
+  _callbacks.clear();
+
+  delete[] _thread_descs; _thread_descs = NULL;
+
+  pthread_cond_destroy(&_idle_cond);
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+void ThirdPartyRegEngine::send(const std::string& as_uri,
+                               const std::string& key,
+                               bool coalesce,
+                               SendFn send_fn)
+{
+  pthread_mutex_lock(&_lock);
+
+  if (coalesce)
+  {
+    std::map<std::string, Request*>::iterator it = _pending.find(key);
+
+    if (it != _pending.end())
+    {
+      // There's already a re-registration waiting for this user and AS, so
+      // just replace it with this one.
+      TRC_DEBUG("Coalesce third-party REGISTER for %s", key.c_str());
+      it->second->send_fn = send_fn;
+      pthread_mutex_unlock(&_lock);
+      return;
+    }
+  }
+
+  unsigned long now = now_ms();
+
+  std::map<std::string, AsQueue>::iterator as_queue = _as_queues.find(as_uri);
+  if (as_queue == _as_queues.end())
+  {
+    // First REGISTER to this AS, so start with a full bucket.
+    AsQueue new_queue;
+    new_queue.tokens = std::max(_max_rate_per_as, 1);
+    new_queue.last_refill_ms = now;
+    as_queue = _as_queues.insert(std::make_pair(as_uri, new_queue)).first;
+  }
+
+  Request* request = new Request;
+  request->key = key;
+  request->coalesce = coalesce;
+  request->send_fn = send_fn;
+
+  if (coalesce)
+  {
+    request->ready_ms = now + _coalesce_ms;
+    as_queue->second.delayed.push_back(request);
+    _pending[key] = request;
+  }
+  else
+  {
+    // A registration that can't be coalesced (such as a de-registration)
+    // supersedes any re-registration for this user and AS that hasn't been
+    // sent yet, which would otherwise be sent after it.
+    std::map<std::string, Request*>::iterator pending = _pending.find(key);
+
+    if (pending != _pending.end())
+    {
+      TRC_DEBUG("Drop pending third-party re-REGISTER for %s", key.c_str());
+      std::deque<Request*>& delayed = as_queue->second.delayed;
+      delayed.erase(std::remove(delayed.begin(), delayed.end(), pending->second),
+                    delayed.end());
+      delete pending->second;
+      _pending.erase(pending);
+    }
+
+    request->ready_ms = now;
+    as_queue->second.immediate.push_back(request);
+  }
+
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+}
+
+void ThirdPartyRegEngine::complete(PJUtils::Callback* cb)
+{
+  pthread_mutex_lock(&_lock);
+  _callbacks.push_back(cb);
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+}
+
+void ThirdPartyRegEngine::flush()
+{
+  pthread_mutex_lock(&_lock);
+
+  while ((!_terminated) && (!idle()))
+  {
+    pthread_cond_wait(&_idle_cond, &_lock);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+bool ThirdPartyRegEngine::idle() const
+{
+  if ((_in_progress > 0) || (!_callbacks.empty()))
+  {
+    return false;
+  }
+
+  for (std::map<std::string, AsQueue>::const_iterator it = _as_queues.begin();
+       it != _as_queues.end();
+       ++it)
+  {
+    if ((!it->second.immediate.empty()) || (!it->second.delayed.empty()))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void* ThirdPartyRegEngine::thread_fn(void* p)
+{
+  ((ThirdPartyRegEngine*)p)->process_requests();
+  return NULL;
+}
+
+ThirdPartyRegEngine::Request* ThirdPartyRegEngine::next_request(unsigned long now,
+                                                                unsigned long& wait_ms)
+{
+  wait_ms = 0;
+
+  for (std::map<std::string, AsQueue>::iterator it = _as_queues.begin();
+       it != _as_queues.end();
+       ++it)
+  {
+    AsQueue& as_queue = it->second;
+    std::deque<Request*>* queue = NULL;
+
+    if (!as_queue.immediate.empty())
+    {
+      queue = &as_queue.immediate;
+    }
+    else if (!as_queue.delayed.empty())
+    {
+      if (as_queue.delayed.front()->ready_ms <= now)
+      {
+        queue = &as_queue.delayed;
+      }
+      else
+      {
+        unsigned long wait = as_queue.delayed.front()->ready_ms - now;
+        wait_ms = (wait_ms == 0) ? wait : std::min(wait_ms, wait);
+      }
+    }
+
+    if (queue == NULL)
+    {
+      continue;
+    }
+
+    if (_max_rate_per_as > 0)
+    {
+      // Refill the AS's bucket, allowing up to a second's worth of tokens.
+      as_queue.tokens = std::min((double)_max_rate_per_as,
+                                 as_queue.tokens +
+                                 _max_rate_per_as * (now - as_queue.last_refill_ms) / 1000.0);
+      as_queue.last_refill_ms = now;
+
+      if (as_queue.tokens < 1.0)
+      {
+        unsigned long wait =
+          (unsigned long)((1.0 - as_queue.tokens) * 1000.0 / _max_rate_per_as) + 1;
+        wait_ms = (wait_ms == 0) ? wait : std::min(wait_ms, wait);
+        continue;
+      }
+
+      as_queue.tokens -= 1.0;
+    }
+
+    Request* request = queue->front();
+    queue->pop_front();
+
+    if (request->coalesce)
+    {
+      // This re-registration can no longer be replaced.
+      _pending.erase(request->key);
+    }
+
+    return request;
+  }
+
+  return NULL;
+}
+
+void ThirdPartyRegEngine::process_requests()
+{
+  pthread_mutex_lock(&_lock);
+
+  // Register this thread with PJLIB so it can send requests.
+  pj_thread_desc* desc = &_thread_descs[_registered_threads++];
+  pj_bzero(*desc, sizeof(pj_thread_desc));
+  pj_thread_t* thread = NULL;
+
+  if (pj_thread_register("ThirdPartyReg", *desc, &thread) != PJ_SUCCESS)
+  {
+    TRC_ERROR("Failed to register third-party registration thread with PJLIB"); // LCOV_EXCL_LINE
+  }
+
+  while (!_terminated)
+  {
+    // Callbacks complete REGISTERs that have already been sent, so they
+    // take priority over sending new ones.
+    if (!_callbacks.empty())
+    {
+      PJUtils::Callback* cb = _callbacks.front();
+      _callbacks.pop_front();
+      ++_in_progress;
+      pthread_mutex_unlock(&_lock);
+
+      cb->run();
+      delete cb;
+
+      pthread_mutex_lock(&_lock);
+      --_in_progress;
+    }
+    else
+    {
+      unsigned long wait_ms;
+      Request* request = next_request(now_ms(), wait_ms);
+
+      if (request != NULL)
+      {
+        ++_in_progress;
+        pthread_mutex_unlock(&_lock);
+
+        request->send_fn();
+        delete request;
+
+        pthread_mutex_lock(&_lock);
+        --_in_progress;
+      }
+      else if (wait_ms > 0)
+      {
+        // Wait until a re-registration is ready, or an AS's bucket has a
+        // token.
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += wait_ms / 1000;
+        wake.tv_nsec += (wait_ms % 1000) * 1000000;
+        if (wake.tv_nsec >= 1000000000)
+        {
+          wake.tv_sec += 1;
+          wake.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&_cond, &_lock, &wake);
+        continue;
+      }
+      else
+      {
+        pthread_cond_wait(&_cond, &_lock);
+        continue;
+      }
+    }
+
+    if (idle())
+    {
+      // Wake up any flushes.
+      pthread_cond_broadcast(&_idle_cond);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+unsigned long ThirdPartyRegEngine::now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
@@ -19,15 +19,18 @@ extern "C" {
 
 // Common STL includes.
 #include <cassert>
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <set>
 #include <list>
 #include <queue>
 #include <string>
+#include <atomic>
+#include <new>
 
 #include "constants.h"
-#include "eventq.h"
+#include "priority_eventq.h"
 #include "pjutils.h"
 #include "log.h"
 #include "sas.h"
@@ -46,9 +49,15 @@ extern "C" {
 #include "exception_handler.h"
 #include "snmp_event_accumulator_table.h"
 #include "snmp_event_accumulator_by_scope_table.h"
+#include "latency_breakdown.h"
 
 static std::vector<pj_thread_t*> worker_threads;
 
+// MessageEvents are allocated from the pool of the cloned rdata they refer
+// to, so they are recycled along with the rdata's pool (by the PJSIP caching
+// pool) rather than needing a heap allocation of their own for every message.
+// This means they must be trivially destructible, and must not be accessed
+// after the rdata has been freed.
 struct MessageEvent
 {
   // The received message
@@ -67,6 +76,25 @@ union Event
   MessageEvent* message;
 };
 
+// Priority levels for events on the queue.  Events that complete work already
+// in progress are processed ahead of events that start new work, so that when
+// the queue backs up (for example during a registration storm) calls and
+// registrations that are already underway don't time out behind new ones.
+enum EventPriority
+{
+  // Responses.
+  PRIORITY_RESPONSE = 0,
+
+  // Requests within an existing dialog, and callbacks from asynchronous
+  // operations started by earlier messages.
+  PRIORITY_IN_DIALOG,
+
+  // Requests that start a new dialog or a standalone transaction.
+  PRIORITY_INITIAL_REQUEST,
+
+  NUM_PRIORITIES
+};
+
 struct worker_thread_qe
 {
   // The type of the event
@@ -76,8 +104,22 @@ struct worker_thread_qe
   Event event;
 };
 
-// Queue for incoming events.
-eventq<struct worker_thread_qe> worker_thread_q;
+// Queues for incoming events.  By default there is a single queue shared by
+// all the worker threads.  If the dispatcher is configured with more than one
+// queue shard, each worker thread is bound to one shard (worker N services
+// shard N modulo the number of shards), SIP messages are placed on a shard
+// chosen by a hash of their Call-ID (so all the messages in a dialog are
+// normally handled by the same set of threads), and a worker thread whose own
+// shard is empty steals work from the other shards.
+static std::vector<priority_eventq<struct worker_thread_qe>*> worker_thread_qs;
+
+// Round-robin counter used to spread callbacks (which have no Call-ID) across
+// the queue shards.
+static std::atomic<unsigned int> next_callback_q(0);
+
+// Set when the worker threads are being shut down, so that threads polling
+// the queue shards for work to steal know to exit.
+static std::atomic<bool> worker_threads_terminating(false);
 
 // Deadlock detection threshold for the message queue (in milliseconds).  This
 // is set to roughly twice the expected maximum service time for each message
@@ -85,14 +127,118 @@ eventq<struct worker_thread_qe> worker_thread_q;
 // from a single request, each with a possible 500ms timeout).
 static const int MSG_Q_DEADLOCK_TIME = 4000;
 
+// Time (in milliseconds) that a worker thread with no work on its own queue
+// shard waits for new work before looking for work to steal from the other
+// shards again.
+static const int WORK_STEAL_POLL_TIME = 10;
+
+// Retry-After value (in seconds) on 503 responses sent when an initial request
+// is rejected because the worker queue is full.  This gives the queue a chance
+// to drain before the client retries.
+static const int QUEUE_FULL_RETRY_AFTER = 5;
+
 static int num_worker_threads = 1;
 static SNMP::EventAccumulatorByScopeTable* latency_table = NULL;
 static LoadMonitor* load_monitor = NULL;
 static SNMP::EventAccumulatorByScopeTable* queue_size_table = NULL;
 static ExceptionHandler* exception_handler = NULL;
+static SNMP::CounterByScopeTable* overload_counter = NULL;
+static LatencyBreakdown* latency_breakdown = NULL;
+
+// Maximum number of events queued on a queue shard before new initial
+// requests are rejected.  Zero means the queues are unbounded.
+static int max_queue_depth = 0;
 
 static pj_bool_t threads_on_rx_msg(pjsip_rx_data* rdata);
 
+/// Select the queue shard for a received message.  Messages with the same
+/// Call-ID always map to the same shard.
+static priority_eventq<struct worker_thread_qe>* select_queue(pjsip_rx_data* rdata)
+{
+  size_t num_qs = worker_thread_qs.size();
+  if ((num_qs == 1) || (rdata->msg_info.cid == NULL))
+  {
+    return worker_thread_qs[0];
+  }
+
+  const pj_str_t& call_id = rdata->msg_info.cid->id;
+  pj_uint32_t hash = pj_hash_calc(0, call_id.ptr, call_id.slen);
+  return worker_thread_qs[hash % num_qs];
+}
+
+/// Determine the priority with which a received message should be queued.
+///
+/// ACKs and CANCELs are queued at the same priority as the request they
+/// relate to (which has the same Call-ID, so is on the same queue shard).
+/// This means they are never processed before that request if it is still
+/// queued - for example, a CANCEL overtaking its INVITE would be rejected
+/// with a 481, and the INVITE would then proceed.
+static EventPriority get_priority(pjsip_rx_data* rdata)
+{
+  pjsip_msg* msg = rdata->msg_info.msg;
+
+  if (msg->type == PJSIP_RESPONSE_MSG)
+  {
+    return PRIORITY_RESPONSE;
+  }
+  else if ((rdata->msg_info.to != NULL) &&
+           (rdata->msg_info.to->tag.slen > 0))
+  {
+    return PRIORITY_IN_DIALOG;
+  }
+  else
+  {
+    return PRIORITY_INITIAL_REQUEST;
+  }
+}
+
+/// Get the next event for a worker thread to process, waiting if there is
+/// none.
+///
+/// @returns          false if the worker threads are terminating, true
+///                   otherwise.
+/// @param shard      The queue shard that this worker thread services.
+/// @param qe         The event that was dequeued.
+static bool get_next_event(size_t shard, struct worker_thread_qe& qe)
+{
+  size_t num_qs = worker_thread_qs.size();
+  priority_eventq<struct worker_thread_qe>* own_q = worker_thread_qs[shard];
+
+  if (num_qs == 1)
+  {
+    // Only one queue, so just block on it.
+    return own_q->pop(qe);
+  }
+
+  while (!worker_threads_terminating)
+  {
+    // Prefer work from our own shard, as this keeps the state for each dialog
+    // on the same threads.
+    if (own_q->pop(qe, 0))
+    {
+      return true;
+    }
+
+    // Our shard is empty, so try to steal work from the other shards.
+    for (size_t ii = 1; ii < num_qs; ++ii)
+    {
+      if (worker_thread_qs[(shard + ii) % num_qs]->pop(qe, 0))
+      {
+        return true;
+      }
+    }
+
+    // There's no work anywhere, so wait for work to arrive on our own shard
+    // for a short while before checking the others again.
+    if (own_q->pop(qe, WORK_STEAL_POLL_TIME))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 // Module to clone SIP requests and dispatch them to worker threads.
 
 // Priority of PJSIP_MOD_PRIORITY_TRANSPORT_LAYER-1 causes this to run
@@ -122,6 +268,9 @@ static pjsip_module mod_thread_dispatcher =
 /// Worker threads handle most SIP message processing.
 static int worker_thread(void* p)
 {
+  // The queue shard this thread services is passed as the thread argument.
+  size_t shard = (size_t)p;
+
   // Set up data to always process incoming messages at the first PJSIP
   // module after our module.
   pjsip_process_rdata_param rp;
@@ -133,7 +282,7 @@ static int worker_thread(void* p)
 
   struct worker_thread_qe qe = { MESSAGE };
 
-  while (worker_thread_q.pop(qe))
+  while (get_next_event(shard, qe))
   {
     if (qe.type == MESSAGE)
     {
@@ -144,6 +293,13 @@ static int worker_thread(void* p)
       {
         TRC_DEBUG("Worker thread dequeue message %p", rdata);
 
+        // Note how long the message has been queued, and how long this thread
+        // has been blocked on dependencies so far, so we can work out how the
+        // time is split once the message is processed.
+        unsigned long queue_us = 0;
+        bool queue_time_valid = me->stop_watch.read(queue_us);
+        unsigned long blocked_start_us = LatencyBreakdown::thread_blocked_us();
+
         CW_TRY
         {
           pjsip_endpt_process_rx_data(stack_data.endpt, rdata, &rp, NULL);
@@ -193,21 +349,35 @@ static int worker_thread(void* p)
         CW_END
 
         TRC_DEBUG("Worker thread completed processing message %p", rdata);
+
+        // Freeing the rdata also frees the MessageEvent, so take a copy of the
+        // stop watch first.
+        Utils::StopWatch stop_watch = me->stop_watch;
         pjsip_rx_data_free_cloned(rdata);
+        rdata = NULL; me = NULL;
 
         unsigned long latency_us = 0;
-        if (me->stop_watch.read(latency_us))
+        if (stop_watch.read(latency_us))
         {
           TRC_DEBUG("Request latency = %ldus", latency_us);
           latency_table->accumulate(latency_us);
           load_monitor->request_complete(latency_us);
+
+          if ((latency_breakdown != NULL) &&
+              (queue_time_valid) &&
+              (latency_us >= queue_us))
+          {
+            latency_breakdown->record_message(
+                    queue_us,
+                    latency_us - queue_us,
+                    LatencyBreakdown::thread_blocked_us() - blocked_start_us);
+          }
         }
         else
         {
           TRC_ERROR("Failed to get done timestamp: %s", strerror(errno));
         }
       }
-      delete me; me = NULL;
     }
     else
     {
@@ -229,8 +399,10 @@ static pj_bool_t threads_on_rx_msg(pjsip_rx_data* rdata)
   SAS::Event event(get_trail(rdata), SASEvent::BEGIN_THREAD_DISPATCHER, 0);
   SAS::report_event(event);
 
+  priority_eventq<struct worker_thread_qe>* worker_thread_q = select_queue(rdata);
+
   // Check that the worker threads are not all deadlocked.
-  if (worker_thread_q.is_deadlocked())
+  if (worker_thread_q->is_deadlocked())
   {
     // The queue has not been serviced for sufficiently long to imply that
     // all the worker threads are deadlock, so exit the process so it will be
@@ -240,12 +412,48 @@ static pj_bool_t threads_on_rx_msg(pjsip_rx_data* rdata)
     abort();
   }
 
+  EventPriority priority = get_priority(rdata);
+
+  // Apply back-pressure if the queue is full.  Only new initial requests are
+  // rejected - everything else relates to work that is already in progress,
+  // and is queued ahead of the initial requests anyway.  ACKs and CANCELs
+  // for new transactions are queued at initial request priority, but must
+  // still be processed.
+  pjsip_method_e method_id = rdata->msg_info.msg->line.req.method.id;
+  if ((max_queue_depth > 0) &&
+      (priority == PRIORITY_INITIAL_REQUEST) &&
+      (method_id != PJSIP_ACK_METHOD) &&
+      (method_id != PJSIP_CANCEL_METHOD) &&
+      (worker_thread_q->size() >= max_queue_depth))
+  {
+    TRC_DEBUG("Rejecting initial request as worker queue is full (%d events)",
+              max_queue_depth);
+    pjsip_retry_after_hdr* retry_after =
+      pjsip_retry_after_hdr_create(rdata->tp_info.pool, QUEUE_FULL_RETRY_AFTER);
+    PJUtils::respond_stateless(stack_data.endpt,
+                               rdata,
+                               PJSIP_SC_SERVICE_UNAVAILABLE,
+                               NULL,
+                               (pjsip_hdr*)retry_after,
+                               NULL);
+
+    if (overload_counter != NULL)
+    {
+      overload_counter->increment();
+    }
+    return PJ_TRUE;
+  }
+
   // Before we start, get a timestamp.  This will track the time from
   // receiving a message to forwarding it on (or rejecting it).
-  MessageEvent* me = new MessageEvent();
-  me->stop_watch.start();
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
 
-  // Clone the message and queue it to a scheduler thread.
+  // Clone the message and queue it to a scheduler thread.  The clone is still
+  // needed on this path: PJSIP transports reset the rdata's pool and reuse its
+  // receive buffer for the next message as soon as this callback returns, and
+  // the TCP transport doesn't read from the connection again until it does.
+  // Only the separate MessageEvent allocation has been removed.
   pjsip_rx_data* clone_rdata;
   pj_status_t status = pjsip_rx_data_clone(rdata, 0, &clone_rdata);
 
@@ -259,21 +467,18 @@ static pj_bool_t threads_on_rx_msg(pjsip_rx_data* rdata)
   // Make sure the trail identifier is passed across.
   set_trail(clone_rdata, get_trail(rdata));
 
-  // @TODO - need to think about back-pressure mechanisms.  For example,
-  // should we have a maximum depth of queue and drop messages after that?
-  // May be better to hold on to the message until the queue has space - this
-  // will force back pressure on the particular TCP connection.  Or should we
-  // have a queue per transport and round-robin them?
-
   TRC_DEBUG("Queuing cloned received message %p for worker threads", clone_rdata);
+  MessageEvent* me = new (pj_pool_alloc(clone_rdata->tp_info.pool,
+                                        sizeof(MessageEvent))) MessageEvent();
   me->rdata = clone_rdata;
+  me->stop_watch = stop_watch;
   Event queue_event;
   queue_event.message = me;
   struct worker_thread_qe qe = { MESSAGE, queue_event };
 
   // Track the current queue size
-  queue_size_table->accumulate(worker_thread_q.size());
-  worker_thread_q.push(qe);
+  queue_size_table->accumulate(worker_thread_q->size());
+  worker_thread_q->push(qe, priority);
 
   // return TRUE to flag that we have absorbed the incoming message.
   return PJ_TRUE;
@@ -283,20 +488,44 @@ pj_status_t init_thread_dispatcher(int num_worker_threads_arg,
                                    SNMP::EventAccumulatorByScopeTable* latency_table_arg,
                                    SNMP::EventAccumulatorByScopeTable* queue_size_table_arg,
                                    LoadMonitor* load_monitor_arg,
-                                   ExceptionHandler* exception_handler_arg)
+                                   ExceptionHandler* exception_handler_arg,
+                                   int num_queue_shards_arg,
+                                   int max_queue_depth_arg,
+                                   SNMP::CounterByScopeTable* overload_counter_arg,
+                                   LatencyBreakdown* latency_breakdown_arg)
 {
   // Set up the vectors of threads.  The threads don't get created until
   // start_worker_threads is called.
   worker_threads.resize(num_worker_threads_arg);
 
-  // Enable deadlock detection on the message queue.
-  worker_thread_q.set_deadlock_threshold(MSG_Q_DEADLOCK_TIME);
+  // There is no point having more queue shards than worker threads, as some
+  // shards would never be serviced except by stealing.
+  int num_queue_shards = std::max(1, std::min(num_queue_shards_arg,
+                                               num_worker_threads_arg));
+  if (num_queue_shards != num_queue_shards_arg)
+  {
+    TRC_WARNING("Using %d worker queue shards (%d requested)",
+                num_queue_shards, num_queue_shards_arg);
+  }
+
+  // Create the queues, and enable deadlock detection on them.
+  for (int ii = 0; ii < num_queue_shards; ++ii)
+  {
+    priority_eventq<struct worker_thread_qe>* q =
+                        new priority_eventq<struct worker_thread_qe>(NUM_PRIORITIES);
+    q->set_deadlock_threshold(MSG_Q_DEADLOCK_TIME);
+    worker_thread_qs.push_back(q);
+  }
+  worker_threads_terminating = false;
 
   num_worker_threads = num_worker_threads_arg;
   latency_table = latency_table_arg;
   queue_size_table = queue_size_table_arg;
   load_monitor = load_monitor_arg;
   exception_handler = exception_handler_arg;
+  max_queue_depth = max_queue_depth_arg;
+  overload_counter = overload_counter_arg;
+  latency_breakdown = latency_breakdown_arg;
 
   // Register the PJSIP module.
   pjsip_endpt_register_module(stack_data.endpt, &mod_thread_dispatcher);
@@ -312,8 +541,9 @@ pj_status_t start_worker_threads()
   for (size_t ii = 0; ii < worker_threads.size(); ++ii)
   {
     pj_thread_t* thread;
+    void* shard = (void*)(ii % worker_thread_qs.size());
     status = pj_thread_create(stack_data.pool, "worker", &worker_thread,
-                              NULL, 0, 0, &thread);
+                              shard, 0, 0, &thread);
     if (status != PJ_SUCCESS)
     {
       TRC_ERROR("Error creating worker thread, %s",
@@ -330,7 +560,13 @@ void stop_worker_threads()
 {
   // Now it is safe to signal the worker threads to exit via the queue and to
   // wait for them to terminate.
-  worker_thread_q.terminate();
+  worker_threads_terminating = true;
+  for (std::vector<priority_eventq<struct worker_thread_qe>*>::iterator i = worker_thread_qs.begin();
+       i != worker_thread_qs.end();
+       ++i)
+  {
+    (*i)->terminate();
+  }
   for (std::vector<pj_thread_t*>::iterator i = worker_threads.begin();
        i != worker_threads.end();
        ++i)
@@ -344,6 +580,13 @@ void unregister_thread_dispatcher(void)
 {
   pjsip_endpt_unregister_module(stack_data.endpt, &mod_thread_dispatcher);
 
+  for (std::vector<priority_eventq<struct worker_thread_qe>*>::iterator i = worker_thread_qs.begin();
+       i != worker_thread_qs.end();
+       ++i)
+  {
+    delete *i;
+  }
+  worker_thread_qs.clear();
 }
 
 void add_callback_to_queue(PJUtils::Callback* cb)
@@ -353,9 +596,15 @@ void add_callback_to_queue(PJUtils::Callback* cb)
   queue_event.callback = cb;
   worker_thread_qe qe = { CALLBACK, queue_event };
 
+  // Callbacks aren't associated with a dialog, so just spread them across the
+  // queue shards.
+  priority_eventq<struct worker_thread_qe>* worker_thread_q =
+                 worker_thread_qs[next_callback_q++ % worker_thread_qs.size()];
+
   // Track the current queue size
-  queue_size_table->accumulate(worker_thread_q.size());
+  queue_size_table->accumulate(worker_thread_q->size());
 
-  // Add the Event
-  worker_thread_q.push(qe);
+  // Add the Event.  Callbacks complete work that is already in progress, so
+  // are prioritized ahead of new requests.
+  worker_thread_q->push(qe, PRIORITY_IN_DIALOG);
 }
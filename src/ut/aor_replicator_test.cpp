@@ -0,0 +1,235 @@
+/**
+ * @file aor_replicator_test.cpp UT for the geo-redundant AoR replicator.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "gtest/gtest.h"
+
+#include "localstore.h"
+#include "subscriber_data_manager.h"
+#include "astaire_aor_store.h"
+#include "aor_replicator.h"
+#include "fakechronosconnection.hpp"
+#include "mock_subscriber_data_manager.h"
+
+using ::testing::InvokeWithoutArgs;
+
+static const std::string AOR_ID = "sip:6505550231@homedomain";
+
+/// Fixture for AoRReplicatorTest.  There is a local store and two remote
+/// stores.
+class AoRReplicatorTest : public ::testing::Test
+{
+public:
+  static const int NUM_SITES = 2;
+
+  void SetUp()
+  {
+    _chronos_connection = new FakeChronosConnection();
+
+    for (int ii = 0; ii <= NUM_SITES; ++ii)
+    {
+      _datastores.push_back(new LocalStore());
+      _aor_stores.push_back(new AstaireAoRStore(_datastores.back()));
+      _sdms.push_back(new SubscriberDataManager(_aor_stores.back(),
+                                                _chronos_connection,
+                                                NULL,
+                                                false));
+    }
+
+    _local_sdm = _sdms[0];
+    _remote_sdms.assign(_sdms.begin() + 1, _sdms.end());
+    _replicator = new AoRReplicator(_remote_sdms, 2);
+  }
+
+  void TearDown()
+  {
+    delete _replicator; _replicator = NULL;
+
+    for (size_t ii = 0; ii < _sdms.size(); ++ii)
+    {
+      delete _sdms[ii];
+      delete _aor_stores[ii];
+      delete _datastores[ii];
+    }
+
+    delete _chronos_connection; _chronos_connection = NULL;
+  }
+
+  static void add_binding(AoR* aor, const std::string& id, int cseq)
+  {
+    AoR::Binding* b = aor->get_binding(id);
+    b->_uri = "sip:6505550231@192.91.191.29:59934;transport=tcp;ob";
+    b->_cid = "gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq";
+    b->_cseq = cseq;
+    b->_expires = time(NULL) + 300;
+    b->_priority = 0;
+    b->_private_id = "6505550231@homedomain";
+    b->_emergency_registration = false;
+  }
+
+  // Applies a change to the AoR in a store, and (if it is the local store)
+  // queues it for replication.
+  void update(SubscriberDataManager* sdm,
+              std::function<void(AoR*)> change)
+  {
+    AoRPair* aor_pair = sdm->get_aor_data(AOR_ID, 0);
+    ASSERT_TRUE(aor_pair != NULL);
+    change(aor_pair->get_current());
+    EXPECT_EQ(Store::OK, sdm->set_aor_data(AOR_ID, aor_pair, 0));
+
+    if (sdm == _local_sdm)
+    {
+      _replicator->replicate(AOR_ID, aor_pair, 0);
+    }
+
+    delete aor_pair;
+  }
+
+  FakeChronosConnection* _chronos_connection;
+  std::vector<LocalStore*> _datastores;
+  std::vector<AstaireAoRStore*> _aor_stores;
+  std::vector<SubscriberDataManager*> _sdms;
+  SubscriberDataManager* _local_sdm;
+  std::vector<SubscriberDataManager*> _remote_sdms;
+  AoRReplicator* _replicator;
+};
+
+// A change to the local store is written to every remote store.
+TEST_F(AoRReplicatorTest, Replicate)
+{
+  update(_local_sdm, [](AoR* aor) { add_binding(aor, "binding1", 1); });
+  _replicator->flush();
+
+  for (SubscriberDataManager* sdm : _remote_sdms)
+  {
+    AoRPair* aor_pair = sdm->get_aor_data(AOR_ID, 0);
+    ASSERT_TRUE(aor_pair != NULL);
+    ASSERT_EQ(1u, aor_pair->get_current()->bindings().size());
+    EXPECT_EQ(1, aor_pair->get_current()->bindings().begin()->second->_cseq);
+    delete aor_pair;
+  }
+}
+
+// Bindings removed locally are removed from the remote stores, but bindings
+// only in the remote stores are left alone.
+TEST_F(AoRReplicatorTest, Removals)
+{
+  update(_local_sdm, [](AoR* aor) { add_binding(aor, "binding1", 1);
+                                    add_binding(aor, "binding2", 1); });
+  _replicator->flush();
+  update(_remote_sdms[0], [](AoR* aor) { add_binding(aor, "remote", 1); });
+
+  update(_local_sdm, [](AoR* aor) { aor->remove_binding("binding1"); });
+  _replicator->flush();
+
+  AoRPair* aor_pair = _remote_sdms[0]->get_aor_data(AOR_ID, 0);
+  ASSERT_TRUE(aor_pair != NULL);
+  EXPECT_EQ(2u, aor_pair->get_current()->bindings().size());
+  EXPECT_TRUE(aor_pair->get_current()->bindings().find("binding1") ==
+              aor_pair->get_current()->bindings().end());
+  EXPECT_TRUE(aor_pair->get_current()->bindings().find("remote") !=
+              aor_pair->get_current()->bindings().end());
+  delete aor_pair;
+
+  aor_pair = _remote_sdms[1]->get_aor_data(AOR_ID, 0);
+  ASSERT_TRUE(aor_pair != NULL);
+  ASSERT_EQ(1u, aor_pair->get_current()->bindings().size());
+  EXPECT_EQ("binding2", aor_pair->get_current()->bindings().begin()->first);
+  delete aor_pair;
+}
+
+// A burst of changes to an AoR leaves the remote stores with the final state,
+// however the changes are coalesced.  In particular, a binding that is removed
+// and then added back again is present in the remote stores.
+TEST_F(AoRReplicatorTest, Coalescing)
+{
+  update(_local_sdm, [](AoR* aor) { add_binding(aor, "binding1", 1); });
+
+  for (int ii = 2; ii <= 50; ++ii)
+  {
+    if (ii % 2 == 0)
+    {
+      update(_local_sdm, [](AoR* aor) { aor->remove_binding("binding1"); });
+    }
+    else
+    {
+      update(_local_sdm, [ii](AoR* aor) { add_binding(aor, "binding1", ii); });
+    }
+  }
+
+  update(_local_sdm, [](AoR* aor) { add_binding(aor, "binding1", 51); });
+  _replicator->flush();
+
+  for (SubscriberDataManager* sdm : _remote_sdms)
+  {
+    AoRPair* aor_pair = sdm->get_aor_data(AOR_ID, 0);
+    ASSERT_TRUE(aor_pair != NULL);
+    ASSERT_EQ(1u, aor_pair->get_current()->bindings().size());
+    EXPECT_EQ(51, aor_pair->get_current()->bindings().begin()->second->_cseq);
+    delete aor_pair;
+  }
+}
+
+// If a site falls too far behind, changes to further AoRs are dropped for it
+// rather than queued without limit.  Changes to AoRs that are already queued
+// are still coalesced.
+TEST_F(AoRReplicatorTest, QueueFull)
+{
+  // The remote store blocks the first write until we release it.
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool writing = false;
+  bool released = false;
+
+  MockSubscriberDataManager* remote_sdm = new MockSubscriberDataManager();
+  EXPECT_CALL(*remote_sdm, has_servers()).WillRepeatedly(InvokeWithoutArgs([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    writing = true;
+    cond.notify_all();
+    cond.wait(lock, [&]() { return released; });
+    return false;
+  }));
+
+  std::vector<SubscriberDataManager*> remote_sdms(1, remote_sdm);
+  AoRReplicator* replicator = new AoRReplicator(remote_sdms, 1, NULL, 2);
+  AoRPair* aor_pair = _local_sdm->get_aor_data(AOR_ID, 0);
+  ASSERT_TRUE(aor_pair != NULL);
+
+  // Wait for the first change to be picked up, so it isn't on the queue.
+  replicator->replicate("sip:1@homedomain", aor_pair, 0);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]() { return writing; });
+  }
+
+  replicator->replicate("sip:2@homedomain", aor_pair, 0);
+  replicator->replicate("sip:3@homedomain", aor_pair, 0);
+  EXPECT_EQ(0u, replicator->dropped());
+
+  replicator->replicate("sip:4@homedomain", aor_pair, 0);
+  EXPECT_EQ(1u, replicator->dropped());
+
+  replicator->replicate("sip:2@homedomain", aor_pair, 0);
+  EXPECT_EQ(1u, replicator->dropped());
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    released = true;
+    cond.notify_all();
+  }
+  replicator->flush();
+
+  delete replicator;
+  delete aor_pair;
+  delete remote_sdm;
+}
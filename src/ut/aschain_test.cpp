@@ -10,6 +10,8 @@
  */
 
 #include <string>
+#include <thread>
+#include <atomic>
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -162,6 +164,67 @@ TEST_F(AsChainTest, Basics)
   EXPECT_TRUE(res.complete());
 }
 
+// Walk several deep AS chains at once, looking up the ODI token for each
+// hop, as the S-CSCF does for subscribers with many application servers.
+// Walks several deep chains at once through AsChainTable::lookup(), checking
+// that every ODI token finds the next link of the right chain while other
+// threads are looking up tokens on other chains.  The timed version is
+// LookupBench.DISABLED_AsChainLookups in the benchmark harness.
+TEST_F(AsChainTest, DeepChainsConcurrentLookups)
+{
+  const int NUM_THREADS = 4;
+  const int NUM_WALKS = 1000;
+  IFCConfiguration ifc_configuration(false, false, "", &SNMP::FAKE_COUNTER_TABLE, &SNMP::FAKE_COUNTER_TABLE);
+
+  std::vector<AsChain*> chains;
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    Ifcs ifcs = matching_ifcs(8,
+                              "sip:as1.homedomain", "sip:as2.homedomain",
+                              "sip:as3.homedomain", "sip:as4.homedomain",
+                              "sip:as5.homedomain", "sip:as6.homedomain",
+                              "sip:as7.homedomain", "sip:as8.homedomain");
+    chains.push_back(new AsChain(_as_chain_table, SessionCase::Originating, "sip:5755550011@homedomain", true, 0, ifcs, NULL, NULL, ifc_configuration, "sip:scscf.homedomain"));
+  }
+
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    threads.push_back(std::thread([&, tt]()
+    {
+      for (int ii = 0; ii < NUM_WALKS; ++ii)
+      {
+        AsChainLink link(chains[tt], 0u);
+        while (!link.complete())
+        {
+          AsChainLink next = _as_chain_table->lookup(link.next_odi_token());
+          if ((next.as_chain() != chains[tt]) ||
+              (next._index != link._index + 1))
+          {
+            ++failures;
+            break;
+          }
+          link = next;
+          next.release();
+        }
+      }
+    }));
+  }
+
+  for (size_t ii = 0; ii < threads.size(); ++ii)
+  {
+    threads[ii].join();
+  }
+
+  EXPECT_EQ(0, failures.load());
+
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    AsChainLink(chains[tt], 0u).release();
+  }
+}
+
 // We have matching standard iFCs - we should select the ASs from
 // those iFCs and no more.
 TEST_F(AsChainTest, MatchingStandardiFCs)
@@ -0,0 +1,126 @@
+/**
+ * @file chronos_timer_batcher_test.cpp UT for the Chronos timer batcher.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "chronos_timer_batcher.h"
+#include "mock_chronos_connection.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::Return;
+using ::testing::SetArgReferee;
+
+static const std::string AOR_ID = "sip:6505550231@homedomain";
+
+/// Fixture for ChronosTimerBatcherTest.
+class ChronosTimerBatcherTest : public ::testing::Test
+{
+public:
+  // The batcher's threads register with PJLIB, so PJLIB must be initialised.
+  static void SetUpTestCase()
+  {
+    pj_init();
+  }
+
+  static void TearDownTestCase()
+  {
+    pj_shutdown();
+  }
+
+  void SetUp()
+  {
+    _chronos_connection = new MockChronosConnection("chronos");
+    _batcher = new ChronosTimerBatcher(_chronos_connection, 2, 20);
+    _batcher->set_timer_id_callback([this](const std::string& aor_id,
+                                           const std::string& timer_id,
+                                           SAS::TrailId trail)
+                                    {
+                                      _stored_ids[aor_id] = timer_id;
+                                    });
+    _tags["REG"] = 1;
+    _tags["BIND"] = 1;
+    _tags["SUB"] = 0;
+  }
+
+  void TearDown()
+  {
+    delete _batcher; _batcher = NULL;
+    delete _chronos_connection; _chronos_connection = NULL;
+  }
+
+  MockChronosConnection* _chronos_connection;
+  ChronosTimerBatcher* _batcher;
+  std::map<std::string, std::string> _stored_ids;
+  std::map<std::string, uint32_t> _tags;
+};
+
+// A new timer is created with a POST, and its ID is passed to the callback.
+TEST_F(ChronosTimerBatcherTest, NewTimer)
+{
+  EXPECT_CALL(*_chronos_connection, send_post(_, 300, "/timers", _, _, _tags))
+    .WillOnce(DoAll(SetArgReferee<0>("TIMER_ID"), Return(HTTP_OK)));
+
+  _batcher->set_timer(AOR_ID, "", 300, _tags, 0);
+  _batcher->flush();
+
+  EXPECT_EQ("TIMER_ID", _stored_ids[AOR_ID]);
+}
+
+// Repeated changes to a timer are coalesced into a single PUT with the
+// latest expiry.
+TEST_F(ChronosTimerBatcherTest, Coalescing)
+{
+  EXPECT_CALL(*_chronos_connection, send_put(_, _, _, _, _, _)).Times(0);
+  EXPECT_CALL(*_chronos_connection, send_put("TIMER_ID", 310, "/timers", _, _, _tags))
+    .WillOnce(Return(HTTP_OK));
+
+  for (uint32_t expiry = 300; expiry <= 310; ++expiry)
+  {
+    _batcher->set_timer(AOR_ID, "TIMER_ID", expiry, _tags, 0);
+  }
+  _batcher->flush();
+
+  EXPECT_TRUE(_stored_ids.empty());
+}
+
+// Requests for an AoR whose new timer ID hasn't been stored yet use that ID,
+// rather than creating another timer.
+TEST_F(ChronosTimerBatcherTest, UnstoredTimerId)
+{
+  EXPECT_CALL(*_chronos_connection, send_post(_, 300, _, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<0>("TIMER_ID"), Return(HTTP_OK)));
+  _batcher->set_timer(AOR_ID, "", 300, _tags, 0);
+  _batcher->flush();
+
+  EXPECT_CALL(*_chronos_connection, send_put("TIMER_ID", 200, _, _, _, _))
+    .WillOnce(Return(HTTP_OK));
+  _batcher->set_timer(AOR_ID, "", 200, _tags, 0);
+  _batcher->flush();
+
+  EXPECT_CALL(*_chronos_connection, send_delete("TIMER_ID", _))
+    .WillOnce(Return(HTTP_OK));
+  _batcher->delete_timer(AOR_ID, "", 0);
+  _batcher->flush();
+}
+
+// Deleting a timer that was never created doesn't send anything to Chronos.
+TEST_F(ChronosTimerBatcherTest, DeleteUnsetTimer)
+{
+  EXPECT_CALL(*_chronos_connection, send_post(_, _, _, _, _, _)).Times(0);
+  EXPECT_CALL(*_chronos_connection, send_delete(_, _)).Times(0);
+
+  _batcher->set_timer(AOR_ID, "", 300, _tags, 0);
+  _batcher->delete_timer(AOR_ID, "", 0);
+  _batcher->flush();
+}
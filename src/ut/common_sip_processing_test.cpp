@@ -239,6 +239,66 @@ TEST_F(CommonProcessingTest, AckRequestAlwaysAllowed)
   ASSERT_EQ(0, txdata_count());
 }
 
+TEST_F(CommonProcessingTest, InDialogRequestAllowedWithOverload)
+{
+  // Tests that, when there is no token in the load monitor's bucket but the
+  // node isn't deeply overloaded, an in-dialog request is not rejected.
+
+  // Consume the only token in the bucket.
+  _lm->admit_request(0);
+
+  // Inject an in-dialog request.
+  Message msg1;
+  msg1._first_hop = true;
+  msg1._method = "BYE";
+  msg1._in_dialog = true;
+  inject_msg(msg1.get_request(), _tp);
+
+  // As only the common processing module is loaded (and not anything
+  // that will actually handle the request), expect it to just disappear.
+  ASSERT_EQ(0, txdata_count());
+}
+
+TEST_F(CommonProcessingTest, ClassifyRequests)
+{
+  // Tests that requests are classified for admission control.
+  Message msg1;
+  msg1._method = "INVITE";
+  pjsip_msg* msg = parse_msg(msg1.get_request());
+  EXPECT_EQ(AdmissionController::NEW_SESSION, AdmissionController::classify(msg));
+
+  msg1._in_dialog = true;
+  msg = parse_msg(msg1.get_request());
+  EXPECT_EQ(AdmissionController::IN_DIALOG, AdmissionController::classify(msg));
+
+  // A To tag from an untrusted source isn't enough on its own...
+  EXPECT_EQ(AdmissionController::NEW_SESSION, AdmissionController::classify(msg, false));
+
+  // ...the request must also be routed to this node.
+  msg1._route = "Route: <sip:127.0.0.1;transport=TCP;lr>";
+  msg = parse_msg(msg1.get_request());
+  EXPECT_EQ(AdmissionController::IN_DIALOG, AdmissionController::classify(msg, false));
+
+  msg1._route = "Route: <sip:proxy.otherdomain;transport=TCP;lr>";
+  msg = parse_msg(msg1.get_request());
+  EXPECT_EQ(AdmissionController::NEW_SESSION, AdmissionController::classify(msg, false));
+
+  Message msg2;
+  msg2._method = "INVITE";
+  msg2._requri = "urn:service:sos";
+  msg = parse_msg(msg2.get_request());
+  EXPECT_EQ(AdmissionController::EMERGENCY, AdmissionController::classify(msg));
+
+  Message msg3;
+  msg3._method = "REGISTER";
+  msg = parse_msg(msg3.get_request());
+  EXPECT_EQ(AdmissionController::INITIAL_REGISTER, AdmissionController::classify(msg));
+
+  msg3._extra = "Expires: 0";
+  msg = parse_msg(msg3.get_request());
+  EXPECT_EQ(AdmissionController::RE_REGISTER, AdmissionController::classify(msg));
+}
+
 TEST_F(CommonProcessingTest, BadRequestRejected)
 {
   // Tests that a malformed request receives a 400 Bad Request error.
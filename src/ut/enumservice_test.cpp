@@ -440,3 +440,106 @@ TEST_F(DNSEnumServiceTest, PosixRegexTest)
   ET("1234", "").test(enum_);
 }
 
+
+TEST_F(DNSEnumServiceTest, CachedAnswerTest)
+{
+  // Answers are cached for their TTL, capped at the configured maximum.
+  cwtest_completely_control_time();
+  FakeDNSResolver::_reply_ttl = 600;
+  FakeDNSResolver::_database.insert(std::make_pair(std::string("4.3.2.1.e164.arpa"), (struct ares_naptr_reply*)basic_naptr_reply));
+  DNSEnumService enum_(_servers, ".e164.arpa", new FakeDNSResolverFactory(), NULL, 300);
+  ET("1234", "sip:1234@ut.cw-ngv.com").test(enum_);
+  EXPECT_EQ(1, FakeDNSResolver::_num_calls);
+
+  // Another lookup of the same number is answered from the cache, as is one
+  // of the same number with different punctuation.
+  ET("1234", "sip:1234@ut.cw-ngv.com").test(enum_);
+  ET("+1234", "sip:+1234@ut.cw-ngv.com").test(enum_);
+  EXPECT_EQ(1, FakeDNSResolver::_num_calls);
+
+  // Once the answer has expired, we query again.
+  cwtest_advance_time_ms(301000);
+  ET("1234", "sip:1234@ut.cw-ngv.com").test(enum_);
+  EXPECT_EQ(2, FakeDNSResolver::_num_calls);
+  cwtest_reset_time();
+}
+
+TEST_F(DNSEnumServiceTest, CacheEvictionTest)
+{
+  // When the cache is full, the oldest answer is evicted to make room.
+  cwtest_completely_control_time();
+  FakeDNSResolver::_reply_ttl = 60;
+  DNSEnumService enum_(_servers, ".e164.arpa", new FakeDNSResolverFactory(), NULL, 300, 2);
+  ET("1234", "").test(enum_);
+  ET("2345", "").test(enum_);
+  EXPECT_EQ(2, FakeDNSResolver::_num_calls);
+
+  // Refreshing the oldest answer makes it the newest.
+  cwtest_advance_time_ms(61000);
+  ET("1234", "").test(enum_);
+  EXPECT_EQ(3, FakeDNSResolver::_num_calls);
+
+  // Adding a third answer evicts the answer for 2345, but not 1234.
+  ET("3456", "").test(enum_);
+  ET("1234", "").test(enum_);
+  EXPECT_EQ(4, FakeDNSResolver::_num_calls);
+  ET("2345", "").test(enum_);
+  EXPECT_EQ(5, FakeDNSResolver::_num_calls);
+  cwtest_reset_time();
+}
+
+TEST_F(DNSEnumServiceTest, NegativeCacheTest)
+{
+  // A domain that doesn't exist is cached.
+  cwtest_completely_control_time();
+  FakeDNSResolver::_reply_ttl = 60;
+  DNSEnumService enum_(_servers, ".e164.arpa", new FakeDNSResolverFactory(), NULL, 300);
+  ET("1234", "").test(enum_);
+  ET("1234", "").test(enum_);
+  EXPECT_EQ(1, FakeDNSResolver::_num_calls);
+
+  cwtest_advance_time_ms(61000);
+  ET("1234", "").test(enum_);
+  EXPECT_EQ(2, FakeDNSResolver::_num_calls);
+  cwtest_reset_time();
+}
+
+TEST_F(DNSEnumServiceTest, NoTTLNotCachedTest)
+{
+  // If the resolver can't tell us a TTL, we don't cache the answer.
+  FakeDNSResolver::_database.insert(std::make_pair(std::string("4.3.2.1.e164.arpa"), (struct ares_naptr_reply*)basic_naptr_reply));
+  DNSEnumService enum_(_servers, ".e164.arpa", new FakeDNSResolverFactory(), NULL, 300);
+  ET("1234", "sip:1234@ut.cw-ngv.com").test(enum_);
+  ET("1234", "sip:1234@ut.cw-ngv.com").test(enum_);
+  EXPECT_EQ(2, FakeDNSResolver::_num_calls);
+}
+
+TEST_F(DNSEnumServiceTest, ParseTTLTest)
+{
+  // A response to a NAPTR query for 1.e164.arpa, with two answers with TTLs
+  // of 300 and 120 seconds.  The second answer's name is compressed.
+  const unsigned char positive[] = {
+    0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x01, '1', 0x04, 'e', '1', '6', '4', 0x04, 'a', 'r', 'p', 'a', 0x00,
+    0x00, 0x23, 0x00, 0x01,
+    0xc0, 0x0c, 0x00, 0x23, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x02, 0xaa, 0xbb,
+    0xc0, 0x0c, 0x00, 0x23, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x02, 0xaa, 0xbb
+  };
+  EXPECT_EQ(120, DNSResolver::parse_ttl(positive, sizeof(positive), false));
+
+  // An NXDOMAIN response with an SOA record with a TTL of 3600 seconds and a
+  // MINIMUM of 60 seconds.
+  const unsigned char negative[] = {
+    0x12, 0x34, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x01, '1', 0x04, 'e', '1', '6', '4', 0x04, 'a', 'r', 'p', 'a', 0x00,
+    0x00, 0x23, 0x00, 0x01,
+    0xc0, 0x0e, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x18,
+    0xc0, 0x0e, 0xc0, 0x0e,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x3c
+  };
+  EXPECT_EQ(60, DNSResolver::parse_ttl(negative, sizeof(negative), true));
+
+  // A truncated response has no TTL.
+  EXPECT_EQ(-1, DNSResolver::parse_ttl(positive, 20, false));
+}
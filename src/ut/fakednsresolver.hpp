@@ -24,10 +24,12 @@ public:
   virtual int perform_naptr_query(const std::string& domain, struct ares_naptr_reply*& naptr_reply, SAS::TrailId trail);
   virtual void free_naptr_reply(struct ares_naptr_reply* naptr_reply) const;
   // Reset the static data.
-  static inline void reset() { _num_calls = 0; _database.clear(); };
+  static inline void reset() { _num_calls = 0; _database.clear(); _reply_ttl = -1; };
 
   // Number of calls that have been made so far.
   static int _num_calls;
+  // Caching TTL to report for each reply.
+  static int _reply_ttl;
   // Database mapping domain names to NAPTR responses.
   static std::map<std::string,struct ares_naptr_reply*> _database;
 
@@ -28,8 +28,9 @@ class FakeEventAccumulatorTable: public EventAccumulatorTable
 {
 public:
   int _count;
-  FakeEventAccumulatorTable() { _count = 0; };
-  void accumulate(uint32_t sample) { _count++; };
+  uint32_t _last_sample;
+  FakeEventAccumulatorTable() { _count = 0; _last_sample = 0; };
+  void accumulate(uint32_t sample) { _count++; _last_sample = sample; };
 };
 
 class FakeContinuousAccumulatorTable: public ContinuousAccumulatorTable
@@ -11,6 +11,8 @@
 ///----------------------------------------------------------------------------
 
 #include <string>
+#include <thread>
+#include <atomic>
 #include "gtest/gtest.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/lexical_cast.hpp>
@@ -26,6 +28,19 @@ using namespace std;
 //This can only be statically initialised in UT, because we're stubbing out netsnmp - in production code, net-snmp needs to be initialized before creating any tables
 static SNMP::U32Scalar fake_connection_count("", "");
 
+/// QuiescingManager that counts the inputs it receives rather than acting on
+/// them.  The FlowTable only ever sends it flows_gone.
+class CountingQuiescingManager : public QuiescingManager
+{
+public:
+  CountingQuiescingManager() : QuiescingManager(), inputs(0) {}
+
+  std::atomic<int> inputs;
+
+private:
+  void process_input(int input) { ++inputs; }
+};
+
 /// Fixture for IfcHandlerTest
 class FlowTest : public SipTest
 {
@@ -131,3 +146,101 @@ TEST_F(FlowTest, FlowUnQuiesceMidDialog)
   EXPECT_FALSE(flow->should_quiesce());
 }
 
+
+
+TEST_F(FlowTest, ConcurrentLookups)
+{
+  // Create a set of flows, then look them up by address and by token from
+  // several threads at once, checking that every lookup finds the right flow
+  // and that taking and dropping references doesn't remove any.  This checks
+  // correctness only - the timed version is LookupBench.DISABLED_FlowLookups
+  // in the benchmark harness.
+  const int NUM_FLOWS = 100;
+  const int NUM_THREADS = 4;
+  const int NUM_LOOKUPS = 10000;
+  pjsip_transport* tp = TransportFlow::udp_transport(stack_data.pcscf_untrusted_port);
+
+  std::vector<pj_sockaddr> addrs(NUM_FLOWS);
+  std::vector<Flow*> flows;
+  for (int ii = 0; ii < NUM_FLOWS; ++ii)
+  {
+    pj_sockaddr_init(PJ_AF_INET, &addrs[ii], NULL, 5060 + ii);
+    flows.push_back(ft->find_create_flow(tp, &addrs[ii]));
+  }
+
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    threads.push_back(std::thread([&, tt]()
+    {
+      for (int ii = 0; ii < NUM_LOOKUPS; ++ii)
+      {
+        int index = (ii * NUM_THREADS + tt) % NUM_FLOWS;
+        Flow* f1 = ft->find_flow(tp, &addrs[index]);
+        Flow* f2 = ft->find_flow(flows[index]->token());
+
+        if ((f1 != flows[index]) || (f2 != flows[index]))
+        {
+          ++failures;
+        }
+
+        if (f1 != NULL)
+        {
+          f1->dec_ref();
+        }
+
+        if (f2 != NULL)
+        {
+          f2->dec_ref();
+        }
+      }
+    }));
+  }
+
+  for (size_t ii = 0; ii < threads.size(); ++ii)
+  {
+    threads[ii].join();
+  }
+
+  EXPECT_EQ(0, failures.load());
+
+  // All the flows are still in the table.
+  for (int ii = 0; ii < NUM_FLOWS; ++ii)
+  {
+    Flow* f = ft->find_flow(tp, &addrs[ii]);
+    EXPECT_EQ(flows[ii], f);
+    f->dec_ref();
+    ft->remove_flow(flows[ii]);
+  }
+}
+
+TEST_F(FlowTest, QuiesceWhileRemovingLastFlow)
+{
+  // Quiesce a flow table on one thread while its last flow is removed on
+  // another.  Both threads may see the table empty, but flows_gone must only
+  // be reported once, however the two interleave.
+  const int NUM_ROUNDS = 1000;
+  pjsip_transport* tp = TransportFlow::udp_transport(stack_data.pcscf_untrusted_port);
+
+  for (int ii = 0; ii < NUM_ROUNDS; ++ii)
+  {
+    CountingQuiescingManager counting_qm;
+    FlowTable table(&counting_qm, &fake_connection_count);
+    Flow* last_flow = table.find_create_flow(tp, &addr);
+
+    std::thread remover([&]() { table.remove_flow(last_flow); });
+    table.quiesce();
+    remover.join();
+
+    EXPECT_EQ(1, counting_qm.inputs.load());
+
+    // Further checks while still quiescing don't report it again, but
+    // quiescing again after unquiescing does.
+    table.check_quiescing_state();
+    EXPECT_EQ(1, counting_qm.inputs.load());
+    table.unquiesce();
+    table.quiesce();
+    EXPECT_EQ(2, counting_qm.inputs.load());
+  }
+}
@@ -923,6 +923,72 @@ TEST_F(GetSubscriptionsTest, BadMethod)
   task->run();
 }
 
+//
+// Tests for reporting the breakdown of SIP message latency.
+//
+
+class GetLatencyTest : public TestWithMockSdms
+{
+};
+
+TEST_F(GetLatencyTest, Get)
+{
+  LatencyBreakdown breakdown(NULL, NULL, NULL, NULL);
+  breakdown.record_message(100, 200, 50);
+  breakdown.sproutlet_stats("scscf")->request.record(20);
+
+  MockHttpStack::Request req(stack, "/latency", "");
+  GetLatencyTask::Config config(&breakdown);
+  GetLatencyTask* task = new GetLatencyTask(req, &config, 0);
+
+  EXPECT_CALL(*stack, send_reply(_, 200, _));
+  task->run();
+
+  // Check that the JSON document has the stages and Sproutlets in it.
+  rapidjson::Document document;
+  document.Parse(req.content().c_str());
+  ASSERT_TRUE(document.IsObject());
+  EXPECT_EQ(1, document["queue"]["count"].GetInt());
+  EXPECT_EQ(100, document["queue"]["max_us"].GetInt());
+  EXPECT_EQ(200, document["processing"]["max_us"].GetInt());
+  EXPECT_TRUE(document["dependencies"].HasMember("homestead"));
+  EXPECT_EQ(1, document["sproutlets"]["scscf"]["request"]["count"].GetInt());
+  EXPECT_EQ(0, document["sproutlets"]["scscf"]["response"]["count"].GetInt());
+}
+
+TEST_F(GetLatencyTest, Reset)
+{
+  LatencyBreakdown breakdown(NULL, NULL, NULL, NULL);
+  breakdown.record_message(100, 200, 50);
+  breakdown.sproutlet_stats("scscf")->request.record(20);
+
+  MockHttpStack::Request req(stack, "/latency", "", "", "", htp_method_DELETE);
+  GetLatencyTask::Config config(&breakdown);
+  GetLatencyTask* task = new GetLatencyTask(req, &config, 0);
+
+  EXPECT_CALL(*stack, send_reply(_, 200, _));
+  task->run();
+
+  // Everything recorded has been discarded.
+  rapidjson::Document document;
+  document.Parse(breakdown.to_json().c_str());
+  ASSERT_TRUE(document.IsObject());
+  EXPECT_EQ(0, document["queue"]["count"].GetInt());
+  EXPECT_EQ(0u, breakdown.sproutlet_stats("scscf")->request.count());
+}
+
+TEST_F(GetLatencyTest, BadMethod)
+{
+  LatencyBreakdown breakdown(NULL, NULL, NULL, NULL);
+
+  MockHttpStack::Request req(stack, "/latency", "", "", "", htp_method_PUT);
+  GetLatencyTask::Config config(&breakdown);
+  GetLatencyTask* task = new GetLatencyTask(req, &config, 0);
+
+  EXPECT_CALL(*stack, send_reply(_, 405, _));
+  task->run();
+}
+
 //
 // Tests for deleting sprout's cached data.
 //
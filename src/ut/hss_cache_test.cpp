@@ -0,0 +1,125 @@
+/**
+ * @file hss_cache_test.cpp UT for the HSS subscriber data cache.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+///
+///----------------------------------------------------------------------------
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "hss_cache.h"
+#include "test_interposer.hpp"
+
+/// Fixture for HSSCacheTest.
+class HSSCacheTest : public ::testing::Test
+{
+public:
+  HSSCacheTest()
+  {
+    cwtest_completely_control_time();
+  }
+
+  virtual ~HSSCacheTest()
+  {
+    cwtest_reset_time();
+  }
+
+  static HSSCache::Entry make_entry(const std::string& regstate,
+                                    const std::string& uri)
+  {
+    HSSCache::Entry entry;
+    entry.regstate = regstate;
+    entry.associated_uris.add_uri(uri, false);
+    entry.ccfs.push_back("ccf1");
+    return entry;
+  }
+};
+
+// An entry that has been added can be retrieved until it is invalidated.
+TEST_F(HSSCacheTest, PutGetInvalidate)
+{
+  HSSCache cache(60000, 100);
+  HSSCache::Entry entry;
+
+  EXPECT_FALSE(cache.get("sip:6505550001@homedomain", entry));
+
+  cache.put("sip:6505550001@homedomain",
+            make_entry("REGISTERED", "sip:6505550001@homedomain"));
+  ASSERT_TRUE(cache.get("sip:6505550001@homedomain", entry));
+  EXPECT_EQ("REGISTERED", entry.regstate);
+  EXPECT_TRUE(entry.associated_uris.contains_uri("sip:6505550001@homedomain"));
+  ASSERT_EQ(1u, entry.ccfs.size());
+  EXPECT_EQ("ccf1", entry.ccfs[0]);
+
+  // Replacing the entry updates the data returned.
+  cache.put("sip:6505550001@homedomain",
+            make_entry("UNREGISTERED", "sip:6505550001@homedomain"));
+  ASSERT_TRUE(cache.get("sip:6505550001@homedomain", entry));
+  EXPECT_EQ("UNREGISTERED", entry.regstate);
+  EXPECT_EQ(1, cache.size());
+
+  cache.invalidate("sip:6505550001@homedomain");
+  EXPECT_FALSE(cache.get("sip:6505550001@homedomain", entry));
+  EXPECT_EQ(0, cache.size());
+}
+
+// Entries expire after the TTL.
+TEST_F(HSSCacheTest, Expiry)
+{
+  HSSCache cache(30000, 100);
+  HSSCache::Entry entry;
+
+  cache.put("sip:6505550001@homedomain",
+            make_entry("REGISTERED", "sip:6505550001@homedomain"));
+
+  cwtest_advance_time_ms(29000);
+  EXPECT_TRUE(cache.get("sip:6505550001@homedomain", entry));
+
+  cwtest_advance_time_ms(2000);
+  EXPECT_FALSE(cache.get("sip:6505550001@homedomain", entry));
+  EXPECT_EQ(0, cache.size());
+}
+
+// The cache is bounded, and evicts the least recently used entry first.
+TEST_F(HSSCacheTest, LRUEviction)
+{
+  // Use a single shard so that the eviction order is deterministic.
+  HSSCache cache(60000, 2, 1);
+  HSSCache::Entry entry;
+
+  cache.put("sip:1@homedomain", make_entry("REGISTERED", "sip:1@homedomain"));
+  cache.put("sip:2@homedomain", make_entry("REGISTERED", "sip:2@homedomain"));
+
+  // Touch the first entry so that the second is now least recently used.
+  EXPECT_TRUE(cache.get("sip:1@homedomain", entry));
+
+  cache.put("sip:3@homedomain", make_entry("REGISTERED", "sip:3@homedomain"));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_TRUE(cache.get("sip:1@homedomain", entry));
+  EXPECT_FALSE(cache.get("sip:2@homedomain", entry));
+  EXPECT_TRUE(cache.get("sip:3@homedomain", entry));
+}
+
+// A whole implicit registration set can be invalidated at once.
+TEST_F(HSSCacheTest, InvalidateMultiple)
+{
+  HSSCache cache(60000, 100);
+  HSSCache::Entry entry;
+
+  cache.put("sip:1@homedomain", make_entry("REGISTERED", "sip:1@homedomain"));
+  cache.put("sip:2@homedomain", make_entry("REGISTERED", "sip:1@homedomain"));
+  cache.put("sip:3@homedomain", make_entry("REGISTERED", "sip:3@homedomain"));
+
+  cache.invalidate({"sip:1@homedomain", "sip:2@homedomain", "sip:4@homedomain"});
+  EXPECT_FALSE(cache.get("sip:1@homedomain", entry));
+  EXPECT_FALSE(cache.get("sip:2@homedomain", entry));
+  EXPECT_TRUE(cache.get("sip:3@homedomain", entry));
+}
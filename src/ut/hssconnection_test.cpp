@@ -688,6 +688,57 @@ TEST_F(HssConnectionTest, CacheNotAllowed)
   EXPECT_EQ(rc, 200);
 }
 
+// Call lookups are served from the local cache when one is configured, and a
+// change to the registration state invalidates the cached data.
+TEST_F(HssConnectionTest, LocalCache)
+{
+  HSSCache cache(60000, 100);
+  HSSConnection hss("narcissus",
+                    &_resolver,
+                    NULL,
+                    &SNMP::FAKE_IP_COUNT_TABLE,
+                    &SNMP::FAKE_EVENT_ACCUMULATOR_TABLE,
+                    &SNMP::FAKE_EVENT_ACCUMULATOR_TABLE,
+                    &SNMP::FAKE_EVENT_ACCUMULATOR_TABLE,
+                    &SNMP::FAKE_EVENT_ACCUMULATOR_TABLE,
+                    &SNMP::FAKE_EVENT_ACCUMULATOR_TABLE,
+                    &_cm,
+                    NULL,
+                    500,
+                    &cache);
+  AssociatedURIs uris;
+  std::map<std::string, Ifcs> ifcs_map;
+  std::string regstate;
+  const std::string url = "http://narcissus:80/impu/pubid50/reg-data";
+
+  // The first lookup goes to Homestead and populates the cache.
+  fakecurl_requests.clear();
+  EXPECT_EQ(200, hss.update_registration_state("pubid50", "", HSSConnection::CALL, regstate, "server_name", ifcs_map, uris, 0));
+  EXPECT_EQ("UNREGISTERED", regstate);
+  EXPECT_TRUE(fakecurl_requests.find(url) != fakecurl_requests.end());
+  EXPECT_EQ(1, cache.size());
+
+  // The second is served from the cache.
+  fakecurl_requests.clear();
+  regstate = "";
+  EXPECT_EQ(200, hss.update_registration_state("pubid50", "", HSSConnection::CALL, regstate, "server_name", ifcs_map, uris, 0));
+  EXPECT_EQ("UNREGISTERED", regstate);
+  EXPECT_TRUE(fakecurl_requests.find(url) == fakecurl_requests.end());
+
+  // Deregistering the subscriber invalidates the cache, so the next lookup
+  // goes to Homestead again.
+  EXPECT_EQ(200, hss.update_registration_state("pubid50", "", HSSConnection::DEREG_ADMIN, regstate, "server_name", ifcs_map, uris, 0));
+  EXPECT_EQ(0, cache.size());
+  fakecurl_requests.clear();
+  EXPECT_EQ(200, hss.update_registration_state("pubid50", "", HSSConnection::CALL, regstate, "server_name", ifcs_map, uris, 0));
+  EXPECT_TRUE(fakecurl_requests.find(url) != fakecurl_requests.end());
+
+  // Explicit invalidation (as used when the HSS pushes a new profile) also
+  // clears the cache.
+  hss.invalidate_cached_data({"pubid50"});
+  EXPECT_EQ(0, cache.size());
+}
+
 /// Fake iFCs to use to test Shared iFCs.
 std::string ifc_priority_one = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
                                "<InitialFilterCriteria>\n"
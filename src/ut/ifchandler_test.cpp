@@ -1043,6 +1043,25 @@ TEST_F(IfcHandlerTest, HeaderMatchCaseInsensitive)
          true);
 }
 
+// Plain header names are matched anywhere in the header name, just as if they
+// were treated as a regex.
+TEST_F(IfcHandlerTest, HeaderMatchSubstring)
+{
+  doTest("",
+         "    <TriggerPoint>\n"
+         "    <ConditionTypeCNF>1</ConditionTypeCNF>\n"
+         "    <SPT>\n"
+         "      <ConditionNegated>0</ConditionNegated>\n"
+         "      <Group>0</Group>\n"
+         "      <SIPHeader><Header>ALL-inf</Header><Content>bar</Content></SIPHeader>\n"
+         "      <Extension></Extension>\n"
+         "    </SPT>\n"
+         "  </TriggerPoint>\n",
+         true,
+         SessionCase::Originating,
+         true);
+}
+
 TEST_F(IfcHandlerTest, NegatedHeaderMatch)
 {
   doTest("",
@@ -1381,6 +1400,28 @@ TEST_F(IfcHandlerTest, SIPHeaderBadRegex)
   EXPECT_TRUE(log2.contains("Invalid regular expression in Content element for SIPHeader service point trigger"));
 }
 
+// An invalid Content regex is only reported once the Header matches, so an
+// iFC whose Header doesn't match any header in the request is evaluated as
+// normal.
+TEST_F(IfcHandlerTest, SIPHeaderBadContentRegexNotReached)
+{
+  CapturingTestLogger log;
+  doTest("",
+         "    <TriggerPoint>\n"
+         "    <ConditionTypeCNF>1</ConditionTypeCNF>\n"
+         "    <SPT>\n"
+         "      <ConditionNegated>1</ConditionNegated>\n"
+         "      <Group>0</Group>\n"
+         "      <SIPHeader><Header>X-No-Such-Header</Header><Content>?</Content></SIPHeader>\n"
+         "      <Extension></Extension>\n"
+         "    </SPT>\n"
+         "  </TriggerPoint>\n",
+         true,
+         SessionCase::Terminating,
+         true);
+  EXPECT_FALSE(log.contains("Invalid regular expression in Content element for SIPHeader service point trigger"));
+}
+
 TEST_F(IfcHandlerTest, ReqURIMatch)
 {
   doTest("",
@@ -0,0 +1,176 @@
+/**
+ * @file latency_breakdown_test.cpp UT for the SIP message latency breakdown.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <climits>
+#include "gtest/gtest.h"
+#include "rapidjson/document.h"
+
+#include "stack.h"
+#include "latency_breakdown.h"
+#include "fakesnmp.hpp"
+#include "test_interposer.hpp"
+
+class LatencyHistogramTest : public ::testing::Test
+{
+};
+
+TEST_F(LatencyHistogramTest, Buckets)
+{
+  // Small values each have their own bucket.
+  for (unsigned long value = 0; value < 16; ++value)
+  {
+    EXPECT_EQ((int)value, LatencyHistogram::bucket(value));
+    EXPECT_EQ(value, LatencyHistogram::bucket_max(LatencyHistogram::bucket(value)));
+  }
+
+  // Every value is no greater than the maximum of its bucket, and greater than
+  // the maximum of the bucket below, and the buckets are no wider than 1/16th
+  // of the values in them.
+  unsigned long values[] = {16, 17, 31, 32, 33, 1000, 1023, 1024, 123456, 99999999, ULONG_MAX};
+  for (unsigned long value : values)
+  {
+    int bucket = LatencyHistogram::bucket(value);
+    ASSERT_LT(bucket, LatencyHistogram::NUM_BUCKETS);
+    EXPECT_LE(value, LatencyHistogram::bucket_max(bucket));
+    EXPECT_GT(value, LatencyHistogram::bucket_max(bucket - 1));
+    EXPECT_LE(LatencyHistogram::bucket_max(bucket) - LatencyHistogram::bucket_max(bucket - 1),
+              (value / 16) + 1);
+  }
+}
+
+TEST_F(LatencyHistogramTest, Percentiles)
+{
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.percentile(50));
+  EXPECT_EQ(0u, histogram.mean());
+
+  for (unsigned long value = 1; value <= 1000; ++value)
+  {
+    histogram.record(value);
+  }
+
+  EXPECT_EQ(1000u, histogram.count());
+  EXPECT_EQ(1000u, histogram.max());
+  EXPECT_EQ(500u, histogram.mean());
+
+  // Percentiles are accurate to within the width of a bucket, and never
+  // exceed the largest value recorded.
+  EXPECT_NEAR(500, histogram.percentile(50), 500 / 16);
+  EXPECT_NEAR(990, histogram.percentile(99), 990 / 16);
+  EXPECT_EQ(1000u, histogram.percentile(100));
+  EXPECT_EQ(1u, histogram.percentile(0));
+
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.count());
+  EXPECT_EQ(0u, histogram.max());
+  EXPECT_EQ(0u, histogram.percentile(99));
+}
+
+class LatencyBreakdownTest : public ::testing::Test
+{
+public:
+  LatencyBreakdownTest() :
+    _breakdown(&_queue_tbl, &_processing_tbl, &_proxy_tbl, &_blocked_tbl)
+  {
+    cwtest_completely_control_time();
+    stack_data.latency_breakdown = &_breakdown;
+  }
+
+  virtual ~LatencyBreakdownTest()
+  {
+    stack_data.latency_breakdown = NULL;
+    cwtest_reset_time();
+  }
+
+  SNMP::FakeEventAccumulatorTable _queue_tbl;
+  SNMP::FakeEventAccumulatorTable _processing_tbl;
+  SNMP::FakeEventAccumulatorTable _proxy_tbl;
+  SNMP::FakeEventAccumulatorTable _blocked_tbl;
+  LatencyBreakdown _breakdown;
+};
+
+TEST_F(LatencyBreakdownTest, RecordMessage)
+{
+  _breakdown.record_message(100, 2000, 500);
+
+  EXPECT_EQ(1, _queue_tbl._count);
+  EXPECT_EQ(100u, _queue_tbl._last_sample);
+  EXPECT_EQ(2000u, _processing_tbl._last_sample);
+  EXPECT_EQ(500u, _blocked_tbl._last_sample);
+  EXPECT_EQ(0, _proxy_tbl._count);
+}
+
+TEST_F(LatencyBreakdownTest, NestedTimers)
+{
+  LatencyBreakdown::SproutletStats* stats = _breakdown.sproutlet_stats("scscf");
+  EXPECT_EQ(stats, _breakdown.sproutlet_stats("scscf"));
+
+  {
+    // 1ms in the proxy, then 3ms in the Sproutlet, of which 2ms is blocked on
+    // Homestead, then another 1ms in the proxy.
+    LatencyBreakdown::ProxyTimer proxy_timer(&_breakdown);
+    cwtest_advance_time_ms(1);
+    {
+      LatencyBreakdown::SproutletTimer sproutlet_timer(&stats->request);
+      cwtest_advance_time_ms(1);
+      {
+        LatencyBreakdown::DependencyTimer dependency_timer(LatencyBreakdown::HOMESTEAD);
+        cwtest_advance_time_ms(2);
+      }
+    }
+    cwtest_advance_time_ms(1);
+
+    // A nested proxy timer doesn't record anything.
+    LatencyBreakdown::ProxyTimer nested_proxy_timer(&_breakdown);
+  }
+
+  EXPECT_EQ(1u, stats->request.count());
+  EXPECT_EQ(1000u, stats->request.max());
+  EXPECT_EQ(0u, stats->response.count());
+  EXPECT_EQ(1, _proxy_tbl._count);
+  EXPECT_EQ(2000u, _proxy_tbl._last_sample);
+
+  // The dependency is reported on the management interface.
+  rapidjson::Document document;
+  document.Parse(_breakdown.to_json().c_str());
+  ASSERT_TRUE(document.IsObject());
+  EXPECT_EQ(1, document["dependencies"]["homestead"]["count"].GetInt());
+  EXPECT_EQ(2000, document["dependencies"]["homestead"]["max_us"].GetInt());
+  EXPECT_EQ(0, document["dependencies"]["astaire"]["count"].GetInt());
+  EXPECT_EQ(1000, document["sproutlets"]["scscf"]["request"]["max_us"].GetInt());
+  EXPECT_EQ(1, document["sproutlet_proxy"]["count"].GetInt());
+}
+
+TEST_F(LatencyBreakdownTest, ThreadTotals)
+{
+  unsigned long blocked_us = LatencyBreakdown::thread_blocked_us();
+  unsigned long sproutlet_us = LatencyBreakdown::thread_sproutlet_us();
+
+  {
+    LatencyBreakdown::SproutletTimer sproutlet_timer(&_breakdown.sproutlet_stats("bgcf")->response);
+    cwtest_advance_time_ms(3);
+    LatencyBreakdown::DependencyTimer dependency_timer(LatencyBreakdown::ENUM);
+    cwtest_advance_time_ms(4);
+  }
+
+  EXPECT_EQ(4000u, LatencyBreakdown::thread_blocked_us() - blocked_us);
+  EXPECT_EQ(3000u, LatencyBreakdown::thread_sproutlet_us() - sproutlet_us);
+
+  // Timers without a histogram or breakdown don't record anything.
+  {
+    LatencyBreakdown::SproutletTimer sproutlet_timer(NULL);
+    LatencyBreakdown::ProxyTimer proxy_timer(NULL);
+    cwtest_advance_time_ms(3);
+  }
+
+  EXPECT_EQ(3000u, LatencyBreakdown::thread_sproutlet_us() - sproutlet_us);
+  EXPECT_EQ(0, _proxy_tbl._count);
+}
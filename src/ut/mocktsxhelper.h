@@ -44,10 +44,12 @@ public:
   MOCK_METHOD1(fork_state, const ForkState&(int));
   MOCK_METHOD1(free_msg, void(pjsip_msg*&));
   MOCK_METHOD1(get_pool, pj_pool_t*(const pjsip_msg*));
+  MOCK_METHOD0(get_tsx_pool, pj_pool_t*());
   MOCK_METHOD1(msg_info, const char*(pjsip_msg*));
   MOCK_METHOD3(schedule_timer, bool(void*, TimerID&, int));
   MOCK_METHOD1(cancel_timer, void(TimerID));
   MOCK_METHOD1(timer_running, bool(TimerID));
+  MOCK_METHOD2(run_in_background, bool(void*, std::function<void()>));
   MOCK_CONST_METHOD1(get_routing_uri, pjsip_sip_uri*(const pjsip_msg* req));
   MOCK_CONST_METHOD3(next_hop_uri, pjsip_sip_uri*(const std::string& service,
                                                   const pjsip_sip_uri* base_uri,
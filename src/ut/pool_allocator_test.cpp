@@ -0,0 +1,93 @@
+/**
+ * @file pool_allocator_test.cpp UT for allocation from PJLIB pools.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <set>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "pool_allocator.h"
+
+class PoolAllocatorTest : public ::testing::Test
+{
+public:
+  static pj_caching_pool caching_pool;
+
+  static void SetUpTestCase()
+  {
+    pj_init();
+    pj_caching_pool_init(&caching_pool, &pj_pool_factory_default_policy, 0);
+  };
+
+  static void TearDownTestCase()
+  {
+    pj_caching_pool_destroy(&caching_pool);
+    pj_shutdown();
+  };
+};
+pj_caching_pool PoolAllocatorTest::caching_pool;
+
+TEST_F(PoolAllocatorTest, Containers)
+{
+  ScopedPool pool(&caching_pool.factory, "pool-allocator-test", 1000, 1000);
+
+  // Fill containers allocated from the pool, growing past the initial size
+  // of the pool.
+  std::vector<int, PoolAllocator<int> > v((PoolAllocator<int>(pool.get())));
+  std::set<std::string,
+           std::less<std::string>,
+           PoolAllocator<std::string> > s(std::less<std::string>(),
+                                          PoolAllocator<std::string>(pool.get()));
+
+  for (int ii = 0; ii < 1000; ++ii)
+  {
+    v.push_back(ii);
+    s.insert(std::to_string(ii % 100));
+  }
+
+  EXPECT_EQ(1000u, v.size());
+  EXPECT_EQ(999, v.back());
+  EXPECT_EQ(100u, s.size());
+  EXPECT_EQ(1u, s.count("42"));
+
+  s.erase("42");
+  EXPECT_EQ(0u, s.count("42"));
+
+  EXPECT_GT(pj_pool_get_used_size(pool.get()), 1000u);
+}
+
+TEST_F(PoolAllocatorTest, Alignment)
+{
+  ScopedPool pool(&caching_pool.factory, "pool-allocator-test", 1000, 1000);
+
+  // Allocations are aligned for any type, however the pool has been used.
+  for (std::size_t size = 1; size < 40; ++size)
+  {
+    void* p = pool_alloc_aligned(pool.get(), size);
+    EXPECT_EQ(0u, (std::size_t)p % alignof(std::max_align_t));
+  }
+}
+
+TEST_F(PoolAllocatorTest, Equality)
+{
+  ScopedPool pool1(&caching_pool.factory, "pool-allocator-test", 1000, 1000);
+  ScopedPool pool2(&caching_pool.factory, "pool-allocator-test", 1000, 1000);
+
+  // Allocators are equal if they allocate from the same pool, whatever their
+  // type.
+  PoolAllocator<int> a1(pool1.get());
+  PoolAllocator<std::string> a2(pool1.get());
+  PoolAllocator<int> a3(pool2.get());
+
+  EXPECT_TRUE(a1 == a2);
+  EXPECT_TRUE(a1 != a3);
+  EXPECT_TRUE(PoolAllocator<int>(a2) == a1);
+}
@@ -0,0 +1,131 @@
+/**
+ * @file prefix_trie_test.cpp UT for the number prefix trie.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+///
+///----------------------------------------------------------------------------
+
+#include <string>
+#include <map>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+
+#include "prefix_trie.h"
+
+/// Fixture for PrefixTrieTest.
+class PrefixTrieTest : public ::testing::Test
+{
+public:
+  // The matching algorithm the trie replaces - scan a map of the prefixes in
+  // reverse order for the first one that matches.
+  static const std::string* reference_match(const std::map<std::string, std::string>& prefixes,
+                                            const std::string& number)
+  {
+    for (std::map<std::string, std::string>::const_reverse_iterator it = prefixes.rbegin();
+         it != prefixes.rend();
+         ++it)
+    {
+      size_t len = std::min(number.size(), it->first.size());
+      if (number.compare(0, len, it->first, 0, len) == 0)
+      {
+        return &(it->second);
+      }
+    }
+
+    return NULL;
+  }
+
+  PrefixTrie<std::string> _trie;
+};
+
+// The longest matching prefix is chosen.
+TEST_F(PrefixTrieTest, LongestPrefix)
+{
+  EXPECT_TRUE(_trie.empty());
+  EXPECT_TRUE(_trie.match("1234") == NULL);
+
+  EXPECT_TRUE(_trie.insert("1", "one"));
+  EXPECT_TRUE(_trie.insert("123", "one-two-three"));
+  EXPECT_TRUE(_trie.insert("2", "two"));
+  EXPECT_FALSE(_trie.insert("123", "duplicate"));
+  EXPECT_FALSE(_trie.empty());
+
+  ASSERT_TRUE(_trie.match("12345") != NULL);
+  EXPECT_EQ("123", _trie.match("12345")->first);
+  EXPECT_EQ("one-two-three", _trie.match("12345")->second);
+  EXPECT_EQ("one", _trie.match("1245")->second);
+  EXPECT_EQ("two", _trie.match("2")->second);
+  EXPECT_TRUE(_trie.match("3") == NULL);
+}
+
+// A number that is a prefix of configured prefixes matches the greatest of
+// them, and an empty prefix matches everything.
+TEST_F(PrefixTrieTest, ShortNumber)
+{
+  _trie.insert("1234", "a");
+  _trie.insert("1299", "b");
+  _trie.insert("", "default");
+
+  EXPECT_EQ("b", _trie.match("12")->second);
+  EXPECT_EQ("a", _trie.match("123")->second);
+  EXPECT_EQ("default", _trie.match("5")->second);
+  EXPECT_EQ("b", _trie.match("")->second);
+}
+
+// Swapping tries exchanges their contents.
+TEST_F(PrefixTrieTest, Swap)
+{
+  PrefixTrie<std::string> other;
+  other.insert("44", "uk");
+  _trie.insert("1", "us");
+
+  _trie.swap(other);
+  EXPECT_EQ("uk", _trie.match("447700900000")->second);
+  EXPECT_TRUE(_trie.match("15555550100") == NULL);
+  EXPECT_EQ("us", other.match("15555550100")->second);
+}
+
+// The trie gives the same answers as the map scan for a large numbering plan.
+TEST_F(PrefixTrieTest, MatchesReference)
+{
+  std::map<std::string, std::string> prefixes;
+  srand(12345);
+
+  for (int ii = 0; ii < 60000; ++ii)
+  {
+    std::string prefix;
+    int len = 1 + rand() % 8;
+    for (int jj = 0; jj < len; ++jj)
+    {
+      prefix += (char)('0' + rand() % 10);
+    }
+
+    prefixes.insert(std::make_pair(prefix, "route" + std::to_string(ii)));
+    _trie.insert(prefix, "route" + std::to_string(ii));
+  }
+
+  for (int ii = 0; ii < 200; ++ii)
+  {
+    std::string number;
+    int len = rand() % 12;
+    for (int jj = 0; jj < len; ++jj)
+    {
+      number += (char)('0' + rand() % 10);
+    }
+
+    const std::string* expected = reference_match(prefixes, number);
+    const PrefixTrie<std::string>::Entry* actual = _trie.match(number);
+    ASSERT_EQ(expected == NULL, actual == NULL) << number;
+    if (expected != NULL)
+    {
+      EXPECT_EQ(*expected, actual->second) << number;
+    }
+  }
+}
@@ -0,0 +1,98 @@
+/**
+ * @file priority_eventq_test.cpp UT for the multi-level priority event queue.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+///
+///----------------------------------------------------------------------------
+
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+#include "priority_eventq.h"
+
+/// Fixture for PriorityEventQTest.
+class PriorityEventQTest : public ::testing::Test
+{
+public:
+  PriorityEventQTest() : _q(3) {}
+
+  priority_eventq<int> _q;
+};
+
+// Items are popped from the highest priority level first, and in FIFO order
+// within a level.
+TEST_F(PriorityEventQTest, PopsInPriorityOrder)
+{
+  _q.push(1, 2);
+  _q.push(2, 1);
+  _q.push(3, 2);
+  _q.push(4, 0);
+  _q.push(5, 1);
+  EXPECT_EQ(5, _q.size());
+
+  int item;
+  int expected[] = { 4, 2, 5, 1, 3 };
+  for (int ii = 0; ii < 5; ++ii)
+  {
+    EXPECT_TRUE(_q.pop(item, 0));
+    EXPECT_EQ(expected[ii], item);
+  }
+  EXPECT_EQ(0, _q.size());
+}
+
+// Priorities beyond the lowest level are treated as the lowest level.
+TEST_F(PriorityEventQTest, OutOfRangePriority)
+{
+  _q.push(1, 7);
+  _q.push(2, 2);
+  EXPECT_EQ(2, _q.size());
+
+  int item;
+  EXPECT_TRUE(_q.pop(item, 0));
+  EXPECT_EQ(1, item);
+  EXPECT_TRUE(_q.pop(item, 0));
+  EXPECT_EQ(2, item);
+}
+
+// Popping from an empty queue with a timeout fails once the timeout expires.
+TEST_F(PriorityEventQTest, PopTimesOut)
+{
+  int item;
+  EXPECT_FALSE(_q.pop(item, 0));
+  EXPECT_FALSE(_q.pop(item, 5));
+}
+
+// A terminated queue rejects pushes and pops.
+TEST_F(PriorityEventQTest, Terminate)
+{
+  _q.push(1, 0);
+  _q.terminate();
+
+  int item;
+  EXPECT_FALSE(_q.pop(item));
+  EXPECT_FALSE(_q.push(2, 0));
+}
+
+// The queue is only deadlocked if it is non-empty and unserviced for longer
+// than the threshold.
+TEST_F(PriorityEventQTest, DeadlockDetection)
+{
+  EXPECT_FALSE(_q.is_deadlocked());
+  _q.set_deadlock_threshold(1);
+  EXPECT_FALSE(_q.is_deadlocked());
+
+  _q.push(1, 0);
+  usleep(5000);
+  EXPECT_TRUE(_q.is_deadlocked());
+
+  int item;
+  EXPECT_TRUE(_q.pop(item));
+  EXPECT_FALSE(_q.is_deadlocked());
+}
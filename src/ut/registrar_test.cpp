@@ -298,7 +298,8 @@ public:
   void check_notify(pjsip_msg* out,
                     std::string expected_aor,
                     std::string reg_state,
-                    std::pair<std::string, std::string> contact_values)
+                    std::pair<std::string, std::string> contact_values,
+                    std::string doc_state = "full")
   {
     char buf[16384];
     int n = out->body->print_body(out->body, buf, sizeof(buf));
@@ -327,7 +328,7 @@ public:
     ASSERT_TRUE(contact);
 
     ASSERT_EQ(expected_aor, std::string(registration->first_attribute("aor")->value()));
-    ASSERT_EQ("full", std::string(reg_info->first_attribute("state")->value()));
+    ASSERT_EQ(doc_state, std::string(reg_info->first_attribute("state")->value()));
     ASSERT_EQ(reg_state, std::string(registration->first_attribute("state")->value()));
     ASSERT_EQ(contact_values.first, std::string(contact->first_attribute("state")->value()));
     ASSERT_EQ(contact_values.second, std::string(contact->first_attribute("event")->value()));
@@ -2912,7 +2913,7 @@ TEST_F(RegistrarTest, RegistrationWithSubscription)
   ASSERT_EQ(2, txdata_count());
   out = pop_txdata()->msg;
   EXPECT_EQ("NOTIFY", str_pj(out->line.status.reason));
-  check_notify(out, aor, "active", std::make_pair("active", "refreshed"));
+  check_notify(out, aor, "active", std::make_pair("active", "refreshed"), "partial");
   inject_msg(respond_to_current_txdata(200));
   free_txdata();
 
@@ -2924,7 +2925,7 @@ TEST_F(RegistrarTest, RegistrationWithSubscription)
   ASSERT_EQ(2, txdata_count());
   out = pop_txdata()->msg;
   EXPECT_EQ("NOTIFY", str_pj(out->line.status.reason));
-  check_notify(out, aor, "active", std::make_pair("active", "shortened"));
+  check_notify(out, aor, "active", std::make_pair("active", "shortened"), "partial");
   inject_msg(respond_to_current_txdata(200));
   free_txdata();
 
@@ -3060,7 +3061,7 @@ TEST_F(RegistrarTest, MultipleRegistrationsWithSubscription)
   ASSERT_EQ(2, txdata_count());
   out = pop_txdata()->msg;
   EXPECT_EQ("NOTIFY", str_pj(out->line.status.reason));
-  check_notify(out, aor, "active", std::make_pair("active", "created"));
+  check_notify(out, aor, "active", std::make_pair("active", "created"), "partial");
   inject_msg(respond_to_current_txdata(200));
   free_txdata();
 
@@ -3072,7 +3073,7 @@ TEST_F(RegistrarTest, MultipleRegistrationsWithSubscription)
   ASSERT_EQ(2, txdata_count());
   out = pop_txdata()->msg;
   EXPECT_EQ("NOTIFY", str_pj(out->line.status.reason));
-  check_notify(out, aor, "active", std::make_pair("terminated", "expired"));
+  check_notify(out, aor, "active", std::make_pair("terminated", "expired"), "partial");
   inject_msg(respond_to_current_txdata(200));
   free_txdata();
 }
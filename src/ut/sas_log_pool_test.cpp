@@ -0,0 +1,211 @@
+/**
+ * @file sas_log_pool_test.cpp UT for the SAS logging thread pool.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include <pjsip.h>
+}
+
+#include "sas_log_pool.h"
+#include "sproutsasevent.h"
+#include "fakesnmp.hpp"
+
+/// Fixture for SasLogPoolTest.  Messages are reported to the fixture rather
+/// than to SAS, and reporting can be held up to fill the ring.
+class SasLogPoolTest : public ::testing::Test
+{
+public:
+  /// A message reported by the pool.
+  struct Reported
+  {
+    uint32_t event_id;
+    SAS::TrailId trail;
+    uint32_t port;
+    std::string addr;
+    std::string msg;
+    SAS::Timestamp timestamp;
+  };
+
+  SasLogPoolTest() :
+    _blocked(false),
+    _reporting(0)
+  {
+  }
+
+  SasLogPool* create_pool(int num_threads, int max_queue)
+  {
+    return new SasLogPool(num_threads,
+                          max_queue,
+                          &_dropped_tbl,
+                          [this](uint32_t event_id,
+                                 SAS::TrailId trail,
+                                 uint32_t transport_type,
+                                 uint32_t port,
+                                 const char* addr,
+                                 const char* msg,
+                                 int msg_len,
+                                 SAS::Timestamp timestamp)
+                          {
+                            report(event_id, trail, port, addr, msg, msg_len, timestamp);
+                          });
+  }
+
+  void report(uint32_t event_id,
+              SAS::TrailId trail,
+              uint32_t port,
+              const char* addr,
+              const char* msg,
+              int msg_len,
+              SAS::Timestamp timestamp)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    ++_reporting;
+    _cond.notify_all();
+    _cond.wait(lock, [this]{ return !_blocked; });
+
+    Reported reported = {event_id, trail, port, addr, std::string(msg, msg_len), timestamp};
+    _reported.push_back(reported);
+  }
+
+  void block()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _blocked = true;
+  }
+
+  void unblock()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _blocked = false;
+    _cond.notify_all();
+  }
+
+  // Waits until the pool threads have started reporting the given number of
+  // messages.
+  void wait_for_reporting(int count)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this, count]{ return _reporting >= count; });
+  }
+
+  SNMP::FakeCounterTable _dropped_tbl;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  bool _blocked;
+  int _reporting;
+  std::vector<Reported> _reported;
+};
+
+// Messages are copied onto the ring and reported in the order they were
+// queued, with the time they were queued.
+TEST_F(SasLogPoolTest, LogMessages)
+{
+  SasLogPool* pool = create_pool(1, 10);
+
+  SAS::Timestamp before = SAS::get_current_timestamp();
+
+  for (int ii = 0; ii < 3; ++ii)
+  {
+    std::string msg = "INVITE sip:" + std::to_string(ii) + "@homedomain SIP/2.0";
+    EXPECT_TRUE(pool->log_msg(SASEvent::RX_SIP_MSG,
+                              1000 + ii,
+                              PJSIP_TRANSPORT_TCP,
+                              5060 + ii,
+                              "10.0.0.1",
+                              msg.data(),
+                              msg.size()));
+  }
+
+  pool->flush();
+
+  ASSERT_EQ(3u, _reported.size());
+  for (int ii = 0; ii < 3; ++ii)
+  {
+    EXPECT_EQ((uint32_t)SASEvent::RX_SIP_MSG, _reported[ii].event_id);
+    EXPECT_EQ((SAS::TrailId)(1000 + ii), _reported[ii].trail);
+    EXPECT_EQ((uint32_t)(5060 + ii), _reported[ii].port);
+    EXPECT_EQ("10.0.0.1", _reported[ii].addr);
+    EXPECT_EQ("INVITE sip:" + std::to_string(ii) + "@homedomain SIP/2.0", _reported[ii].msg);
+    EXPECT_LE(before, _reported[ii].timestamp);
+
+    if (ii > 0)
+    {
+      EXPECT_LE(_reported[ii - 1].timestamp, _reported[ii].timestamp);
+    }
+  }
+
+  EXPECT_EQ(0, _dropped_tbl._count);
+
+  delete pool;
+}
+
+// Messages are dropped and counted when the ring is full, and the ring is
+// reused once the pool catches up.
+TEST_F(SasLogPoolTest, DropWhenFull)
+{
+  SasLogPool* pool = create_pool(1, 2);
+  std::string msg = "SIP/2.0 200 OK";
+
+  // Hold up the pool thread reporting the first message, then fill the ring.
+  block();
+  EXPECT_TRUE(pool->log_msg(SASEvent::TX_SIP_MSG, 1, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  wait_for_reporting(1);
+  EXPECT_TRUE(pool->log_msg(SASEvent::TX_SIP_MSG, 2, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  EXPECT_TRUE(pool->log_msg(SASEvent::TX_SIP_MSG, 3, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+
+  // The ring is full, so the next messages are dropped.
+  EXPECT_FALSE(pool->log_msg(SASEvent::TX_SIP_MSG, 4, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  EXPECT_FALSE(pool->log_msg(SASEvent::TX_SIP_MSG, 5, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  EXPECT_EQ(2, _dropped_tbl._count);
+
+  // Flushing waits for the queued messages to be reported.
+  unblock();
+  pool->flush();
+
+  ASSERT_EQ(3u, _reported.size());
+  EXPECT_EQ(1u, _reported[0].trail);
+  EXPECT_EQ(2u, _reported[1].trail);
+  EXPECT_EQ(3u, _reported[2].trail);
+
+  // There's space on the ring again.
+  EXPECT_TRUE(pool->log_msg(SASEvent::TX_SIP_MSG, 6, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  pool->flush();
+  EXPECT_EQ(4u, _reported.size());
+  EXPECT_EQ(2, _dropped_tbl._count);
+
+  delete pool;
+}
+
+// Every message is reported when there are several pool threads.
+TEST_F(SasLogPoolTest, MultipleThreads)
+{
+  SasLogPool* pool = create_pool(4, 100);
+  std::string msg = "OPTIONS sip:homedomain SIP/2.0";
+
+  for (int ii = 0; ii < 100; ++ii)
+  {
+    EXPECT_TRUE(pool->log_msg(SASEvent::RX_SIP_MSG, ii, PJSIP_TRANSPORT_UDP, 5060, "10.0.0.1", msg.data(), msg.size()));
+  }
+
+  pool->flush();
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  EXPECT_EQ(100u, _reported.size());
+  EXPECT_EQ(0, _dropped_tbl._count);
+  lock.unlock();
+
+  delete pool;
+}
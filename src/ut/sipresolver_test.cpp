@@ -674,3 +674,41 @@ TEST_F(SIPResolverTest, AllowedHostStateForIPAddr)
   EXPECT_EQ(1, targets.size());
   targets.pop_back();
 }
+
+TEST_F(SIPResolverTest, RememberedSelectionExpires)
+{
+  // Test that the transport selected for a name is remembered only until the
+  // TTL of the NAPTR record expires.
+  cwtest_completely_control_time();
+
+  std::vector<DnsRRecord*> records;
+  records.push_back(naptr("sprout.cw-ngv.com", 2, 0, 0, "S", "SIP+D2T", "", "_sip._tcp.sprout.cw-ngv.com"));
+  _dnsresolver.add_to_cache("sprout.cw-ngv.com", ns_t_naptr, records);
+
+  records.push_back(srv("_sip._tcp.sprout.cw-ngv.com", 3600, 0, 0, 5054, "sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_sip._tcp.sprout.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(srv("_sip._udp.sprout.cw-ngv.com", 3600, 0, 0, 5054, "sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_sip._udp.sprout.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(a("sprout-1.cw-ngv.com", 3600, "3.0.0.1"));
+  _dnsresolver.add_to_cache("sprout-1.cw-ngv.com", ns_t_a, records);
+
+  EXPECT_EQ("3.0.0.1:5054;transport=TCP",
+            RT(_sipresolver, "sprout.cw-ngv.com").resolve());
+
+  // Change the NAPTR record to select UDP.  TCP is still selected until the
+  // TTL of the original record has passed.
+  records.push_back(naptr("sprout.cw-ngv.com", 3600, 0, 0, "S", "SIP+D2U", "", "_sip._udp.sprout.cw-ngv.com"));
+  _dnsresolver.add_to_cache("sprout.cw-ngv.com", ns_t_naptr, records);
+
+  EXPECT_EQ("3.0.0.1:5054;transport=TCP",
+            RT(_sipresolver, "sprout.cw-ngv.com").resolve());
+
+  cwtest_advance_time_ms(3000);
+
+  EXPECT_EQ("3.0.0.1:5054;transport=UDP",
+            RT(_sipresolver, "sprout.cw-ngv.com").resolve());
+
+  cwtest_reset_time();
+}
@@ -0,0 +1,990 @@
+/**
+ * @file sprout_bench.cpp In-process SIP benchmark, built on the UT fixtures.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+///
+/// Drives REGISTER, SUBSCRIBE and INVITE scenarios through a SproutletProxy
+/// with the S-CSCF, I-CSCF, BGCF, registrar and subscription Sproutlets
+/// loaded, using the fake transports and the fake HSS, Chronos and DNS
+/// in place of Homestead, Chronos and Astaire.  Also times lookups in the
+/// tables that are shared between threads, from several threads at once
+/// (including number prefix lookups in large BGCF and ENUM configurations),
+/// and the cost of serializing AoRs in each of the store formats.  Each
+/// scenario reports its throughput and latency percentiles, apart from the
+/// serializer scenarios, which report the size and cost per binding.
+///
+/// This is built with the UTs, but isn't one of them - the scenarios are
+/// disabled so they don't run with the UTs, and "make bench" runs them with
+/// --gtest_also_run_disabled_tests.  Choose the scenarios with --gtest_filter
+/// (for example --gtest_filter=*Invite), and the number of iterations with
+/// the SPROUT_BENCH_ITERATIONS environment variable.
+///
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "siptest.hpp"
+#include "test_utils.hpp"
+#include "utils.h"
+#include "stack.h"
+#include "analyticslogger.h"
+#include "localstore.h"
+#include "astaire_aor_store.h"
+#include "fakehssconnection.hpp"
+#include "fakechronosconnection.hpp"
+#include "test_interposer.hpp"
+#include "scscfsproutlet.h"
+#include "icscfsproutlet.h"
+#include "bgcfsproutlet.h"
+#include "registrarsproutlet.h"
+#include "subscriptionsproutlet.h"
+#include "scscfselector.h"
+#include "sproutletproxy.h"
+#include "fakesnmp.hpp"
+#include "mock_as_communication_tracker.h"
+#include "acr.h"
+#include "aschain.h"
+#include "flowtable.h"
+#include "bgcfservice.h"
+#include "enumservice.h"
+#include "snmp_scalar.h"
+#include "testingcommon.h"
+
+using namespace TestingCommon;
+using ::testing::NiceMock;
+
+/// Latencies of one scenario, and the time spent on them.
+class BenchStats
+{
+public:
+  BenchStats(const std::string& scenario) :
+    _scenario(scenario),
+    _latencies_us(),
+    _elapsed_us(0)
+  {
+  }
+
+  void add(unsigned long latency_us)
+  {
+    _latencies_us.push_back(latency_us);
+  }
+
+  /// Sets the wall clock time of a scenario run on several threads at once.
+  /// The throughput is worked out from this rather than from the total of
+  /// the latencies.
+  void set_elapsed(unsigned long elapsed_us)
+  {
+    _elapsed_us = elapsed_us;
+  }
+
+  /// Prints the throughput (counting only time spent on the scenario, not
+  /// polling for timers between iterations), and the latency percentiles.
+  void report()
+  {
+    if (_latencies_us.empty())
+    {
+      return;
+    }
+
+    std::sort(_latencies_us.begin(), _latencies_us.end());
+
+    unsigned long total_us = _elapsed_us;
+    if (total_us == 0)
+    {
+      for (unsigned long latency_us : _latencies_us)
+      {
+        total_us += latency_us;
+      }
+    }
+
+    printf("[  BENCH   ] %s: %lu iterations, %.1f per second, "
+           "latency (us) p50 %lu p90 %lu p99 %lu max %lu\n",
+           _scenario.c_str(),
+           (unsigned long)_latencies_us.size(),
+           _latencies_us.size() * 1000000.0 / std::max(total_us, 1ul),
+           percentile(50),
+           percentile(90),
+           percentile(99),
+           _latencies_us.back());
+  }
+
+  static unsigned long now_us()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+  }
+
+private:
+  unsigned long percentile(int pct)
+  {
+    size_t index = (_latencies_us.size() * pct) / 100;
+    return _latencies_us[std::min(index, _latencies_us.size() - 1)];
+  }
+
+  std::string _scenario;
+  std::vector<unsigned long> _latencies_us;
+  unsigned long _elapsed_us;
+};
+
+/// Fixture for the benchmark.  The Sproutlets are configured as in the S-CSCF
+/// and registrar UTs.
+class SproutBench : public SipTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    SipTest::SetUpTestCase();
+
+    _chronos_connection = new FakeChronosConnection();
+    _local_data_store = new LocalStore();
+    _local_aor_store = new AstaireAoRStore(_local_data_store);
+    _sdm = new SubscriberDataManager((AoRStore*)_local_aor_store, _chronos_connection, NULL, true);
+    _analytics = new AnalyticsLogger();
+    _bgcf_service = new BgcfService(string(UT_DIR).append("/test_stateful_proxy_bgcf.json"));
+    _enum_service = new JSONEnumService(string(UT_DIR).append("/test_stateful_proxy_enum.json"));
+    _acr_factory = new ACRFactory();
+    _mmf_service = new MMFService(NULL, string(UT_DIR).append("/test_mmf_targets.json"));
+    _fifc_service = new FIFCService(NULL, string(UT_DIR).append("/test_scscf_fifc.xml"));
+    _sess_term_comm_tracker = new NiceMock<MockAsCommunicationTracker>();
+    _sess_cont_comm_tracker = new NiceMock<MockAsCommunicationTracker>();
+
+    // Schedule timers.
+    SipTest::poll();
+  }
+
+  static void TearDownTestCase()
+  {
+    // Shut down the transaction module first, before we destroy the
+    // objects that might handle any callbacks!
+    pjsip_tsx_layer_destroy();
+    delete _sess_cont_comm_tracker; _sess_cont_comm_tracker = NULL;
+    delete _sess_term_comm_tracker; _sess_term_comm_tracker = NULL;
+    delete _fifc_service; _fifc_service = NULL;
+    delete _mmf_service; _mmf_service = NULL;
+    delete _acr_factory; _acr_factory = NULL;
+    delete _enum_service; _enum_service = NULL;
+    delete _bgcf_service; _bgcf_service = NULL;
+    delete _analytics; _analytics = NULL;
+    delete _sdm; _sdm = NULL;
+    delete _local_aor_store; _local_aor_store = NULL;
+    delete _local_data_store; _local_data_store = NULL;
+    delete _chronos_connection; _chronos_connection = NULL;
+    SipTest::TearDownTestCase();
+  }
+
+  SproutBench() :
+    SipTest(),
+    _iterations(1000),
+    _tp_ue(TransportFlow::Protocol::TCP, stack_data.scscf_port, "10.114.61.213", 5061),
+    _tp_bono(TransportFlow::Protocol::TCP, stack_data.scscf_port, "10.99.88.11", 12345)
+  {
+    _log_traffic = false;
+    _local_data_store->flush_all();
+
+    const char* iterations = getenv("SPROUT_BENCH_ITERATIONS");
+    if ((iterations != NULL) && (atoi(iterations) > 0))
+    {
+      _iterations = atoi(iterations);
+    }
+
+    _hss_connection = new FakeHSSConnection();
+    _chronos_connection->set_result("", HTTP_OK);
+    _chronos_connection->set_result("post_identity", HTTP_OK);
+
+    IFCConfiguration ifc_configuration(false, false, "sip:DUMMY_AS", NULL, NULL);
+
+    // Create the S-CSCF Sproutlet, which owns the S-CSCF port.
+    _scscf_sproutlet = new SCSCFSproutlet("scscf",
+                                          "scscf",
+                                          "sip:scscf.sprout.homedomain:5058;transport=TCP",
+                                          "sip:127.0.0.1:5058",
+                                          "sip:icscf.sprout.homedomain:5059;transport=TCP",
+                                          "sip:bgcf@homedomain:5058",
+                                          "sip:11.22.33.44;service=mmf",
+                                          "sip:44.33.22.11:5053;service=mmf",
+                                          5058,
+                                          "sip:scscf.sprout.homedomain:5058;transport=TCP",
+                                          "scscf",
+                                          "",
+                                          _sdm,
+                                          {},
+                                          _hss_connection,
+                                          _enum_service,
+                                          _acr_factory,
+                                          &SNMP::FAKE_INCOMING_SIP_TRANSACTIONS_TABLE,
+                                          &SNMP::FAKE_OUTGOING_SIP_TRANSACTIONS_TABLE,
+                                          false,
+                                          _mmf_service,
+                                          _fifc_service,
+                                          ifc_configuration,
+                                          3000,
+                                          6000,
+                                          _sess_term_comm_tracker,
+                                          _sess_cont_comm_tracker);
+    _scscf_sproutlet->init();
+
+    // Create the I-CSCF Sproutlet.
+    _scscf_selector = new SCSCFSelector("sip:scscf.sprout.homedomain",
+                                        string(UT_DIR).append("/test_icscf.json"));
+    _icscf_sproutlet = new ICSCFSproutlet("icscf",
+                                          "sip:bgcf@homedomain:5058",
+                                          5059,
+                                          "sip:icscf.sprout.homedomain:5059;transport=TCP",
+                                          "icscf",
+                                          "",
+                                          _hss_connection,
+                                          _acr_factory,
+                                          _scscf_selector,
+                                          _enum_service,
+                                          &SNMP::FAKE_INCOMING_SIP_TRANSACTIONS_TABLE,
+                                          &SNMP::FAKE_OUTGOING_SIP_TRANSACTIONS_TABLE,
+                                          false);
+    _icscf_sproutlet->init();
+
+    // Create the BGCF Sproutlet.
+    _bgcf_sproutlet = new BGCFSproutlet("bgcf",
+                                        5054,
+                                        "sip:bgcf.homedomain:5054;transport=tcp",
+                                        _bgcf_service,
+                                        _enum_service,
+                                        _acr_factory,
+                                        nullptr,
+                                        nullptr,
+                                        false);
+
+    // Create the registrar and subscription Sproutlets.  As in the S-CSCF
+    // plug-in, these don't own a port, so requests reach them with a service
+    // parameter on the Route.
+    _registrar_sproutlet = new RegistrarSproutlet("registrar",
+                                                  0,
+                                                  "sip:registrar.homedomain:5058;transport=tcp",
+                                                  {},
+                                                  "scscf",
+                                                  "subscription",
+                                                  _sdm,
+                                                  {},
+                                                  _hss_connection,
+                                                  _acr_factory,
+                                                  300,
+                                                  false,
+                                                  &SNMP::FAKE_REGISTRATION_STATS_TABLES,
+                                                  &SNMP::FAKE_THIRD_PARTY_REGISTRATION_STATS_TABLES,
+                                                  _fifc_service,
+                                                  ifc_configuration);
+    _registrar_sproutlet->init();
+
+    _subscription_sproutlet = new SubscriptionSproutlet("subscription",
+                                                        0,
+                                                        "sip:subscription.homedomain:5058;transport=tcp",
+                                                        "scscf",
+                                                        "scscf",
+                                                        _sdm,
+                                                        {},
+                                                        _hss_connection,
+                                                        _acr_factory,
+                                                        _analytics,
+                                                        300);
+    _subscription_sproutlet->init();
+
+    std::list<Sproutlet*> sproutlets;
+    sproutlets.push_back(_scscf_sproutlet);
+    sproutlets.push_back(_icscf_sproutlet);
+    sproutlets.push_back(_bgcf_sproutlet);
+    sproutlets.push_back(_registrar_sproutlet);
+    sproutlets.push_back(_subscription_sproutlet);
+
+    std::unordered_set<std::string> additional_home_domains;
+    additional_home_domains.insert("sprout.homedomain");
+    additional_home_domains.insert("127.0.0.1");
+
+    _proxy = new SproutletProxy(stack_data.endpt,
+                                PJSIP_MOD_PRIORITY_UA_PROXY_LAYER+1,
+                                "homedomain",
+                                additional_home_domains,
+                                sproutlets,
+                                std::set<std::string>());
+  }
+
+  ~SproutBench()
+  {
+    // Terminate any transactions left over, and let PJSIP destroy them.
+    terminate_all_tsxs(PJSIP_SC_SERVICE_UNAVAILABLE);
+    cwtest_advance_time_ms(33000L);
+    poll();
+
+    pjsip_tsx_layer_instance()->stop();
+    pjsip_tsx_layer_instance()->start();
+
+    _chronos_connection->flush_all();
+
+    delete _proxy; _proxy = NULL;
+    delete _subscription_sproutlet; _subscription_sproutlet = NULL;
+    delete _registrar_sproutlet; _registrar_sproutlet = NULL;
+    delete _bgcf_sproutlet; _bgcf_sproutlet = NULL;
+    delete _icscf_sproutlet; _icscf_sproutlet = NULL;
+    delete _scscf_selector; _scscf_selector = NULL;
+    delete _scscf_sproutlet; _scscf_sproutlet = NULL;
+    delete _hss_connection; _hss_connection = NULL;
+  }
+
+protected:
+  /// The public identity of the n'th subscriber in a scenario.
+  static std::string user(int n)
+  {
+    return std::to_string(6505600000L + n);
+  }
+
+  /// Takes all the outbound messages.  They must be freed with
+  /// release_txdata.
+  std::vector<pjsip_tx_data*> take_txdata()
+  {
+    std::vector<pjsip_tx_data*> txdata;
+    pjsip_tx_data* tdata;
+
+    while ((tdata = pop_txdata()) != NULL)
+    {
+      txdata.push_back(tdata);
+    }
+
+    return txdata;
+  }
+
+  /// Finds the request with the method, or (if status_code is non-zero) the
+  /// response with the status code.  Returns NULL if there's no match.
+  static pjsip_tx_data* find_txdata(const std::vector<pjsip_tx_data*>& txdata,
+                                    const std::string& method,
+                                    int status_code = 0)
+  {
+    for (pjsip_tx_data* tdata : txdata)
+    {
+      pjsip_msg* msg = tdata->msg;
+
+      if ((status_code == 0) &&
+          (msg->type == PJSIP_REQUEST_MSG) &&
+          (PJUtils::pj_str_to_string(&msg->line.req.method.name) == method))
+      {
+        return tdata;
+      }
+      else if ((status_code != 0) &&
+               (msg->type == PJSIP_RESPONSE_MSG) &&
+               (msg->line.status.code == status_code))
+      {
+        return tdata;
+      }
+    }
+
+    return NULL;
+  }
+
+  static void release_txdata(std::vector<pjsip_tx_data*>& txdata)
+  {
+    for (pjsip_tx_data* tdata : txdata)
+    {
+      pjsip_tx_data_dec_ref(tdata);
+    }
+    txdata.clear();
+  }
+
+  /// Lets PJSIP destroy completed transactions.  This isn't counted in the
+  /// latencies, so it's only done every so often.
+  void poll_between_iterations(int iteration)
+  {
+    if (iteration % 100 == 99)
+    {
+      poll();
+    }
+  }
+
+  int _iterations;
+  TransportFlow _tp_ue;
+  TransportFlow _tp_bono;
+
+  static LocalStore* _local_data_store;
+  static AstaireAoRStore* _local_aor_store;
+  static FakeChronosConnection* _chronos_connection;
+  static SubscriberDataManager* _sdm;
+  static AnalyticsLogger* _analytics;
+  static BgcfService* _bgcf_service;
+  static EnumService* _enum_service;
+  static ACRFactory* _acr_factory;
+  static MMFService* _mmf_service;
+  static FIFCService* _fifc_service;
+  static MockAsCommunicationTracker* _sess_term_comm_tracker;
+  static MockAsCommunicationTracker* _sess_cont_comm_tracker;
+
+  FakeHSSConnection* _hss_connection;
+  SCSCFSproutlet* _scscf_sproutlet;
+  SCSCFSelector* _scscf_selector;
+  ICSCFSproutlet* _icscf_sproutlet;
+  BGCFSproutlet* _bgcf_sproutlet;
+  RegistrarSproutlet* _registrar_sproutlet;
+  SubscriptionSproutlet* _subscription_sproutlet;
+  SproutletProxy* _proxy;
+};
+
+LocalStore* SproutBench::_local_data_store;
+AstaireAoRStore* SproutBench::_local_aor_store;
+FakeChronosConnection* SproutBench::_chronos_connection;
+SubscriberDataManager* SproutBench::_sdm;
+AnalyticsLogger* SproutBench::_analytics;
+BgcfService* SproutBench::_bgcf_service;
+EnumService* SproutBench::_enum_service;
+ACRFactory* SproutBench::_acr_factory;
+MMFService* SproutBench::_mmf_service;
+FIFCService* SproutBench::_fifc_service;
+MockAsCommunicationTracker* SproutBench::_sess_term_comm_tracker;
+MockAsCommunicationTracker* SproutBench::_sess_cont_comm_tracker;
+
+// Initial registrations, each for a different subscriber, timed from the
+// REGISTER arriving to the 200 OK being sent.
+TEST_F(SproutBench, DISABLED_Register)
+{
+  BenchStats stats("REGISTER");
+
+  for (int ii = 0; ii < _iterations; ++ii)
+  {
+    _hss_connection->set_impu_result("sip:" + user(ii) + "@homedomain",
+                                     "reg",
+                                     RegDataXMLUtils::STATE_REGISTERED,
+                                     "");
+  }
+
+  for (int ii = 0; ii < _iterations; ++ii)
+  {
+    Message msg;
+    msg._method = "REGISTER";
+    msg._from = user(ii);
+    msg._to = user(ii);
+    msg._requri = "sip:homedomain";
+    msg._content_type = "";
+    msg._route = "Route: <sip:sprout.homedomain;transport=tcp;lr;service=registrar>";
+    msg._extra = "Contact: <sip:" + user(ii) + "@10.114.61.213:5061;transport=tcp>;expires=300";
+
+    unsigned long start_us = BenchStats::now_us();
+    inject_msg(msg.get_request(), &_tp_ue);
+    std::vector<pjsip_tx_data*> txdata = take_txdata();
+    stats.add(BenchStats::now_us() - start_us);
+
+    bool ok = (find_txdata(txdata, "REGISTER", 200) != NULL);
+    release_txdata(txdata);
+    ASSERT_TRUE(ok) << "REGISTER " << ii << " failed";
+    poll_between_iterations(ii);
+  }
+
+  stats.report();
+}
+
+// Subscriptions to the registration state of registered subscribers, timed
+// from the SUBSCRIBE arriving to the 200 OK and the NOTIFY being sent.
+TEST_F(SproutBench, DISABLED_Subscribe)
+{
+  BenchStats stats("SUBSCRIBE");
+
+  for (int ii = 0; ii < _iterations; ++ii)
+  {
+    register_uri(_sdm,
+                 _hss_connection,
+                 user(ii),
+                 "homedomain",
+                 "sip:" + user(ii) + "@10.114.61.213:5061;transport=tcp");
+    _hss_connection->set_impu_result("sip:" + user(ii) + "@homedomain",
+                                     "",
+                                     RegDataXMLUtils::STATE_REGISTERED,
+                                     "");
+  }
+
+  for (int ii = 0; ii < _iterations; ++ii)
+  {
+    Message msg;
+    msg._method = "SUBSCRIBE";
+    msg._from = user(ii);
+    msg._to = user(ii);
+    msg._content_type = "";
+    msg._route = "Route: <sip:sprout.homedomain;transport=tcp;lr;service=subscription>";
+    msg._extra = "Contact: <sip:" + user(ii) + "@10.114.61.213:5061;transport=tcp>\r\n"
+                 "Event: reg\r\n"
+                 "Accept: application/reginfo+xml\r\n"
+                 "Expires: 300";
+
+    unsigned long start_us = BenchStats::now_us();
+    inject_msg(msg.get_request(), &_tp_ue);
+    std::vector<pjsip_tx_data*> txdata = take_txdata();
+    stats.add(BenchStats::now_us() - start_us);
+
+    bool ok = (find_txdata(txdata, "SUBSCRIBE", 200) != NULL);
+    pjsip_tx_data* notify = find_txdata(txdata, "NOTIFY");
+    if (notify != NULL)
+    {
+      // Complete the NOTIFY transaction.
+      inject_msg(respond_to_txdata(notify, 200), &_tp_ue);
+    }
+    release_txdata(txdata);
+    release_txdata(take_txdata());
+
+    ASSERT_TRUE(ok) << "SUBSCRIBE " << ii << " failed";
+    ASSERT_TRUE(notify != NULL) << "SUBSCRIBE " << ii << " sent no NOTIFY";
+    poll_between_iterations(ii);
+  }
+
+  stats.report();
+}
+
+// Calls between two registered subscribers, through originating and
+// terminating S-CSCF processing, timed from the INVITE arriving to the
+// 200 OK being sent back to the caller.  This includes injecting the callee's
+// 200 OK.
+TEST_F(SproutBench, DISABLED_Invite)
+{
+  BenchStats stats("INVITE");
+
+  _hss_connection->set_impu_result("sip:6505551000@homedomain",
+                                   "call",
+                                   RegDataXMLUtils::STATE_REGISTERED,
+                                   "");
+  register_uri(_sdm,
+               _hss_connection,
+               "6505551234",
+               "homedomain",
+               "sip:wuntootreefower@10.114.61.213:5061;transport=tcp;ob");
+
+  for (int ii = 0; ii < _iterations; ++ii)
+  {
+    Message msg;
+    msg._via = "10.99.88.11:12345;transport=TCP";
+    msg._route = "Route: <sip:sprout.homedomain;orig>";
+
+    unsigned long start_us = BenchStats::now_us();
+    inject_msg(msg.get_request(), &_tp_bono);
+    std::vector<pjsip_tx_data*> txdata = take_txdata();
+    pjsip_tx_data* invite = find_txdata(txdata, "INVITE");
+    if (invite != NULL)
+    {
+      inject_msg(respond_to_txdata(invite, 200), &_tp_ue);
+    }
+    std::vector<pjsip_tx_data*> responses = take_txdata();
+    stats.add(BenchStats::now_us() - start_us);
+
+    bool forwarded = (invite != NULL);
+    bool ok = (find_txdata(responses, "INVITE", 200) != NULL);
+    release_txdata(txdata);
+    release_txdata(responses);
+    ASSERT_TRUE(forwarded) << "INVITE " << ii << " wasn't forwarded";
+    ASSERT_TRUE(ok) << "INVITE " << ii << " failed";
+    poll_between_iterations(ii);
+  }
+
+  stats.report();
+}
+
+//This can only be statically initialised in UT, because we're stubbing out netsnmp - in production code, net-snmp needs to be initialized before creating any tables
+static SNMP::U32Scalar bench_connection_count("", "");
+
+/// Fixture for timing lookups in the tables shared between threads.  The
+/// lookups are run on several threads at once, so the results include any
+/// contention on the tables' locks.
+class LookupBench : public SipTest
+{
+public:
+  static const int NUM_THREADS = 4;
+
+  static void SetUpTestCase()
+  {
+    SipTest::SetUpTestCase();
+  }
+
+  static void TearDownTestCase()
+  {
+    SipTest::TearDownTestCase();
+  }
+
+  LookupBench() :
+    SipTest(NULL),
+    _iterations(100000)
+  {
+    const char* iterations = getenv("SPROUT_BENCH_ITERATIONS");
+    if ((iterations != NULL) && (atoi(iterations) > 0))
+    {
+      _iterations = atoi(iterations);
+    }
+  }
+
+protected:
+  /// Calls lookup(thread, iteration) the configured number of times on each
+  /// thread, timing each call.  The lookup returns false if it failed.
+  void run_concurrently(BenchStats& stats,
+                        const std::function<bool(int, int)>& lookup)
+  {
+    std::vector<std::vector<unsigned long> > latencies_us(NUM_THREADS);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    unsigned long start_us = BenchStats::now_us();
+
+    for (int tt = 0; tt < NUM_THREADS; ++tt)
+    {
+      threads.push_back(std::thread([&, tt]()
+      {
+        latencies_us[tt].reserve(_iterations);
+
+        for (int ii = 0; ii < _iterations; ++ii)
+        {
+          unsigned long lookup_start_us = BenchStats::now_us();
+          bool ok = lookup(tt, ii);
+          latencies_us[tt].push_back(BenchStats::now_us() - lookup_start_us);
+
+          if (!ok)
+          {
+            ++failures;
+          }
+        }
+      }));
+    }
+
+    for (size_t ii = 0; ii < threads.size(); ++ii)
+    {
+      threads[ii].join();
+    }
+
+    stats.set_elapsed(BenchStats::now_us() - start_us);
+
+    for (int tt = 0; tt < NUM_THREADS; ++tt)
+    {
+      for (unsigned long latency_us : latencies_us[tt])
+      {
+        stats.add(latency_us);
+      }
+    }
+
+    EXPECT_EQ(0, failures.load());
+  }
+
+  /// Writes some configuration to a temporary file, returning its name.
+  std::string write_config(const std::string& contents)
+  {
+    char filename[] = "/tmp/sprout_bench_XXXXXX";
+    int fd = mkstemp(filename);
+    EXPECT_NE(-1, fd);
+    close(fd);
+
+    std::ofstream file(filename);
+    file << contents;
+    return filename;
+  }
+
+  int _iterations;
+};
+
+// Flow lookups, as done by Bono for every message from a client, timed from
+// looking up a flow by transport address and by token to dropping the
+// references taken.
+TEST_F(LookupBench, DISABLED_FlowLookups)
+{
+  BenchStats stats("Flow lookup");
+
+  const int NUM_FLOWS = 1000;
+  FlowTable ft(NULL, &bench_connection_count);
+  pjsip_transport* tp = TransportFlow::udp_transport(stack_data.pcscf_untrusted_port);
+
+  std::vector<pj_sockaddr> addrs(NUM_FLOWS);
+  std::vector<Flow*> flows;
+  for (int ii = 0; ii < NUM_FLOWS; ++ii)
+  {
+    pj_sockaddr_init(PJ_AF_INET, &addrs[ii], NULL, 5060 + ii);
+    flows.push_back(ft.find_create_flow(tp, &addrs[ii]));
+  }
+
+  run_concurrently(stats, [&](int tt, int ii) -> bool
+  {
+    int index = (ii * NUM_THREADS + tt) % NUM_FLOWS;
+    Flow* f1 = ft.find_flow(tp, &addrs[index]);
+    Flow* f2 = ft.find_flow(flows[index]->token());
+    bool ok = ((f1 == flows[index]) && (f2 == flows[index]));
+
+    if (f1 != NULL)
+    {
+      f1->dec_ref();
+    }
+
+    if (f2 != NULL)
+    {
+      f2->dec_ref();
+    }
+
+    return ok;
+  });
+
+  for (int ii = 0; ii < NUM_FLOWS; ++ii)
+  {
+    ft.remove_flow(flows[ii]);
+  }
+
+  stats.report();
+}
+
+// Walks along deep AS chains, as the S-CSCF does when a request returns from
+// each AS, timed from looking up the first ODI token to looking up the last.
+// Each thread walks its own chain of 8 ASs.
+TEST_F(LookupBench, DISABLED_AsChainLookups)
+{
+  BenchStats stats("AS chain walk");
+
+  const int CHAIN_LENGTH = 8;
+  AsChainTable as_chain_table;
+  IFCConfiguration ifc_configuration(false, false, "", &SNMP::FAKE_COUNTER_TABLE, &SNMP::FAKE_COUNTER_TABLE);
+
+  std::string xml = R"(<?xml version="1.0" encoding="UTF-8"?><IMSSubscription><ServiceProfile><PublicIdentity><Identity>sip:6505551000@homedomain</Identity></PublicIdentity>)";
+  for (int ii = 0; ii < CHAIN_LENGTH; ++ii)
+  {
+    xml += "<InitialFilterCriteria><Priority>" + std::to_string(ii) + "</Priority>"
+           "<ApplicationServer><ServerName>sip:as" + std::to_string(ii) + ".homedomain</ServerName>"
+           "<DefaultHandling>0</DefaultHandling></ApplicationServer></InitialFilterCriteria>";
+  }
+  xml += "</ServiceProfile></IMSSubscription>";
+
+  std::shared_ptr<rapidxml::xml_document<> > ifc_doc(new rapidxml::xml_document<>);
+  ifc_doc->parse<0>(ifc_doc->allocate_string(xml.c_str()));
+
+  std::vector<AsChainLink> chains;
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    Ifcs ifcs(ifc_doc, ifc_doc->first_node("IMSSubscription")->first_node("ServiceProfile"), NULL, 0);
+    chains.push_back(AsChainLink::create_as_chain(&as_chain_table,
+                                                  SessionCase::Originating,
+                                                  "sip:6505551000@homedomain",
+                                                  true,
+                                                  0,
+                                                  ifcs,
+                                                  NULL,
+                                                  NULL,
+                                                  ifc_configuration,
+                                                  "sip:scscf.homedomain"));
+  }
+
+  run_concurrently(stats, [&](int tt, int ii) -> bool
+  {
+    int hops = 0;
+    AsChainLink link = chains[tt];
+
+    while (!link.complete())
+    {
+      AsChainLink next = as_chain_table.lookup(link.next_odi_token());
+      bool ok = (next.as_chain() == chains[tt].as_chain());
+      next.release();
+
+      if (!ok)
+      {
+        return false;
+      }
+
+      link = link.next();
+      ++hops;
+    }
+
+    return (hops == CHAIN_LENGTH);
+  });
+
+  for (int tt = 0; tt < NUM_THREADS; ++tt)
+  {
+    chains[tt].release();
+  }
+
+  stats.report();
+}
+
+// Number prefix lookups in BGCF and ENUM configurations the size of a large
+// operator's number plan, timed from looking up a number to getting the
+// route or URI for its prefix.
+TEST_F(LookupBench, DISABLED_NumberPrefixLookups)
+{
+  const int NUM_ROUTES = 60000;
+
+  // Spread the prefixes across the number space so that they don't share
+  // long runs of digits.
+  std::vector<std::string> prefixes;
+  for (int ii = 0; ii < NUM_ROUTES; ++ii)
+  {
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "+4420%06d", (ii * 7919) % 1000000);
+    prefixes.push_back(prefix);
+  }
+
+  std::string bgcf_json = "{\"routes\": [";
+  std::string enum_json = "{\"number_blocks\": [";
+  for (int ii = 0; ii < NUM_ROUTES; ++ii)
+  {
+    std::string sep = (ii == 0) ? "" : ",";
+    bgcf_json += sep + "{\"name\": \"Route " + std::to_string(ii) + "\", "
+                 "\"number\": \"" + prefixes[ii] + "\", "
+                 "\"route\": [\"sip:bgcf" + std::to_string(ii) + ".homedomain\"]}";
+    enum_json += sep + "{\"name\": \"Block " + std::to_string(ii) + "\", "
+                 "\"prefix\": \"" + prefixes[ii] + "\", "
+                 "\"regex\": \"!(^.*$)!sip:\\\\1@enum" + std::to_string(ii) + ".homedomain!\"}";
+  }
+  bgcf_json += "]}";
+  enum_json += "]}";
+
+  std::string bgcf_file = write_config(bgcf_json);
+  std::string enum_file = write_config(enum_json);
+
+  unsigned long load_start_us = BenchStats::now_us();
+  BgcfService bgcf_service(bgcf_file);
+  unsigned long bgcf_load_us = BenchStats::now_us() - load_start_us;
+
+  load_start_us = BenchStats::now_us();
+  JSONEnumService enum_service(enum_file);
+  unsigned long enum_load_us = BenchStats::now_us() - load_start_us;
+
+  printf("[  BENCH   ] Loaded %d number prefixes: BGCF %lu ms, ENUM %lu ms\n",
+         NUM_ROUTES,
+         bgcf_load_us / 1000,
+         enum_load_us / 1000);
+
+  BenchStats bgcf_stats("BGCF number route lookup");
+  run_concurrently(bgcf_stats, [&](int tt, int ii) -> bool
+  {
+    int index = (ii * NUM_THREADS + tt) % NUM_ROUTES;
+    std::vector<std::string> route =
+      bgcf_service.get_route_from_number(prefixes[index] + "321", 0);
+    return ((route.size() == 1) &&
+            (route[0] == "sip:bgcf" + std::to_string(index) + ".homedomain"));
+  });
+  bgcf_stats.report();
+
+  BenchStats enum_stats("ENUM number prefix lookup");
+  run_concurrently(enum_stats, [&](int tt, int ii) -> bool
+  {
+    int index = (ii * NUM_THREADS + tt) % NUM_ROUTES;
+    std::string number = prefixes[index] + "321";
+    std::string uri = enum_service.lookup_uri_from_user(number, 0);
+    return (uri == "sip:" + number + "@enum" + std::to_string(index) + ".homedomain");
+  });
+  enum_stats.report();
+
+  unlink(bgcf_file.c_str());
+  unlink(enum_file.c_str());
+}
+
+/// Fixture for timing the AoR serializers.  Unlike the other scenarios, these
+/// run on a single thread and report the cost per binding rather than latency
+/// percentiles, since the cost grows with the size of the AoR.
+class SerializerBench : public ::testing::Test
+{
+public:
+  SerializerBench() :
+    _iterations(1000)
+  {
+    const char* iterations = getenv("SPROUT_BENCH_ITERATIONS");
+    if ((iterations != NULL) && (atoi(iterations) > 0))
+    {
+      _iterations = atoi(iterations);
+    }
+  }
+
+protected:
+  /// Builds an AoR with the given number of bindings, each filled in as the
+  /// registrar would fill in a binding for a typical client.
+  AoR* create_aor(int num_bindings)
+  {
+    AoR* aor = new AoR("sip:6505551000@homedomain");
+    int now = time(NULL);
+
+    for (int ii = 0; ii < num_bindings; ++ii)
+    {
+      std::string instance = "urn:uuid:00000000-0000-0000-0000-b4dd3281" + std::to_string(1000 + ii);
+      AoR::Binding* b = aor->get_binding(instance + ":1");
+      b->_uri = "<sip:6505551000@10.83.18." + std::to_string(ii % 256) + ":59934;transport=tcp;ob>";
+      b->_cid = "gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq" + std::to_string(ii);
+      b->_cseq = 17038 + ii;
+      b->_expires = now + 300;
+      b->_priority = 0;
+      b->_path_uris.push_back("sip:abcdefgh@bono-1.homedomain;lr");
+      b->_path_headers.push_back("<sip:abcdefgh@bono-1.homedomain;lr>");
+      b->_params["+sip.instance"] = "\"<" + instance + ">\"";
+      b->_params["reg-id"] = "1";
+      b->_params["+sip.ice"] = "";
+      b->_private_id = "6505551000@homedomain";
+      b->_emergency_registration = false;
+    }
+
+    return aor;
+  }
+
+  /// Encodes and decodes AoRs of increasing size with the given serializer,
+  /// and reports the size of the serialized AoR and the time taken per
+  /// binding.
+  void run(AstaireAoRStore::SerializerDeserializer& serializer)
+  {
+    const int BINDING_COUNTS[] = {1, 4, 16, 64};
+
+    for (int num_bindings : BINDING_COUNTS)
+    {
+      AoR* aor = create_aor(num_bindings);
+      std::string data;
+
+      unsigned long start_us = BenchStats::now_us();
+      for (int ii = 0; ii < _iterations; ++ii)
+      {
+        data = serializer.serialize_aor(aor);
+      }
+      unsigned long encode_us = BenchStats::now_us() - start_us;
+
+      start_us = BenchStats::now_us();
+      for (int ii = 0; ii < _iterations; ++ii)
+      {
+        AoR* decoded = serializer.deserialize_aor("sip:6505551000@homedomain", data);
+        ASSERT_TRUE(decoded != NULL);
+        EXPECT_EQ(num_bindings, (int)decoded->bindings().size());
+        delete decoded;
+      }
+      unsigned long decode_us = BenchStats::now_us() - start_us;
+
+      double per_binding = (double)_iterations * num_bindings;
+      printf("[  BENCH   ] %s AoR, %d bindings: %lu bytes (%.1f per binding), "
+             "encode %.1f ns per binding, decode %.1f ns per binding\n",
+             serializer.name().c_str(),
+             num_bindings,
+             (unsigned long)data.size(),
+             (double)data.size() / num_bindings,
+             encode_us * 1000.0 / per_binding,
+             decode_us * 1000.0 / per_binding);
+
+      delete aor;
+    }
+  }
+
+  int _iterations;
+};
+
+// The JSON format, as written by stores configured for JSON and as read from
+// stores written by older Sprouts.
+TEST_F(SerializerBench, DISABLED_Json)
+{
+  AstaireAoRStore::JsonSerializerDeserializer json;
+  run(json);
+}
+
+// The binary format.
+TEST_F(SerializerBench, DISABLED_Binary)
+{
+  AstaireAoRStore::BinarySerializerDeserializer binary;
+  run(binary);
+}
@@ -17,6 +17,7 @@
 #include "pjutils.h"
 #include "pjsip.h"
 #include "pjsip_simple.h"
+#include "rapidjson/document.h"
 
 #include <mutex>
 
@@ -582,6 +583,37 @@ public:
   }
 };
 
+/// Sproutlet that adds a header to in-dialog requests, and records whether
+/// the request returned by original_request() has the header.
+class FakeSproutletTsxOriginalRequest : public SproutletTsx
+{
+public:
+  FakeSproutletTsxOriginalRequest(Sproutlet* sproutlet) :
+    SproutletTsx(sproutlet)
+  {
+  }
+
+  void on_rx_in_dialog_request(pjsip_msg* req)
+  {
+    pj_str_t name = pj_str((char*)"X-Modified");
+    pj_str_t value = pj_str((char*)"yes");
+    pjsip_msg_add_hdr(req,
+                      (pjsip_hdr*)pjsip_generic_string_hdr_create(get_pool(req),
+                                                                  &name,
+                                                                  &value));
+
+    pjsip_msg* original = original_request();
+    _original_modified = (pjsip_msg_find_hdr_by_name(original, &name, NULL) != NULL);
+    free_msg(original);
+
+    send_request(req);
+  }
+
+  static bool _original_modified;
+};
+
+bool FakeSproutletTsxOriginalRequest::_original_modified = false;
+
 class FakeSproutletTsxNextHop : public CompositeSproutletTsx
 {
 public:
@@ -624,6 +656,7 @@ public:
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxDelayAfterFwd<1> >("delayafterfwd", 0, "sip:delayafterfwd.homedomain;transport=tcp", ""));
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxDummySCSCF>("scscf", 44444, "sip:scscf.homedomain:44444;transport=tcp", "scscf"));
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletReusesTransport>("transport", 0, "sip:transport.homedomain;transport=tcp", ""));
+    _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxOriginalRequest>("origreq", 0, "sip:origreq.homedomain;transport=tcp", ""));
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxForwarder<false> >("fwdwithstats", 0, "sip:fwdwithstats.homedomain;transport=tcp", "", "", &SNMP::FAKE_INCOMING_SIP_TRANSACTIONS_TABLE, &SNMP::FAKE_OUTGOING_SIP_TRANSACTIONS_TABLE));
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxNextHop>("loop1", 0, "sip:loop1.homedomain;transport=tcp", "", "", NULL, NULL, "loop-nf", "loop2"));
     _sproutlets.push_back(new FakeSproutlet<FakeSproutletTsxNextHop>("loop2", 0, "sip:loop2.homedomain;transport=tcp", "", "", NULL, NULL, "loop-nf", "loop1"));
@@ -643,7 +676,11 @@ public:
                                 "proxy1.homedomain",
                                 host_aliases,
                                 _sproutlets,
-                                std::set<std::string>());
+                                std::set<std::string>(),
+                                SproutletProxy::DEFAULT_MAX_SPROUTLET_DEPTH,
+                                0,
+                                &_clones_tbl,
+                                &_latency_breakdown);
 
     // Schedule timers.
     SipTest::poll();
@@ -874,10 +911,14 @@ protected:
 
   static SproutletProxy* _proxy;
   static std::list<Sproutlet*> _sproutlets;
+  static SNMP::FakeEventAccumulatorTable _clones_tbl;
+  static LatencyBreakdown _latency_breakdown;
 };
 
 SproutletProxy* SproutletProxyTest::_proxy;
 std::list<Sproutlet*> SproutletProxyTest::_sproutlets;
+SNMP::FakeEventAccumulatorTable SproutletProxyTest::_clones_tbl;
+LatencyBreakdown SproutletProxyTest::_latency_breakdown(NULL, NULL, NULL, NULL);
 
 TEST_F(SproutletProxyTest, NullSproutlet)
 {
@@ -1111,6 +1152,56 @@ TEST_F(SproutletProxyTest, SimpleSproutletForwarder)
   delete tp;
 }
 
+TEST_F(SproutletProxyTest, LatencyBreakdown)
+{
+  // Tests that the time spent in a Sproutlet is recorded against it, and the
+  // time spent in the proxy itself is recorded separately.
+  _latency_breakdown.reset();
+  LatencyBreakdown::SproutletStats* stats = _latency_breakdown.sproutlet_stats("fwd");
+
+  TransportFlow* tp = new TransportFlow(TransportFlow::Protocol::TCP,
+                                        stack_data.scscf_port,
+                                        "1.2.3.4",
+                                        49152);
+
+  // Inject a request that's forwarded by the forwarder Sproutlet.
+  Message msg1;
+  msg1._method = "INVITE";
+  msg1._requri = "sip:bob@awaydomain";
+  msg1._from = "sip:alice@homedomain";
+  msg1._to = "sip:bob@awaydomain";
+  msg1._via = tp->to_string(false);
+  msg1._route = "Route: <sip:fwd.proxy1.homedomain;transport=TCP;lr>\r\nRoute: <sip:proxy1.awaydomain;transport=TCP;lr>";
+  inject_msg(msg1.get_request(), tp);
+
+  // Expecting 100 Trying and forwarded INVITE.
+  ASSERT_EQ(2, txdata_count());
+  free_txdata();
+  ASSERT_EQ(1, txdata_count());
+  ReqMatcher("INVITE").matches(current_txdata()->msg);
+  EXPECT_EQ(1u, stats->request.count());
+  EXPECT_EQ(0u, stats->response.count());
+
+  // Send a 200 OK response, which is forwarded back to the source.
+  inject_msg(respond_to_current_txdata(200));
+  ASSERT_EQ(1, txdata_count());
+  RespMatcher(200).matches(current_txdata()->msg);
+  free_txdata();
+  EXPECT_EQ(1u, stats->request.count());
+  EXPECT_EQ(1u, stats->response.count());
+
+  // Other Sproutlets didn't see the request.
+  EXPECT_EQ(0u, _latency_breakdown.sproutlet_stats("scscf")->request.count());
+
+  // The proxy recorded its own time for the request and the response.
+  rapidjson::Document document;
+  document.Parse(_latency_breakdown.to_json().c_str());
+  ASSERT_TRUE(document.IsObject());
+  EXPECT_LE(2, document["sproutlet_proxy"]["count"].GetInt());
+
+  delete tp;
+}
+
 TEST_F(SproutletProxyTest, SimpleSproutletForwarderRR)
 {
   // Tests standard routing of a request through a Sproutlet that simply
@@ -2115,6 +2206,105 @@ TEST_F(SproutletProxyTest, SproutletChain)
   delete tp;
 }
 
+TEST_F(SproutletProxyTest, AckChainNotCloned)
+{
+  // Tests that an ACK passed between Sproutlets is handed over rather than
+  // cloned at each hop.
+  pjsip_tx_data* tdata;
+
+  // Create a TCP connection to the listening port.
+  TransportFlow* tp = new TransportFlow(TransportFlow::Protocol::TCP,
+                                        stack_data.scscf_port,
+                                        "1.2.3.4",
+                                        49152);
+
+  // Inject an in-dialog ACK that passes through the Record-Routing forwarding
+  // Sproutlet twice.  The Sproutlet checks the top Route header on each hop.
+  Message msg1;
+  msg1._method = "ACK";
+  msg1._requri = "sip:bob@awaydomain";
+  msg1._from = "sip:alice@homedomain";
+  msg1._to = "sip:bob@awaydomain";
+  msg1._to_tag = "abcdefg";
+  msg1._via = tp->to_string(false);
+  msg1._route = "Route: <sip:proxy1.homedomain-alias;lr;service=alias;hello=world>\r\nRoute: <sip:proxy1.homedomain-alias;lr;service=alias;hello=world>\r\nRoute: <sip:proxy1.awaydomain;transport=TCP;lr>";
+  int transactions = _clones_tbl._count;
+  inject_msg(msg1.get_request(), tp);
+
+  // Check the ACK is forwarded with the local Route headers removed.
+  ASSERT_EQ(1, txdata_count());
+  tdata = current_txdata();
+  expect_target("TCP", "10.10.20.1", 5060, tdata);
+  ReqMatcher("ACK").matches(tdata->msg);
+  EXPECT_EQ("Route: <sip:proxy1.awaydomain;transport=TCP;lr>",
+            get_headers(tdata->msg, "Route"));
+  free_txdata();
+
+  // Only the first Sproutlet cloned the ACK, as the transaction keeps hold
+  // of the original.
+  poll();
+  EXPECT_EQ(transactions + 1, _clones_tbl._count);
+  EXPECT_EQ(1u, _clones_tbl._last_sample);
+
+  delete tp;
+}
+
+TEST_F(SproutletProxyTest, AckOriginalRequest)
+{
+  // Tests what original_request() returns for an ACK.  The first Sproutlet
+  // is passed a clone of the ACK, so original_request() returns the ACK as
+  // received.  Later Sproutlets are passed the ACK itself, so
+  // original_request() includes their changes.
+  pjsip_tx_data* tdata;
+
+  // Create a TCP connection to the listening port.
+  TransportFlow* tp = new TransportFlow(TransportFlow::Protocol::TCP,
+                                        stack_data.scscf_port,
+                                        "1.2.3.4",
+                                        49152);
+
+  Message msg1;
+  msg1._method = "ACK";
+  msg1._requri = "sip:bob@awaydomain";
+  msg1._from = "sip:alice@homedomain";
+  msg1._to = "sip:bob@awaydomain";
+  msg1._to_tag = "abcdefg";
+  msg1._via = tp->to_string(false);
+  msg1._route = "Route: <sip:origreq.proxy1.homedomain;transport=TCP;lr>\r\nRoute: <sip:proxy1.awaydomain;transport=TCP;lr>";
+  FakeSproutletTsxOriginalRequest::_original_modified = true;
+  inject_msg(msg1.get_request(), tp);
+
+  ASSERT_EQ(1, txdata_count());
+  tdata = current_txdata();
+  ReqMatcher("ACK").matches(tdata->msg);
+  EXPECT_EQ("X-Modified: yes", get_headers(tdata->msg, "X-Modified"));
+  free_txdata();
+  EXPECT_FALSE(FakeSproutletTsxOriginalRequest::_original_modified);
+
+  // Now pass the ACK through the forwarding Sproutlet first.
+  Message msg2;
+  msg2._method = "ACK";
+  msg2._requri = "sip:bob@awaydomain";
+  msg2._from = "sip:alice@homedomain";
+  msg2._to = "sip:bob@awaydomain";
+  msg2._to_tag = "abcdefg";
+  msg2._via = tp->to_string(false);
+  msg2._route = "Route: <sip:proxy1.homedomain-alias;lr;service=alias;hello=world>\r\nRoute: <sip:origreq.proxy1.homedomain;transport=TCP;lr>\r\nRoute: <sip:proxy1.awaydomain;transport=TCP;lr>";
+  FakeSproutletTsxOriginalRequest::_original_modified = false;
+  inject_msg(msg2.get_request(), tp);
+
+  ASSERT_EQ(1, txdata_count());
+  tdata = current_txdata();
+  ReqMatcher("ACK").matches(tdata->msg);
+  EXPECT_EQ("Route: <sip:proxy1.awaydomain;transport=TCP;lr>",
+            get_headers(tdata->msg, "Route"));
+  EXPECT_EQ("X-Modified: yes", get_headers(tdata->msg, "X-Modified"));
+  free_txdata();
+  EXPECT_TRUE(FakeSproutletTsxOriginalRequest::_original_modified);
+
+  delete tp;
+}
+
 TEST_F(SproutletProxyTest, CompositeNetworkFunction)
 {
   // Tests passing a request through a Network Function composed of multiple
@@ -2512,6 +2702,40 @@ TEST_F(SproutletProxyTest, SproutletSelection)
   ASSERT_EQ("b2bua", service_name);
 }
 
+// Tests that local hostnames are matched case-insensitively, and service
+// names and aliases case-sensitively, when selecting a Sproutlet.
+TEST_F(SproutletProxyTest, SproutletSelectionCase)
+{
+  std::string service_name;
+  std::string uri_str = "sip:PROXY1.HomeDomain-Alias;service=alias";
+  pjsip_sip_uri* uri = (pjsip_sip_uri*)PJUtils::uri_from_string(uri_str, stack_data.pool, PJ_FALSE);
+
+  // Should match fwdrr by its alias.
+  service_name = match_sproutlet_from_uri((pjsip_uri*)uri);
+  ASSERT_EQ("fwdrr", service_name);
+
+  uri_str = "sip:fwd.Proxy1.HOMEDOMAIN";
+  uri = (pjsip_sip_uri*)PJUtils::uri_from_string(uri_str, stack_data.pool, PJ_FALSE);
+
+  // Should match fwd.
+  service_name = match_sproutlet_from_uri((pjsip_uri*)uri);
+  ASSERT_EQ("fwd", service_name);
+
+  uri_str = "sip:FWD.proxy1.homedomain";
+  uri = (pjsip_sip_uri*)PJUtils::uri_from_string(uri_str, stack_data.pool, PJ_FALSE);
+
+  // Service names are case-sensitive, so shouldn't match anything.
+  service_name = match_sproutlet_from_uri((pjsip_uri*)uri);
+  ASSERT_EQ("", service_name);
+
+  uri_str = "sip:fwd.proxy9.homedomain";
+  uri = (pjsip_sip_uri*)PJUtils::uri_from_string(uri_str, stack_data.pool, PJ_FALSE);
+
+  // Not a local hostname, so shouldn't match anything.
+  service_name = match_sproutlet_from_uri((pjsip_uri*)uri);
+  ASSERT_EQ("", service_name);
+}
+
 // Tests that it's not possible to register more than one Sproutlet for the
 // same service name or port.
 TEST_F(SproutletProxyTest, ConflictingSproutlets)
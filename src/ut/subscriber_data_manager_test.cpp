@@ -142,7 +142,7 @@ TEST_F(BasicSubscriberDataManagerTest, BindingTests)
   EXPECT_EQ("AoRtimer", aor_data1->get_current()->_timer_id);
   EXPECT_EQ(1u, aor_data1->get_current()->bindings().size());
   EXPECT_EQ(std::string("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1"), aor_data1->get_current()->bindings().begin()->first);
-  b1 = aor_data1->get_current()->bindings().begin()->second;
+  b1 = aor_data1->get_current()->get_binding(std::string("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1"));
   EXPECT_EQ(std::string("<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>"), b1->_uri);
   EXPECT_EQ(std::string("gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq"), b1->_cid);
   EXPECT_EQ(17038, b1->_cseq);
@@ -176,7 +176,7 @@ TEST_F(BasicSubscriberDataManagerTest, BindingTests)
   EXPECT_EQ("AoRtimer", aor_data1->get_current()->_timer_id);
   EXPECT_EQ(1u, aor_data1->get_current()->bindings().size());
   EXPECT_EQ(std::string("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1"), aor_data1->get_current()->bindings().begin()->first);
-  b1 = aor_data1->get_current()->bindings().begin()->second;
+  b1 = aor_data1->get_current()->get_binding(std::string("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1"));
   EXPECT_EQ(std::string("<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>"), b1->_uri);
   EXPECT_EQ(std::string("gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq"), b1->_cid);
   EXPECT_EQ(17039, b1->_cseq);
@@ -719,6 +719,184 @@ TEST_F(SubscriberDataManagerCorruptDataTest, EmptyJsonObject)
   delete aor_data1;
 }
 
+TEST_F(SubscriberDataManagerCorruptDataTest, CorruptBinary)
+{
+  AoRPair* aor_data1;
+
+  // Build a valid binary record, then truncate it, give it an unknown version,
+  // and add trailing data. None of these should be deserialized.
+  AoR aor("2010000001@cw-ngv.com");
+  aor.get_binding("<sip:2010000001@192.91.191.29:59934>")->_uri = "sip:2010000001@192.91.191.29:59934";
+  AstaireAoRStore::BinarySerializerDeserializer binary;
+  std::string valid = binary.serialize_aor(&aor);
+  std::string truncated = valid.substr(0, valid.size() - 1);
+  std::string bad_version = valid;
+  bad_version[1] = AstaireAoRStore::BinarySerializerDeserializer::VERSION + 1;
+  std::string trailing = valid + "x";
+
+  EXPECT_CALL(*_datastore, get_data(_, _, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<2>(truncated),
+                    SetArgReferee<3>(1), // CAS
+                    Return(Store::OK)))
+    .WillOnce(DoAll(SetArgReferee<2>(bad_version),
+                    SetArgReferee<3>(1), // CAS
+                    Return(Store::OK)))
+    .WillOnce(DoAll(SetArgReferee<2>(trailing),
+                    SetArgReferee<3>(1), // CAS
+                    Return(Store::OK)));
+
+  aor_data1 = this->_store->get_aor_data(std::string("2010000001@cw-ngv.com"), 0);
+  ASSERT_TRUE(aor_data1 == NULL);
+  aor_data1 = this->_store->get_aor_data(std::string("2010000001@cw-ngv.com"), 0);
+  ASSERT_TRUE(aor_data1 == NULL);
+  aor_data1 = this->_store->get_aor_data(std::string("2010000001@cw-ngv.com"), 0);
+  ASSERT_TRUE(aor_data1 == NULL);
+}
+
+/// Tests for the binary AoR serialization format.
+class AstaireAoRStoreBinaryTest : public ::testing::Test
+{
+  void SetUp()
+  {
+    _now = time(NULL);
+    _aor = new AoR("5102175698@cw-ngv.com");
+
+    AoR::Binding* b1 = _aor->get_binding("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1");
+    b1->_uri = std::string("<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>");
+    b1->_cid = std::string("gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq");
+    b1->_cseq = 17038;
+    b1->_expires = _now + 300;
+    b1->_priority = -1;
+    b1->_path_uris.push_back(std::string("sip:abcdefgh@bono-1.cw-ngv.com;lr"));
+    b1->_path_headers.push_back(std::string("\"Bob\" <sip:abcdefgh@bono-1.cw-ngv.com;lr>;tag=6ht7"));
+    b1->_params["+sip.instance"] = "\"<urn:uuid:00000000-0000-0000-0000-b4dd32817622>\"";
+    b1->_params["reg-id"] = "1";
+    b1->_params["+sip.ice"] = "";
+    b1->_private_id = "5102175698@cw-ngv.com";
+    b1->_emergency_registration = true;
+
+    AoR::Subscription* s1 = _aor->get_subscription("1234");
+    s1->_req_uri = std::string("sip:5102175698@192.91.191.29:59934;transport=tcp");
+    s1->_from_uri = std::string("<sip:5102175698@cw-ngv.com>");
+    s1->_from_tag = std::string("4321");
+    s1->_to_uri = std::string("<sip:5102175698@cw-ngv.com>");
+    s1->_to_tag = std::string("1234");
+    s1->_cid = std::string("xyzabc@192.91.191.29");
+    s1->_route_uris.push_back(std::string("<sip:abcdefgh@bono-1.cw-ngv.com;lr>"));
+    s1->_expires = _now + 300;
+    s1->_notify_version = 3;
+
+    _aor->_associated_uris.add_uri("5102175698@cw-ngv.com", false);
+    _aor->_associated_uris.add_uri("5102175694@cw-ngv.com", true);
+    _aor->_associated_uris.add_wildcard_mapping("510*@cw-ngv.com", "5102175699@cw-ngv.com");
+    _aor->_notify_cseq = 20;
+    _aor->_timer_id = "AoRtimer";
+    _aor->_scscf_uri = "sip:scscf.cw-ngv.com";
+  }
+
+  void TearDown()
+  {
+    delete _aor; _aor = NULL;
+  }
+
+  /// Check that the AoR matches the one built in SetUp.
+  void check_aor(AoR* aor)
+  {
+    ASSERT_TRUE(aor != NULL);
+    ASSERT_EQ(1u, aor->get_bindings_count());
+    AoR::Binding* b1 = aor->bindings().begin()->second;
+    EXPECT_EQ("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1", aor->bindings().begin()->first);
+    EXPECT_EQ("<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>", b1->_uri);
+    EXPECT_EQ("gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq", b1->_cid);
+    EXPECT_EQ(17038, b1->_cseq);
+    EXPECT_EQ(_now + 300, b1->_expires);
+    EXPECT_EQ(-1, b1->_priority);
+    EXPECT_EQ(1u, b1->_path_uris.size());
+    EXPECT_EQ(1u, b1->_path_headers.size());
+    EXPECT_EQ("\"Bob\" <sip:abcdefgh@bono-1.cw-ngv.com;lr>;tag=6ht7", b1->_path_headers.front());
+    EXPECT_EQ(3u, b1->_params.size());
+    EXPECT_EQ("1", b1->_params["reg-id"]);
+    EXPECT_EQ("5102175698@cw-ngv.com", b1->_private_id);
+    EXPECT_TRUE(b1->_emergency_registration);
+
+    ASSERT_EQ(1u, aor->get_subscriptions_count());
+    AoR::Subscription* s1 = aor->subscriptions().begin()->second;
+    EXPECT_EQ("1234", aor->subscriptions().begin()->first);
+    EXPECT_EQ("sip:5102175698@192.91.191.29:59934;transport=tcp", s1->_req_uri);
+    EXPECT_EQ("4321", s1->_from_tag);
+    EXPECT_EQ("1234", s1->_to_tag);
+    EXPECT_EQ("xyzabc@192.91.191.29", s1->_cid);
+    EXPECT_EQ(1u, s1->_route_uris.size());
+    EXPECT_EQ(_now + 300, s1->_expires);
+    EXPECT_EQ(3, s1->_notify_version);
+
+    EXPECT_EQ(2u, aor->_associated_uris.get_all_uris().size());
+    EXPECT_TRUE(aor->_associated_uris.is_impu_barred("5102175694@cw-ngv.com"));
+    EXPECT_FALSE(aor->_associated_uris.is_impu_barred("5102175698@cw-ngv.com"));
+    EXPECT_EQ(1u, aor->_associated_uris.get_wildcard_mapping().size());
+    EXPECT_EQ(20, aor->_notify_cseq);
+    EXPECT_EQ("AoRtimer", aor->_timer_id);
+    EXPECT_EQ("sip:scscf.cw-ngv.com", aor->_scscf_uri);
+  }
+
+  int _now;
+  AoR* _aor;
+};
+
+TEST_F(AstaireAoRStoreBinaryTest, RoundTrip)
+{
+  AstaireAoRStore::BinarySerializerDeserializer binary;
+  AstaireAoRStore::JsonSerializerDeserializer json;
+
+  std::string data = binary.serialize_aor(_aor);
+  AoR* aor = binary.deserialize_aor("5102175698@cw-ngv.com", data);
+  check_aor(aor);
+  EXPECT_EQ(_aor->_associated_uris.get_wildcard_mapping(),
+            aor->_associated_uris.get_wildcard_mapping());
+  delete aor;
+
+  // The binary format is smaller than the JSON format, and neither
+  // deserializer accepts the other's format.
+  std::string json_data = json.serialize_aor(_aor);
+  EXPECT_LT(data.size(), json_data.size());
+  EXPECT_TRUE(binary.deserialize_aor("5102175698@cw-ngv.com", json_data) == NULL);
+  EXPECT_TRUE(json.deserialize_aor("5102175698@cw-ngv.com", data) == NULL);
+}
+
+TEST_F(AstaireAoRStoreBinaryTest, MixedFormats)
+{
+  // Write the AoR to a store in binary format, and check it can be read back
+  // both by that store and by a store writing JSON, and then vice versa.
+  LocalStore* datastore = new LocalStore();
+  AstaireAoRStore* binary_store =
+    new AstaireAoRStore(datastore, AstaireAoRStore::SerializationFormat::BINARY);
+  AstaireAoRStore* json_store =
+    new AstaireAoRStore(datastore, AstaireAoRStore::SerializationFormat::JSON);
+
+  AoRPair* aor_pair = new AoRPair(new AoR(*_aor), new AoR(*_aor));
+  EXPECT_EQ(Store::OK, binary_store->set_aor_data("5102175698@cw-ngv.com", aor_pair, 300, 0));
+  delete aor_pair;
+
+  AoR* aor = binary_store->get_aor_data("5102175698@cw-ngv.com", 0);
+  check_aor(aor);
+  delete aor;
+
+  aor = json_store->get_aor_data("5102175698@cw-ngv.com", 0);
+  check_aor(aor);
+
+  aor_pair = new AoRPair(new AoR(*aor), aor);
+  EXPECT_EQ(Store::OK, json_store->set_aor_data("5102175698@cw-ngv.com", aor_pair, 300, 0));
+  delete aor_pair;
+
+  aor = binary_store->get_aor_data("5102175698@cw-ngv.com", 0);
+  check_aor(aor);
+  delete aor;
+
+  delete json_store;
+  delete binary_store;
+  delete datastore;
+}
+
 /// Test using a Mock Chronos connection that doesn't just swallow requests
 class SubscriberDataManagerChronosRequestsTest : public SipTest
 {
@@ -1120,7 +1298,7 @@ TEST_F(SubscriberDataManagerChronosRequestsTest, AoRNextExpiresUpdateTimerTest)
   EXPECT_EQ("TIMER_ID", aor_data1->get_current()->_timer_id);
 
   // Modify the expiry time of the binding to be later. This should not update the timer.
-  b1 = aor_data1->get_current()->bindings().begin()->second;
+  b1 = aor_data1->get_current()->get_binding(aor_data1->get_current()->bindings().begin()->first);
   b1->_expires = now + 500;
 
   // Write the record back to the store.
@@ -1134,7 +1312,7 @@ TEST_F(SubscriberDataManagerChronosRequestsTest, AoRNextExpiresUpdateTimerTest)
   ASSERT_TRUE(aor_data1 != NULL);
 
   // Modify the expiry time of the binding to be sooner. This should generate an update.
-  b1 = aor_data1->get_current()->bindings().begin()->second;
+  b1 = aor_data1->get_current()->get_binding(aor_data1->get_current()->bindings().begin()->first);
   b1->_expires = now + 200;
 
   // Write the record back to the store.
@@ -1149,7 +1327,7 @@ TEST_F(SubscriberDataManagerChronosRequestsTest, AoRNextExpiresUpdateTimerTest)
   ASSERT_TRUE(aor_data1 != NULL);
 
   // Modify the expiry time of the subscription to be sooner. This should also generate an update.
-  s1 = aor_data1->get_current()->subscriptions().begin()->second;
+  s1 = aor_data1->get_current()->get_subscription(aor_data1->get_current()->subscriptions().begin()->first);
   s1->_expires = now + 100;
 
   // Write the record back to the store.
@@ -1618,3 +1796,121 @@ TEST_F(BasicSubscriberDataManagerTest, AoRComparisonUnchangedSubscription)
 
   delete aor_pair; aor_pair = NULL;
 }
+
+// Storing a timer ID changes only the timer ID - in particular, the NOTIFY
+// CSeq isn't bumped as it would be by set_aor_data.
+TEST_F(BasicSubscriberDataManagerTest, StoreTimerId)
+{
+  std::string aor = "5102175698@cw-ngv.com";
+  int now = time(NULL);
+
+  // An AoR with no bindings doesn't need a timer.
+  EXPECT_FALSE(this->_store->store_timer_id(aor, "TIMER_ID", 0));
+
+  AoRPair* aor_data1 = this->_store->get_aor_data(aor, 0);
+  ASSERT_TRUE(aor_data1 != NULL);
+  AoR::Binding* b1 = aor_data1->get_current()->get_binding(std::string("urn:uuid:00000000-0000-0000-0000-b4dd32817622:1"));
+  b1->_uri = std::string("<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>");
+  b1->_cid = std::string("gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq");
+  b1->_cseq = 17038;
+  b1->_expires = now + 300;
+  b1->_priority = 0;
+  b1->_private_id = "5102175698@cw-ngv.com";
+  b1->_emergency_registration = false;
+
+  EXPECT_CALL(*(this->_analytics_logger), registration(_, _, _, _)).Times(1);
+  EXPECT_EQ(Store::OK, this->_store->set_aor_data(aor, aor_data1, 0));
+  delete aor_data1; aor_data1 = NULL;
+
+  aor_data1 = this->_store->get_aor_data(aor, 0);
+  ASSERT_TRUE(aor_data1 != NULL);
+  int notify_cseq = aor_data1->get_current()->_notify_cseq;
+  delete aor_data1; aor_data1 = NULL;
+
+  EXPECT_TRUE(this->_store->store_timer_id(aor, "TIMER_ID", 0));
+
+  aor_data1 = this->_store->get_aor_data(aor, 0);
+  ASSERT_TRUE(aor_data1 != NULL);
+  EXPECT_EQ("TIMER_ID", aor_data1->get_current()->_timer_id);
+  EXPECT_EQ(notify_cseq, aor_data1->get_current()->_notify_cseq);
+  EXPECT_EQ(1u, aor_data1->get_current()->bindings().size());
+  delete aor_data1; aor_data1 = NULL;
+}
+
+TEST_F(BasicSubscriberDataManagerTest, AoRCopyOnWrite)
+{
+  std::string aor_id = "5102175698@cw-ngv.com";
+  int now = time(NULL);
+  AoR* orig_aor = new AoR(aor_id);
+
+  // Add three bindings and two subscriptions to the original AoR.
+  std::string b_id1 = "<sip:5102175698@192.91.191.29:59934;transport=tcp;ob>";
+  std::string b_id2 = "<sip:5102175698@192.91.191.30:59934;transport=tcp;ob>";
+  std::string b_id3 = "<sip:5102175698@192.91.191.31:59934;transport=tcp;ob>";
+  orig_aor->get_binding(b_id1)->_expires = now + 300;
+  orig_aor->get_binding(b_id2)->_expires = now + 300;
+  orig_aor->get_binding(b_id3)->_expires = now + 300;
+  orig_aor->get_subscription("1234")->_expires = now + 300;
+  orig_aor->get_subscription("5678")->_expires = now + 300;
+
+  // Make a copy-on-write copy. It shares all the original AoR's bindings and
+  // subscriptions.
+  AoR* current_aor = orig_aor->copy_on_write();
+  AoRPair* aor_pair = new AoRPair(orig_aor, current_aor);
+  EXPECT_EQ(3u, current_aor->get_bindings_count());
+  EXPECT_EQ(orig_aor->bindings().at(b_id1), current_aor->bindings().at(b_id1));
+  EXPECT_EQ(orig_aor->subscriptions().at("1234"), current_aor->subscriptions().at("1234"));
+  EXPECT_TRUE(aor_pair->get_updated_bindings().empty());
+  EXPECT_TRUE(aor_pair->get_removed_bindings().empty());
+
+  // Retrieving a binding for modification copies it, leaving the original
+  // AoR unchanged.
+  AoR::Binding* b1 = current_aor->get_binding(b_id1);
+  EXPECT_NE(orig_aor->bindings().at(b_id1), b1);
+  b1->_expires = now + 600;
+  EXPECT_EQ(now + 300, orig_aor->bindings().at(b_id1)->_expires);
+
+  // Retrieve another binding without changing its expiry, remove the third,
+  // and add a new one.
+  current_aor->get_binding(b_id2);
+  current_aor->remove_binding(b_id3);
+  std::string b_id4 = "<sip:5102175698@192.91.191.32:59934;transport=tcp;ob>";
+  current_aor->get_binding(b_id4)->_expires = now + 300;
+
+  // Update one subscription and remove the other.
+  current_aor->get_subscription("1234")->_expires = now + 600;
+  current_aor->remove_subscription("5678");
+
+  // Only the changed bindings and subscriptions are reported, and the
+  // original AoR still has everything it started with.
+  AoR::Bindings updated_bindings = aor_pair->get_updated_bindings();
+  EXPECT_EQ(2u, updated_bindings.size());
+  EXPECT_TRUE(updated_bindings.find(b_id1) != updated_bindings.end());
+  EXPECT_TRUE(updated_bindings.find(b_id4) != updated_bindings.end());
+  AoR::Bindings removed_bindings = aor_pair->get_removed_bindings();
+  EXPECT_EQ(1u, removed_bindings.size());
+  EXPECT_TRUE(removed_bindings.find(b_id3) != removed_bindings.end());
+  AoR::Subscriptions updated_subscriptions = aor_pair->get_updated_subscriptions();
+  EXPECT_EQ(1u, updated_subscriptions.size());
+  EXPECT_TRUE(updated_subscriptions.find("1234") != updated_subscriptions.end());
+  AoR::Subscriptions removed_subscriptions = aor_pair->get_removed_subscriptions();
+  EXPECT_EQ(1u, removed_subscriptions.size());
+  EXPECT_TRUE(removed_subscriptions.find("5678") != removed_subscriptions.end());
+  EXPECT_EQ(3u, orig_aor->get_bindings_count());
+  EXPECT_EQ(2u, orig_aor->get_subscriptions_count());
+
+  // A deep copy of the current AoR owns all its bindings and subscriptions.
+  AoR* copy_aor = new AoR(*current_aor);
+  EXPECT_NE(current_aor->bindings().at(b_id2), copy_aor->bindings().at(b_id2));
+  EXPECT_EQ(3u, copy_aor->get_bindings_count());
+  delete copy_aor; copy_aor = NULL;
+
+  // Clearing the current AoR removes everything from it but nothing from the
+  // original AoR.
+  current_aor->clear(true);
+  EXPECT_EQ(3u, aor_pair->get_removed_bindings().size());
+  EXPECT_EQ(2u, aor_pair->get_removed_subscriptions().size());
+  EXPECT_EQ(3u, orig_aor->get_bindings_count());
+
+  delete aor_pair; aor_pair = NULL;
+}
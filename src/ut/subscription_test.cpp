@@ -218,7 +218,8 @@ protected:
                                   std::pair<std::string, std::string> contact_values,
                                   std::vector<std::pair<std::string, bool>> irs_impus,
                                   bool terminated = false,
-                                  std::string reason = "");
+                                  std::string reason = "",
+                                  int version = 0);
 
   std::string do_OK_NOTIFY_flow(std::string* body = nullptr,
                                 bool terminated = false,
@@ -227,7 +228,8 @@ protected:
   void check_NOTIFY_body(std::string& body,
                          std::string reg_state,
                          std::pair<std::string, std::string> contact_values,
-                         std::vector<std::pair<std::string, bool>> irs_impus);
+                         std::vector<std::pair<std::string, bool>> irs_impus,
+                         int version = 0);
 
 };
 
@@ -508,7 +510,7 @@ TEST_F(SubscriptionTest, SimpleMainline)
   msg._unique += 1;
   msg._expires = "0";
   inject_msg(msg.get());
-  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus, true, "timeout");
+  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus, true, "timeout", 1);
 
   check_subscriptions("sip:6505550231@homedomain", 0u);
 }
@@ -572,7 +574,7 @@ TEST_F(SubscriptionTest, SimpleMainlineWithTelURI)
                            "sip:f5cc3de4334589d89c661a7acf228ed7@10.114.61.213:5061;transport=tcp;ob",
                            0)).Times(1);
   inject_msg(msg.get());
-  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus_check, true, "timeout");
+  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus_check, true, "timeout", 1);
 }
 
 /// Check that a subscription with immediate expiry is treated correctly
@@ -1266,7 +1268,8 @@ TEST_F(SubscriptionTest, Resubscribe)
   msg._unique += 1;
   inject_msg(msg.get());
 
-  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus);
+  // The resubscription gets the full state again, with the next version
+  check_OK_and_NOTIFY("active", std::make_pair("active", "registered"), irs_impus, false, "", 1);
   check_subscriptions("sip:6505550231@homedomain", 1u);
 }
 
@@ -1339,7 +1342,8 @@ std::string SubscriptionTest::do_OK_NOTIFY_flow(std::string* body,
 void SubscriptionTest::check_NOTIFY_body(std::string& body,
                                          std::string reg_state,
                                          std::pair<std::string, std::string> contact_values,
-                                         std::vector<std::pair<std::string, bool>> irs_impus)
+                                         std::vector<std::pair<std::string, bool>> irs_impus,
+                                         int version)
 {
   // Parse the XML document, saving off the passed in string first (as parsing
   // is destructive)
@@ -1363,7 +1367,7 @@ void SubscriptionTest::check_NOTIFY_body(std::string& body,
   EXPECT_EQ("urn:ietf:params:xml:ns:gruuinfo", std::string(reg_info->first_attribute("gr")->value()));
   EXPECT_EQ("http://www.w3.org/2001/XMLSchema-instance", std::string(reg_info->first_attribute("xsi")->value()));
   EXPECT_EQ("urn:3gpp:ns:extRegExp:1.0", std::string(reg_info->first_attribute("ere")->value()));
-  EXPECT_EQ("0", std::string(reg_info->first_attribute("version")->value()));
+  EXPECT_EQ(std::to_string(version), std::string(reg_info->first_attribute("version")->value()));
 
   int num_reg = 0;
 
@@ -1407,11 +1411,12 @@ std::string SubscriptionTest::check_OK_and_NOTIFY(std::string reg_state,
                                                   std::pair<std::string, std::string> contact_values,
                                                   std::vector<std::pair<std::string, bool>> irs_impus,
                                                   bool terminated,
-                                                  std::string reason)
+                                                  std::string reason,
+                                                  int version)
 {
   std::string body;
   std::string to_tag = do_OK_NOTIFY_flow(&body, terminated, reason);
-  check_NOTIFY_body(body, reg_state, contact_values, irs_impus);
+  check_NOTIFY_body(body, reg_state, contact_values, irs_impus, version);
   return to_tag;
 }
 
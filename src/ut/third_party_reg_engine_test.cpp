@@ -0,0 +1,127 @@
+/**
+ * @file third_party_reg_engine_test.cpp UT for the third-party REGISTER
+ * engine.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <atomic>
+#include "gtest/gtest.h"
+
+#include "third_party_reg_engine.h"
+
+static const std::string AS_URI = "sip:as.homedomain";
+static const std::string KEY = "sip:6505550231@homedomain sip:as.homedomain";
+
+/// Callback that counts the times it is run.
+class CountingCallback : public PJUtils::Callback
+{
+public:
+  CountingCallback(std::atomic<int>& count) : _count(count) {}
+  void run() override { ++_count; }
+
+private:
+  std::atomic<int>& _count;
+};
+
+/// Fixture for ThirdPartyRegEngineTest.
+class ThirdPartyRegEngineTest : public ::testing::Test
+{
+public:
+  // The engine's threads register with PJLIB, so PJLIB must be initialised.
+  static void SetUpTestCase()
+  {
+    pj_init();
+  }
+
+  static void TearDownTestCase()
+  {
+    pj_shutdown();
+  }
+
+  void SetUp()
+  {
+    _engine = new ThirdPartyRegEngine(2, 0, 100);
+  }
+
+  void TearDown()
+  {
+    delete _engine; _engine = NULL;
+  }
+
+  ThirdPartyRegEngine* _engine;
+};
+
+// Registrations that aren't re-registrations are all sent.
+TEST_F(ThirdPartyRegEngineTest, SendsRequests)
+{
+  std::atomic<int> sent(0);
+
+  for (int ii = 0; ii < 3; ++ii)
+  {
+    _engine->send(AS_URI, KEY, false, [&sent]() { ++sent; });
+  }
+  _engine->flush();
+
+  EXPECT_EQ(3, sent.load());
+}
+
+// Re-registrations for the same user and AS that arrive within the window
+// are coalesced, and only the latest is sent.
+TEST_F(ThirdPartyRegEngineTest, CoalescesReregistrations)
+{
+  std::atomic<int> sent(0);
+  std::atomic<int> last(0);
+
+  for (int ii = 1; ii <= 5; ++ii)
+  {
+    _engine->send(AS_URI, KEY, true, [&sent, &last, ii]() { ++sent; last = ii; });
+  }
+  _engine->send(AS_URI, "sip:6505550232@homedomain sip:as.homedomain", true, [&sent]() { ++sent; });
+  _engine->flush();
+
+  EXPECT_EQ(2, sent.load());
+  EXPECT_EQ(5, last.load());
+}
+
+// A de-registration replaces a re-registration for the same user and AS
+// that hasn't been sent yet, so the re-registration isn't sent after it.
+TEST_F(ThirdPartyRegEngineTest, DeregistrationReplacesReregistration)
+{
+  std::atomic<int> reregs(0);
+  std::atomic<int> deregs(0);
+  std::atomic<int> others(0);
+
+  _engine->send(AS_URI, KEY, true, [&reregs]() { ++reregs; });
+  _engine->send(AS_URI, "sip:6505550232@homedomain sip:as.homedomain", true, [&others]() { ++others; });
+  _engine->send(AS_URI, KEY, false, [&deregs]() { ++deregs; });
+  _engine->flush();
+
+  EXPECT_EQ(0, reregs.load());
+  EXPECT_EQ(1, deregs.load());
+  EXPECT_EQ(1, others.load());
+
+  // A later re-registration is held and sent as normal.
+  _engine->send(AS_URI, KEY, true, [&reregs]() { ++reregs; });
+  _engine->flush();
+
+  EXPECT_EQ(1, reregs.load());
+}
+
+// Completion callbacks are run on the engine's threads.
+TEST_F(ThirdPartyRegEngineTest, RunsCallbacks)
+{
+  std::atomic<int> count(0);
+
+  _engine->complete(new CountingCallback(count));
+  _engine->complete(new CountingCallback(count));
+  _engine->flush();
+
+  EXPECT_EQ(2, count.load());
+}
@@ -22,6 +22,7 @@
 #include "httpconnection.h"
 #include "xdmconnection.h"
 #include "snmp_continuous_accumulator_table.h"
+#include "latency_breakdown.h"
 
 /// Main constructor.
 XDMConnection::XDMConnection(const std::string& server,
@@ -65,7 +66,11 @@ bool XDMConnection::get_simservs(const std::string& user,
 
   std::string url = "/org.etsi.ngn.simservs/users/" + Utils::url_escape(user) + "/simservs.xml";
 
-  HTTPCode http_code = _http->send_get(url, xml_data, user, trail);
+  HTTPCode http_code;
+  {
+    LatencyBreakdown::DependencyTimer timer(LatencyBreakdown::XDM);
+    http_code = _http->send_get(url, xml_data, user, trail);
+  }
 
   unsigned long latency_us = 0;
   if (stopWatch.read(latency_us))